@@ -0,0 +1,564 @@
+/**************************************************************
+*
+*                        bench_cache.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Microbenchmark for cache lookups and insertions. For
+*     1k, 100k and 1M entries, it reports ops/sec of hits
+*     that copy the value, hits that pin it, misses, puts that
+*     evict the least recently used element, and puts that
+*     evict an expired element.
+*
+*     In trace mode, it replays a trace of requests against
+*     each eviction policy like the proxy does: a hit pins
+*     the response, and a miss puts it. It reports the hit
+*     ratio, byte hit ratio and requests/sec. The trace is a
+*     file of "<key> [<size>]" lines, or a synthetic one:
+*     Zipf-distributed requests for CDN assets, mixed with a
+*     crawler requesting one-off URLs.
+*
+*     In disk mode, it replays the synthetic trace with and
+*     without a disk tier in the given directory.
+*
+*     In churn mode, it keeps replacing the whole cache with
+*     responses of sizes that shift between phases, and
+*     reports the RSS of the process against the budget after
+*     each phase.
+*
+*     Usage: ./bench_cache [ops per measurement]
+*            ./bench_cache trace [<cache bytes> [<trace file>]]
+*            ./bench_cache disk <dir> [<disk bytes>]
+*            ./bench_cache churn [<cache bytes> [<rounds>]]
+*
+**************************************************************/
+
+#include "cache.h"
+#include "disk_cache.h"
+#include "slab.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KEY_SIZE 64
+#define VAL_SIZE 128
+#define TRACE_CACHE_BYTES (16 << 20) /* Default cache budget in trace mode. */
+#define TRACE_REQUESTS 1000000 /* Requests in the synthetic trace. */
+#define TRACE_OBJECTS 100000 /* CDN assets in the synthetic trace. */
+#define TRACE_ZIPF 0.9 /* Skew of requests for CDN assets. */
+#define TRACE_SCAN_PERCENT 30 /* Share of one-off crawler requests. */
+#define TRACE_MAX_SIZE (64 << 10) /* Max response size of a trace. */
+#define TRACE_DISK_BYTES (256 << 20) /* Default disk budget in disk mode. */
+#define CHURN_CACHE_BYTES (64 << 20) /* Default cache budget in churn mode. */
+#define CHURN_ROUNDS 3 /* Default rounds of phases in churn mode. */
+#define CHURN_TURNOVER 4 /* Times the budget put in each phase. */
+#define CHURN_MAX_SIZE (256 << 10) /* Max response size in churn mode. */
+
+static char val[VAL_SIZE]; /* Value of every element. */
+
+/* Request of a trace. */
+struct request {
+    const char* key;
+    int size; /* Byte size of the response. */
+};
+
+/* Read the monotonic clock in seconds. */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Make keys that look like cached URLs. */
+char* make_keys(int num_keys, int first)
+{
+    char* keys = malloc((size_t)num_keys * KEY_SIZE);
+
+    if (keys == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_keys; ++i) {
+        snprintf(keys + (size_t)i * KEY_SIZE,
+                 KEY_SIZE,
+                 "www.example.com/static/objects/%d.html",
+                 first + i);
+    }
+    return keys;
+}
+
+void bench(int num_entries, int ops)
+{
+    char* keys = make_keys(num_entries, 0);
+    char* new_keys = make_keys(ops, num_entries);
+    char* out_val;
+    const char* pinned_val;
+    struct cache_elem* elem;
+    int out_val_len;
+    int out_head_len;
+    int out_age;
+    int hits = 0;
+    unsigned r = 12345;
+    double start;
+    double get_rate;
+    double pin_rate;
+    double miss_rate;
+    double put_rate;
+    double expire_rate;
+    size_t budget;
+
+    /* Measure the bytes of all the entries, then fill a cache with exactly
+     * that budget. */
+    if (cache_init(SIZE_MAX, 1 << 20, CACHE_LRU) < 0) {
+        fprintf(stderr, "cache_init failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_entries; ++i) {
+        cache_put(keys + (size_t)i * KEY_SIZE, val, VAL_SIZE, 3600);
+    }
+    budget = cache_bytes();
+    cache_clear();
+    if (cache_init(budget, 1 << 20, CACHE_LRU) < 0) {
+        fprintf(stderr, "cache_init failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_entries; ++i) {
+        cache_put(keys + (size_t)i * KEY_SIZE, val, VAL_SIZE, 3600);
+    }
+
+    /* Hits on random keys. */
+    start = now();
+    for (int i = 0; i < ops; ++i) {
+        r = r * 1103515245u + 12345u;
+        if (cache_get(keys + (size_t)(r % num_entries) * KEY_SIZE,
+                      &out_val,
+                      &out_val_len,
+                      &out_age) > 0) {
+            free(out_val);
+            ++hits;
+        }
+    }
+    get_rate = ops / (now() - start);
+
+    /* Hits on random keys, pinned instead of copied. */
+    start = now();
+    for (int i = 0; i < ops; ++i) {
+        r = r * 1103515245u + 12345u;
+        elem = cache_acquire(keys + (size_t)(r % num_entries) * KEY_SIZE,
+                             &pinned_val,
+                             &out_val_len,
+                             &out_head_len,
+                             &out_age);
+        if (elem != NULL) {
+            cache_release(elem);
+            ++hits;
+        }
+    }
+    pin_rate = ops / (now() - start);
+
+    /* Misses on keys that have never been put. */
+    start = now();
+    for (int i = 0; i < ops; ++i) {
+        if (cache_get(new_keys + (size_t)i * KEY_SIZE,
+                      &out_val,
+                      &out_val_len,
+                      &out_age) > 0) {
+            free(out_val);
+            ++hits;
+        }
+    }
+    miss_rate = ops / (now() - start);
+
+    /* Puts of new keys into the full cache, each evicting one element. */
+    start = now();
+    for (int i = 0; i < ops; ++i) {
+        cache_put(new_keys + (size_t)i * KEY_SIZE, val, VAL_SIZE, 3600);
+    }
+    put_rate = ops / (now() - start);
+
+    /* Puts of new keys into a cache full of expired elements. */
+    cache_clear();
+    cache_init(budget, 1 << 20, CACHE_LRU);
+    for (int i = 0; i < num_entries; ++i) {
+        cache_put(keys + (size_t)i * KEY_SIZE, val, VAL_SIZE, 0);
+    }
+    start = now();
+    for (int i = 0; i < ops; ++i) {
+        cache_put(new_keys + (size_t)i * KEY_SIZE, val, VAL_SIZE, 3600);
+    }
+    expire_rate = ops / (now() - start);
+
+    printf("%9d entries: get hit %10.0f ops/s, pinned hit %10.0f ops/s, "
+           "get miss %10.0f ops/s, put+evict %10.0f ops/s, "
+           "put+expire %10.0f ops/s (%d hits, %zu bytes)\n",
+           num_entries,
+           get_rate,
+           pin_rate,
+           miss_rate,
+           put_rate,
+           expire_rate,
+           hits,
+           budget);
+    cache_clear();
+    free(keys);
+    free(new_keys);
+}
+
+/* Add a request to a trace, growing it as needed. */
+void add_request(struct request** trace,
+                 int* num_requests,
+                 int* cap,
+                 const char* key,
+                 int size)
+{
+    if (*num_requests == *cap) {
+        *cap = *cap > 0 ? *cap * 2 : 1024;
+        *trace = realloc(*trace, *cap * sizeof(struct request));
+        if (*trace == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*trace)[*num_requests].key = key;
+    (*trace)[*num_requests].size = size;
+    ++*num_requests;
+}
+
+/* Read a trace of "<key> [<size>]" lines; the size is VAL_SIZE by default. */
+struct request* read_trace(const char* path, int* num_requests)
+{
+    struct request* trace = NULL;
+    FILE* file = fopen(path, "r");
+    char line[4096];
+    char key[4096];
+    char* copy;
+    int cap = 0;
+    int size;
+
+    if (file == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    *num_requests = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        size = VAL_SIZE;
+        if (sscanf(line, "%4095s %d", key, &size) < 1) {
+            continue;
+        }
+        if (size < 0 || size > TRACE_MAX_SIZE) {
+            size = TRACE_MAX_SIZE;
+        }
+        copy = strdup(key);
+        if (copy == NULL) {
+            perror("strdup");
+            exit(EXIT_FAILURE);
+        }
+        add_request(&trace, num_requests, &cap, copy, size);
+    }
+    fclose(file);
+    return trace;
+}
+
+/* Make a trace of Zipf-distributed requests for CDN assets of various sizes,
+ * mixed with one-off crawler requests. */
+struct request* make_trace(int* num_requests)
+{
+    struct request* trace = NULL;
+    double* cdf = malloc(TRACE_OBJECTS * sizeof(double));
+    char* assets = make_keys(TRACE_OBJECTS, 0);
+    char* key;
+    double sum = 0;
+    double p;
+    unsigned r = 12345;
+    int cap = 0;
+    int lo;
+    int hi;
+
+    if (cdf == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < TRACE_OBJECTS; ++i) {
+        sum += 1 / pow(i + 1, TRACE_ZIPF);
+        cdf[i] = sum;
+    }
+    *num_requests = 0;
+    for (int i = 0; i < TRACE_REQUESTS; ++i) {
+        r = r * 1103515245u + 12345u;
+        if ((r >> 8) % 100 < TRACE_SCAN_PERCENT) {
+            key = malloc(KEY_SIZE);
+            if (key == NULL) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            snprintf(key, KEY_SIZE, "crawler.example.com/page/%d", i);
+            add_request(&trace, num_requests, &cap, key, 8192);
+            continue;
+        }
+        /* Pick an asset by binary search of the CDF. */
+        r = r * 1103515245u + 12345u;
+        p = (double)(r >> 8) / (1u << 24) * sum;
+        lo = 0;
+        hi = TRACE_OBJECTS - 1;
+        while (lo < hi) {
+            if (cdf[(lo + hi) / 2] < p) {
+                lo = (lo + hi) / 2 + 1;
+            }
+            else {
+                hi = (lo + hi) / 2;
+            }
+        }
+        add_request(&trace,
+                    num_requests,
+                    &cap,
+                    assets + (size_t)lo * KEY_SIZE,
+                    1024 + (lo * 2654435761u) % 15360);
+    }
+    free(cdf);
+    return trace;
+}
+
+/* Replay a trace against each eviction policy, with a disk tier in the given
+ * directory unless it's NULL. */
+void bench_trace(const struct request* trace,
+                 int num_requests,
+                 size_t budget,
+                 const char* disk_dir,
+                 size_t disk_budget)
+{
+    static char response[TRACE_MAX_SIZE]; /* Value of every response. */
+    struct cache_elem* elem;
+    const char* pinned_val;
+    int out_val_len;
+    int out_head_len;
+    int out_age;
+    int hits;
+    double hit_bytes;
+    double total_bytes;
+    double start;
+    double rate;
+    char name[32];
+
+    memset(response, 'x', sizeof(response));
+    for (int policy = 0; policy < CACHE_NUM_POLICIES; ++policy) {
+        if (cache_init(budget, budget, policy) < 0) {
+            fprintf(stderr, "cache_init failed\n");
+            exit(EXIT_FAILURE);
+        }
+        if (disk_dir != NULL &&
+            disk_cache_init(disk_dir, disk_budget, DISK_SEGMENT_BYTES) < 0) {
+            fprintf(stderr, "disk_cache_init failed\n");
+            exit(EXIT_FAILURE);
+        }
+        hits = 0;
+        hit_bytes = 0;
+        total_bytes = 0;
+        start = now();
+        for (int i = 0; i < num_requests; ++i) {
+            total_bytes += trace[i].size;
+            elem = cache_acquire(trace[i].key,
+                                 &pinned_val,
+                                 &out_val_len,
+                                 &out_head_len,
+                                 &out_age);
+            if (elem != NULL) {
+                cache_release(elem);
+                ++hits;
+                hit_bytes += trace[i].size;
+                continue;
+            }
+            cache_put(trace[i].key, response, trace[i].size, 3600);
+        }
+        rate = num_requests / (now() - start);
+        snprintf(name,
+                 sizeof(name),
+                 "%s%s",
+                 cache_policy_name(policy),
+                 disk_dir != NULL ? "+disk" : "");
+        printf("%12s: hit ratio %6.2f%%, byte hit ratio %6.2f%%, "
+               "%10.0f requests/s, %zu bytes on disk\n",
+               name,
+               100.0 * hits / num_requests,
+               100.0 * hit_bytes / total_bytes,
+               rate,
+               disk_cache_bytes());
+        cache_clear();
+        disk_cache_clear();
+    }
+}
+
+/* Read the resident set size of this process in bytes. */
+size_t rss_bytes(void)
+{
+    FILE* file = fopen("/proc/self/statm", "r");
+    unsigned long size;
+    unsigned long pages = 0;
+
+    if (file == NULL) {
+        return 0;
+    }
+    if (fscanf(file, "%lu %lu", &size, &pages) != 2) {
+        pages = 0;
+    }
+    fclose(file);
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+/* Fill the cache over and over with responses whose sizes shift between
+ * phases, and report the RSS after each phase. */
+void bench_churn(size_t budget, int rounds)
+{
+    /* Response sizes of each phase, uniform in [min, max]. */
+    static const struct {
+        const char* name;
+        int min;
+        int max;
+    } phases[] = {
+        {"small", 200, 2000},
+        {"large", 16 << 10, 96 << 10},
+        {"tiny", 16, 300},
+        {"mixed", 100, CHURN_MAX_SIZE},
+    };
+    static char response[CHURN_MAX_SIZE];
+    struct slab_stats stats;
+    unsigned long long id = 0;
+    char key[KEY_SIZE];
+    size_t put_bytes;
+    int num_puts;
+    unsigned seed = 1;
+    int size;
+    size_t base_rss;
+    double start;
+
+    memset(response, 'x', sizeof(response));
+    base_rss = rss_bytes();
+    if (cache_init(budget, CHURN_MAX_SIZE * 2, CACHE_LRU) < 0) {
+        fprintf(stderr, "cache_init failed\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("%zu cache bytes, %zu bytes of RSS before\n", budget, base_rss);
+    for (int round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); ++i) {
+            put_bytes = 0;
+            num_puts = 0;
+            start = now();
+            while (put_bytes < CHURN_TURNOVER * budget) {
+                seed = seed * 1103515245u + 12345u;
+                size = phases[i].min +
+                       (seed >> 8) % (phases[i].max - phases[i].min + 1);
+                snprintf(key,
+                         sizeof(key),
+                         "http://churn.example.com/%llu",
+                         id++);
+                cache_put(key, response, size, 3600);
+                put_bytes += size;
+                ++num_puts;
+            }
+            slab_get_stats(&stats);
+            printf("round %d %6s: %8.0f puts/s, cache %6.1fM, RSS %6.1fM "
+                   "(%4.2fx budget), slabs %6.1fM %3.0f%% used, "
+                   "rounding %5.1fM, large %6.1fM\n",
+                   round,
+                   phases[i].name,
+                   num_puts / (now() - start),
+                   cache_bytes() / 1048576.0,
+                   (rss_bytes() - base_rss) / 1048576.0,
+                   (double)(rss_bytes() - base_rss) / budget,
+                   stats.slab_bytes / 1048576.0,
+                   stats.slab_bytes == 0 ?
+                   0 : 100.0 * stats.chunk_bytes / stats.slab_bytes,
+                   (stats.chunk_bytes - stats.request_bytes) / 1048576.0,
+                   stats.large_bytes / 1048576.0);
+        }
+    }
+    cache_clear();
+}
+
+int main(int argc, char** argv)
+{
+    int ops = argc > 1 ? atoi(argv[1]) : 1000000;
+    int sizes[] = {1000, 100000, 1000000};
+    struct request* trace;
+    int num_requests;
+    size_t budget = TRACE_CACHE_BYTES;
+    int rounds;
+
+    if (argc > 1 && strcmp(argv[1], "trace") == 0) {
+        if (argc > 2) {
+            budget = strtoull(argv[2], NULL, 10);
+        }
+        if (budget == 0 || argc > 4) {
+            fprintf(stderr,
+                    "Usage: %s trace [<cache bytes> [<trace file>]]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+        /* Keys of the trace are not freed; it lives until exit. */
+        if (argc > 3) {
+            trace = read_trace(argv[3], &num_requests);
+        }
+        else {
+            trace = make_trace(&num_requests);
+        }
+        printf("%d requests, %zu cache bytes\n", num_requests, budget);
+        bench_trace(trace, num_requests, budget, NULL, 0);
+        free(trace);
+        return EXIT_SUCCESS;
+    }
+    if (argc > 1 && strcmp(argv[1], "disk") == 0) {
+        budget = argc > 3 ? strtoull(argv[3], NULL, 10) : TRACE_DISK_BYTES;
+        if (argc < 3 || argc > 4 || budget < 2 * (size_t)DISK_SEGMENT_BYTES) {
+            fprintf(stderr,
+                    "Usage: %s disk <dir> [<disk bytes>]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+        trace = make_trace(&num_requests);
+        printf("%d requests, %d cache bytes, %zu disk bytes\n",
+               num_requests,
+               TRACE_CACHE_BYTES,
+               budget);
+        bench_trace(trace, num_requests, TRACE_CACHE_BYTES, NULL, 0);
+        bench_trace(trace, num_requests, TRACE_CACHE_BYTES, argv[2], budget);
+        free(trace);
+        return EXIT_SUCCESS;
+    }
+    if (argc > 1 && strcmp(argv[1], "churn") == 0) {
+        budget = argc > 2 ? strtoull(argv[2], NULL, 10) : CHURN_CACHE_BYTES;
+        rounds = argc > 3 ? atoi(argv[3]) : CHURN_ROUNDS;
+        if (budget == 0 || rounds <= 0 || argc > 4) {
+            fprintf(stderr,
+                    "Usage: %s churn [<cache bytes> [<rounds>]]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+        bench_churn(budget, rounds);
+        return EXIT_SUCCESS;
+    }
+    if (ops <= 0) {
+        fprintf(stderr,
+                "Usage: %s [ops per measurement]\n"
+                "       %s trace [<cache bytes> [<trace file>]]\n"
+                "       %s disk <dir> [<disk bytes>]\n"
+                "       %s churn [<cache bytes> [<rounds>]]\n",
+                argv[0],
+                argv[0],
+                argv[0],
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    memset(val, 'x', VAL_SIZE);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        bench(sizes[i], ops);
+    }
+    return EXIT_SUCCESS;
+}
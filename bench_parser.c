@@ -0,0 +1,249 @@
+/**************************************************************
+*
+*                        bench_parser.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Microbenchmark for the incremental HTTP parser. For
+*     request heads of a browser and of a command line client,
+*     and response heads of a CDN, it reports heads/sec, GB/s
+*     and heap allocations per head. Each head is parsed whole,
+*     and fed in small segments as if it arrived in pieces,
+*     with each scan kernel that the CPU supports.
+*
+*     Allocations are counted by wrapping malloc(), calloc()
+*     and realloc() of the C library.
+*
+*     Usage: ./bench_parser [heads per measurement]
+*
+**************************************************************/
+
+#include "http_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SEGMENT_BYTES 64 /* Byte size of each piece of a segmented head. */
+
+/* Allocators of glibc, wrapped to count allocations. */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t num, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static long num_allocs; /* Number of allocations so far. */
+
+/* Head to parse. */
+struct head {
+    const char* name;
+    int is_request;
+    const char* text;
+};
+
+static const struct head heads[] = {
+    {"browser request",
+     1,
+     "GET http://www.example.com/assets/app.4f3a2c.js?v=20261016 HTTP/1.1\r\n"
+     "Host: www.example.com\r\n"
+     "Connection: keep-alive\r\n"
+     "sec-ch-ua: \"Chromium\";v=\"130\", \"Not?A_Brand\";v=\"99\"\r\n"
+     "sec-ch-ua-mobile: ?0\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+     "(KHTML, like Gecko) Chrome/130.0.0.0 Safari/537.36\r\n"
+     "sec-ch-ua-platform: \"Linux\"\r\n"
+     "Accept: */*\r\n"
+     "Sec-Fetch-Site: same-origin\r\n"
+     "Sec-Fetch-Mode: no-cors\r\n"
+     "Sec-Fetch-Dest: script\r\n"
+     "Referer: http://www.example.com/products/index.html\r\n"
+     "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+     "Accept-Language: en-US,en;q=0.9\r\n"
+     "Cookie: session=4b1d2f6e8a0c4e2a9f7b3d5c1e0a8f6b; theme=dark; "
+     "_ga=GA1.2.1234567890.1700000000; _gid=GA1.2.987654321.1700000000; "
+     "consent=analytics%3Dyes%26ads%3Dno\r\n"
+     "If-None-Match: \"5d8c72a5edda8\"\r\n"
+     "\r\n"},
+    {"navigation",
+     1,
+     "GET http://shop.example.com/cart?step=2&ref=header HTTP/1.1\r\n"
+     "Host: shop.example.com\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:131.0) Gecko/20100101 "
+     "Firefox/131.0\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+     "image/avif,image/webp,image/png,image/svg+xml,*/*;q=0.8\r\n"
+     "Accept-Language: en-US,en;q=0.5\r\n"
+     "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+     "Referer: http://shop.example.com/products/42?color=blue\r\n"
+     "Connection: keep-alive\r\n"
+     "Cookie: session=eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJzdWIiOiIxMjM0NT"
+     "Y3ODkwIiwibmFtZSI6IkpvaG4gRG9lIiwiaWF0IjoxNTE2MjM5MDIyfQ.SflKxwRJSMeKK"
+     "F2QT4fwpMeJf36POk6yJV_adQssw5c; cart=%5B%7B%22id%22%3A42%2C%22qty%22%3A"
+     "2%7D%2C%7B%22id%22%3A7%2C%22qty%22%3A1%7D%5D; _ga=GA1.1.1234567890."
+     "1700000000; _ga_ABCDEF1234=GS1.1.1700000000.3.1.1700000123.0.0.0; "
+     "_fbp=fb.1.1700000000000.1234567890; locale=en-US; currency=USD; "
+     "ab_test=checkout_v2%3Dtreatment; csrftoken=8f14e45fceea167a5a36dedd4bea"
+     "2543\r\n"
+     "Upgrade-Insecure-Requests: 1\r\n"
+     "Sec-Fetch-Dest: document\r\n"
+     "Sec-Fetch-Mode: navigate\r\n"
+     "Sec-Fetch-Site: same-origin\r\n"
+     "Sec-Fetch-User: ?1\r\n"
+     "Priority: u=0, i\r\n"
+     "\r\n"},
+    {"curl request",
+     1,
+     "GET http://example.com/ HTTP/1.1\r\n"
+     "Host: example.com\r\n"
+     "User-Agent: curl/8.5.0\r\n"
+     "Accept: */*\r\n"
+     "\r\n"},
+    {"CDN response",
+     0,
+     "HTTP/1.1 200 OK\r\n"
+     "Content-Type: application/javascript; charset=utf-8\r\n"
+     "Content-Length: 184213\r\n"
+     "Connection: keep-alive\r\n"
+     "Date: Fri, 16 Oct 2026 12:00:00 GMT\r\n"
+     "Last-Modified: Thu, 15 Oct 2026 08:30:00 GMT\r\n"
+     "ETag: \"5d8c72a5edda8\"\r\n"
+     "Cache-Control: public, max-age=31536000, immutable\r\n"
+     "Accept-Ranges: bytes\r\n"
+     "Server: ECS (nyb/1D2A)\r\n"
+     "Vary: Accept-Encoding\r\n"
+     "X-Cache: HIT\r\n"
+     "Age: 51234\r\n"
+     "Via: 1.1 varnish, 1.1 a1b2c3d4e5f6.cloudfront.net (CloudFront)\r\n"
+     "X-Amz-Cf-Pop: IAD89-C1\r\n"
+     "X-Amz-Cf-Id: 0aZ3kT9Qm1Xb4cV6nH8jL2pR5sW7yU0eG3iK6oM9qT1vX4zB7dF2==\r\n"
+     "Strict-Transport-Security: max-age=63072000; includeSubDomains\r\n"
+     "\r\n"},
+    {"HTML response",
+     0,
+     "HTTP/1.1 200 OK\r\n"
+     "Content-Type: text/html; charset=utf-8\r\n"
+     "Transfer-Encoding: chunked\r\n"
+     "Connection: keep-alive\r\n"
+     "Date: Fri, 16 Oct 2026 12:00:00 GMT\r\n"
+     "Cache-Control: private, no-cache, max-age=0, must-revalidate\r\n"
+     "Vary: Accept-Encoding, Cookie\r\n"
+     "Content-Security-Policy: default-src 'self'; script-src 'self' "
+     "'nonce-r4nd0mN0nc3V4lu3' https://cdn.example.com "
+     "https://www.googletagmanager.com; style-src 'self' 'unsafe-inline' "
+     "https://fonts.googleapis.com; img-src 'self' data: https: blob:; "
+     "font-src 'self' https://fonts.gstatic.com; connect-src 'self' "
+     "https://api.example.com wss://ws.example.com; frame-ancestors 'none'; "
+     "base-uri 'self'; form-action 'self'; upgrade-insecure-requests\r\n"
+     "Set-Cookie: session=eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.e30.abc; "
+     "Path=/; HttpOnly; SameSite=Lax\r\n"
+     "Link: <https://cdn.example.com/app.4f3a2c.css>; rel=preload; as=style, "
+     "<https://cdn.example.com/app.4f3a2c.js>; rel=preload; as=script\r\n"
+     "X-Content-Type-Options: nosniff\r\n"
+     "X-Frame-Options: DENY\r\n"
+     "Referrer-Policy: strict-origin-when-cross-origin\r\n"
+     "Permissions-Policy: camera=(), microphone=(), geolocation=()\r\n"
+     "Server-Timing: cdn-cache; desc=MISS, edge; dur=12, origin; dur=87\r\n"
+     "X-Cache: MISS from edge-fra1\r\n"
+     "X-Request-Id: 3f2b6c1e-9a7d-4e8f-b1c2-d3e4f5a6b7c8\r\n"
+     "\r\n"},
+};
+
+/* Kernels to measure, with their names. */
+static const struct {
+    enum http_scan_kernel kernel;
+    const char* name;
+} kernels[] = {
+    {HTTP_SCAN_SCALAR, "scalar"},
+    {HTTP_SCAN_SSE42, "sse4.2"},
+    {HTTP_SCAN_AVX2, "avx2"},
+};
+
+void* malloc(size_t size)
+{
+    ++num_allocs;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size)
+{
+    ++num_allocs;
+    return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    ++num_allocs;
+    return __libc_realloc(ptr, size);
+}
+
+/* Read the monotonic clock in seconds. */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parse a head the given number of times, fed in segments of the given byte
+ * size, and report the rates. */
+void bench(const struct head* head, int num_heads, int segment)
+{
+    static struct http_parser parser;
+    int len = strlen(head->text);
+    int n;
+    int ret = HTTP_PARSE_PARTIAL;
+    long allocs;
+    double start;
+    double elapsed;
+
+    allocs = num_allocs;
+    start = now();
+    for (int i = 0; i < num_heads; ++i) {
+        http_parser_init(&parser, head->is_request);
+        for (n = segment; n < len; n += segment) {
+            ret = http_parse(&parser, head->text, n);
+        }
+        ret = http_parse(&parser, head->text, len);
+        if (ret != HTTP_PARSE_DONE) {
+            fprintf(stderr, "%s is not parsed\n", head->name);
+            exit(EXIT_FAILURE);
+        }
+    }
+    elapsed = now() - start;
+    allocs = num_allocs - allocs;
+
+    printf("%16s (%4d bytes, %2d fields), %-9s: %10.0f heads/s, "
+           "%6.3f GB/s, %.2f allocs/head\n",
+           head->name,
+           len,
+           parser.num_fields,
+           segment < len ? "segmented" : "whole",
+           num_heads / elapsed,
+           (double)len * num_heads / elapsed / 1e9,
+           (double)allocs / num_heads);
+}
+
+int main(int argc, char** argv)
+{
+    int num_heads = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    if (num_heads <= 0 || argc > 2) {
+        fprintf(stderr, "Usage: %s [heads per measurement]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        if (http_scan_set_kernel(kernels[k].kernel) < 0) {
+            printf("%s kernel: not supported\n", kernels[k].name);
+            continue;
+        }
+        printf("%s kernel:\n", kernels[k].name);
+        for (size_t i = 0; i < sizeof(heads) / sizeof(heads[0]); ++i) {
+            bench(&heads[i], num_heads, HTTP_MAX_HEAD_BYTES);
+            bench(&heads[i], num_heads, SEGMENT_BYTES);
+        }
+    }
+    return EXIT_SUCCESS;
+}
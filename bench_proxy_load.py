@@ -0,0 +1,581 @@
+###############################################################
+#
+#                  bench_proxy_load.py
+#
+#     Final Project: High Performance HTTP Proxy
+#     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+#     Date: 2026-10-16
+#
+#     Summary:
+#     Load benchmark for proxy against a local origin server.
+#     * get: hold many concurrent client connections open, then
+#       send keep-alive GET requests on all of them.
+#     * tls: run the proxy in SSL interception mode and open
+#       CONNECT tunnels in a loop; each one costs a handshake
+#       with the client and one with the origin.
+#     * flood: run tls, and meanwhile measure the latency of
+#       unrelated plain-HTTP clients, which shouldn't wait for
+#       any handshake.
+#     * tunnel: stream bulk data through CONNECT tunnels, with
+#       tunnel data copied through user space and spliced.
+#     * churn: hold many idle connections, then open, use and
+#       close short-lived connections in a loop; the cost of a
+#       disconnect shouldn't grow with the idle ones.
+#     It reports throughput, latency and CPU time used by the
+#     proxy, for each given number of worker processes.
+#
+#     Usage: python3 bench_proxy_load.py [port] [options]
+#     where [port] is the port that the proxy listens on,
+#     9999 by default. Run with -h for options.
+#
+###############################################################
+
+import argparse
+import asyncio
+import multiprocessing
+import os
+import resource
+import shutil
+import socket
+import ssl
+import subprocess
+import sys
+import threading
+import time
+
+
+ORIGIN_BODY_SIZE = 1024  # Byte size of each object served by the origin.
+
+
+def raise_fd_limit(n):
+    '''
+    @brief Raise the soft limit of open files to at least n if possible.
+    @param n Number of open files needed.
+    '''
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    want = max(soft, n) if hard == resource.RLIM_INFINITY else min(max(soft, n), hard)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (want, hard))
+    return want
+
+
+async def origin_handle(reader, writer):
+    '''
+    @brief Serve GET requests with a fixed-size cacheable body.
+    '''
+    body = b"x" * ORIGIN_BODY_SIZE
+    try:
+        while True:
+            head = await reader.readuntil(b"\r\n\r\n")
+            if not head:
+                break
+            writer.write(b"HTTP/1.1 200 OK\r\n"
+                         b"Content-Type: text/plain\r\n"
+                         b"Cache-Control: max-age=3600\r\n"
+                         b"Content-Length: " + str(len(body)).encode() +
+                         b"\r\n\r\n" + body)
+            await writer.drain()
+    except (asyncio.IncompleteReadError, ConnectionError):
+        pass
+    writer.close()
+
+
+def run_origin(port, cert_file=None, key_file=None):
+    '''
+    @brief Run the local origin server until killed.
+    @param port Port that the origin listens on.
+    @param cert_file Certificate to serve HTTPS; None to serve HTTP.
+    @param key_file Private key to serve HTTPS.
+    '''
+    raise_fd_limit(65536)
+    ssl_ctx = None
+    if cert_file is not None:
+        ssl_ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        ssl_ctx.load_cert_chain(cert_file, key_file)
+
+    async def serve():
+        server = await asyncio.start_server(origin_handle, "127.0.0.1", port,
+                                            backlog=4096, ssl=ssl_ctx)
+        async with server:
+            await server.serve_forever()
+    asyncio.run(serve())
+
+
+def blast_handle(conn):
+    '''
+    @brief Read a byte count in a line and send that many bytes back.
+    '''
+    chunk = memoryview(bytes(1 << 20))
+    with conn:
+        line = conn.makefile("rb").readline()
+        left = int(line)
+        while left > 0:
+            n = min(left, len(chunk))
+            conn.sendall(chunk[:n])
+            left -= n
+
+
+def run_blast_origin(port):
+    '''
+    @brief Run the bulk data origin for tunnel mode until killed.
+    @param port Port that the origin listens on.
+    '''
+    server = socket.socket()
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("127.0.0.1", port))
+    server.listen(128)
+    while True:
+        conn, _ = server.accept()
+        threading.Thread(target=blast_handle, args=(conn,), daemon=True).start()
+
+
+def free_port():
+    '''
+    @brief Pick a free local TCP port.
+    '''
+    sock = socket.socket()
+    sock.bind(("127.0.0.1", 0))
+    port = sock.getsockname()[1]
+    sock.close()
+    return port
+
+
+def proc_tree(pid):
+    '''
+    @brief PIDs of a process and its direct children, i.e. proxy workers.
+    @param pid Process ID.
+    '''
+    pids = [pid]
+    try:
+        with open("/proc/{}/task/{}/children".format(pid, pid)) as f:
+            pids += [int(child) for child in f.read().split()]
+    except OSError:
+        pass
+    return pids
+
+
+def proc_cpu_seconds(pid):
+    '''
+    @brief User + system CPU time of a process and its children in seconds.
+    @param pid Process ID.
+    '''
+    total = 0
+    for p in proc_tree(pid):
+        try:
+            with open("/proc/{}/stat".format(p)) as f:
+                fields = f.read().rsplit(")", 1)[1].split()
+        except OSError:
+            continue
+        # utime and stime are the 14th and 15th fields.
+        total += int(fields[11]) + int(fields[12])
+    return total / os.sysconf("SC_CLK_TCK")
+
+
+def proc_open_fds(pid):
+    '''
+    @brief Number of FDs opened by a process and its children.
+    @param pid Process ID.
+    '''
+    return sum(len(os.listdir("/proc/{}/fd".format(p))) for p in proc_tree(pid))
+
+
+def print_stats(latencies, elapsed, cpu, unit):
+    '''
+    @brief Print throughput, latency percentiles and proxy CPU time.
+    @param latencies Latency of each operation in seconds.
+    @param elapsed Wall time of the run in seconds.
+    @param cpu CPU time used by the proxy in seconds.
+    @param unit Name of the operation.
+    '''
+    latencies.sort()
+    print("{:<22}: {}".format(unit + "s", len(latencies)))
+    print("elapsed               : {:.3f} s".format(elapsed))
+    print("throughput            : {:.0f} {}/s".format(len(latencies) / elapsed,
+                                                       unit))
+    print("latency p50           : {:.3f} ms".format(
+        latencies[len(latencies) // 2] * 1000))
+    print("latency p99           : {:.3f} ms".format(
+        latencies[int(len(latencies) * 0.99)] * 1000))
+    print("proxy CPU             : {:.3f} s ({:.0%} of one core)".format(
+        cpu, cpu / elapsed))
+
+
+async def read_response(reader):
+    '''
+    @brief Read one HTTP response with Content-Length from the stream.
+    '''
+    head = await reader.readuntil(b"\r\n\r\n")
+    length = 0
+    for line in head.split(b"\r\n"):
+        if line.lower().startswith(b"content-length:"):
+            length = int(line.split(b":", 1)[1])
+    if length > 0:
+        await reader.readexactly(length)
+
+
+async def open_conns(proxy_port, n, batch):
+    '''
+    @brief Open n client connections to the proxy, batch at a time.
+    '''
+    conns = []
+    for i in range(0, n, batch):
+        todo = [asyncio.open_connection("127.0.0.1", proxy_port)
+                for _ in range(min(batch, n - i))]
+        conns += await asyncio.gather(*todo)
+    return conns
+
+
+async def client_loop(conn, origin_port, requests, objects, index, latencies):
+    '''
+    @brief Send keep-alive GET requests on one connection.
+    '''
+    reader, writer = conn
+    for i in range(requests):
+        url = "http://127.0.0.1:{}/obj/{}".format(origin_port,
+                                                  (index + i) % objects)
+        request = ("GET {} HTTP/1.1\r\n"
+                   "Host: 127.0.0.1:{}\r\n\r\n").format(url, origin_port)
+        start = time.monotonic()
+        writer.write(request.encode())
+        await read_response(reader)
+        latencies.append(time.monotonic() - start)
+
+
+async def bench_get(args, proxy_pid, origin_port):
+    '''
+    @brief Hold args.conns connections and send GET requests on all of them.
+    '''
+    start = time.monotonic()
+    conns = await open_conns(args.port, args.conns, args.batch)
+    await asyncio.sleep(0.5)  # Let the proxy accept the last batch.
+    print("concurrent connections: {} (opened in {:.2f} s)".format(
+        len(conns), time.monotonic() - start))
+    print("proxy open FDs        : {}".format(proc_open_fds(proxy_pid)))
+
+    latencies = []
+    cpu_start = proc_cpu_seconds(proxy_pid)
+    start = time.monotonic()
+    await asyncio.gather(*[client_loop(conn, origin_port, args.requests,
+                                       args.objects, i, latencies)
+                           for i, conn in enumerate(conns)])
+    elapsed = time.monotonic() - start
+    cpu = proc_cpu_seconds(proxy_pid) - cpu_start
+    print_stats(latencies, elapsed, cpu, "request")
+
+    for _, writer in conns:
+        writer.close()
+
+
+async def tls_loop(args, origin_port, latencies):
+    '''
+    @brief Open intercepted CONNECT tunnels one after another, each with a
+    fresh TLS handshake and one GET request.
+    '''
+    ctx = ssl.create_default_context()
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+    for _ in range(args.requests):
+        start = time.monotonic()
+        reader, writer = await asyncio.open_connection("127.0.0.1", args.port)
+        writer.write("CONNECT 127.0.0.1:{} HTTP/1.1\r\n"
+                     "Host: 127.0.0.1:{}\r\n\r\n".format(origin_port,
+                                                        origin_port).encode())
+        await reader.readuntil(b"\r\n\r\n")
+        await writer.start_tls(ctx)
+        writer.write("GET /obj/0 HTTP/1.1\r\n"
+                     "Host: 127.0.0.1:{}\r\n\r\n".format(origin_port).encode())
+        await read_response(reader)
+        latencies.append(time.monotonic() - start)
+        writer.close()
+
+
+async def bench_tls(args, proxy_pid, origin_port):
+    '''
+    @brief Run args.conns concurrent loops of intercepted CONNECT tunnels.
+    '''
+    latencies = []
+    cpu_start = proc_cpu_seconds(proxy_pid)
+    start = time.monotonic()
+    results = await asyncio.gather(*[tls_loop(args, origin_port, latencies)
+                                     for _ in range(args.conns)],
+                                   return_exceptions=True)
+    elapsed = time.monotonic() - start
+    cpu = proc_cpu_seconds(proxy_pid) - cpu_start
+    errors = [r for r in results if isinstance(r, Exception)]
+    if errors:
+        print("failed loops          : {} ({})".format(len(errors), errors[0]))
+    print_stats(latencies, elapsed, cpu, "handshake")
+
+
+async def probe_loop(args, origin_port, index, latencies, done):
+    '''
+    @brief Send plain-HTTP GET requests on one keep-alive connection until
+    done is set.
+    '''
+    reader, writer = await asyncio.open_connection("127.0.0.1", args.port)
+    i = 0
+    while not done.is_set():
+        url = "http://127.0.0.1:{}/obj/{}".format(origin_port,
+                                                  (index + i) % args.objects)
+        request = ("GET {} HTTP/1.1\r\n"
+                   "Host: 127.0.0.1:{}\r\n\r\n").format(url, origin_port)
+        start = time.monotonic()
+        writer.write(request.encode())
+        await read_response(reader)
+        latencies.append(time.monotonic() - start)
+        i += 1
+        await asyncio.sleep(0.01)
+    writer.close()
+
+
+async def bench_flood(args, proxy_pid, origin_port, plain_port):
+    '''
+    @brief Run args.conns loops of intercepted CONNECT tunnels, and measure
+    args.probes plain-HTTP clients in the meantime.
+    '''
+    latencies = []
+    probe_latencies = []
+    done = asyncio.Event()
+    probes = [asyncio.ensure_future(probe_loop(args, plain_port, i,
+                                               probe_latencies, done))
+              for i in range(args.probes)]
+    await asyncio.sleep(0.2)  # Warm up the cache for plain-HTTP clients.
+    probe_latencies.clear()
+
+    cpu_start = proc_cpu_seconds(proxy_pid)
+    start = time.monotonic()
+    results = await asyncio.gather(*[tls_loop(args, origin_port, latencies)
+                                     for _ in range(args.conns)],
+                                   return_exceptions=True)
+    elapsed = time.monotonic() - start
+    cpu = proc_cpu_seconds(proxy_pid) - cpu_start
+    done.set()
+    await asyncio.gather(*probes)
+
+    errors = [r for r in results if isinstance(r, Exception)]
+    if errors:
+        print("failed loops          : {} ({})".format(len(errors), errors[0]))
+    print_stats(latencies, elapsed, cpu, "handshake")
+    probe_latencies.sort()
+    print("plain-HTTP requests   : {}".format(len(probe_latencies)))
+    print("plain-HTTP p50        : {:.3f} ms".format(
+        probe_latencies[len(probe_latencies) // 2] * 1000))
+    print("plain-HTTP p99        : {:.3f} ms".format(
+        probe_latencies[int(len(probe_latencies) * 0.99)] * 1000))
+
+
+async def churn_loop(args, origin_port, index, latencies):
+    '''
+    @brief Open a connection, send one GET request and close it, args.requests
+    times.
+    '''
+    for i in range(args.requests):
+        url = "http://127.0.0.1:{}/obj/{}".format(origin_port,
+                                                  (index + i) % args.objects)
+        request = ("GET {} HTTP/1.1\r\n"
+                   "Host: 127.0.0.1:{}\r\n\r\n").format(url, origin_port)
+        start = time.monotonic()
+        reader, writer = await asyncio.open_connection("127.0.0.1", args.port)
+        writer.write(request.encode())
+        await read_response(reader)
+        writer.close()
+        await writer.wait_closed()
+        latencies.append(time.monotonic() - start)
+
+
+async def bench_churn(args, proxy_pid, origin_port):
+    '''
+    @brief Hold args.conns idle connections, which fill the socket table of the
+    proxy, and run args.probes loops of short-lived connections.
+    '''
+    start = time.monotonic()
+    conns = await open_conns(args.port, args.conns, args.batch)
+    print("idle connections      : {} (opened in {:.2f} s)".format(
+        len(conns), time.monotonic() - start))
+    print("proxy open FDs        : {}".format(proc_open_fds(proxy_pid)))
+
+    latencies = []
+    cpu_start = proc_cpu_seconds(proxy_pid)
+    start = time.monotonic()
+    await asyncio.gather(*[churn_loop(args, origin_port, i, latencies)
+                           for i in range(args.probes)])
+    elapsed = time.monotonic() - start
+    cpu = proc_cpu_seconds(proxy_pid) - cpu_start
+    print_stats(latencies, elapsed, cpu, "connection")
+    print("proxy CPU/connection  : {:.1f} us".format(
+        cpu / len(latencies) * 1e6))
+
+    for _, writer in conns:
+        writer.close()
+
+
+def tunnel_client(args, origin_port, received):
+    '''
+    @brief Open a CONNECT tunnel to the bulk data origin and read
+    args.megabytes MiB through it.
+    '''
+    want = args.megabytes << 20
+    sock = socket.create_connection(("127.0.0.1", args.port))
+    sock.sendall("CONNECT 127.0.0.1:{} HTTP/1.1\r\n"
+                 "Host: 127.0.0.1:{}\r\n\r\n".format(origin_port,
+                                                      origin_port).encode())
+    head = b""
+    while not head.endswith(b"\r\n\r\n"):
+        head += sock.recv(1)
+    sock.sendall("{}\n".format(want).encode())
+    buf = bytearray(1 << 20)
+    got = 0
+    while got < want:
+        n = sock.recv_into(buf)
+        if n == 0:
+            break
+        got += n
+    sock.close()
+    received.append(got)
+
+
+def bench_tunnel(args, proxy_pid, origin_port):
+    '''
+    @brief Stream args.megabytes MiB through each of args.conns concurrent
+    tunnels.
+    '''
+    received = []
+    threads = [threading.Thread(target=tunnel_client,
+                                args=(args, origin_port, received))
+               for _ in range(args.conns)]
+    cpu_start = proc_cpu_seconds(proxy_pid)
+    start = time.monotonic()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.monotonic() - start
+    cpu = proc_cpu_seconds(proxy_pid) - cpu_start
+    total = sum(received)
+    if total < args.conns * (args.megabytes << 20):
+        print("incomplete tunnels    : {}".format(
+            args.conns - sum(1 for n in received
+                             if n == args.megabytes << 20)))
+    print("tunnels               : {}".format(args.conns))
+    print("bytes                 : {:.2f} GB".format(total / 1e9))
+    print("elapsed               : {:.3f} s".format(elapsed))
+    print("throughput            : {:.2f} Gbit/s".format(
+        total * 8 / elapsed / 1e9))
+    print("proxy CPU             : {:.3f} s ({:.0%} of one core)".format(
+        cpu, cpu / elapsed))
+    print("proxy CPU/GB          : {:.3f} s".format(cpu / (total / 1e9)))
+
+
+def run_bench(args, workers, repo_root, origin_port, plain_port,
+              proxy_args=()):
+    '''
+    @brief Start a proxy with the given number of workers and benchmark it.
+    @param workers Number of worker processes; 0 for a single process.
+    @param proxy_args Extra options of the proxy.
+    @param origin_port Port of the origin; it serves HTTPS in tls/flood mode.
+    @param plain_port Port of the HTTP origin in flood mode.
+    '''
+    cmd = [os.path.join(repo_root, "proxy")]
+    if workers > 0:
+        cmd += ["--workers", str(workers)]
+    cmd += list(proxy_args) + [str(args.port)]
+    if args.mode in ("tls", "flood"):
+        cmd += [os.path.join(repo_root, "cert.pem"),
+                os.path.join(repo_root, "key.pem")]
+    # Pin the proxy on one core per worker.
+    if shutil.which("taskset"):
+        last = args.cpu + max(workers, 1) - 1
+        cmd = ["taskset", "-c", "{}-{}".format(args.cpu, last)] + cmd
+
+    # Start the proxy and drop its logs.
+    proxy = subprocess.Popen(cmd, stderr=subprocess.DEVNULL,
+                             preexec_fn=lambda: raise_fd_limit(args.conns * 2 + 1024))
+    time.sleep(1)  # Wait for proxy to start.
+
+    print("---- workers: {}{} ----".format(workers,
+                                           "".join(" " + a for a in proxy_args)))
+    try:
+        if args.mode == "tls":
+            asyncio.run(bench_tls(args, proxy.pid, origin_port))
+        elif args.mode == "flood":
+            asyncio.run(bench_flood(args, proxy.pid, origin_port, plain_port))
+        elif args.mode == "tunnel":
+            bench_tunnel(args, proxy.pid, origin_port)
+        elif args.mode == "churn":
+            asyncio.run(bench_churn(args, proxy.pid, origin_port))
+        else:
+            asyncio.run(bench_get(args, proxy.pid, origin_port))
+    finally:
+        proxy.send_signal(2)  # Let workers shut down with SIGINT.
+        try:
+            proxy.wait(timeout=5)
+        except subprocess.TimeoutExpired:
+            proxy.kill()
+            proxy.wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Load benchmark for proxy.")
+    parser.add_argument("port", nargs="?", type=int, default=9999,
+                        help="port that the proxy listens on")
+    parser.add_argument("--mode", choices=["get", "tls", "flood", "tunnel", "churn"], default="get",
+                        help="what to benchmark")
+    parser.add_argument("--conns", type=int, default=10000,
+                        help="number of concurrent client connections")
+    parser.add_argument("--requests", type=int, default=5,
+                        help="number of requests (or tunnels) per connection")
+    parser.add_argument("--megabytes", type=int, default=1024,
+                        help="MiB streamed through each tunnel in tunnel mode")
+    parser.add_argument("--objects", type=int, default=100,
+                        help="number of distinct URLs")
+    parser.add_argument("--probes", type=int, default=10,
+                        help="number of plain-HTTP clients in flood mode, or of "
+                             "short-lived connection loops in churn mode")
+    parser.add_argument("--batch", type=int, default=500,
+                        help="number of connections opened at a time")
+    parser.add_argument("--workers", default="0",
+                        help="comma-separated worker counts to run, e.g. "
+                             "1,2,4; 0 runs the proxy in a single process")
+    parser.add_argument("--cpu", type=int, default=0,
+                        help="first core that the proxy is pinned on")
+    args = parser.parse_args()
+
+    raise_fd_limit(args.conns + 1024)
+
+    repo_root = os.path.dirname(os.path.abspath(__file__))
+    if not os.path.exists(os.path.join(repo_root, "proxy")):
+        raise Exception("proxy not found; please build the project first")
+
+    # Start the local origin.
+    origin_port = free_port()
+    origin_args = (origin_port,)
+    if args.mode in ("tls", "flood"):
+        origin_args += (os.path.join(repo_root, "cert.pem"),
+                        os.path.join(repo_root, "key.pem"))
+    origin_target = run_blast_origin if args.mode == "tunnel" else run_origin
+    origins = [multiprocessing.Process(target=origin_target, args=origin_args)]
+    # Plain-HTTP origin for flood mode.
+    plain_port = free_port()
+    if args.mode == "flood":
+        origins.append(multiprocessing.Process(target=run_origin,
+                                               args=(plain_port,)))
+    for origin in origins:
+        origin.start()
+    time.sleep(0.5)  # Wait for origins to start.
+
+    print("==== load benchmark ({}) ====".format(args.mode))
+    try:
+        for workers in [int(w) for w in args.workers.split(",")]:
+            if args.mode == "tunnel":
+                # Compare the copy loop with splice().
+                run_bench(args, workers, repo_root, origin_port, plain_port,
+                          ["--no-splice"])
+            run_bench(args, workers, repo_root, origin_port, plain_port)
+    finally:
+        for origin in origins:
+            origin.kill()
+            origin.join()
+    print("==== benchmark end ====")
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -7,26 +7,213 @@
 *     Date: 2021-11-11
 *
 *     Summary:
-*     Implementation for fixed size LRU cache.
+*     Implementation for byte-budgeted cache with pluggable
+*     eviction policies.
+*
+*     Elements are kept in doubly linked queues, and indexed
+*     by an open-addressing hash table with linear probing.
+*     Each slot keeps the hash of its key, so probing only
+*     compares keys whose hashes match.
+*
+*     Elements, with their keys, and values are allocated
+*     from size-classed slabs, so the memory freed by evicting
+*     responses of one size serves any other size, and the
+*     footprint follows the budget. Each element is charged
+*     for the chunks of its key, value and element struct,
+*     and its share of the hash index. Elements are
+*     evicted to keep the total charge within the budget; the
+*     policy decides which ones, and in which queue each
+*     element lives:
+*     * LRU: one queue in recency order.
+*     * S3-FIFO: a small FIFO queue that new elements enter,
+*     and a main FIFO queue that elements hit in the small
+*     queue move to. Keys evicted from the small queue are
+*     remembered in a ghost queue; they go straight to the
+*     main queue when put again. One-hit wonders only pass
+*     through the small queue.
+*     * W-TinyLFU: a small LRU window that new elements enter,
+*     and a main segmented LRU of probation and protected
+*     queues. An element leaving the window is only admitted
+*     to the main queues if it's been looked up more often
+*     than the element it would evict. Frequencies are
+*     estimated by a count-min sketch that halves
+*     periodically.
+*
+*     A fill copies a response into fixed-size slab chunks as
+*     it arrives, so a large response isn't reallocated as it
+*     grows, and gathers them into the value of a new element
+*     once complete.
+*
+*     Elements are immutable and reference counted. The cache
+*     holds one reference of each element it contains, and a
+*     hit pins the element with another one, so the element
+*     outlives its eviction or replacement until released.
+*     Only the times of an element change, when it's
+*     revalidated by cache_refresh().
+*
+*     An element may be kept for its stale age after it goes
+*     stale; lookups skip it then, but cache_acquire_stale()
+*     gets it to be revalidated. It expires at the end of its
+*     stale age. A binary min-heap orders elements by expiry
+*     time, so expired elements are found without scanning
+*     the list: they are evicted before others, and swept a
+*     few at a time by cache_sweep().
+*
+*     cache_save() writes the unexpired elements to a
+*     snapshot file: a header, an index of keys and times,
+*     then the values. cache_load() maps the file and indexes
+*     its elements in place; their values stay in the mapping,
+*     which is unmapped once none of them is left, and are
+*     only read and checksummed on first use. The file is
+*     replaced by rename(), never rewritten in place, so the
+*     mapping stays valid.
 *
 **************************************************************/
 
+#define _GNU_SOURCE /* For memmem(). */
+
 #include "cache.h"
+#include "disk_cache.h"
 #include "logger.h"
+#include "slab.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+
+#define MIN_SLOTS 64 /* Min number of slots in the hash index. */
+#define FREQ_MAX 3 /* Max frequency of an element in S3-FIFO. */
+#define S3FIFO_SMALL_PERCENT 10 /* Share of the budget for the small queue. */
+#define TINYLFU_WINDOW_PERCENT 1 /* Share of the budget for the window. */
+#define TINYLFU_PROTECTED_PERCENT 80 /* Share of the main budget for the
+                                      * protected queue. */
+#define SKETCH_ROWS 4 /* Number of hash functions of the sketch. */
+#define SKETCH_MAX 15 /* Max counter of the sketch. */
+#define SKETCH_MIN_WIDTH 1024 /* Min number of counters per row. */
+#define SKETCH_SAMPLES 10 /* Counters are halved after this many increments
+                           * per counter of a row. */
+#define GHOST_BUCKETS 4 /* Buckets per hash in the ghost queue. */
+#define SNAPSHOT_MAGIC "PXYSNAP1" /* First bytes of a snapshot file, with the
+                                   * format version. */
+#define CHECKSUM_SEED 14695981039346656037ULL /* FNV-1a 64-bit offset basis. */
+#define FILL_CHUNK_BYTES SLAB_MAX_CHUNK_BYTES /* Byte size of each chunk of a
+                                               * fill. */
+
+/* Mapped snapshot file that loaded elements keep their values in. */
+struct cache_snapshot {
+    char* data;
+    size_t len; /* Byte size of data. */
+    int refs; /* Number of elements with values in data, plus one while
+               * loading. */
+};
 
 struct cache_elem {
-    char* key;
+    char* key; /* Null-terminated key, right after the struct. */
     char* val;
     int val_len; /* Byte size of val. */
     time_t creation_time; /* Creation time in seconds. */
     time_t max_age; /* Time-to-live in seconds. */
+    time_t stale_age; /* Seconds the element is kept once stale, so it can be
+                       * revalidated; it expires then. */
     struct cache_elem* next;
     struct cache_elem* prev;
+    unsigned hash; /* Hash of key. */
+    size_t bytes; /* Bytes charged for the element. */
+    int refs; /* Number of references, including the one of the cache. */
+    int head_len; /* Byte size of the response head up to the end of its last
+                   * field, where an Age field goes; the empty line and body
+                   * follow. -1 if val has no complete head. */
+    int heap_pos; /* Index in the expiry heap; -1 if not cached. */
+    int queue; /* Queue that the element is in; -1 if not cached. */
+    int freq; /* Hits in S3-FIFO, up to FREQ_MAX. */
+    struct cache_snapshot* snapshot; /* Snapshot that val is mapped from; NULL
+                                      * if val is allocated. */
+    uint64_t checksum; /* Checksum of val in the snapshot. */
+    int verified; /* Whether val is known to match its checksum. */
 };
 typedef struct cache_elem cache_elem;
 
+/* Response filled into the cache as it arrives. */
+struct cache_fill {
+    char* key;
+    char** chunks; /* Chunks of FILL_CHUNK_BYTES, each used up before the
+                    * next one; NULL if full. */
+    int num_chunks;
+    int chunks_cap; /* Capacity of chunks. */
+    size_t len; /* Byte size of the value appended so far. */
+    int is_full; /* Whether the value exceeds the per-object cap, so its bytes
+                  * are dropped. */
+};
+
+/* Slot of the hash index. */
+struct cache_slot {
+    unsigned hash; /* Hash of the key of elem. */
+    struct cache_elem* elem; /* NULL if the slot is empty. */
+};
+typedef struct cache_slot cache_slot;
+
+/**
+ * @brief Get the bytes charged for an element with the given key and value.
+ *
+ * @param key_len Length of the key, excluding the null terminator.
+ * @param val_len Byte size of the value.
+ * @return size_t Bytes charged.
+ */
+size_t cache_elem_bytes(size_t key_len, size_t val_len)
+{
+    /* The hash index has at least two slots per element. */
+    return slab_alloc_bytes(sizeof(cache_elem) + key_len + 1) +
+           slab_alloc_bytes(val_len) +
+           2 * sizeof(cache_slot);
+}
+
+/**
+ * @brief Hash a key with FNV-1a.
+ *
+ * @param key Key, non-null.
+ * @return unsigned Hash of the key.
+ */
+unsigned cache_hash(const char* key)
+{
+    unsigned h = 2166136261u;
+
+    for (; *key != '\0'; ++key) {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Split the head and body of the value of an element once, so hits
+ * don't parse the response. The body may contain anything, including null
+ * bytes.
+ *
+ * @param elem Cache element, non-null.
+ */
+static void cache_elem_split(cache_elem* elem)
+{
+    const char* end = NULL;
+
+    elem->head_len = -1;
+    if (elem->val != NULL) {
+        end = memmem(elem->val,
+                     elem->val_len,
+                     "\r\n\r\n",
+                     strlen("\r\n\r\n"));
+        if (end != NULL) {
+            elem->head_len = end + strlen("\r\n") - elem->val;
+        }
+    }
+}
+
 /**
  * @brief Create a new cache element.
  *
@@ -42,23 +229,34 @@ cache_elem* cache_elem_new(const char* key,
                            const time_t max_age)
 {
     time_t now = time(NULL);
+    size_t key_bytes = key != NULL ? strlen(key) + 1 : 0;
 
-    cache_elem* elem = (cache_elem*)malloc(sizeof(cache_elem));
+    /* The key shares a chunk with the struct. */
+    cache_elem* elem = slab_alloc(sizeof(cache_elem) + key_bytes);
     if (elem == NULL) {
-        PLOG_ERROR("malloc");
         return NULL;
     }
     if (key != NULL) {
-        elem->key = strdup(key);
+        elem->key = (char*)(elem + 1);
+        memcpy(elem->key, key, key_bytes);
+        elem->hash = cache_hash(key);
     }
     else {
         elem->key = NULL;
+        elem->hash = 0;
     }
+    elem->bytes = 0;
+    elem->refs = 1;
+    elem->heap_pos = -1;
+    elem->queue = -1;
+    elem->freq = 0;
+    elem->snapshot = NULL;
+    elem->checksum = 0;
+    elem->verified = 1;
     if (val != NULL) {
-        elem->val = NULL;
-        elem->val = malloc(val_len);
+        elem->val = slab_alloc(val_len);
         if (elem->val == NULL) {
-            PLOG_ERROR("fail to malloc elem->val");
+            slab_free(elem, sizeof(cache_elem) + key_bytes);
             return NULL;
         }
         memcpy(elem->val, val, val_len);
@@ -70,11 +268,33 @@ cache_elem* cache_elem_new(const char* key,
     }
     elem->creation_time = now;
     elem->max_age = max_age;
+    elem->stale_age = 0;
     elem->prev = NULL;
     elem->next = NULL;
+    if (key != NULL) {
+        elem->bytes = cache_elem_bytes(strlen(key), elem->val_len);
+    }
+    cache_elem_split(elem);
     return elem;
 }
 
+/**
+ * @brief Drop a reference of the given snapshot, and unmap it once no
+ * reference is left.
+ *
+ * @param snapshot Snapshot to release, non-null.
+ */
+static void cache_snapshot_unref(struct cache_snapshot** snapshot)
+{
+    if (--(*snapshot)->refs > 0) {
+        *snapshot = NULL;
+        return;
+    }
+    munmap((*snapshot)->data, (*snapshot)->len);
+    free(*snapshot);
+    *snapshot = NULL;
+}
+
 /**
  * @brief Free the give cache element.
  *
@@ -85,12 +305,36 @@ void cache_elem_free(cache_elem** elem)
     if (elem == NULL || *elem == NULL) {
         return;
     }
-    free((*elem)->key);
-    free((*elem)->val);
-    free(*elem);
+    if ((*elem)->snapshot != NULL) {
+        cache_snapshot_unref(&(*elem)->snapshot);
+    }
+    else {
+        slab_free((*elem)->val, (*elem)->val_len);
+    }
+    slab_free(*elem,
+              sizeof(cache_elem) +
+              ((*elem)->key != NULL ? strlen((*elem)->key) + 1 : 0));
     *elem = NULL;
 }
 
+/**
+ * @brief Drop a reference of the given cache element, and free it once no
+ * reference is left.
+ *
+ * @param elem Element to release.
+ */
+void cache_elem_unref(cache_elem** elem)
+{
+    if (elem == NULL || *elem == NULL) {
+        return;
+    }
+    if (--(*elem)->refs > 0) {
+        *elem = NULL;
+        return;
+    }
+    cache_elem_free(elem);
+}
+
 /**
  * @brief Get age of the given cache element in seconds.
  * 
@@ -113,328 +357,1475 @@ int cache_elem_is_stale(cache_elem* elem)
     return cache_elem_age(elem) >= elem->max_age;
 }
 
-struct cache {
-    int size;
-    int capacity;
-    /* Doubly linked list of cache elements. */
+/**
+ * @brief Extend an FNV-1a 64-bit checksum with the given bytes.
+ *
+ * @param sum Checksum so far; CHECKSUM_SEED to start.
+ * @param data Bytes to add.
+ * @param len Byte size of data.
+ * @return uint64_t Checksum including data.
+ */
+static uint64_t cache_checksum(uint64_t sum, const void* data, size_t len)
+{
+    const unsigned char* p = data;
+
+    for (size_t i = 0; i < len; ++i) {
+        sum ^= p[i];
+        sum *= 1099511628211ULL;
+    }
+    return sum;
+}
+
+/**
+ * @brief Check that the value of the given element is intact. A value loaded
+ * from a snapshot is checksummed on first use, so loading doesn't read it.
+ *
+ * @param elem Cache element.
+ * @return int 1 if intact; 0 if the value doesn't match its checksum.
+ */
+int cache_elem_verify(cache_elem* elem)
+{
+    if (!elem->verified &&
+        cache_checksum(CHECKSUM_SEED, elem->val, elem->val_len) ==
+        elem->checksum) {
+        elem->verified = 1;
+    }
+    return elem->verified;
+}
+
+/* Queues of cache elements. The policy decides which are used. */
+enum cache_queue_id {
+    CACHE_MAIN, /* LRU list; S3-FIFO main queue; W-TinyLFU protected queue. */
+    CACHE_SMALL, /* S3-FIFO small queue; W-TinyLFU window. */
+    CACHE_PROBATION, /* W-TinyLFU probation queue. */
+    CACHE_NUM_QUEUES
+};
+
+/* Doubly linked queue of cache elements, from the most recently inserted at
+ * the front to the next to evict at the back. */
+struct cache_queue {
+    /* Dummy nodes at front and back. Then, the doubly linked list won't be
+     * empty. It facilities insertions and removals. */
     struct cache_elem* front;
     struct cache_elem* back;
+    int size; /* Number of elements. */
+    size_t bytes; /* Bytes charged for the elements. */
+};
+typedef struct cache_queue cache_queue;
+
+struct cache {
+    int size; /* Number of elements. */
+    size_t bytes; /* Bytes charged for all the elements. */
+    size_t peak_bytes; /* Max bytes ever charged. */
+    size_t max_bytes; /* Memory budget. */
+    size_t max_object_bytes; /* Max bytes charged for one element. */
+    enum cache_policy policy;
+    struct cache_queue queues[CACHE_NUM_QUEUES];
+    /* Hash index of cache elements. */
+    struct cache_slot* slots;
+    int num_slots; /* Power of 2, at least twice the size. */
+    /* Min-heap of cache elements by expiry time. */
+    struct cache_elem** heap;
+    int heap_cap; /* Capacity of heap, at least the size. */
+    /* S3-FIFO ghost queue: ring of key hashes evicted from the small queue,
+     * and a table of them to look up. A hash whose bucket is taken by a
+     * newer one is forgotten early. */
+    unsigned* ghost;
+    int ghost_cap; /* Capacity of ghost, a power of 2. */
+    int ghost_start; /* Index of the oldest hash in ghost. */
+    int ghost_size; /* Number of hashes in ghost. */
+    unsigned* ghost_table; /* GHOST_BUCKETS * ghost_cap buckets; 0 if
+                            * empty. */
+    /* W-TinyLFU count-min sketch of lookup frequencies. */
+    unsigned char* sketch; /* SKETCH_ROWS rows of sketch_width counters. */
+    int sketch_width; /* Power of 2. */
+    int sketch_adds; /* Increments since the counters were halved. */
 };
 typedef struct cache cache;
 
 cache* the_cache = NULL; /* Global singleton cache. */
 
 /**
- * @brief Initialize an empty cache of the given capacity.
+ * @brief Find the slot of the given key in the hash index.
  *
- * @param capacity Max size of the cache, > 0.
- * @return 0 on success; -1 otherwise.
+ * @param key Key, non-null.
+ * @param hash Hash of key.
+ * @return int Index of the slot holding the key if found; otherwise, index of
+ * the empty slot where the key would be inserted.
  */
-int cache_init(int capacity)
+int cache_find_slot(const char* key, unsigned hash)
 {
-    cache_elem* dummy_front;
-    cache_elem* dummy_back;
+    unsigned mask = the_cache->num_slots - 1;
+    unsigned i = hash & mask;
+    cache_slot* slot;
 
-    if (capacity <= 0 || the_cache != NULL) {
-        /* Invalid capacity or the cache has already been initialized. */
-        return -1;
+    while (true) {
+        slot = &the_cache->slots[i];
+        if (slot->elem == NULL ||
+            (slot->hash == hash && strcmp(slot->elem->key, key) == 0)) {
+            return i;
+        }
+        i = (i + 1) & mask;
     }
+}
 
-    the_cache = (cache*)malloc(sizeof(cache));
-    if (the_cache == NULL) {
-        PLOG_ERROR("malloc");
-        return -1;
-    }
-    the_cache->capacity = capacity;
-    the_cache->size = 0;
+/**
+ * @brief Resize the hash index to the given number of slots.
+ *
+ * @param num_slots Number of slots, a power of 2 larger than the size.
+ * @return int 0 on success; -1 otherwise.
+ */
+int cache_resize_index(int num_slots)
+{
+    cache_slot* old_slots = the_cache->slots;
+    int old_num_slots = the_cache->num_slots;
+    int i;
 
-    /* Create dummy nodes at front and back. Then, the doubly linked list won't
-     * be empty. It facilities insertions and removals. */
-    dummy_front = cache_elem_new(NULL, NULL, 0, 0);
-    if (dummy_front == NULL) {
-        PLOG_ERROR("malloc");
-        free(the_cache);
-        the_cache = NULL;
+    the_cache->slots = slab_alloc(num_slots * sizeof(cache_slot));
+    if (the_cache->slots == NULL) {
+        the_cache->slots = old_slots;
         return -1;
     }
-    dummy_back = cache_elem_new(NULL, NULL, 0, 0);
-    if (dummy_back == NULL) {
-        PLOG_ERROR("malloc");
-        free(dummy_front);
-        free(the_cache);
-        the_cache = NULL;
-        return -1;
+    memset(the_cache->slots, 0, num_slots * sizeof(cache_slot));
+    the_cache->num_slots = num_slots;
+    for (int j = 0; j < old_num_slots; ++j) {
+        if (old_slots[j].elem != NULL) {
+            i = cache_find_slot(old_slots[j].elem->key, old_slots[j].hash);
+            the_cache->slots[i] = old_slots[j];
+        }
     }
-    dummy_front->prev = NULL;
-    dummy_front->next = dummy_back;
-    dummy_back->next = NULL;
-    dummy_back->prev = dummy_front;
-    the_cache->front = dummy_front;
-    the_cache->back = dummy_back;
+    slab_free(old_slots, old_num_slots * sizeof(cache_slot));
     return 0;
 }
 
 /**
- * Free the cache.
+ * @brief Add an element to the hash index. Its key should not be indexed yet.
+ *
+ * @param elem Element to add, non-null.
+ * @return int 0 on success; -1 otherwise.
  */
-void cache_clear(void)
+int cache_index_add(cache_elem* elem)
 {
-    cache_elem* curr;
-    cache_elem* next;
+    int i;
 
-    if (the_cache == NULL) {
-        return;
+    /* Keep the load factor at most 1/2. */
+    if ((the_cache->size + 1) * 2 > the_cache->num_slots &&
+        cache_resize_index(the_cache->num_slots * 2) < 0) {
+        return -1;
     }
+    i = cache_find_slot(elem->key, elem->hash);
+    the_cache->slots[i].hash = elem->hash;
+    the_cache->slots[i].elem = elem;
+    return 0;
+}
+
+/**
+ * @brief Remove an element from the hash index. Later elements of the probe
+ * sequence are shifted back, so no tombstone is needed.
+ *
+ * @param elem Indexed element, non-null.
+ */
+void cache_index_remove(cache_elem* elem)
+{
+    unsigned mask = the_cache->num_slots - 1;
+    unsigned i = cache_find_slot(elem->key, elem->hash);
+    unsigned j = i;
+    unsigned home;
 
-    curr = the_cache->front;
-    while (curr != NULL) {
-        next = curr->next;
-        cache_elem_free(&curr);
-        curr = next;
+    while (true) {
+        j = (j + 1) & mask;
+        if (the_cache->slots[j].elem == NULL) {
+            break;
+        }
+        /* Move the element at j to the hole at i, unless its home slot lies
+         * cyclically in (i, j]. */
+        home = the_cache->slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            the_cache->slots[i] = the_cache->slots[j];
+            i = j;
+        }
     }
-    free(the_cache);
-    the_cache = NULL;
+    the_cache->slots[i].elem = NULL;
+    the_cache->slots[i].hash = 0;
 }
 
 /**
- * Get the element by the given key from cache, no matter it is valid or not.
+ * @brief Get the time when the given element expires, i.e. its stale age
+ * after it goes stale.
  *
- * @param key Key of the element to get, non-null.
- * @return A pointer to the element of the given key if found; otherwise, NULL.
+ * @param elem Cache element, non-null.
+ * @return time_t Expiry time in seconds since the Epoch.
  */
-cache_elem* cache_force_get_elem(const char* key)
+time_t cache_elem_expire(const cache_elem* elem)
 {
-    cache_elem* elem;
+    return elem->creation_time + elem->max_age + elem->stale_age;
+}
 
-    /* Invalid args. */
-    if (the_cache == NULL || key == NULL) {
-        return NULL;
-    }
+/**
+ * @brief Put an element at the given position of the expiry heap.
+ */
+static void cache_heap_set(int pos, cache_elem* elem)
+{
+    the_cache->heap[pos] = elem;
+    elem->heap_pos = pos;
+}
+
+/**
+ * @brief Move the element at the given position of the expiry heap toward the
+ * root until its parent expires no later.
+ */
+static void cache_heap_up(int pos)
+{
+    cache_elem* elem = the_cache->heap[pos];
+    int parent;
 
-    elem = the_cache->front->next;
-    while (elem != the_cache->back) {
-        if (strcmp(elem->key, key) == 0) {
-            return elem;
+    while (pos > 0) {
+        parent = (pos - 1) / 2;
+        if (cache_elem_expire(the_cache->heap[parent]) <=
+            cache_elem_expire(elem)) {
+            break;
         }
-        elem = elem->next;
+        cache_heap_set(pos, the_cache->heap[parent]);
+        pos = parent;
     }
-    return NULL;
+    cache_heap_set(pos, elem);
 }
 
 /**
- * Update the element of the given key.
- *
- * @param key Key of the element to be updated, non-null.
- * @param val Value of the element to be updated, non-null.
- * @param val_len Byte size of val.
- * @param max_age Time-to-live of the element in seconds, >= 0.
- * @return Number of elements updated in cache.
+ * @brief Move the element at the given position of the expiry heap toward the
+ * leaves until its children expire no earlier.
  */
-int cache_update(const char* key,
-                 const char* val,
-                 const int val_len,
-                 const int max_age)
+static void cache_heap_down(int pos)
 {
-    cache_elem* elem;
+    cache_elem* elem = the_cache->heap[pos];
+    int size = the_cache->size;
+    int child;
 
-    /* Validate args. */
-    if (the_cache == NULL || key == NULL || val == NULL || val_len < 0) {
-        return 0;
+    while ((child = pos * 2 + 1) < size) {
+        if (child + 1 < size &&
+            cache_elem_expire(the_cache->heap[child + 1]) <
+            cache_elem_expire(the_cache->heap[child])) {
+            ++child;
+        }
+        if (cache_elem_expire(elem) <=
+            cache_elem_expire(the_cache->heap[child])) {
+            break;
+        }
+        cache_heap_set(pos, the_cache->heap[child]);
+        pos = child;
     }
+    cache_heap_set(pos, elem);
+}
 
-    elem = cache_force_get_elem(key);
-    if (elem == NULL) {
-        return 0;
+/**
+ * @brief Resize the expiry heap to the given capacity.
+ *
+ * @param cap Capacity, no less than the size.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int cache_resize_heap(int cap)
+{
+    cache_elem** heap = slab_alloc(cap * sizeof(cache_elem*));
+
+    if (heap == NULL) {
+        return -1;
     }
-    /* Update element contents. */
-    free(elem->val);
-    elem->val = NULL;
-    elem->val = malloc(val_len);
-    if (elem->val == NULL) {
-        PLOG_ERROR("malloc");
-        return 0;
+    if (the_cache->size > 0) {
+        memcpy(heap, the_cache->heap, the_cache->size * sizeof(cache_elem*));
     }
-    memcpy(elem->val, val, val_len);
-    elem->val_len = val_len;
-    elem->creation_time = time(NULL);
-    elem->max_age = max_age;
-    /* Move the updated element to the front. */
-    /* Detach the update element. */
-    elem->prev->next = elem->next;
-    elem->next->prev = elem->prev;
-    /* Insert the updated element at the front. */
-    elem->next = the_cache->front->next;
-    the_cache->front->next->prev = elem;
-    elem->prev = the_cache->front;
-    the_cache->front->next = elem;
-    return 1;
+    slab_free(the_cache->heap, the_cache->heap_cap * sizeof(cache_elem*));
+    the_cache->heap = heap;
+    the_cache->heap_cap = cap;
+    return 0;
 }
 
 /**
- * Remove the given element from cache, regardless of whether element is valid
- * and in cache.
+ * @brief Add an element to the expiry heap. The size of the cache shouldn't
+ * count the element yet.
  *
- * @param elem Element to remove, non-null.
- * @return Number of removed elements.
+ * @param elem Element to add, non-null.
+ * @return int 0 on success; -1 otherwise.
  */
-int cache_force_remove_elem(cache_elem** elem)
+int cache_heap_add(cache_elem* elem)
 {
-    /* Validate args. */
-    if (the_cache == NULL || elem == NULL || *elem == NULL) {
-        return 0;
+    if (the_cache->size == the_cache->heap_cap &&
+        cache_resize_heap(the_cache->heap_cap * 2) < 0) {
+        return -1;
     }
-
-    (*elem)->prev->next = (*elem)->next;
-    (*elem)->next->prev = (*elem)->prev;
-    cache_elem_free(elem);
-    (the_cache->size)--;
-    return 1;
+    cache_heap_set(the_cache->size, elem);
+    cache_heap_up(the_cache->size);
+    return 0;
 }
 
 /**
- * Remove and free all the stale elements in cache.
- * @return Number of removed elements.
+ * @brief Remove an element from the expiry heap. The size of the cache should
+ * still count the element.
+ *
+ * @param elem Element in the heap, non-null.
  */
-int cache_remove_all_stale(void)
+void cache_heap_remove(cache_elem* elem)
 {
-    int count = 0;
-    cache_elem* curr;
-    cache_elem* next;
+    int pos = elem->heap_pos;
+    int last = the_cache->size - 1;
 
-    if (the_cache == NULL) {
-        return 0;
+    elem->heap_pos = -1;
+    if (pos == last) {
+        return;
     }
-
-    curr = the_cache->front->next;
-    while (curr != the_cache->back) {
-        next = curr->next;
-        if (cache_elem_is_stale(curr)) {
-            cache_force_remove_elem(&curr);
-            count++;
-        }
-        curr = next;
+    /* Fill the hole with the last element, then restore the heap order. */
+    cache_heap_set(pos, the_cache->heap[last]);
+    if (pos > 0 &&
+        cache_elem_expire(the_cache->heap[pos]) <
+        cache_elem_expire(the_cache->heap[(pos - 1) / 2])) {
+        cache_heap_up(pos);
+    }
+    else {
+        cache_heap_down(pos);
     }
-    return count;
 }
 
 /**
- * Remove and free the last element in cache.
+ * @brief Link an element at the front of the given queue.
  *
- * @return Number of elements removed.
+ * @param queue Queue to link to.
+ * @param elem Element that is in no queue, non-null.
  */
-int cache_pop_back(void)
+static void cache_queue_push_front(int queue, cache_elem* elem)
 {
-    cache_elem* last;
-
-    /* Invalid args. */
-    if (the_cache == NULL || the_cache->size <= 0) {
-        return 0;
-    }
+    cache_queue* q = &the_cache->queues[queue];
 
-    last = the_cache->back->prev;
-    last->prev->next = last->next;
-    last->next->prev = last->prev;
-    cache_elem_free(&last);
-    (the_cache->size)--;
-    return 1;
+    elem->next = q->front->next;
+    q->front->next->prev = elem;
+    elem->prev = q->front;
+    q->front->next = elem;
+    elem->queue = queue;
+    ++q->size;
+    q->bytes += elem->bytes;
 }
 
 /**
- * Add element at the front of cache, regardless of capacity.
+ * @brief Unlink an element from its queue.
  *
- * @param elem Element to remove, non-null.
- * @return Number of elements added.
+ * @param elem Element in a queue, non-null.
  */
-int cache_force_push_front(cache_elem* elem)
+static void cache_queue_unlink(cache_elem* elem)
 {
-    /* Validate args. */
-    if (the_cache == NULL || elem == NULL) {
-        return 0;
-    }
+    cache_queue* q = &the_cache->queues[elem->queue];
 
-    elem->next = the_cache->front->next;
-    the_cache->front->next->prev = elem;
-    elem->prev = the_cache->front;
-    the_cache->front->next = elem;
-    (the_cache->size)++;
-    return 1;
+    elem->prev->next = elem->next;
+    elem->next->prev = elem->prev;
+    elem->queue = -1;
+    --q->size;
+    q->bytes -= elem->bytes;
 }
 
 /**
- * Put the given element (key, val, ttl) into cache.
+ * @brief Move an element to the front of the given queue.
  *
- * @param key Key of the element to be put, non-null.
- * @param val Value of the element to be put, non-null.
- * @param val_len Byte size of val.
- * @param max_age Time-to-live of the element in seconds, >= 0.
- * @return Number of elements put into cache.
+ * @param queue Queue to move to.
+ * @param elem Element in a queue, non-null.
  */
-int cache_put(const char* key,
-              const char* val,
-              const int val_len,
-              const int max_age)
+static void cache_queue_move_front(int queue, cache_elem* elem)
 {
-    cache_elem* elem = NULL;
+    cache_queue_unlink(elem);
+    cache_queue_push_front(queue, elem);
+}
 
-    /* Invalid args. */
-    if (the_cache == NULL || key == NULL || val == NULL || val_len < 0) {
-        return 0;
-    }
+/**
+ * @brief Get the element at the back of the given queue.
+ *
+ * @param queue Queue.
+ * @return cache_elem* Element to evict first; NULL if the queue is empty.
+ */
+static cache_elem* cache_queue_back(int queue)
+{
+    cache_queue* q = &the_cache->queues[queue];
 
-    /* If KEY is found in CACHE, update the element. */
-    if (cache_update(key, val, val_len, max_age) > 0) {
-        return 1;
-    }
+    return q->size > 0 ? q->back->prev : NULL;
+}
 
-    elem = cache_elem_new(key, val, val_len, max_age);
-    /* If CACHE is full, remove stale elements first. */
-    if (the_cache->size == the_cache->capacity &&
-        cache_remove_all_stale() == 0) {
-        /* If no stale element, remove the least recently used element. */
-        cache_pop_back();
-    }
-    /* Add the new element to the front. */
-    cache_force_push_front(elem);
-    return 1;
+/**
+ * @brief Get the ghost bucket of the given hash.
+ */
+static unsigned* cache_ghost_bucket(unsigned hash)
+{
+    return &the_cache->ghost_table[hash &
+                                   (the_cache->ghost_cap * GHOST_BUCKETS - 1)];
 }
 
 /**
- * Get value of key from cache.
+ * @brief Resize the ghost queue, keeping its hashes in order.
  *
- * If the key is found, *out_val will be set to a copy of the value.
- * If the key is not found, *out_val will remain.
- * @param key Key of the element to get, non-null.
- * @param out_val Pointer to returned value, non-null.
- * *out_val won't be freed in this function.
- * Caller is responsible to free *out_val after using.
- * @param out_val_len Output; byte size of *out_val.
- * @param out_age Output; age of this element in seconds.
- * @return Number of valid elements we get.
+ * @param cap New capacity, a power of 2 no less than the ghost size.
+ * @return int 0 on success; -1 otherwise.
  */
-int cache_get(const char* key,
-              char** out_val,
-              int* out_val_len,
-              int* out_age)
+int cache_ghost_resize(int cap)
 {
-    cache_elem* elem = NULL;
-
-    /* Validate args. */
-    if (the_cache == NULL ||
-        key == NULL ||
-        out_val == NULL ||
-        out_val_len == NULL ||
-        out_age == NULL) {
+    unsigned* ghost = malloc(cap * sizeof(unsigned));
+    unsigned* table = calloc((size_t)cap * GHOST_BUCKETS, sizeof(unsigned));
+    int old_mask = the_cache->ghost_cap - 1;
 
+    if (ghost == NULL || table == NULL) {
+        PLOG_ERROR("malloc");
+        free(ghost);
+        free(table);
+        return -1;
+    }
+    for (int i = 0; i < the_cache->ghost_size; ++i) {
+        ghost[i] = the_cache->ghost[(the_cache->ghost_start + i) & old_mask];
+    }
+    free(the_cache->ghost);
+    free(the_cache->ghost_table);
+    the_cache->ghost = ghost;
+    the_cache->ghost_table = table;
+    the_cache->ghost_cap = cap;
+    the_cache->ghost_start = 0;
+    for (int i = 0; i < the_cache->ghost_size; ++i) {
+        *cache_ghost_bucket(ghost[i]) = ghost[i] | 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Remember the hash of a key evicted from the S3-FIFO small queue. The
+ * ghost queue grows up to the number of cached elements, then forgets the
+ * oldest hash.
+ *
+ * @param hash Hash of the evicted key.
+ */
+void cache_ghost_add(unsigned hash)
+{
+    unsigned* bucket;
+    unsigned oldest;
+    int mask;
+
+    if (the_cache->ghost_size == the_cache->ghost_cap &&
+        (the_cache->ghost_cap >= the_cache->size ||
+         cache_ghost_resize(the_cache->ghost_cap * 2) < 0)) {
+        mask = the_cache->ghost_cap - 1;
+        oldest = the_cache->ghost[the_cache->ghost_start];
+        bucket = cache_ghost_bucket(oldest);
+        if (*bucket == (oldest | 1)) {
+            *bucket = 0;
+        }
+        the_cache->ghost_start = (the_cache->ghost_start + 1) & mask;
+        --the_cache->ghost_size;
+    }
+    mask = the_cache->ghost_cap - 1;
+    the_cache->ghost[(the_cache->ghost_start + the_cache->ghost_size) & mask] =
+        hash;
+    ++the_cache->ghost_size;
+    /* The low bit is set, so no hash is mistaken for an empty bucket. */
+    *cache_ghost_bucket(hash) = hash | 1;
+}
+
+/**
+ * @brief Check whether a key was recently evicted from the S3-FIFO small
+ * queue.
+ *
+ * @param hash Hash of the key.
+ * @return int 1 if the hash is in the ghost queue; 0 otherwise.
+ */
+int cache_ghost_contains(unsigned hash)
+{
+    return *cache_ghost_bucket(hash) == (hash | 1);
+}
+
+/**
+ * @brief Get the counter of a hash in the given row of the sketch.
+ */
+static unsigned char* cache_sketch_counter(int row, unsigned hash)
+{
+    /* Odd multipliers spread the rows apart. */
+    static const unsigned seeds[SKETCH_ROWS] = {
+        0x9e3779b1u, 0x85ebca77u, 0xc2b2ae3du, 0x27d4eb2fu};
+    unsigned h = hash * seeds[row];
+
+    h ^= h >> 16;
+    return &the_cache->sketch[row * the_cache->sketch_width +
+                              (h & (the_cache->sketch_width - 1))];
+}
+
+/**
+ * @brief Record a lookup of the given key hash in the count-min sketch. The
+ * sketch widens with the number of elements, and all counters are halved
+ * periodically, so old popularity fades.
+ *
+ * @param hash Hash of the key looked up.
+ */
+void cache_sketch_add(unsigned hash)
+{
+    unsigned char* counter;
+    unsigned char* sketch;
+    int width;
+
+    if (the_cache->size > the_cache->sketch_width) {
+        /* Counters can't be rehashed; start over with a wider sketch. */
+        width = the_cache->sketch_width * 2;
+        sketch = calloc((size_t)width * SKETCH_ROWS, 1);
+        if (sketch != NULL) {
+            free(the_cache->sketch);
+            the_cache->sketch = sketch;
+            the_cache->sketch_width = width;
+            the_cache->sketch_adds = 0;
+        }
+    }
+    for (int row = 0; row < SKETCH_ROWS; ++row) {
+        counter = cache_sketch_counter(row, hash);
+        if (*counter < SKETCH_MAX) {
+            ++*counter;
+        }
+    }
+    if (++the_cache->sketch_adds >= SKETCH_SAMPLES * the_cache->sketch_width) {
+        for (int i = 0; i < SKETCH_ROWS * the_cache->sketch_width; ++i) {
+            the_cache->sketch[i] >>= 1;
+        }
+        the_cache->sketch_adds /= 2;
+    }
+}
+
+/**
+ * @brief Estimate how often the given key hash has been looked up recently.
+ *
+ * @param hash Hash of the key.
+ * @return int Min counter of the hash over the rows of the sketch.
+ */
+int cache_sketch_frequency(unsigned hash)
+{
+    int freq = SKETCH_MAX;
+    int counter;
+
+    for (int row = 0; row < SKETCH_ROWS; ++row) {
+        counter = *cache_sketch_counter(row, hash);
+        if (counter < freq) {
+            freq = counter;
+        }
+    }
+    return freq;
+}
+
+int cache_force_remove_elem(cache_elem** elem);
+
+/**
+ * @brief Evict an element, spilling it to the disk tier if it's enabled and
+ * the element is still unexpired and intact. A stale element kept for
+ * revalidation spills with the rest of its stale age.
+ *
+ * @param elem Element to evict, non-null.
+ * @return int Number of removed elements.
+ */
+static int cache_evict_elem(cache_elem** elem)
+{
+    if (disk_cache_enabled() &&
+        cache_elem_expire(*elem) > time(NULL) &&
+        cache_elem_verify(*elem)) {
+        disk_cache_put((*elem)->key,
+                       (*elem)->val,
+                       (*elem)->val_len,
+                       (*elem)->creation_time,
+                       (*elem)->max_age,
+                       (*elem)->stale_age);
+    }
+    return cache_force_remove_elem(elem);
+}
+
+/**
+ * @brief Evict the element at the back of the given queue.
+ *
+ * @param queue Non-empty queue.
+ * @return int Number of removed elements.
+ */
+static int cache_queue_pop_back(int queue)
+{
+    cache_elem* last = cache_queue_back(queue);
+
+    return cache_evict_elem(&last);
+}
+
+/* LRU: hits move to the front, and the back is evicted. */
+
+static void lru_insert(cache_elem* elem)
+{
+    cache_queue_push_front(CACHE_MAIN, elem);
+}
+
+static void lru_hit(cache_elem* elem)
+{
+    cache_queue_move_front(CACHE_MAIN, elem);
+}
+
+static int lru_evict(size_t needed)
+{
+    (void)needed;
+    if (the_cache->queues[CACHE_MAIN].size == 0) {
+        return 0;
+    }
+    return cache_queue_pop_back(CACHE_MAIN);
+}
+
+/* S3-FIFO: new keys enter the small queue, and keys remembered by the ghost
+ * queue enter the main queue. Hits only bump a small counter. Only elements
+ * evicted from the main queue spill to disk. */
+
+static void s3fifo_insert(cache_elem* elem)
+{
+    elem->freq = 0;
+    if (cache_ghost_contains(elem->hash)) {
+        cache_queue_push_front(CACHE_MAIN, elem);
+    }
+    else {
+        cache_queue_push_front(CACHE_SMALL, elem);
+    }
+}
+
+static void s3fifo_hit(cache_elem* elem)
+{
+    if (elem->freq < FREQ_MAX) {
+        ++elem->freq;
+    }
+}
+
+static int s3fifo_evict(size_t needed)
+{
+    cache_queue* small = &the_cache->queues[CACHE_SMALL];
+    cache_queue* main_queue = &the_cache->queues[CACHE_MAIN];
+    size_t small_cap = the_cache->max_bytes / 100 * S3FIFO_SMALL_PERCENT;
+    cache_elem* elem;
+
+    (void)needed;
+    while (true) {
+        if (small->size > 0 &&
+            (small->bytes > small_cap || main_queue->size == 0)) {
+            /* Elements hit in the small queue move to the main queue; the
+             * others are evicted and remembered as ghosts. */
+            elem = cache_queue_back(CACHE_SMALL);
+            if (elem->freq > 0) {
+                elem->freq = 0;
+                cache_queue_move_front(CACHE_MAIN, elem);
+                continue;
+            }
+            cache_ghost_add(elem->hash);
+            return cache_force_remove_elem(&elem);
+        }
+        elem = cache_queue_back(CACHE_MAIN);
+        if (elem == NULL) {
+            return 0;
+        }
+        /* Elements hit in the main queue are reinserted, one hit fewer. */
+        if (elem->freq > 0) {
+            --elem->freq;
+            cache_queue_move_front(CACHE_MAIN, elem);
+            continue;
+        }
+        return cache_evict_elem(&elem);
+    }
+}
+
+/* W-TinyLFU: new keys enter the LRU window. Keys pushed out of the window by
+ * new ones enter the probation queue if they fit, or if the sketch says they
+ * are looked up more often than the probation element they would evict.
+ * Probation hits move to the protected queue. Rejected keys don't spill to
+ * disk. */
+
+static void tinylfu_insert(cache_elem* elem)
+{
+    cache_queue_push_front(CACHE_SMALL, elem);
+}
+
+static void tinylfu_hit(cache_elem* elem)
+{
+    size_t main_cap = the_cache->max_bytes -
+                      the_cache->max_bytes / 100 * TINYLFU_WINDOW_PERCENT;
+    size_t protected_cap = main_cap / 100 * TINYLFU_PROTECTED_PERCENT;
+    cache_queue* protected = &the_cache->queues[CACHE_MAIN];
+
+    if (elem->queue != CACHE_PROBATION) {
+        cache_queue_move_front(elem->queue, elem);
+        return;
+    }
+    cache_queue_move_front(CACHE_MAIN, elem);
+    /* Demote the least recently used protected elements back to probation. */
+    while (protected->bytes > protected_cap && protected->size > 1) {
+        cache_queue_move_front(CACHE_PROBATION, cache_queue_back(CACHE_MAIN));
+    }
+}
+
+static int tinylfu_evict(size_t needed)
+{
+    cache_queue* window = &the_cache->queues[CACHE_SMALL];
+    size_t window_cap = the_cache->max_bytes / 100 * TINYLFU_WINDOW_PERCENT;
+    size_t main_cap = the_cache->max_bytes - window_cap;
+    size_t main_bytes;
+    cache_elem* candidate;
+    cache_elem* victim;
+
+    while (true) {
+        main_bytes = the_cache->bytes - window->bytes;
+        victim = cache_queue_back(CACHE_PROBATION);
+        if (victim == NULL) {
+            victim = cache_queue_back(CACHE_MAIN);
+        }
+        if (window->size == 0 ||
+            (window->bytes + needed <= window_cap && victim != NULL)) {
+            break;
+        }
+        candidate = cache_queue_back(CACHE_SMALL);
+        if (main_bytes + candidate->bytes <= main_cap) {
+            cache_queue_move_front(CACHE_PROBATION, candidate);
+            continue;
+        }
+        /* Admit the candidate only if it's looked up more often. */
+        if (victim == NULL ||
+            cache_sketch_frequency(candidate->hash) <=
+            cache_sketch_frequency(victim->hash)) {
+            return cache_force_remove_elem(&candidate);
+        }
+        cache_queue_move_front(CACHE_PROBATION, candidate);
+        break;
+    }
+    return victim == NULL ? 0 : cache_evict_elem(&victim);
+}
+
+/* Eviction policy. */
+struct cache_policy_ops {
+    const char* name;
+    /* Link a new element into a queue. */
+    void (*insert)(cache_elem* elem);
+    /* Update a cached element on a hit. */
+    void (*hit)(cache_elem* elem);
+    /* Remove one element to make room for an element of the given bytes;
+     * return the number of removed elements. */
+    int (*evict)(size_t needed);
+};
+
+static const struct cache_policy_ops cache_policies[] = {
+    [CACHE_LRU] = {"lru", lru_insert, lru_hit, lru_evict},
+    [CACHE_S3FIFO] = {"s3fifo", s3fifo_insert, s3fifo_hit, s3fifo_evict},
+    [CACHE_TINYLFU] = {"tinylfu", tinylfu_insert, tinylfu_hit, tinylfu_evict},
+};
+
+/**
+ * @brief Get the eviction policy of the given name.
+ *
+ * @param name Name of the policy: lru, s3fifo or tinylfu.
+ * @return int The policy if the name is known; -1 otherwise.
+ */
+int cache_parse_policy(const char* name)
+{
+    for (int i = 0; i < CACHE_NUM_POLICIES; ++i) {
+        if (strcmp(name, cache_policies[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Get the name of the given eviction policy.
+ *
+ * @param policy Eviction policy.
+ * @return const char* Name of the policy.
+ */
+const char* cache_policy_name(enum cache_policy policy)
+{
+    return cache_policies[policy].name;
+}
+
+/**
+ * @brief Initialize an empty cache with the given memory budget.
+ *
+ * @param max_bytes Max bytes charged for all the elements, > 0.
+ * @param max_object_bytes Max bytes charged for one element, > 0. Larger
+ * responses are not cached.
+ * @param policy Eviction policy.
+ * @return 0 on success; -1 otherwise.
+ */
+int cache_init(size_t max_bytes,
+               size_t max_object_bytes,
+               enum cache_policy policy)
+{
+    cache_queue* q;
+
+    if (max_bytes == 0 ||
+        max_object_bytes == 0 ||
+        (unsigned)policy >= CACHE_NUM_POLICIES ||
+        the_cache != NULL) {
+        /* Invalid args or the cache has already been initialized. */
+        return -1;
+    }
+
+    the_cache = (cache*)calloc(1, sizeof(cache));
+    if (the_cache == NULL) {
+        PLOG_ERROR("calloc");
+        return -1;
+    }
+    the_cache->max_bytes = max_bytes;
+    the_cache->max_object_bytes = max_object_bytes;
+    the_cache->policy = policy;
+    /* The index, heap, ghost queue and sketch grow with the number of
+     * elements; the index and heap shrink back too. */
+    if (cache_resize_index(MIN_SLOTS) < 0 ||
+        cache_resize_heap(MIN_SLOTS) < 0) {
+        cache_clear();
+        return -1;
+    }
+    if (policy == CACHE_S3FIFO && cache_ghost_resize(MIN_SLOTS) < 0) {
+        cache_clear();
+        return -1;
+    }
+    if (policy == CACHE_TINYLFU) {
+        the_cache->sketch_width = SKETCH_MIN_WIDTH;
+        the_cache->sketch = calloc(SKETCH_MIN_WIDTH * SKETCH_ROWS, 1);
+        if (the_cache->sketch == NULL) {
+            PLOG_ERROR("calloc");
+            cache_clear();
+            return -1;
+        }
+    }
+
+    /* Create dummy nodes at front and back of each queue. */
+    for (int i = 0; i < CACHE_NUM_QUEUES; ++i) {
+        q = &the_cache->queues[i];
+        q->front = cache_elem_new(NULL, NULL, 0, 0);
+        q->back = cache_elem_new(NULL, NULL, 0, 0);
+        if (q->front == NULL || q->back == NULL) {
+            PLOG_ERROR("malloc");
+            cache_elem_free(&q->front);
+            cache_elem_free(&q->back);
+            cache_clear();
+            return -1;
+        }
+        q->front->prev = NULL;
+        q->front->next = q->back;
+        q->back->next = NULL;
+        q->back->prev = q->front;
+    }
+    return 0;
+}
+
+/**
+ * Free the cache.
+ */
+void cache_clear(void)
+{
+    cache_elem* curr;
+    cache_elem* next;
+
+    if (the_cache == NULL) {
+        return;
+    }
+
+    /* Pinned elements are freed once released. */
+    for (int i = 0; i < CACHE_NUM_QUEUES; ++i) {
+        curr = the_cache->queues[i].front;
+        while (curr != NULL) {
+            next = curr->next;
+            cache_elem_unref(&curr);
+            curr = next;
+        }
+    }
+    free(the_cache->sketch);
+    free(the_cache->ghost_table);
+    free(the_cache->ghost);
+    slab_free(the_cache->heap, the_cache->heap_cap * sizeof(cache_elem*));
+    slab_free(the_cache->slots, the_cache->num_slots * sizeof(cache_slot));
+    free(the_cache);
+    the_cache = NULL;
+}
+
+/**
+ * Get the element by the given key from cache, no matter it is valid or not.
+ *
+ * @param key Key of the element to get, non-null.
+ * @return A pointer to the element of the given key if found; otherwise, NULL.
+ */
+cache_elem* cache_force_get_elem(const char* key)
+{
+    /* Invalid args. */
+    if (the_cache == NULL || key == NULL) {
+        return NULL;
+    }
+
+    return the_cache->slots[cache_find_slot(key, cache_hash(key))].elem;
+}
+
+/**
+ * @brief Halve the hash index and expiry heap once they are mostly empty, so
+ * the memory of a past peak of small elements goes back to the budget of
+ * values. A failure to shrink is harmless.
+ */
+static void cache_shrink(void)
+{
+    if (the_cache->num_slots > MIN_SLOTS &&
+        the_cache->size * 8 < the_cache->num_slots) {
+        cache_resize_index(the_cache->num_slots / 2);
+    }
+    if (the_cache->heap_cap > MIN_SLOTS &&
+        the_cache->size * 4 < the_cache->heap_cap) {
+        cache_resize_heap(the_cache->heap_cap / 2);
+    }
+}
+
+/**
+ * Remove the given element from cache, regardless of whether element is valid
+ * and in cache.
+ *
+ * @param elem Element to remove, non-null.
+ * @return Number of removed elements.
+ */
+int cache_force_remove_elem(cache_elem** elem)
+{
+    /* Validate args. */
+    if (the_cache == NULL || elem == NULL || *elem == NULL) {
         return 0;
     }
 
-    elem = cache_force_get_elem(key);
+    cache_index_remove(*elem);
+    cache_heap_remove(*elem);
+    cache_queue_unlink(*elem);
+    the_cache->bytes -= (*elem)->bytes;
+    cache_elem_unref(elem);
+    (the_cache->size)--;
+    cache_shrink();
+    return 1;
+}
+
+/**
+ * Remove expired elements in order of expiry time, up to the given number.
+ *
+ * @param max_elems Max number of elements to remove.
+ * @param needed Stop once these bytes fit in the budget; 0 to ignore the
+ * budget.
+ * @return Number of removed elements.
+ */
+int cache_remove_expired(int max_elems, size_t needed)
+{
+    time_t now = time(NULL);
+    cache_elem* elem;
+    int n = 0;
+
+    while (n < max_elems && the_cache->size > 0) {
+        if (needed > 0 && the_cache->bytes + needed <= the_cache->max_bytes) {
+            break;
+        }
+        elem = the_cache->heap[0];
+        if (cache_elem_expire(elem) > now) {
+            break;
+        }
+        cache_force_remove_elem(&elem);
+        ++n;
+    }
+    return n;
+}
+
+/**
+ * Evict expired elements, then the ones chosen by the policy, until the given
+ * bytes fit in the budget.
+ *
+ * @param needed Bytes to make room for, > 0.
+ */
+void cache_make_room(size_t needed)
+{
+    cache_remove_expired(the_cache->size, needed);
+    while (the_cache->bytes + needed > the_cache->max_bytes &&
+           cache_policies[the_cache->policy].evict(needed) > 0) {
+    }
+}
+
+/**
+ * Add element to the queue chosen by the policy, regardless of the budget.
+ *
+ * @param elem Element to add, non-null.
+ * @return Number of elements added.
+ */
+int cache_force_add_elem(cache_elem* elem)
+{
+    /* Validate args. */
+    if (the_cache == NULL || elem == NULL) {
+        return 0;
+    }
+    if (cache_index_add(elem) < 0) {
+        return 0;
+    }
+    if (cache_heap_add(elem) < 0) {
+        cache_index_remove(elem);
+        return 0;
+    }
+
+    cache_policies[the_cache->policy].insert(elem);
+    (the_cache->size)++;
+    the_cache->bytes += elem->bytes;
+    if (the_cache->bytes > the_cache->peak_bytes) {
+        the_cache->peak_bytes = the_cache->bytes;
+    }
+    return 1;
+}
+
+/**
+ * @brief Whether an element with the given key and value may be cached, i.e.
+ * its charge is within the per-object cap and the budget.
+ *
+ * @param key_len Length of the key, excluding the null terminator.
+ * @param val_len Byte size of the value.
+ * @return int 1 if it may be cached; 0 otherwise.
+ */
+static int cache_fits(size_t key_len, size_t val_len)
+{
+    size_t bytes = cache_elem_bytes(key_len, val_len);
+
+    return bytes <= the_cache->max_object_bytes &&
+           bytes <= the_cache->max_bytes;
+}
+
+/**
+ * @brief Drop the old element of the given key before a new one is put, even
+ * if the new one isn't cached, since elements are immutable.
+ *
+ * @param key Key of the element to be put, non-null.
+ * @param val_len Byte size of the value to be put.
+ * @return int 1 if the new element may be cached; 0 if it's larger than the
+ * cap.
+ */
+static int cache_put_begin(const char* key, size_t val_len)
+{
+    cache_elem* elem = NULL;
+
+    elem = cache_force_get_elem(key);
+    cache_force_remove_elem(&elem);
+    if (disk_cache_enabled()) {
+        disk_cache_remove(key);
+    }
+    return cache_fits(strlen(key), val_len);
+}
+
+/**
+ * @brief Add a new element to cache, after removing expired elements, then the
+ * ones chosen by the policy, until it fits.
+ *
+ * @param elem New element, non-null. It's freed if it isn't added.
+ * @param stale_age Seconds to keep the element once stale, >= 0.
+ * @return int Number of elements put into cache.
+ */
+static int cache_put_elem(cache_elem* elem, int stale_age)
+{
+    elem->stale_age = stale_age;
+    cache_make_room(elem->bytes);
+    if (cache_force_add_elem(elem) == 0) {
+        cache_elem_free(&elem);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Put the given element (key, val, ttl) into cache.
+ *
+ * @param key Key of the element to be put, non-null.
+ * @param val Value of the element to be put, non-null.
+ * @param val_len Byte size of val.
+ * @param max_age Time-to-live of the element in seconds, >= 0.
+ * @return Number of elements put into cache. It's 0 if the element exceeds the
+ * per-object cap, and an old element of the key is removed.
+ */
+int cache_put(const char* key,
+              const char* val,
+              const int val_len,
+              const int max_age)
+{
+    return cache_put_stale(key, val, val_len, max_age, 0);
+}
+
+/**
+ * @brief Put the given element into cache, and keep it for a while after it
+ * goes stale, so it can be revalidated with its origin instead of fetched
+ * again.
+ *
+ * @param key Key of the element to be put, non-null.
+ * @param val Value of the element to be put, non-null.
+ * @param val_len Byte size of val.
+ * @param max_age Time-to-live of the element in seconds, >= 0.
+ * @param stale_age Seconds to keep the element once stale, >= 0.
+ * @return int Number of elements put into cache. It's 0 if the element exceeds
+ * the per-object cap, and an old element of the key is removed.
+ */
+int cache_put_stale(const char* key,
+                    const char* val,
+                    const int val_len,
+                    const int max_age,
+                    const int stale_age)
+{
+    cache_elem* elem = NULL;
+
+    /* Invalid args. */
+    if (the_cache == NULL ||
+        key == NULL ||
+        val == NULL ||
+        val_len < 0 ||
+        stale_age < 0) {
+
+        return 0;
+    }
+
+    if (!cache_put_begin(key, val_len)) {
+        return 0;
+    }
+    elem = cache_elem_new(key, val, val_len, max_age);
+    if (elem == NULL) {
+        return 0;
+    }
+    return cache_put_elem(elem, stale_age);
+}
+
+/**
+ * @brief Drop the chunks of a fill, which is full from then on.
+ *
+ * @param fill Fill, non-null.
+ */
+static void cache_fill_drop(struct cache_fill* fill)
+{
+    for (int i = 0; i < fill->num_chunks; ++i) {
+        slab_free(fill->chunks[i], FILL_CHUNK_BYTES);
+    }
+    free(fill->chunks);
+    fill->chunks = NULL;
+    fill->num_chunks = 0;
+    fill->chunks_cap = 0;
+    fill->is_full = 1;
+}
+
+/**
+ * @brief Start filling a response into the cache as it arrives.
+ *
+ * @param key Key of the element to fill, non-null.
+ * @param expected_len Byte size that the value is known to have; 0 if unknown.
+ * The fill is full from the start if it exceeds the per-object cap.
+ * @return struct cache_fill* Empty fill to free with cache_fill_free(); NULL
+ * on failure.
+ */
+struct cache_fill* cache_fill_new(const char* key, size_t expected_len)
+{
+    struct cache_fill* fill = NULL;
+
+    if (the_cache == NULL || key == NULL) {
+        return NULL;
+    }
+    fill = malloc(sizeof(struct cache_fill));
+    if (fill == NULL) {
+        PLOG_ERROR("malloc");
+        return NULL;
+    }
+    fill->key = strdup(key);
+    if (fill->key == NULL) {
+        PLOG_ERROR("strdup");
+        free(fill);
+        return NULL;
+    }
+    fill->chunks = NULL;
+    fill->num_chunks = 0;
+    fill->chunks_cap = 0;
+    fill->len = 0;
+    fill->is_full = !cache_fits(strlen(key), expected_len);
+    return fill;
+}
+
+/**
+ * @brief Append the next bytes of the value to a fill, copied into fixed-size
+ * chunks. Once the value exceeds the per-object cap, the fill is full: its
+ * bytes are dropped, and it can't be put into cache anymore.
+ *
+ * @param fill Fill to append to, non-null.
+ * @param data Next bytes of the value.
+ * @param len Byte size of data.
+ * @return int 0 on success; -1 if the fill is full or fails to allocate.
+ */
+int cache_fill_append(struct cache_fill* fill, const char* data, size_t len)
+{
+    size_t offset; /* Bytes used of the last chunk. */
+    size_t n;
+    char** chunks = NULL;
+
+    if (!fill->is_full && !cache_fits(strlen(fill->key), fill->len + len)) {
+        cache_fill_drop(fill);
+    }
+    while (!fill->is_full && len > 0) {
+        offset = fill->len % FILL_CHUNK_BYTES;
+        if (offset == 0) {
+            /* The last chunk is used up. */
+            if (fill->num_chunks == fill->chunks_cap) {
+                chunks = realloc(fill->chunks,
+                                 (fill->chunks_cap * 2 + 1) * sizeof(char*));
+                if (chunks == NULL) {
+                    PLOG_ERROR("realloc");
+                    cache_fill_drop(fill);
+                    break;
+                }
+                fill->chunks = chunks;
+                fill->chunks_cap = fill->chunks_cap * 2 + 1;
+            }
+            fill->chunks[fill->num_chunks] = slab_alloc(FILL_CHUNK_BYTES);
+            if (fill->chunks[fill->num_chunks] == NULL) {
+                cache_fill_drop(fill);
+                break;
+            }
+            ++fill->num_chunks;
+        }
+        n = FILL_CHUNK_BYTES - offset;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(fill->chunks[fill->num_chunks - 1] + offset, data, n);
+        fill->len += n;
+        data += n;
+        len -= n;
+    }
+    if (fill->is_full) {
+        fill->len += len;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether a fill is full, i.e. its value exceeds the per-object cap or
+ * failed to be allocated, so its bytes are dropped.
+ *
+ * @param fill Fill, non-null.
+ * @return int 1 if it's full; 0 otherwise.
+ */
+int cache_fill_is_full(const struct cache_fill* fill)
+{
+    return fill->is_full;
+}
+
+/**
+ * @brief Get the byte size of the value appended to a fill so far, including
+ * any dropped bytes.
+ *
+ * @param fill Fill, non-null.
+ * @return size_t Byte size of the value.
+ */
+size_t cache_fill_len(const struct cache_fill* fill)
+{
+    return fill->len;
+}
+
+/**
+ * @brief Get a chunk of the value of a fill, in order, e.g. to replay what has
+ * arrived so far.
+ *
+ * @param fill Fill, non-null.
+ * @param index Index of the chunk, from 0.
+ * @param out_len Output; byte size of the chunk.
+ * @return const char* The chunk; NULL past the last chunk, or if the fill is
+ * full.
+ */
+const char* cache_fill_chunk(const struct cache_fill* fill,
+                             int index,
+                             int* out_len)
+{
+    if (fill->is_full || index < 0 || index >= fill->num_chunks) {
+        return NULL;
+    }
+    *out_len = index < fill->num_chunks - 1 ?
+               FILL_CHUNK_BYTES :
+               fill->len - (size_t)index * FILL_CHUNK_BYTES;
+    return fill->chunks[index];
+}
+
+/**
+ * @brief Put the value of a complete fill into cache, like cache_put_stale().
+ * The fill is left untouched.
+ *
+ * @param fill Fill of the element to be put, non-null.
+ * @param max_age Time-to-live of the element in seconds, >= 0.
+ * @param stale_age Seconds to keep the element once stale, >= 0.
+ * @return int Number of elements put into cache. It's 0 if the fill is full,
+ * and an old element of the key is removed.
+ */
+int cache_fill_put(const struct cache_fill* fill,
+                   const int max_age,
+                   const int stale_age)
+{
+    cache_elem* elem = NULL;
+    const char* chunk = NULL;
+    int chunk_len = 0;
+    size_t pos = 0;
+
+    /* Invalid args. */
+    if (the_cache == NULL || fill == NULL || stale_age < 0) {
+        return 0;
+    }
+
+    if (!cache_put_begin(fill->key, fill->len) || fill->is_full) {
+        return 0;
+    }
+
+    /* Gather the chunks into the value of a new element. */
+    elem = cache_elem_new(fill->key, NULL, 0, max_age);
+    if (elem == NULL) {
+        return 0;
+    }
+    elem->val = slab_alloc(fill->len);
+    if (elem->val == NULL) {
+        cache_elem_free(&elem);
+        return 0;
+    }
+    elem->val_len = fill->len;
+    for (int i = 0; (chunk = cache_fill_chunk(fill, i, &chunk_len)) != NULL;
+         ++i) {
+        memcpy(elem->val + pos, chunk, chunk_len);
+        pos += chunk_len;
+    }
+    elem->bytes = cache_elem_bytes(strlen(fill->key), elem->val_len);
+    cache_elem_split(elem);
+    return cache_put_elem(elem, stale_age);
+}
+
+/**
+ * @brief Free a fill and its chunks.
+ *
+ * @param fill In/out; fill to free, set to NULL. Nothing happens if it's NULL.
+ */
+void cache_fill_free(struct cache_fill** fill)
+{
+    if (fill == NULL || *fill == NULL) {
+        return;
+    }
+    cache_fill_drop(*fill);
+    free((*fill)->key);
+    free(*fill);
+    *fill = NULL;
+}
+
+/**
+ * @brief Move the unexpired element of the given key from the disk tier back to
+ * memory, keeping its creation time and stale age. It may be stale.
+ *
+ * @param key Key of the element, non-null.
+ * @return cache_elem* The promoted element if found on disk; otherwise, NULL.
+ */
+cache_elem* cache_promote(const char* key)
+{
+    cache_elem* elem;
+    char* val;
+    int val_len;
+    time_t creation_time;
+    time_t max_age;
+    time_t stale_age;
+
+    if (!disk_cache_enabled() ||
+        disk_cache_take(key,
+                        &val,
+                        &val_len,
+                        &creation_time,
+                        &max_age,
+                        &stale_age) == 0) {
+        return NULL;
+    }
+    elem = cache_elem_new(key, val, val_len, max_age);
+    free(val);
+    if (elem == NULL) {
+        return NULL;
+    }
+    elem->creation_time = creation_time;
+    elem->stale_age = stale_age;
+    cache_make_room(elem->bytes);
+    if (cache_force_add_elem(elem) == 0) {
+        cache_elem_free(&elem);
+        return NULL;
+    }
+    return elem;
+}
+
+/**
+ * Get the element of the given key, and remove it if expired. An element
+ * missing from memory is promoted from the disk tier.
+ *
+ * @param key Key of the element to get, non-null.
+ * @param allow_stale Whether to get a stale element kept for revalidation.
+ * @return A pointer to the element if found and valid; otherwise, NULL.
+ */
+cache_elem* cache_lookup_elem(const char* key, int allow_stale)
+{
+    unsigned hash = cache_hash(key);
+    cache_elem* elem;
+
+    /* Misses count too, so a key looked up often is admitted once cached. */
+    if (the_cache->sketch != NULL) {
+        cache_sketch_add(hash);
+    }
+    elem = the_cache->slots[cache_find_slot(key, hash)].elem;
     if (elem == NULL) {
-        return 0;
+        elem = cache_promote(key);
+        /* A promoted stale element is kept for revalidation as well. */
+        if (elem != NULL && !allow_stale && cache_elem_is_stale(elem)) {
+            return NULL;
+        }
+        return elem;
+    }
+    /* Remove the expired element. */
+    if (cache_elem_expire(elem) <= time(NULL)) {
+        cache_force_remove_elem(&elem);
+        return NULL;
+    }
+    /* Keep the stale element for revalidation. */
+    if (!allow_stale && cache_elem_is_stale(elem)) {
+        return NULL;
     }
-    /* Remove the stale element. */
-    if (cache_elem_is_stale(elem)) {
+    /* Remove the element whose value is corrupted in its snapshot. */
+    if (!cache_elem_verify(elem)) {
+        LOG_ERROR("cache: corrupted snapshot value of %s", key);
         cache_force_remove_elem(&elem);
+        return NULL;
+    }
+    cache_policies[the_cache->policy].hit(elem);
+    return elem;
+}
+
+/**
+ * Get the valid element of the given key, and remove it if expired. A stale
+ * element kept for revalidation is not valid, but stays cached.
+ *
+ * @param key Key of the element to get, non-null.
+ * @return A pointer to the element if found and valid; otherwise, NULL.
+ */
+cache_elem* cache_get_valid_elem(const char* key)
+{
+    return cache_lookup_elem(key, 0);
+}
+
+/**
+ * Get value of key from cache.
+ *
+ * If the key is found, *out_val will be set to a copy of the value.
+ * If the key is not found, *out_val will remain.
+ * @param key Key of the element to get, non-null.
+ * @param out_val Pointer to returned value, non-null.
+ * *out_val won't be freed in this function.
+ * Caller is responsible to free *out_val after using.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_age Output; age of this element in seconds.
+ * @return Number of valid elements we get.
+ */
+int cache_get(const char* key,
+              char** out_val,
+              int* out_val_len,
+              int* out_age)
+{
+    cache_elem* elem = NULL;
+
+    /* Validate args. */
+    if (the_cache == NULL ||
+        key == NULL ||
+        out_val == NULL ||
+        out_val_len == NULL ||
+        out_age == NULL) {
+
+        return 0;
+    }
+
+    elem = cache_get_valid_elem(key);
+    if (elem == NULL) {
         return 0;
     }
     *out_val = NULL;
@@ -444,3 +1835,503 @@ int cache_get(const char* key,
     *out_age = cache_elem_age(elem);
     return 1;
 }
+
+/**
+ * @brief Pin the value of key in cache without copying it. The value stays
+ * valid until released, even if the element is evicted or replaced.
+ *
+ * @param key Key of the element to get, non-null.
+ * @param out_val Output; value of the element.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_head_len Output; byte size of the head of *out_val up to the end
+ * of its last field, where an Age field goes; -1 if it has no complete head.
+ * @param out_age Output; age of this element in seconds.
+ * @return struct cache_elem* Pinned element to release with cache_release() if
+ * found and valid; otherwise, NULL.
+ */
+struct cache_elem* cache_acquire(const char* key,
+                                 const char** out_val,
+                                 int* out_val_len,
+                                 int* out_head_len,
+                                 int* out_age)
+{
+    cache_elem* elem = NULL;
+
+    /* Validate args. */
+    if (the_cache == NULL ||
+        key == NULL ||
+        out_val == NULL ||
+        out_val_len == NULL ||
+        out_head_len == NULL ||
+        out_age == NULL) {
+
+        return NULL;
+    }
+
+    elem = cache_get_valid_elem(key);
+    if (elem == NULL) {
+        return NULL;
+    }
+    ++elem->refs;
+    *out_val = elem->val;
+    *out_val_len = elem->val_len;
+    *out_head_len = elem->head_len;
+    *out_age = cache_elem_age(elem);
+    return elem;
+}
+
+/**
+ * @brief Pin the value of key in cache like cache_acquire(), including a stale
+ * element kept for revalidation.
+ *
+ * @param key Key of the element to get, non-null.
+ * @param out_val Output; value of the element.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_head_len Output; byte size of the head of *out_val up to the end
+ * of its last field, where an Age field goes; -1 if it has no complete head.
+ * @param out_age Output; age of this element in seconds.
+ * @param out_stale_secs Output; seconds since the element went stale, >= 0 if
+ * it's stale; < 0 if it's fresh.
+ * @return struct cache_elem* Pinned element to release with cache_release() if
+ * found; otherwise, NULL.
+ */
+struct cache_elem* cache_acquire_stale(const char* key,
+                                       const char** out_val,
+                                       int* out_val_len,
+                                       int* out_head_len,
+                                       int* out_age,
+                                       int* out_stale_secs)
+{
+    cache_elem* elem = NULL;
+
+    /* Validate args. */
+    if (the_cache == NULL ||
+        key == NULL ||
+        out_val == NULL ||
+        out_val_len == NULL ||
+        out_head_len == NULL ||
+        out_age == NULL ||
+        out_stale_secs == NULL) {
+
+        return NULL;
+    }
+
+    elem = cache_lookup_elem(key, 1);
+    if (elem == NULL) {
+        return NULL;
+    }
+    ++elem->refs;
+    *out_val = elem->val;
+    *out_val_len = elem->val_len;
+    *out_head_len = elem->head_len;
+    *out_age = cache_elem_age(elem);
+    *out_stale_secs = *out_age - elem->max_age;
+    return elem;
+}
+
+/**
+ * @brief Make a pinned element fresh again, once its origin confirms that it
+ * hasn't changed. Its age starts over from 0.
+ *
+ * @param elem Element pinned by cache_acquire_stale(), non-null.
+ * @param max_age New time-to-live in seconds; < 0 to keep the current one.
+ * @return int 1 if the element is still cached and refreshed; 0 if it has been
+ * evicted or replaced.
+ */
+int cache_refresh(struct cache_elem* elem, int max_age)
+{
+    int pos;
+
+    if (the_cache == NULL || elem->heap_pos < 0) {
+        return 0;
+    }
+    elem->creation_time = time(NULL);
+    if (max_age >= 0) {
+        elem->max_age = max_age;
+    }
+    /* Its expiry moves, so it takes a new place in the heap. */
+    pos = elem->heap_pos;
+    if (pos > 0 &&
+        cache_elem_expire(the_cache->heap[pos]) <
+        cache_elem_expire(the_cache->heap[(pos - 1) / 2])) {
+        cache_heap_up(pos);
+    }
+    else {
+        cache_heap_down(pos);
+    }
+    return 1;
+}
+
+/**
+ * @brief Add a reference to a pinned element.
+ *
+ * @param elem Element pinned by cache_acquire(), non-null.
+ */
+void cache_retain(struct cache_elem* elem)
+{
+    ++elem->refs;
+}
+
+/**
+ * @brief Drop a reference of a pinned element. The element is freed once it's
+ * neither cached nor pinned.
+ *
+ * @param elem Element pinned by cache_acquire().
+ */
+void cache_release(struct cache_elem* elem)
+{
+    cache_elem_unref(&elem);
+}
+
+/**
+ * @brief Get the bytes charged for all the cached elements.
+ *
+ * @return size_t Current bytes; 0 if the cache isn't initialized.
+ */
+size_t cache_bytes(void)
+{
+    return the_cache == NULL ? 0 : the_cache->bytes;
+}
+
+/**
+ * @brief Get the max bytes ever charged since the cache was initialized.
+ *
+ * @return size_t Peak bytes; 0 if the cache isn't initialized.
+ */
+size_t cache_peak_bytes(void)
+{
+    return the_cache == NULL ? 0 : the_cache->peak_bytes;
+}
+
+/**
+ * @brief Remove a bounded number of expired elements, the earliest expired
+ * first. Meant to be called once per event loop tick, so expired responses
+ * don't hold memory until they are looked up or evicted.
+ *
+ * @param max_elems Max number of elements to remove.
+ * @return int Number of removed elements.
+ */
+int cache_sweep(int max_elems)
+{
+    if (the_cache == NULL) {
+        return 0;
+    }
+    return cache_remove_expired(max_elems, 0);
+}
+
+/* Header of a snapshot file. The index follows: an entry and the key of each
+ * element, then the values. */
+struct snapshot_header {
+    char magic[8]; /* SNAPSHOT_MAGIC. */
+    uint32_t num_entries;
+    uint32_t reserved;
+    uint64_t index_bytes; /* Byte size of the index. */
+    uint64_t index_checksum; /* Checksum of the index. */
+};
+
+/* Entry of an element in the snapshot index, followed by its key. */
+struct snapshot_entry {
+    uint64_t val_offset; /* Offset of the value in the file. */
+    uint64_t val_checksum; /* Checksum of the value. */
+    int64_t creation_time;
+    int64_t max_age;
+    uint32_t key_len; /* Length of the key, without a null terminator. */
+    uint32_t val_len;
+    int32_t head_len;
+    uint32_t stale_age; /* Seconds to keep the element once stale. */
+};
+
+/**
+ * @brief Get the elements to save in a snapshot: the unexpired and intact
+ * ones, from the next to evict to the last, so loading them in order rebuilds
+ * the queues.
+ *
+ * @param out_num_elems Output; number of elements.
+ * @return cache_elem** Elements to free by the caller; NULL on failure.
+ */
+static cache_elem** cache_snapshot_elems(int* out_num_elems)
+{
+    time_t now = time(NULL);
+    cache_elem** elems;
+    cache_elem* elem;
+    int n = 0;
+
+    elems = malloc((the_cache->size + 1) * sizeof(cache_elem*));
+    if (elems == NULL) {
+        PLOG_ERROR("malloc");
+        return NULL;
+    }
+    for (int i = CACHE_NUM_QUEUES - 1; i >= 0; --i) {
+        elem = the_cache->queues[i].back->prev;
+        for (; elem != the_cache->queues[i].front; elem = elem->prev) {
+            if (cache_elem_expire(elem) > now && cache_elem_verify(elem)) {
+                elems[n++] = elem;
+            }
+        }
+    }
+    *out_num_elems = n;
+    return elems;
+}
+
+/**
+ * @brief Write the unexpired elements to a snapshot file, replacing it
+ * atomically. Meant to be called on shutdown, so cache_load() can warm the
+ * cache on restart.
+ *
+ * @param path Path of the snapshot file, non-null.
+ * @return int Number of saved elements; -1 on failure.
+ */
+int cache_save(const char* path)
+{
+    char tmp_path[PATH_MAX];
+    struct snapshot_header header;
+    struct snapshot_entry* entries;
+    cache_elem** elems;
+    uint64_t offset;
+    FILE* file;
+    int n = 0;
+    int ok;
+
+    if (the_cache == NULL || path == NULL) {
+        return -1;
+    }
+    if (snprintf(tmp_path,
+                 sizeof(tmp_path),
+                 "%s.tmp",
+                 path) >= (int)sizeof(tmp_path)) {
+        LOG_ERROR("cache: snapshot path too long: %s", path);
+        return -1;
+    }
+    elems = cache_snapshot_elems(&n);
+    if (elems == NULL) {
+        return -1;
+    }
+    entries = calloc(n + 1, sizeof(struct snapshot_entry));
+    if (entries == NULL) {
+        PLOG_ERROR("calloc");
+        free(elems);
+        free(entries);
+        return -1;
+    }
+
+    /* The index comes before the values, so build it first. */
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.num_entries = n;
+    for (int i = 0; i < n; ++i) {
+        header.index_bytes += sizeof(entries[i]) + strlen(elems[i]->key);
+    }
+    offset = sizeof(header) + header.index_bytes;
+    header.index_checksum = CHECKSUM_SEED;
+    for (int i = 0; i < n; ++i) {
+        entries[i].val_offset = offset;
+        entries[i].val_checksum = cache_checksum(CHECKSUM_SEED,
+                                                 elems[i]->val,
+                                                 elems[i]->val_len);
+        entries[i].creation_time = elems[i]->creation_time;
+        entries[i].max_age = elems[i]->max_age;
+        entries[i].key_len = strlen(elems[i]->key);
+        entries[i].val_len = elems[i]->val_len;
+        entries[i].head_len = elems[i]->head_len;
+        entries[i].stale_age = elems[i]->stale_age;
+        offset += elems[i]->val_len;
+        header.index_checksum = cache_checksum(header.index_checksum,
+                                               &entries[i],
+                                               sizeof(entries[i]));
+        header.index_checksum = cache_checksum(header.index_checksum,
+                                               elems[i]->key,
+                                               entries[i].key_len);
+    }
+
+    file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        PLOG_ERROR("fopen %s", tmp_path);
+        free(elems);
+        free(entries);
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    for (int i = 0; i < n; ++i) {
+        fwrite(&entries[i], sizeof(entries[i]), 1, file);
+        fwrite(elems[i]->key, 1, entries[i].key_len, file);
+    }
+    for (int i = 0; i < n; ++i) {
+        fwrite(elems[i]->val, 1, elems[i]->val_len, file);
+    }
+    free(elems);
+    free(entries);
+
+    /* Make the file durable before it replaces the old one. */
+    ok = !ferror(file) && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (!ok) {
+        PLOG_ERROR("write %s", tmp_path);
+    }
+    if (fclose(file) != 0 && ok) {
+        PLOG_ERROR("fclose %s", tmp_path);
+        ok = 0;
+    }
+    if (ok && rename(tmp_path, path) < 0) {
+        PLOG_ERROR("rename %s", tmp_path);
+        ok = 0;
+    }
+    if (!ok) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Index an element of a snapshot, with its value left in the mapping.
+ *
+ * @param snapshot Mapped snapshot, non-null.
+ * @param key Key of the element, not null-terminated.
+ * @param entry Index entry of the element, in bounds of the mapping.
+ * @param now Current time.
+ * @return int Number of loaded elements.
+ */
+static int cache_load_elem(struct cache_snapshot* snapshot,
+                           const char* key,
+                           const struct snapshot_entry* entry,
+                           time_t now)
+{
+    cache_elem* elem;
+    char* elem_key;
+    size_t bytes;
+
+    bytes = cache_elem_bytes(entry->key_len, entry->val_len);
+    if (bytes > the_cache->max_object_bytes || bytes > the_cache->max_bytes) {
+        return 0;
+    }
+    elem_key = strndup(key, entry->key_len);
+    if (elem_key == NULL) {
+        PLOG_ERROR("strndup");
+        return 0;
+    }
+    elem = cache_force_get_elem(elem_key);
+    cache_force_remove_elem(&elem);
+    elem = cache_elem_new(elem_key, NULL, 0, entry->max_age);
+    free(elem_key);
+    if (elem == NULL) {
+        return 0;
+    }
+    elem->val = snapshot->data + entry->val_offset;
+    elem->val_len = entry->val_len;
+    elem->head_len = entry->head_len;
+    elem->stale_age = entry->stale_age;
+    elem->bytes = bytes;
+    /* Keep the age across the restart, unless the clock went back. */
+    elem->creation_time = entry->creation_time < now ?
+                          entry->creation_time : now;
+    elem->snapshot = snapshot;
+    elem->checksum = entry->val_checksum;
+    elem->verified = 0;
+    ++snapshot->refs;
+    cache_make_room(elem->bytes);
+    if (cache_force_add_elem(elem) == 0) {
+        cache_elem_free(&elem);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Load the unexpired elements of a snapshot written by cache_save().
+ * The file is mapped, and values are read lazily on first use, so loading only
+ * reads the index. Values are checksummed before use.
+ *
+ * @param path Path of the snapshot file, non-null.
+ * @return int Number of loaded elements; 0 if there's no snapshot; -1 if the
+ * snapshot is invalid or fails to be read.
+ */
+int cache_load(const char* path)
+{
+    struct snapshot_header header;
+    struct snapshot_entry entry;
+    struct cache_snapshot* snapshot;
+    struct stat st;
+    const char* p;
+    const char* index_end;
+    time_t now = time(NULL);
+    void* data;
+    int fd;
+    int n = 0;
+
+    if (the_cache == NULL || path == NULL) {
+        return -1;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        PLOG_ERROR("open %s", path);
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        PLOG_ERROR("fstat %s", path);
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(header)) {
+        LOG_ERROR("cache: truncated snapshot %s", path);
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        PLOG_ERROR("mmap %s", path);
+        return -1;
+    }
+    snapshot = malloc(sizeof(struct cache_snapshot));
+    if (snapshot == NULL) {
+        PLOG_ERROR("malloc");
+        munmap(data, st.st_size);
+        return -1;
+    }
+    snapshot->data = data;
+    snapshot->len = st.st_size;
+    snapshot->refs = 1;
+
+    /* Validate the whole index before loading any element. */
+    memcpy(&header, snapshot->data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.index_bytes > snapshot->len - sizeof(header) ||
+        cache_checksum(CHECKSUM_SEED,
+                       snapshot->data + sizeof(header),
+                       header.index_bytes) != header.index_checksum) {
+        LOG_ERROR("cache: invalid snapshot %s", path);
+        cache_snapshot_unref(&snapshot);
+        return -1;
+    }
+    p = snapshot->data + sizeof(header);
+    index_end = p + header.index_bytes;
+    for (uint32_t i = 0; i < header.num_entries; ++i) {
+        if ((size_t)(index_end - p) < sizeof(entry)) {
+            break;
+        }
+        memcpy(&entry, p, sizeof(entry));
+        p += sizeof(entry);
+        if (entry.key_len > (size_t)(index_end - p) ||
+            strnlen(p, entry.key_len) != entry.key_len ||
+            entry.val_len > INT_MAX ||
+            entry.val_offset < (size_t)(index_end - snapshot->data) ||
+            entry.val_offset > snapshot->len ||
+            entry.val_len > snapshot->len - entry.val_offset ||
+            entry.head_len < -1 ||
+            entry.head_len > (int32_t)entry.val_len) {
+            break;
+        }
+        /* Skip elements that expired while the proxy was down. */
+        if (entry.creation_time + entry.max_age + entry.stale_age > now) {
+            n += cache_load_elem(snapshot, p, &entry, now);
+        }
+        p += entry.key_len;
+    }
+    if (p != index_end) {
+        LOG_ERROR("cache: malformed snapshot index %s", path);
+    }
+    cache_snapshot_unref(&snapshot);
+    return n;
+}
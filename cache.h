@@ -7,20 +7,91 @@
 *     Date: 2021-11-11
 *
 *     Summary:
-*     Interface for fixed size LRU cache.
+*     Interface for byte-budgeted cache.
+*
+*     Each element is charged for its key, value (headers and
+*     body) and metadata. Elements are evicted to keep the
+*     total within the memory budget; expired elements go
+*     first, then the ones chosen by the eviction policy:
+*     LRU, or the scan-resistant S3-FIFO and W-TinyLFU, which
+*     keep popular responses cached while one-off URLs pass
+*     through.
+*
+*     A response put with a stale age stays cached for that
+*     long after it goes stale. Lookups miss it, but it can
+*     be pinned with cache_acquire_stale(), revalidated with
+*     its origin, and made fresh again by cache_refresh().
+*
+*     If the disk tier is enabled with disk_cache_init(),
+*     fresh responses evicted by the policy spill to disk, and
+*     are promoted back to memory when looked up.
+*
+*     cache_save() snapshots the unexpired responses to a
+*     file on shutdown, and cache_load() maps it on restart.
+*     Loading only reads the index of the snapshot; each
+*     response is read, and checked against its checksum, on
+*     first use.
+*     Responses keep their age across the restart.
+*
+*     A response can also be filled into the cache as it
+*     arrives, in fixed-size chunks, with a cache_fill; it's
+*     put once complete. A fill that exceeds the per-object
+*     cap drops its bytes, so larger responses pass through
+*     without being held in memory.
+*
+*     Responses are split into head and body when cached.
+*     A hit can pin an element instead of copying its value.
+*     A pinned element stays valid after it's evicted or
+*     replaced, and is freed once released; its bytes no
+*     longer count toward the budget then.
 *
 **************************************************************/
 
 #ifndef CACHE_H
 #define CACHE_H
 
+#include <stddef.h>
+
+struct cache_elem;
+struct cache_fill;
+
+/* Eviction policies. */
+enum cache_policy {
+    CACHE_LRU, /* Least recently used. */
+    CACHE_S3FIFO, /* Small and main FIFO queues, with a ghost queue. */
+    CACHE_TINYLFU, /* LRU window, and segmented LRU behind a frequency
+                    * filter. */
+    CACHE_NUM_POLICIES
+};
+
+/**
+ * @brief Get the eviction policy of the given name.
+ *
+ * @param name Name of the policy: lru, s3fifo or tinylfu.
+ * @return int The policy if the name is known; -1 otherwise.
+ */
+int cache_parse_policy(const char* name);
+
 /**
- * @brief Initialize an empty cache of the given capacity.
+ * @brief Get the name of the given eviction policy.
  *
- * @param capacity Max size of the cache, > 0.
+ * @param policy Eviction policy.
+ * @return const char* Name of the policy.
+ */
+const char* cache_policy_name(enum cache_policy policy);
+
+/**
+ * @brief Initialize an empty cache with the given memory budget.
+ *
+ * @param max_bytes Max bytes charged for all the elements, > 0.
+ * @param max_object_bytes Max bytes charged for one element, > 0. Larger
+ * responses are not cached.
+ * @param policy Eviction policy.
  * @return 0 on success; -1 otherwise.
  */
-int cache_init(int capacity);
+int cache_init(size_t max_bytes,
+               size_t max_object_bytes,
+               enum cache_policy policy);
 
 /**
  * Free the cache.
@@ -34,13 +105,109 @@ void cache_clear(void);
  * @param val Value of the element to be put, non-null.
  * @param val_len Byte size of val.
  * @param max_age Time-to-live of the element in seconds, >= 0.
- * @return Number of elements put into cache.
+ * @return Number of elements put into cache. It's 0 if the element exceeds the
+ * per-object cap, and an old element of the key is removed.
  */
 int cache_put(const char* key,
               const char* val,
               const int val_len,
               const int max_age);
 
+/**
+ * @brief Put the given element into cache, and keep it for a while after it
+ * goes stale, so it can be revalidated with its origin instead of fetched
+ * again.
+ *
+ * @param key Key of the element to be put, non-null.
+ * @param val Value of the element to be put, non-null.
+ * @param val_len Byte size of val.
+ * @param max_age Time-to-live of the element in seconds, >= 0.
+ * @param stale_age Seconds to keep the element once stale, >= 0.
+ * @return int Number of elements put into cache. It's 0 if the element exceeds
+ * the per-object cap, and an old element of the key is removed.
+ */
+int cache_put_stale(const char* key,
+                    const char* val,
+                    const int val_len,
+                    const int max_age,
+                    const int stale_age);
+
+/**
+ * @brief Start filling a response into the cache as it arrives.
+ *
+ * @param key Key of the element to fill, non-null.
+ * @param expected_len Byte size that the value is known to have; 0 if unknown.
+ * The fill is full from the start if it exceeds the per-object cap.
+ * @return struct cache_fill* Empty fill to free with cache_fill_free(); NULL
+ * on failure.
+ */
+struct cache_fill* cache_fill_new(const char* key, size_t expected_len);
+
+/**
+ * @brief Append the next bytes of the value to a fill, copied into fixed-size
+ * chunks. Once the value exceeds the per-object cap, the fill is full: its
+ * bytes are dropped, and it can't be put into cache anymore.
+ *
+ * @param fill Fill to append to, non-null.
+ * @param data Next bytes of the value.
+ * @param len Byte size of data.
+ * @return int 0 on success; -1 if the fill is full or fails to allocate.
+ */
+int cache_fill_append(struct cache_fill* fill, const char* data, size_t len);
+
+/**
+ * @brief Whether a fill is full, i.e. its value exceeds the per-object cap or
+ * failed to be allocated, so its bytes are dropped.
+ *
+ * @param fill Fill, non-null.
+ * @return int 1 if it's full; 0 otherwise.
+ */
+int cache_fill_is_full(const struct cache_fill* fill);
+
+/**
+ * @brief Get the byte size of the value appended to a fill so far, including
+ * any dropped bytes.
+ *
+ * @param fill Fill, non-null.
+ * @return size_t Byte size of the value.
+ */
+size_t cache_fill_len(const struct cache_fill* fill);
+
+/**
+ * @brief Get a chunk of the value of a fill, in order, e.g. to replay what has
+ * arrived so far.
+ *
+ * @param fill Fill, non-null.
+ * @param index Index of the chunk, from 0.
+ * @param out_len Output; byte size of the chunk.
+ * @return const char* The chunk; NULL past the last chunk, or if the fill is
+ * full.
+ */
+const char* cache_fill_chunk(const struct cache_fill* fill,
+                             int index,
+                             int* out_len);
+
+/**
+ * @brief Put the value of a complete fill into cache, like cache_put_stale().
+ * The fill is left untouched.
+ *
+ * @param fill Fill of the element to be put, non-null.
+ * @param max_age Time-to-live of the element in seconds, >= 0.
+ * @param stale_age Seconds to keep the element once stale, >= 0.
+ * @return int Number of elements put into cache. It's 0 if the fill is full,
+ * and an old element of the key is removed.
+ */
+int cache_fill_put(const struct cache_fill* fill,
+                   const int max_age,
+                   const int stale_age);
+
+/**
+ * @brief Free a fill and its chunks.
+ *
+ * @param fill In/out; fill to free, set to NULL. Nothing happens if it's NULL.
+ */
+void cache_fill_free(struct cache_fill** fill);
+
 /**
  * Get value of key from cache.
  *
@@ -59,4 +226,116 @@ int cache_get(const char* key,
               int* out_val_len,
               int* out_age);
 
+/**
+ * @brief Pin the value of key in cache without copying it. The value stays
+ * valid until released, even if the element is evicted or replaced.
+ *
+ * @param key Key of the element to get, non-null.
+ * @param out_val Output; value of the element.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_head_len Output; byte size of the head of *out_val up to the end
+ * of its last field, where an Age field goes; -1 if it has no complete head.
+ * @param out_age Output; age of this element in seconds.
+ * @return struct cache_elem* Pinned element to release with cache_release() if
+ * found and valid; otherwise, NULL.
+ */
+struct cache_elem* cache_acquire(const char* key,
+                                 const char** out_val,
+                                 int* out_val_len,
+                                 int* out_head_len,
+                                 int* out_age);
+
+/**
+ * @brief Pin the value of key in cache like cache_acquire(), including a stale
+ * element kept for revalidation.
+ *
+ * @param key Key of the element to get, non-null.
+ * @param out_val Output; value of the element.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_head_len Output; byte size of the head of *out_val up to the end
+ * of its last field, where an Age field goes; -1 if it has no complete head.
+ * @param out_age Output; age of this element in seconds.
+ * @param out_stale_secs Output; seconds since the element went stale, >= 0 if
+ * it's stale; < 0 if it's fresh.
+ * @return struct cache_elem* Pinned element to release with cache_release() if
+ * found; otherwise, NULL.
+ */
+struct cache_elem* cache_acquire_stale(const char* key,
+                                       const char** out_val,
+                                       int* out_val_len,
+                                       int* out_head_len,
+                                       int* out_age,
+                                       int* out_stale_secs);
+
+/**
+ * @brief Make a pinned element fresh again, once its origin confirms that it
+ * hasn't changed. Its age starts over from 0.
+ *
+ * @param elem Element pinned by cache_acquire_stale(), non-null.
+ * @param max_age New time-to-live in seconds; < 0 to keep the current one.
+ * @return int 1 if the element is still cached and refreshed; 0 if it has been
+ * evicted or replaced.
+ */
+int cache_refresh(struct cache_elem* elem, int max_age);
+
+/**
+ * @brief Add a reference to a pinned element.
+ *
+ * @param elem Element pinned by cache_acquire(), non-null.
+ */
+void cache_retain(struct cache_elem* elem);
+
+/**
+ * @brief Drop a reference of a pinned element. The element is freed once it's
+ * neither cached nor pinned.
+ *
+ * @param elem Element pinned by cache_acquire().
+ */
+void cache_release(struct cache_elem* elem);
+
+/**
+ * @brief Get the bytes charged for all the cached elements.
+ *
+ * @return size_t Current bytes; 0 if the cache isn't initialized.
+ */
+size_t cache_bytes(void);
+
+/**
+ * @brief Get the max bytes ever charged since the cache was initialized.
+ *
+ * @return size_t Peak bytes; 0 if the cache isn't initialized.
+ */
+size_t cache_peak_bytes(void);
+
+/**
+ * @brief Remove a bounded number of expired elements, the earliest expired
+ * first. Meant to be called once per event loop tick, so expired responses
+ * don't hold memory until they are looked up or evicted.
+ *
+ * @param max_elems Max number of elements to remove.
+ * @return int Number of removed elements.
+ */
+int cache_sweep(int max_elems);
+
+/**
+ * @brief Write the unexpired elements to a snapshot file, replacing it
+ * atomically. Meant to be called on shutdown, so cache_load() can warm the
+ * cache on restart.
+ *
+ * @param path Path of the snapshot file, non-null.
+ * @return int Number of saved elements; -1 on failure.
+ */
+int cache_save(const char* path);
+
+/**
+ * @brief Load the unexpired elements of a snapshot written by cache_save().
+ * The file is mapped, and values are read lazily on first use, so loading only
+ * reads the index. Values are checksummed before use.
+ *
+ * @param path Path of the snapshot file, non-null.
+ * @return int Number of loaded elements; 0 if there's no snapshot; -1 if the
+ * snapshot is invalid or fails to be read.
+ */
+int cache_load(const char* path);
+
 #endif /* CACHE_H */
@@ -0,0 +1,499 @@
+/**************************************************************
+*
+*                       disk_cache.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Implementation for disk-backed second tier of the cache.
+*
+*     Each record is a header, the key and the response,
+*     appended to the active segment with one pwritev().
+*     When a record doesn't fit, the next segment becomes
+*     active, and the index entries of its old records are
+*     dropped. The index is an open-addressing hash table of
+*     record locations; it doesn't hold keys, so a hash match
+*     is confirmed by reading the key from the record.
+*
+**************************************************************/
+
+#include "disk_cache.h"
+#include "logger.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define MIN_SLOTS 64 /* Min number of slots in the index. */
+
+/* Header of a record in a segment. */
+struct disk_record {
+    uint32_t key_len; /* Byte size of the key after the header. */
+    uint32_t val_len; /* Byte size of the response after the key. */
+    int64_t creation_time; /* Time when the response was cached. */
+    int64_t max_age; /* Time-to-live of the response in seconds. */
+    int64_t stale_age; /* Seconds the response is kept once stale. */
+};
+
+/* Index entry of a record. */
+struct disk_slot {
+    unsigned hash; /* Hash of the key. */
+    int segment; /* Segment of the record; -1 if the slot is empty. */
+    uint32_t offset; /* Offset of the record in the segment. */
+    uint32_t key_len; /* Byte size of the key. */
+    uint32_t val_len; /* Byte size of the response. */
+};
+
+/* Segment file. */
+struct disk_segment {
+    int fd; /* FD of the unlinked file; -1 if not created. */
+    size_t used; /* Bytes appended since the segment was last reused. */
+};
+
+static struct disk_segment* segments = NULL;
+static int num_segments = 0;
+static size_t segment_bytes = 0; /* Byte size of a segment. */
+static int active = 0; /* Segment that records are appended to. */
+static struct disk_slot* slots = NULL; /* Index of records. */
+static int num_slots = 0; /* Power of 2, at least twice the size. */
+static int size = 0; /* Number of indexed records. */
+static size_t bytes = 0; /* Bytes of indexed records. */
+
+/**
+ * @brief Hash a key with 32-bit FNV-1a.
+ */
+static unsigned disk_hash(const char* key, size_t key_len)
+{
+    unsigned hash = 2166136261u;
+
+    for (size_t i = 0; i < key_len; ++i) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Get the byte size of a record.
+ */
+static size_t record_bytes(size_t key_len, size_t val_len)
+{
+    return sizeof(struct disk_record) + key_len + val_len;
+}
+
+/**
+ * @brief Check whether the record of a slot has the given key, reading its
+ * key from the segment if the hash and length match.
+ */
+static bool slot_matches(const struct disk_slot* slot,
+                         const char* key,
+                         size_t key_len,
+                         unsigned hash)
+{
+    char* buf;
+    ssize_t n;
+    bool matches;
+
+    if (slot->hash != hash || slot->key_len != key_len) {
+        return false;
+    }
+    buf = malloc(key_len + 1);
+    if (buf == NULL) {
+        PLOG_ERROR("malloc");
+        return false;
+    }
+    n = pread(segments[slot->segment].fd,
+              buf,
+              key_len,
+              slot->offset + sizeof(struct disk_record));
+    matches = n == (ssize_t)key_len && memcmp(buf, key, key_len) == 0;
+    free(buf);
+    return matches;
+}
+
+/**
+ * @brief Find the slot of the given key in the index.
+ *
+ * @return int Index of the slot holding the key if found; otherwise, index of
+ * the empty slot where the key would be inserted.
+ */
+static int find_slot(const char* key, size_t key_len, unsigned hash)
+{
+    unsigned mask = num_slots - 1;
+    unsigned i = hash & mask;
+
+    while (slots[i].segment >= 0 &&
+           !slot_matches(&slots[i], key, key_len, hash)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * @brief Resize the index to the given number of slots.
+ *
+ * @return int 0 on success; -1 otherwise.
+ */
+static int resize_index(int new_num_slots)
+{
+    struct disk_slot* old_slots = slots;
+    int old_num_slots = num_slots;
+    unsigned mask = new_num_slots - 1;
+    unsigned i;
+
+    slots = malloc(new_num_slots * sizeof(struct disk_slot));
+    if (slots == NULL) {
+        PLOG_ERROR("malloc");
+        slots = old_slots;
+        return -1;
+    }
+    for (int j = 0; j < new_num_slots; ++j) {
+        slots[j].segment = -1;
+    }
+    num_slots = new_num_slots;
+    /* Records are distinct, so they are placed without comparing keys. */
+    for (int j = 0; j < old_num_slots; ++j) {
+        if (old_slots[j].segment < 0) {
+            continue;
+        }
+        i = old_slots[j].hash & mask;
+        while (slots[i].segment >= 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = old_slots[j];
+    }
+    free(old_slots);
+    return 0;
+}
+
+/**
+ * @brief Empty the given slot of the index. Later slots of the probe sequence
+ * are shifted back, so no tombstone is needed.
+ */
+static void remove_slot(unsigned i)
+{
+    unsigned mask = num_slots - 1;
+    unsigned j = i;
+    unsigned home;
+
+    --size;
+    bytes -= record_bytes(slots[i].key_len, slots[i].val_len);
+    while (true) {
+        j = (j + 1) & mask;
+        if (slots[j].segment < 0) {
+            break;
+        }
+        /* Move the slot at j to the hole at i, unless its home slot lies
+         * cyclically in (i, j]. */
+        home = slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].segment = -1;
+}
+
+/**
+ * @brief Drop the index entries of the records in the given segment, so it
+ * can be reused.
+ */
+static void reuse_segment(int segment)
+{
+    int i = 0;
+
+    /* A slot shifted back into i is checked again. Slots that wrap around
+     * into visited ones have been checked already. */
+    while (i < num_slots && size > 0) {
+        if (slots[i].segment == segment) {
+            remove_slot(i);
+            continue;
+        }
+        ++i;
+    }
+    segments[segment].used = 0;
+}
+
+/**
+ * @brief Create empty segment files in the given directory.
+ *
+ * @param dir Directory for the segment files, non-null.
+ * @param max_bytes Disk budget, at least two segments.
+ * @param seg_bytes Byte size of a segment, > 0.
+ * @return int 0 on success; -1 otherwise.
+ */
+int disk_cache_init(const char* dir, size_t max_bytes, size_t seg_bytes)
+{
+    char path[PATH_MAX];
+
+    if (dir == NULL ||
+        seg_bytes == 0 ||
+        seg_bytes > UINT32_MAX ||
+        max_bytes / seg_bytes < 2 ||
+        max_bytes / seg_bytes > INT_MAX ||
+        segments != NULL) {
+        /* Invalid args or the disk tier has already been initialized. */
+        return -1;
+    }
+
+    num_segments = max_bytes / seg_bytes;
+    segment_bytes = seg_bytes;
+    segments = malloc(num_segments * sizeof(struct disk_segment));
+    if (segments == NULL) {
+        PLOG_ERROR("malloc");
+        return -1;
+    }
+    for (int i = 0; i < num_segments; ++i) {
+        segments[i].fd = -1;
+        segments[i].used = 0;
+    }
+    for (int i = 0; i < num_segments; ++i) {
+        snprintf(path, sizeof(path), "%s/segment-XXXXXX", dir);
+        segments[i].fd = mkstemp(path);
+        if (segments[i].fd < 0) {
+            PLOG_ERROR("mkstemp %s", path);
+            disk_cache_clear();
+            return -1;
+        }
+        /* The file is freed once closed. */
+        unlink(path);
+    }
+    active = 0;
+    size = 0;
+    bytes = 0;
+    num_slots = 0;
+    if (resize_index(MIN_SLOTS) < 0) {
+        disk_cache_clear();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Close the segment files and free the index.
+ */
+void disk_cache_clear(void)
+{
+    if (segments == NULL) {
+        return;
+    }
+    for (int i = 0; i < num_segments; ++i) {
+        if (segments[i].fd >= 0) {
+            close(segments[i].fd);
+        }
+    }
+    free(segments);
+    segments = NULL;
+    num_segments = 0;
+    free(slots);
+    slots = NULL;
+    num_slots = 0;
+    size = 0;
+    bytes = 0;
+}
+
+/**
+ * @brief Check whether the disk tier is initialized.
+ *
+ * @return int 1 if initialized; 0 otherwise.
+ */
+int disk_cache_enabled(void)
+{
+    return segments != NULL;
+}
+
+/**
+ * @brief Append a response to the log, replacing the one of the same key.
+ *
+ * @param key Key of the response, non-null.
+ * @param val Response, non-null.
+ * @param val_len Byte size of val.
+ * @param creation_time Time when the response was cached.
+ * @param max_age Time-to-live of the response in seconds.
+ * @param stale_age Seconds the response is kept once stale, so it can be
+ * revalidated or served stale; it expires then.
+ * @return int Number of responses kept. It's 0 if the response is smaller
+ * than DISK_MIN_OBJECT_BYTES, doesn't fit in a segment, or fails to be
+ * written.
+ */
+int disk_cache_put(const char* key,
+                   const char* val,
+                   int val_len,
+                   time_t creation_time,
+                   time_t max_age,
+                   time_t stale_age)
+{
+    struct disk_record record;
+    struct iovec iovs[3];
+    size_t key_len;
+    size_t rec_bytes;
+    unsigned hash;
+    int i;
+
+    if (segments == NULL || key == NULL || val == NULL) {
+        return 0;
+    }
+    disk_cache_remove(key);
+    key_len = strlen(key);
+    rec_bytes = record_bytes(key_len, val_len);
+    if (val_len < DISK_MIN_OBJECT_BYTES || rec_bytes > segment_bytes) {
+        return 0;
+    }
+
+    /* Move on to the next segment once the active one is full. */
+    if (segments[active].used + rec_bytes > segment_bytes) {
+        active = (active + 1) % num_segments;
+        reuse_segment(active);
+    }
+
+    record.key_len = key_len;
+    record.val_len = val_len;
+    record.creation_time = creation_time;
+    record.max_age = max_age;
+    record.stale_age = stale_age;
+    iovs[0].iov_base = &record;
+    iovs[0].iov_len = sizeof(record);
+    iovs[1].iov_base = (char*)key;
+    iovs[1].iov_len = key_len;
+    iovs[2].iov_base = (char*)val;
+    iovs[2].iov_len = val_len;
+    if (pwritev(segments[active].fd, iovs, 3, segments[active].used) !=
+        (ssize_t)rec_bytes) {
+        PLOG_ERROR("pwritev");
+        return 0;
+    }
+
+    /* Keep the load factor of the index at most 1/2. */
+    if ((size + 1) * 2 > num_slots && resize_index(num_slots * 2) < 0) {
+        return 0;
+    }
+    hash = disk_hash(key, key_len);
+    i = find_slot(key, key_len, hash);
+    slots[i].hash = hash;
+    slots[i].segment = active;
+    slots[i].offset = segments[active].used;
+    slots[i].key_len = key_len;
+    slots[i].val_len = val_len;
+    segments[active].used += rec_bytes;
+    ++size;
+    bytes += rec_bytes;
+    return 1;
+}
+
+/**
+ * @brief Take the unexpired response of key out of the log. It may be stale,
+ * if it's kept once stale.
+ *
+ * @param key Key of the response, non-null.
+ * @param out_val Output; copy of the response to free by the caller.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_creation_time Output; time when the response was cached.
+ * @param out_max_age Output; time-to-live of the response in seconds.
+ * @param out_stale_age Output; seconds the response is kept once stale.
+ * @return int 1 if found and unexpired; 0 otherwise. An expired response is
+ * dropped.
+ */
+int disk_cache_take(const char* key,
+                    char** out_val,
+                    int* out_val_len,
+                    time_t* out_creation_time,
+                    time_t* out_max_age,
+                    time_t* out_stale_age)
+{
+    struct disk_record record;
+    struct disk_slot slot;
+    size_t key_len;
+    char* val;
+    int i;
+
+    if (segments == NULL || key == NULL || size == 0) {
+        return 0;
+    }
+    key_len = strlen(key);
+    i = find_slot(key, key_len, disk_hash(key, key_len));
+    if (slots[i].segment < 0) {
+        return 0;
+    }
+    /* The record is taken out whether it's fresh or not. */
+    slot = slots[i];
+    remove_slot(i);
+
+    if (pread(segments[slot.segment].fd, &record, sizeof(record), slot.offset)
+        != sizeof(record)) {
+        PLOG_ERROR("pread");
+        return 0;
+    }
+    if (time(NULL) - record.creation_time >=
+        record.max_age + record.stale_age) {
+        return 0;
+    }
+    val = malloc(slot.val_len);
+    if (val == NULL) {
+        PLOG_ERROR("malloc");
+        return 0;
+    }
+    if (pread(segments[slot.segment].fd,
+              val,
+              slot.val_len,
+              slot.offset + sizeof(record) + key_len) !=
+        (ssize_t)slot.val_len) {
+        PLOG_ERROR("pread");
+        free(val);
+        return 0;
+    }
+    *out_val = val;
+    *out_val_len = slot.val_len;
+    *out_creation_time = record.creation_time;
+    *out_max_age = record.max_age;
+    *out_stale_age = record.stale_age;
+    return 1;
+}
+
+/**
+ * @brief Drop the response of key from the log, if any.
+ *
+ * @param key Key of the response, non-null.
+ * @return int Number of dropped responses.
+ */
+int disk_cache_remove(const char* key)
+{
+    size_t key_len;
+    int i;
+
+    if (segments == NULL || key == NULL || size == 0) {
+        return 0;
+    }
+    key_len = strlen(key);
+    i = find_slot(key, key_len, disk_hash(key, key_len));
+    if (slots[i].segment < 0) {
+        return 0;
+    }
+    remove_slot(i);
+    return 1;
+}
+
+/**
+ * @brief Get the bytes of the responses kept in the log.
+ *
+ * @return size_t Bytes of the records of the indexed responses.
+ */
+size_t disk_cache_bytes(void)
+{
+    return bytes;
+}
+
+/**
+ * @brief Get the number of responses kept in the log.
+ *
+ * @return int Number of indexed responses.
+ */
+int disk_cache_size(void)
+{
+    return size;
+}
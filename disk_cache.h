@@ -0,0 +1,121 @@
+/**************************************************************
+*
+*                       disk_cache.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Interface for disk-backed second tier of the cache.
+*
+*     Responses evicted from the memory cache are appended to
+*     a log of fixed-size segment files, and found by an
+*     in-memory index. A hit takes the response out of the
+*     log, so it can be promoted back to memory. Segments are
+*     reused in turn; reusing one drops whatever it still
+*     holds, so the disk budget is never exceeded and no
+*     compaction is needed.
+*
+*     Segment files are unlinked as soon as they are created,
+*     so they vanish with the process. Only responses of at
+*     least DISK_MIN_OBJECT_BYTES are kept, which bounds the
+*     memory of the index by the disk budget.
+*
+**************************************************************/
+
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define DISK_SEGMENT_BYTES (16 << 20) /* Default byte size of a segment. */
+#define DISK_MIN_OBJECT_BYTES 4096 /* Min byte size of a kept response. */
+
+/**
+ * @brief Create empty segment files in the given directory.
+ *
+ * @param dir Directory for the segment files, non-null.
+ * @param max_bytes Disk budget, at least two segments.
+ * @param seg_bytes Byte size of a segment, > 0.
+ * @return int 0 on success; -1 otherwise.
+ */
+int disk_cache_init(const char* dir, size_t max_bytes, size_t seg_bytes);
+
+/**
+ * @brief Close the segment files and free the index.
+ */
+void disk_cache_clear(void);
+
+/**
+ * @brief Check whether the disk tier is initialized.
+ *
+ * @return int 1 if initialized; 0 otherwise.
+ */
+int disk_cache_enabled(void);
+
+/**
+ * @brief Append a response to the log, replacing the one of the same key.
+ *
+ * @param key Key of the response, non-null.
+ * @param val Response, non-null.
+ * @param val_len Byte size of val.
+ * @param creation_time Time when the response was cached.
+ * @param max_age Time-to-live of the response in seconds.
+ * @param stale_age Seconds the response is kept once stale, so it can be
+ * revalidated or served stale; it expires then.
+ * @return int Number of responses kept. It's 0 if the response is smaller
+ * than DISK_MIN_OBJECT_BYTES, doesn't fit in a segment, or fails to be
+ * written.
+ */
+int disk_cache_put(const char* key,
+                   const char* val,
+                   int val_len,
+                   time_t creation_time,
+                   time_t max_age,
+                   time_t stale_age);
+
+/**
+ * @brief Take the unexpired response of key out of the log. It may be stale,
+ * if it's kept once stale.
+ *
+ * @param key Key of the response, non-null.
+ * @param out_val Output; copy of the response to free by the caller.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_creation_time Output; time when the response was cached.
+ * @param out_max_age Output; time-to-live of the response in seconds.
+ * @param out_stale_age Output; seconds the response is kept once stale.
+ * @return int 1 if found and unexpired; 0 otherwise. An expired response is
+ * dropped.
+ */
+int disk_cache_take(const char* key,
+                    char** out_val,
+                    int* out_val_len,
+                    time_t* out_creation_time,
+                    time_t* out_max_age,
+                    time_t* out_stale_age);
+
+/**
+ * @brief Drop the response of key from the log, if any.
+ *
+ * @param key Key of the response, non-null.
+ * @return int Number of dropped responses.
+ */
+int disk_cache_remove(const char* key);
+
+/**
+ * @brief Get the bytes of the responses kept in the log.
+ *
+ * @return size_t Bytes of the records of the indexed responses.
+ */
+size_t disk_cache_bytes(void);
+
+/**
+ * @brief Get the number of responses kept in the log.
+ *
+ * @return int Number of indexed responses.
+ */
+int disk_cache_size(void);
+
+#endif /* DISK_CACHE_H */
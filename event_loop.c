@@ -0,0 +1,234 @@
+/**************************************************************
+*
+*                       event_loop.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Implementation for edge-triggered epoll event loop.
+*
+**************************************************************/
+
+#include "event_loop.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 256 /* Max number of ready FDs per epoll_wait(). */
+
+static int epoll_fd = -1; /* FD for the epoll instance. */
+static event_handler* handlers = NULL; /* Handler of each FD, indexed by FD. */
+static int handlers_cap = 0; /* Number of slots in handlers. */
+
+/**
+ * @brief Create the epoll instance and an empty handler table.
+ *
+ * @return int 0 on success; -1 otherwise.
+ */
+int event_loop_init(void)
+{
+    if (epoll_fd >= 0) {
+        /* Already initialized. */
+        return -1;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        PLOG_ERROR("epoll_create1");
+        return -1;
+    }
+    handlers = NULL;
+    handlers_cap = 0;
+    return 0;
+}
+
+/**
+ * @brief Close the epoll instance and free the handler table.
+ */
+void event_loop_clear(void)
+{
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+    epoll_fd = -1;
+    free(handlers);
+    handlers = NULL;
+    handlers_cap = 0;
+}
+
+/**
+ * @brief Make sure the handler table has a slot for the given FD.
+ *
+ * @param fd FD, >= 0.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int reserve_handler(int fd)
+{
+    int cap = handlers_cap;
+    event_handler* ret = NULL;
+
+    if (fd < handlers_cap) {
+        return 0;
+    }
+    if (cap == 0) {
+        cap = 64;
+    }
+    while (cap <= fd) {
+        cap *= 2;
+    }
+    ret = realloc(handlers, cap * sizeof(event_handler));
+    if (ret == NULL) {
+        PLOG_ERROR("realloc");
+        return -1;
+    }
+    for (int i = handlers_cap; i < cap; ++i) {
+        ret[i] = NULL;
+    }
+    handlers = ret;
+    handlers_cap = cap;
+    return 0;
+}
+
+/**
+ * @brief Convert EVENT_* flags to edge-triggered epoll flags.
+ *
+ * @param events Bitwise OR of EVENT_READ and EVENT_WRITE.
+ * @return unsigned Epoll event flags.
+ */
+static unsigned to_epoll_events(int events)
+{
+    unsigned ret = EPOLLET;
+
+    if (events & EVENT_READ) {
+        ret |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & EVENT_WRITE) {
+        ret |= EPOLLOUT;
+    }
+    return ret;
+}
+
+/**
+ * @brief Register an FD with interested events and its handler.
+ *
+ * @param fd FD to register, >= 0.
+ * @param events Bitwise OR of EVENT_READ and EVENT_WRITE.
+ * @param handler Callback on readiness, non-null.
+ * @return int 0 on success; -1 otherwise.
+ */
+int event_loop_add(int fd, int events, event_handler handler)
+{
+    struct epoll_event ev;
+
+    if (epoll_fd < 0 || fd < 0 || handler == NULL) {
+        return -1;
+    }
+    if (reserve_handler(fd) < 0) {
+        return -1;
+    }
+
+    ev.events = to_epoll_events(events);
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        PLOG_ERROR("epoll_ctl add (fd: %d)", fd);
+        return -1;
+    }
+    handlers[fd] = handler;
+    return 0;
+}
+
+/**
+ * @brief Change interested events of a registered FD.
+ *
+ * @param fd Registered FD.
+ * @param events Bitwise OR of EVENT_READ and EVENT_WRITE.
+ * @return int 0 on success; -1 otherwise.
+ */
+int event_loop_mod(int fd, int events)
+{
+    struct epoll_event ev;
+
+    if (epoll_fd < 0 || fd < 0 || fd >= handlers_cap || handlers[fd] == NULL) {
+        return -1;
+    }
+
+    ev.events = to_epoll_events(events);
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        PLOG_ERROR("epoll_ctl mod (fd: %d)", fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Unregister an FD. It should be called before closing the FD.
+ *
+ * @param fd Registered FD.
+ * @return int 0 on success; -1 otherwise.
+ */
+int event_loop_del(int fd)
+{
+    if (epoll_fd < 0 || fd < 0 || fd >= handlers_cap || handlers[fd] == NULL) {
+        return -1;
+    }
+
+    handlers[fd] = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+        PLOG_ERROR("epoll_ctl del (fd: %d)", fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Wait for ready FDs once and dispatch them to their handlers.
+ *
+ * @param timeout Max time to wait in milliseconds; -1 to wait forever.
+ * @param sigmask Signal mask to set while waiting, e.g. to let signals that
+ * are blocked otherwise interrupt the wait; NULL to keep the current one.
+ * @return int Number of dispatched FDs; 0 if interrupted by a signal; -1 on
+ * error.
+ */
+int event_loop_run_once(int timeout, const sigset_t* sigmask)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int n;
+    int fd;
+    int ready;
+
+    if (epoll_fd < 0) {
+        return -1;
+    }
+
+    n = epoll_pwait(epoll_fd, events, MAX_EVENTS, timeout, sigmask);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        PLOG_ERROR("epoll_wait");
+        return -1;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        fd = events[i].data.fd;
+        /* The FD may have been unregistered by an earlier handler in this
+         * batch. */
+        if (fd >= handlers_cap || handlers[fd] == NULL) {
+            continue;
+        }
+        ready = 0;
+        /* Report errors and hang-ups as readable so that the handler finds
+         * them on its next read. */
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+            ready |= EVENT_READ;
+        }
+        if (events[i].events & EPOLLOUT) {
+            ready |= EVENT_WRITE;
+        }
+        handlers[fd](fd, ready);
+    }
+    return n;
+}
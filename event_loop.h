@@ -0,0 +1,86 @@
+/**************************************************************
+*
+*                       event_loop.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Interface for edge-triggered epoll event loop.
+*
+**************************************************************/
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <signal.h>
+
+#define EVENT_READ 0x1 /* FD is readable, or has error/hang-up pending. */
+#define EVENT_WRITE 0x2 /* FD is writable. */
+
+/**
+ * @brief Callback invoked when a registered FD becomes ready.
+ *
+ * Events are edge-triggered, so the handler should read/write until the
+ * operation would block (EAGAIN); otherwise it won't be notified again until
+ * new readiness arrives.
+ *
+ * @param fd Ready FD.
+ * @param events Bitwise OR of EVENT_READ and EVENT_WRITE.
+ */
+typedef void (*event_handler)(int fd, int events);
+
+/**
+ * @brief Create the epoll instance and an empty handler table.
+ *
+ * @return int 0 on success; -1 otherwise.
+ */
+int event_loop_init(void);
+
+/**
+ * @brief Close the epoll instance and free the handler table.
+ */
+void event_loop_clear(void);
+
+/**
+ * @brief Register an FD with interested events and its handler.
+ *
+ * The handler table grows on demand, so FD is not limited by FD_SETSIZE.
+ *
+ * @param fd FD to register, >= 0.
+ * @param events Bitwise OR of EVENT_READ and EVENT_WRITE.
+ * @param handler Callback on readiness, non-null.
+ * @return int 0 on success; -1 otherwise.
+ */
+int event_loop_add(int fd, int events, event_handler handler);
+
+/**
+ * @brief Change interested events of a registered FD.
+ *
+ * @param fd Registered FD.
+ * @param events Bitwise OR of EVENT_READ and EVENT_WRITE.
+ * @return int 0 on success; -1 otherwise.
+ */
+int event_loop_mod(int fd, int events);
+
+/**
+ * @brief Unregister an FD. It should be called before closing the FD.
+ *
+ * @param fd Registered FD.
+ * @return int 0 on success; -1 otherwise.
+ */
+int event_loop_del(int fd);
+
+/**
+ * @brief Wait for ready FDs once and dispatch them to their handlers.
+ *
+ * @param timeout Max time to wait in milliseconds; -1 to wait forever.
+ * @param sigmask Signal mask to set while waiting, e.g. to let signals that
+ * are blocked otherwise interrupt the wait; NULL to keep the current one.
+ * @return int Number of dispatched FDs; 0 if interrupted by a signal; -1 on
+ * error.
+ */
+int event_loop_run_once(int timeout, const sigset_t* sigmask);
+
+#endif /* EVENT_LOOP_H */
@@ -11,602 +11,1276 @@
 *
 **************************************************************/
 
+#define _GNU_SOURCE /* For memmem(). */
+
 #include "http_utils.h"
 #include "logger.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 
 /**
- * @brief Parse HTTP request/response and extract its head and body.
- *
- * @param buf Byte buffer should contain a whole HTTP request/response head and
- * may contain a whole/partial/empty entity body.
- * @param n Byte size of the buffer.
- * @param out_head Output pointer to a null-terminated string copy of head
- * without the empty line.
- * If the empty line between head and body is not found, *out_head will remain
- * its original value.
- * @param out_head_len Output; byte size of head.
- * @param out_body Output pointer to a null-terminated string copy of entity
- * body.
- * It may not be the whole entity body, or even be an empty string.
- * If empty line between head and body is not found, *out_body will remain its
- * original value.
- * @param out_body_len Output; byte size of body.
+ * @brief Parse the given host field value of an HTTP request, and extract
+ * hostname and port number.
+ *
+ * @param host Host field value in an HTTP request. It may not contain port
+ * number, and needn't be null-terminated.
+ * @param host_len Byte size of host.
+ * @param out_hostname Output pointer to a null-terminated string copy of
+ * hostname without port number.
+ * @param out_port Output pointer to an integer copy of port number.
+ * If port number is not specified in host field, out_port remains its original
+ * value.
+ * @return int 0 on success; -1 if out of memory.
  */
-void parse_body_head(const char* buf,
-                     const int n,
-                     char** out_head,
-                     int* out_head_len,
-                     char** out_body,
-                     int* out_body_len)
+int parse_host_field(const char* host,
+                     int host_len,
+                     char** out_hostname,
+                     int* out_port)
 {
-    char* pos;
-    unsigned size;
+    const char* st; /* Start of port number. */
+    const char* end = host + host_len;
+    int port = 0;
 
-    if (buf == NULL) {
-        return;
+    st = memchr(host, ':', host_len);
+    *out_hostname = strndup(host, st != NULL ? st - host : host_len);
+    if (*out_hostname == NULL) {
+        PLOG_ERROR("strndup");
+        return -1;
     }
-
-    /* Find the empty line between head and body. */
-    pos = strstr(buf, "\r\n\r\n");
-    /* Invalid response; End of head is not found. */
-    if (pos == NULL) {
-        return;
+    /* No ":" is found, or it's the last char; out_port remains. */
+    if (st == NULL || ++st == end) {
+        return 0;
+    }
+    while (st < end && isdigit((unsigned char)*st) && port <= 65535) {
+        port = port * 10 + (*st - '0');
+        ++st;
     }
+    *out_port = port;
+    return 0;
+}
 
-    /* Copy response head without the empty line. */
-    pos += strlen("\r\n"); /* End of head. */
-    size = pos - buf;
-    *out_head = malloc(size + 1);
-    if (*out_head == NULL) {
-        PLOG_ERROR("malloc");
-        return;
+/**
+ * @brief Find a directive of the given cache control field by name, ignoring
+ * case, and extract its value, e.g. the integer of "stale-if-error=60".
+ *
+ * @param cache_control Cache control field value; it needn't be
+ * null-terminated.
+ * @param len Byte size of cache_control.
+ * @param name Directive name to find.
+ * @param out_value Output; integer value of the directive, which may be
+ * quoted. It remains its original value if the directive is not found or has
+ * no value.
+ * @return int 1 if the directive is found; 0 otherwise.
+ */
+int parse_cache_directive(const char* cache_control,
+                          int len,
+                          const char* name,
+                          int* out_value)
+{
+    const char* pos = cache_control; /* Start of a directive. */
+    const char* end = cache_control + len; /* End of cache_control. */
+    int name_len = strlen(name);
+    int value;
+
+    if (cache_control == NULL) {
+        return 0;
     }
-    memcpy(*out_head, buf, size);
-    (*out_head)[size] = '\0';
-    *out_head_len = size;
 
-    /* Skip the empty line between the head and body. */
-    pos += strlen("\r\n"); /* End of empty line and start of body. */
+    while (pos < end) {
+        while (pos < end && memchr(" \t,", *pos, 3) != NULL) {
+            ++pos;
+        }
+        if (end - pos >= name_len &&
+            strncasecmp(pos, name, name_len) == 0 &&
+            (end - pos == name_len ||
+             memchr("= \t,", pos[name_len], 4) != NULL)) {
+            pos += name_len;
+            while (pos < end && (*pos == ' ' || *pos == '\t')) {
+                ++pos;
+            }
+            if (pos < end && *pos == '=') {
+                ++pos;
+                while (pos < end && memchr(" \t\"", *pos, 3) != NULL) {
+                    ++pos;
+                }
+                if (pos < end && isdigit((unsigned char)*pos)) {
+                    value = 0;
+                    while (pos < end && isdigit((unsigned char)*pos)) {
+                        /* Saturate rather than overflow. */
+                        value = value > (INT_MAX - 9) / 10 ?
+                                INT_MAX :
+                                value * 10 + (*pos - '0');
+                        ++pos;
+                    }
+                    *out_value = value;
+                }
+            }
+            return 1;
+        }
+        /* Skip to the next directive. */
+        while (pos < end && *pos != ',') {
+            ++pos;
+        }
+    }
+    return 0;
+}
 
-    /* Copy response body. */
-    size = n - size - strlen("\r\n");
-    *out_body = malloc(size + 1);
-    if (*out_body == NULL) {
-        PLOG_ERROR("malloc");
+/**
+ * @brief Parse the given cache control field and extract the integer after 
+ * "max-age=".
+ *
+ * @param cache_control String of cache control field.
+ * @param out_max_age Ouput; Integer after "max-age=".
+ * If "max-age=" is not found, *out_max_age will remain its original value.
+ */
+void parse_cache_control(const char* cache_control, int* out_max_age)
+{
+    if (cache_control == NULL) {
         return;
     }
-    memcpy(*out_body, pos, size);
-    (*out_body)[size] = '\0';
-    *out_body_len = size;
+    parse_cache_directive(cache_control,
+                          strlen(cache_control),
+                          "max-age",
+                          out_max_age);
 }
 
 /**
- * Get substring before the first delimiter in the string.
- *
- * @param str String to get prefix from.
- * @param delim Delimiter string right after the prefix.
- * @param out_prefix Output pointer to a string copy of prefix.
- * If string starts with delimiter, *out_prefix will be an empty string.
- * If delimiter is not found, out_prefix will remain.
- * @return Pointer to the char right after the delimiter. NULL if delimiter is
- * not found.
+ * @brief Find a header field of the given HTTP request/response head by name,
+ * ignoring case, and point at its value in place, without copying it. The head
+ * needn't be null-terminated.
+ *
+ * @param head HTTP request/response head, starting with its start line.
+ * @param head_len Byte size of head.
+ * @param name Field name to find.
+ * @param out_value Output; start of the value of the first such field within
+ * head, without surrounding spaces; it isn't null-terminated. It is not changed
+ * if the field is not found.
+ * @param out_len Output; byte size of *out_value.
+ * @return int 1 if the field is found; 0 otherwise.
  */
-char* get_prefix(const char* str, const char* delim, char** out_prefix)
+int find_header_value(const char* head,
+                      int head_len,
+                      const char* name,
+                      const char** out_value,
+                      int* out_len)
 {
-    int len;
-    char* end;
+    const char* st; /* Start of a header line. */
+    const char* end = head + head_len; /* End of head. */
+    const char* line_end; /* End of a header line. */
+    const char* colon; /* End of a field name. */
+    size_t name_len = strlen(name);
 
-    /* Empty string. */
-    if (str == NULL) {
-        return NULL;
+    if (head == NULL || head_len <= 0) {
+        return 0;
     }
 
-    end = strstr(str, delim);
-    /* Prefix is not found. */
-    if (end == NULL) {
-        return NULL;
+    /* Skip the start line. */
+    st = memmem(head, head_len, "\r\n", strlen("\r\n"));
+    if (st == NULL) {
+        return 0;
     }
-    /* `end` points to the end of prefix and the beginning of the first
-     * delimiter. */
-    len = end - str;
-    *out_prefix = malloc(len + 1);
-    if (out_prefix == NULL) {
-        PLOG_ERROR("malloc");
-        return NULL;
+    st += strlen("\r\n");
+
+    /* Check each header line. */
+    while (st < end) {
+        line_end = memmem(st, end - st, "\r\n", strlen("\r\n"));
+        if (line_end == NULL) {
+            line_end = end;
+        }
+        colon = memchr(st, ':', line_end - st);
+        if (colon != NULL &&
+            (size_t)(colon - st) == name_len &&
+            strncasecmp(st, name, name_len) == 0) {
+            /* Trim the value. */
+            st = colon + 1;
+            while (st < line_end && (*st == ' ' || *st == '\t')) {
+                ++st;
+            }
+            while (line_end > st &&
+                   (line_end[-1] == ' ' || line_end[-1] == '\t')) {
+                --line_end;
+            }
+            *out_value = st;
+            *out_len = line_end - st;
+            return 1;
+        }
+        st = line_end + strlen("\r\n");
     }
-    strncpy(*out_prefix, str, len);
-    (*out_prefix)[len] = '\0';
-    end += strlen(delim); /* End of delimiter. */
-    return end;
+    return 0;
 }
 
 /**
- * @brief Parse the given HTTP request line and extract method, url and version 
- * fields.
- *
- * @param line String that starts with HTTP request line to parse. It may
- * contain other contents after the request line.
- * @param out_method Output pointer to a string copy of method field.
- * @param out_url Output pointer to a string copy of url field.
- * @param out_version Output pointer to a string copy of version field.
- * @return Length of request line including "\r\n"; -1 if the given request line
- * is invalid.
+ * @brief Find a header field of the given HTTP request/response head by name,
+ * ignoring case, and extract its value. The head needn't be null-terminated.
+ *
+ * @param head HTTP request/response head, starting with its start line.
+ * @param head_len Byte size of head.
+ * @param name Field name to find.
+ * @param out_value Output pointer to a null-terminated string copy of the value
+ * of the first such field, without surrounding spaces. It is not changed if the
+ * field is not found.
+ * @return int 1 if the field is found; 0 otherwise.
  */
-int parse_request_line(const char* line,
-                       char** out_method,
-                       char** out_url,
-                       char** out_version)
+int find_header_field(const char* head,
+                      int head_len,
+                      const char* name,
+                      char** out_value)
 {
-    char* st; /* Start of a field. */
+    const char* value = NULL;
+    int value_len = 0;
 
-    /* Extract method field. */
-    st = get_prefix(line, " ", out_method);
-    /* " " is not found. */
-    if (st == NULL) {
+    if (!find_header_value(head, head_len, name, &value, &value_len)) {
+        return 0;
+    }
+    *out_value = strndup(value, value_len);
+    if (*out_value == NULL) {
+        PLOG_ERROR("strndup");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Make a conditional copy of the given GET request, which asks the
+ * server to reply "304 Not Modified" if a cached response is still valid.
+ * The validators of the cached response are added as If-None-Match and
+ * If-Modified-Since fields at the end of the head.
+ *
+ * @param request HTTP request head, ending with the empty line.
+ * @param request_len Byte size of request.
+ * @param etag ETag field value of the cached response; NULL if it has none.
+ * @param last_modified Last-Modified field value of the cached response; NULL
+ * if it has none.
+ * @param out_request Output pointer to a null-terminated conditional request.
+ * @param out_len Output; byte size of *out_request.
+ * @return int 0 on success; -1 if the request has no head or the response has
+ * no validator.
+ */
+int make_conditional_request(const char* request,
+                             int request_len,
+                             const char* etag,
+                             const char* last_modified,
+                             char** out_request,
+                             int* out_len)
+{
+    int head_len = request_len - strlen("\r\n"); /* Head without the empty
+                                                   * line. */
+    size_t size;
+    int len;
+
+    if (etag == NULL && last_modified == NULL) {
         return -1;
     }
-    
-    /* Extract url field. */
-    st = get_prefix(st, " ", out_url);
-    /* " " is not found. */
-    if (st == NULL) {
+    if (head_len < 0 ||
+        memcmp(request + head_len, "\r\n", strlen("\r\n")) != 0) {
         return -1;
     }
 
-    /* Extract version field. */
-    st = get_prefix(st, "\r\n", out_version);
-    /* "\r\n" is not found. */
-    if (st == NULL) {
+    size = request_len + 1;
+    if (etag != NULL) {
+        size += strlen("If-None-Match: \r\n") + strlen(etag);
+    }
+    if (last_modified != NULL) {
+        size += strlen("If-Modified-Since: \r\n") + strlen(last_modified);
+    }
+    *out_request = malloc(size);
+    if (*out_request == NULL) {
+        PLOG_ERROR("malloc");
         return -1;
     }
-    /* `st` points to the end of `line`. */
-
-    return st - line;
+    memcpy(*out_request, request, head_len);
+    len = head_len;
+    if (etag != NULL) {
+        len += sprintf(*out_request + len, "If-None-Match: %s\r\n", etag);
+    }
+    if (last_modified != NULL) {
+        len += sprintf(*out_request + len,
+                       "If-Modified-Since: %s\r\n",
+                       last_modified);
+    }
+    len += sprintf(*out_request + len, "\r\n");
+    *out_len = len;
+    return 0;
 }
 
 /**
- * @brief Parse the given HTTP header line and extract field name and value.
- *
- * @param line String that starts with a HTTP header line to parse. It may
- * contain other content after the header line.
- * @param out_name Output pointer to a string copy of field name.
- * @param out_value Output pointer to a string copy of field value.
- * @return Length of header line including "\r\n"; -1 if the given request line
- * is invalid.
+ * @brief Track the framing of a message body over the next bytes received, see
+ * scan_body().
+ *
+ * @param body Framing of the body, set by http_parse().
+ * @param data Next bytes received.
+ * @param len Byte size of data.
+ * @param stop_at_data Whether to stop right after the next run of body data.
+ * @param out_data_len Output; byte size of the run of body data that the
+ * scanned part ends with; 0 if it has none.
+ * @return int Byte size of the leading part of data that is scanned; -1 if the
+ * chunked framing is malformed.
  */
-int parse_header_line(const char* line, char** out_name, char** out_value)
+static int scan_framing(struct http_body* body,
+                        const char* data,
+                        int len,
+                        int stop_at_data,
+                        int* out_data_len)
 {
-    char* st; /* Start of a field. */
+    int pos = 0; /* Bytes of data scanned so far. */
+    long long size; /* Bytes to skip at once. */
+    unsigned char c;
 
-    /* Extract field name. */
-    st = get_prefix(line, ": ", out_name);
-    /* ": " is not found. */
-    if (st == NULL) {
-        return -1;
-    }
+    *out_data_len = 0;
+    while (pos < len && !body->is_done) {
+        /* Skip data in bulk. */
+        if (!body->is_chunked || body->chunk_state == CHUNK_DATA) {
+            size = len - pos;
+            if (body->remaining >= 0 && size > body->remaining) {
+                size = body->remaining;
+            }
+            pos += size;
+            body->data_len += size;
+            *out_data_len = size;
+            if (body->remaining < 0) {
+                return pos;
+            }
+            body->remaining -= size;
+            if (body->remaining == 0) {
+                if (body->is_chunked) {
+                    body->chunk_state = CHUNK_DATA_END;
+                }
+                else {
+                    body->is_done = 1;
+                }
+            }
+            if (stop_at_data) {
+                return pos;
+            }
+            *out_data_len = 0;
+            continue;
+        }
 
-    /* Extract field value. */
-    st = get_prefix(st, "\r\n", out_value);
-    /* "\r\n" is not found. */
-    if (st == NULL) {
-        return -1;
+        /* Scan the lines around the chunk data byte by byte. */
+        c = data[pos++];
+        switch (body->chunk_state) {
+        case CHUNK_SIZE:
+            if (isxdigit(c)) {
+                if (body->remaining > (LLONG_MAX >> 4)) {
+                    return -1;
+                }
+                body->remaining = body->remaining * 16 +
+                                  (isdigit(c) ?
+                                   c - '0' :
+                                   tolower(c) - 'a' + 10);
+                ++body->line_len;
+                break;
+            }
+            /* Past the size, an extension or the line break must follow. */
+            if (body->line_len == 0 || memchr(";\t \r", c, 4) == NULL) {
+                return -1;
+            }
+            body->chunk_state = CHUNK_EXT;
+            /* FALLTHROUGH */
+        case CHUNK_EXT:
+            if (c == '\r') {
+                body->chunk_state = CHUNK_SIZE_LF;
+            }
+            else if ((c < 0x20 && c != '\t') || c == 0x7f) {
+                return -1;
+            }
+            break;
+        case CHUNK_SIZE_LF:
+            if (c != '\n') {
+                return -1;
+            }
+            body->line_len = 0;
+            body->chunk_state = body->remaining > 0 ?
+                                CHUNK_DATA :
+                                CHUNK_TRAILER;
+            break;
+        case CHUNK_DATA_END:
+            /* line_len counts the bytes of the CRLF so far. */
+            if (c != "\r\n"[body->line_len]) {
+                return -1;
+            }
+            if (++body->line_len == 2) {
+                body->line_len = 0;
+                body->chunk_state = CHUNK_SIZE;
+            }
+            break;
+        case CHUNK_TRAILER:
+            if (c == '\r') {
+                body->chunk_state = CHUNK_TRAILER_LF;
+            }
+            else if ((c < 0x20 && c != '\t') || c == 0x7f) {
+                return -1;
+            }
+            else {
+                ++body->line_len;
+            }
+            break;
+        case CHUNK_TRAILER_LF:
+            if (c != '\n') {
+                return -1;
+            }
+            /* An empty line ends the body. */
+            body->is_done = body->line_len == 0;
+            body->line_len = 0;
+            body->chunk_state = CHUNK_TRAILER;
+            break;
+        default:
+            break;
+        }
     }
-    /* `st` points to the end of `line`. */
+    return pos;
+}
 
-    return st - line;
+/**
+ * @brief Track the framing of a message body over the next bytes received
+ * after what's been scanned so far, and find where the body ends. Each byte is
+ * scanned once, however the body is split. Chunk extensions and trailer fields
+ * are checked for control chars, and skipped.
+ *
+ * @param body Framing of the body, set by http_parse().
+ * @param data Next bytes received.
+ * @param len Byte size of data.
+ * @return int Byte size of the leading part of data that belongs to the body;
+ * it's less than len only if the body ends within data, and body->is_done is
+ * set then. -1 if the chunked framing is malformed, e.g. a line doesn't end
+ * with CRLF.
+ */
+int scan_body(struct http_body* body, const char* data, int len)
+{
+    int data_len;
+
+    return scan_framing(body, data, len, 0, &data_len);
 }
 
 /**
- * @brief Parse the given HTTP request and extract method, url, version and host
- * fields.
- *
- * @param request HTTP request to parse.
- * @param out_method Output pointer to a null-terminated string as a copy of
- * method field in the request.
- * @param out_url Output pointer to a null-terminated string as a copy of url
- * field in the request.
- * @param out_version Output pointer to a null-terminated string as a copy of
- * version field in the request.
- * @param host Output pointer to a null-terminated string as a copy of host
- * field in the requst.
+ * @brief Like scan_body(), but stop right after the next run of body data, so
+ * a chunked body can be taken out of its framing.
+ *
+ * @param body Framing of the body, set by http_parse().
+ * @param data Next bytes received.
+ * @param len Byte size of data.
+ * @param out_data_len Output; byte size of the run of body data that the
+ * scanned part ends with; 0 if it has none.
+ * @return int Byte size of the leading part of data that is scanned; -1 if the
+ * chunked framing is malformed.
  */
-void parse_request_head(const char* request,
-                        char** out_method,
-                        char** out_url,
-                        char** out_version,
-                        char** out_host)
+int scan_body_data(struct http_body* body,
+                   const char* data,
+                   int len,
+                   int* out_data_len)
 {
-    const char* st = request; /* Start of the part to parse. */
-    const char* end = request + strlen(request); /* End of request. */
-    int len = 0; /* Byte size of the last parsed part. */
-    char* name = NULL; /* Field name of a header line. */
-    char* value = NULL; /* Field value of a header line. */
+    return scan_framing(body, data, len, 1, out_data_len);
+}
 
-    /* Parse request line. */
-    len = parse_request_line(st, out_method, out_url, out_version);
+/* Bitmap of the chars of a token, e.g. a method or field name: letters,
+ * digits and "!#$%&'*+-.^_`|~". */
+static const unsigned int token_chars[8] = {
+    0x00000000, 0x03ff6cfa, 0xc7fffffe, 0x57ffffff, 0, 0, 0, 0
+};
 
-    /* Parse each header line. */
-    st += len; /* End of request line. */
-    while (st < end) {
-        len = parse_header_line(st, &name, &value);
-        if (len < 0) {
-            free(name);
-            name = NULL;
-            free(value);
-            value = NULL;
+#if defined(__x86_64__) || defined(__i386__)
+/* Nibble tables of token_chars for the vector kernels: bit h of the entry for
+ * a low nibble is set if the char of high nibble h and that low nibble is a
+ * token char, and the entry for a high nibble is its bit. Chars of high nibble
+ * 8 or more aren't token chars. */
+static unsigned char token_lo_bits[16];
+static const unsigned char token_hi_bits[16] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0, 0, 0, 0, 0, 0, 0, 0
+};
+#endif
+
+/* Kernels that scan a head, picked by http_scan_set_kernel(). Each returns
+ * the byte size of the leading run of its chars in str. */
+static enum http_scan_kernel scan_kernel;
+static int (*scan_token)(const char* str, int len) = NULL; /* Token chars. */
+/* Field text, i.e. no control chars but tabs. */
+static int (*scan_text)(const char* str, int len) = NULL;
+
+/**
+ * @brief Scan the leading token chars of a string a byte at a time.
+ *
+ * @param str String to scan; it needn't be null-terminated.
+ * @param len Byte size of str.
+ * @return int Byte size of the leading run of token chars.
+ */
+static int scan_token_scalar(const char* str, int len)
+{
+    unsigned char c;
+    int i = 0;
+
+    for (; i < len; ++i) {
+        c = str[i];
+        if (!((token_chars[c >> 5] >> (c & 31)) & 1)) {
             break;
         }
-        if (name != NULL && strcmp(name, "Host") == 0) {
-            *out_host = value;
-            value = NULL;
-            free(name);
-            name = NULL;
+    }
+    return i;
+}
+
+/**
+ * @brief Scan the leading field text of a string 8 bytes at a time, until a
+ * word may have a control char; a tab passes in the byte by byte check after.
+ *
+ * @param str String to scan; it needn't be null-terminated.
+ * @param len Byte size of str.
+ * @return int Byte size of the leading run of field text.
+ */
+static int scan_text_scalar(const char* str, int len)
+{
+    const uint64_t ones = 0x0101010101010101ULL; /* 0x01 in each byte. */
+    const uint64_t highs = ones * 0x80; /* High bit of each byte. */
+    uint64_t word;
+    uint64_t del; /* Bytes of word that are DEL (0x7f) are 0 in del. */
+    unsigned char c;
+    int i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&word, str + i, sizeof(word));
+        del = word ^ (ones * 0x7f);
+        if ((((word - ones * ' ') & ~word) | ((del - ones) & ~del)) & highs) {
             break;
         }
-        free(name);
-        name = NULL;
-        free(value);
-        value = NULL;
-        st += len;
     }
+    for (; i < len; ++i) {
+        c = str[i];
+        if ((c < 0x20 && c != '\t') || c == 0x7f) {
+            break;
+        }
+    }
+    return i;
 }
 
+#if defined(__x86_64__) || defined(__i386__)
 /**
- * @brief Parse the given host field value of an HTTP request, and extract
- * hostname and port number.
+ * @brief Scan the leading token chars of a string 16 bytes at a time, by
+ * looking up the nibbles of each byte in token_lo_bits and token_hi_bits.
  *
- * @param host Host field value in an HTTP request. It may not contain port
- * number.
- * @param out_hostname Output pointer to a string copy of hostname without port
- * number.
- * @param out_port Output pointer to an integer copy of port number.
- * If port number is not specified in host field, out_port remains its original
- * value.
+ * @param str String to scan; it needn't be null-terminated.
+ * @param len Byte size of str.
+ * @return int Byte size of the leading run of token chars.
  */
-void parse_host_field(const char* host, char** out_hostname, int* out_port)
+__attribute__((target("sse4.2")))
+static int scan_token_sse42(const char* str, int len)
 {
-    char* st; /* Start of port number. */
+    const __m128i lo_bits = _mm_loadu_si128((const __m128i*)token_lo_bits);
+    const __m128i hi_bits = _mm_loadu_si128((const __m128i*)token_hi_bits);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i chars;
+    __m128i bits;
+    int mask;
+    int i = 0;
 
-    st = get_prefix(host, ":", out_hostname);
-    /* No ":" is found. */
-    if (st == NULL) {
-        *out_hostname = strdup(host);
-        /* out_port remains. */
-        return;
+    for (; i + 16 <= len; i += 16) {
+        chars = _mm_loadu_si128((const __m128i*)(str + i));
+        bits = _mm_and_si128(
+            _mm_shuffle_epi8(lo_bits, _mm_and_si128(chars, nibble)),
+            _mm_shuffle_epi8(hi_bits,
+                             _mm_and_si128(_mm_srli_epi16(chars, 4), nibble)));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128()));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
     }
-    /* Convert substring after the first ":" to port number in integer. */
-    if (st < host + strlen(host)) {
-        *out_port = atoi(st);
+    return i + scan_token_scalar(str + i, len - i);
+}
+
+/**
+ * @brief Scan the leading field text of a string 16 bytes at a time, with a
+ * string compare of the control char ranges.
+ *
+ * @param str String to scan; it needn't be null-terminated.
+ * @param len Byte size of str.
+ * @return int Byte size of the leading run of field text.
+ */
+__attribute__((target("sse4.2")))
+static int scan_text_sse42(const char* str, int len)
+{
+    /* Control chars but tabs, as 3 ranges. */
+    const __m128i ranges = _mm_setr_epi8(0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f,
+                                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    int pos;
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        pos = _mm_cmpestri(ranges,
+                           6,
+                           _mm_loadu_si128((const __m128i*)(str + i)),
+                           16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES);
+        if (pos < 16) {
+            return i + pos;
+        }
     }
-    /* If the first ":" is the last char, out_port will remain.*/
+    return i + scan_text_scalar(str + i, len - i);
 }
 
 /**
- * @brief Parse the given HTTP status line and extract version, status code and 
- * phrase fields.
- *
- * @param line String that starts with HTTP status line to parse. It may contain
- * other contents after the status line.
- * @param out_version Output pointer to a string copy of version field.
- * @param out_status_code Output pointer to an integer copy of status code
- * field.
- * @param out_phrase Pointer to a string copy of phrase field.
- * @return Length of status line including "\r\n"; -1 if the given request line
- * is invalid.
+ * @brief Scan the leading token chars of a string 32 bytes at a time, like
+ * scan_token_sse42().
+ *
+ * @param str String to scan; it needn't be null-terminated.
+ * @param len Byte size of str.
+ * @return int Byte size of the leading run of token chars.
  */
-int parse_status_line(const char* line,
-                      char** out_version,
-                      int* out_status_code,
-                      char** out_phrase)
+__attribute__((target("avx2")))
+static int scan_token_avx2(const char* str, int len)
 {
-    char* st;
-    char* status_code;
-    
-    /* Extract version field. */
-    st = get_prefix(line, " ", out_version);
-    /* " " is not found. */
-    if (*out_version == NULL) {
-        return -1;
+    const __m256i lo_bits = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)token_lo_bits));
+    const __m256i hi_bits = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)token_hi_bits));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i chars;
+    __m256i bits;
+    unsigned mask;
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        chars = _mm256_loadu_si256((const __m256i*)(str + i));
+        bits = _mm256_and_si256(
+            _mm256_shuffle_epi8(lo_bits, _mm256_and_si256(chars, nibble)),
+            _mm256_shuffle_epi8(
+                hi_bits,
+                _mm256_and_si256(_mm256_srli_epi16(chars, 4), nibble)));
+        mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(bits, _mm256_setzero_si256()));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
     }
+    return i + scan_token_sse42(str + i, len - i);
+}
 
-    /* Extract status code field. */
-    st = get_prefix(st, " ", &status_code);
-    /* " " is not found. */
-    if (status_code == NULL) {
-        return -1;
+/**
+ * @brief Scan the leading field text of a string 32 bytes at a time: a byte
+ * ends it if it's at most 0x1f but not a tab, or if it's DEL.
+ *
+ * @param str String to scan; it needn't be null-terminated.
+ * @param len Byte size of str.
+ * @return int Byte size of the leading run of field text.
+ */
+__attribute__((target("avx2")))
+static int scan_text_avx2(const char* str, int len)
+{
+    const __m256i max_ctl = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    __m256i chars;
+    __m256i ctls;
+    unsigned mask;
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        chars = _mm256_loadu_si256((const __m256i*)(str + i));
+        ctls = _mm256_cmpeq_epi8(_mm256_max_epu8(chars, max_ctl), max_ctl);
+        ctls = _mm256_or_si256(
+            _mm256_andnot_si256(_mm256_cmpeq_epi8(chars, tab), ctls),
+            _mm256_cmpeq_epi8(chars, del));
+        mask = _mm256_movemask_epi8(ctls);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
     }
-    *out_status_code = atoi(status_code);
-    free(status_code);
-    status_code = NULL;
+    return i + scan_text_sse42(str + i, len - i);
+}
+#endif
 
-    /* Extract phrase field. */
-    st = get_prefix(st, "\r\n", out_phrase);
-    /* "\r\n" is not found. */
-    if (*out_phrase == NULL) {
+/**
+ * @brief Pick the kernels that scan heads. By default, the SSE4.2 ones are
+ * picked on first use if the CPU supports them, or the scalar ones otherwise.
+ *
+ * @param kernel Kernels to pick.
+ * @return int 0 on success; -1 if the CPU doesn't support them.
+ */
+int http_scan_set_kernel(enum http_scan_kernel kernel)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    /* Fill the nibble tables of token chars. */
+    for (int lo = 0; lo < 16; ++lo) {
+        token_lo_bits[lo] = 0;
+        for (int hi = 0; hi < 8; ++hi) {
+            if ((token_chars[hi >> 1] >> ((hi & 1) * 16 + lo)) & 1) {
+                token_lo_bits[lo] |= 1 << hi;
+            }
+        }
+    }
+#endif
+
+    switch (kernel) {
+    case HTTP_SCAN_SCALAR:
+        scan_token = scan_token_scalar;
+        scan_text = scan_text_scalar;
+        break;
+#if defined(__x86_64__) || defined(__i386__)
+    case HTTP_SCAN_SSE42:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse4.2")) {
+            return -1;
+        }
+        scan_token = scan_token_sse42;
+        scan_text = scan_text_sse42;
+        break;
+    case HTTP_SCAN_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2") ||
+            !__builtin_cpu_supports("sse4.2")) {
+            return -1;
+        }
+        scan_token = scan_token_avx2;
+        scan_text = scan_text_avx2;
+        break;
+#endif
+    default:
         return -1;
     }
+    scan_kernel = kernel;
+    return 0;
+}
+
+/**
+ * @brief Get the kernels that scan heads, picking the default ones if none
+ * are picked yet.
+ *
+ * @return enum http_scan_kernel Kernels in use.
+ */
+enum http_scan_kernel http_scan_get_kernel(void)
+{
+    if (scan_token == NULL && http_scan_set_kernel(HTTP_SCAN_SSE42) < 0) {
+        http_scan_set_kernel(HTTP_SCAN_SCALAR);
+    }
+    return scan_kernel;
+}
 
-    return st - line;
+/**
+ * @brief Whether a string may be a field value or reason phrase, i.e. it has
+ * no control chars but tabs.
+ *
+ * @param str String to check; it needn't be null-terminated.
+ * @param len Byte size of str.
+ * @return int 1 if it's valid; 0 otherwise.
+ */
+static int is_field_text(const char* str, int len)
+{
+    return scan_text(str, len) == len;
 }
 
+/**
+ * @brief Whether a string is an HTTP/1.x version, e.g. "HTTP/1.1".
+ *
+ * @param str String to check; it needn't be null-terminated.
+ * @param len Byte size of str.
+ * @return int 1 if it's valid; 0 otherwise.
+ */
+static int is_http_version(const char* str, int len)
+{
+    return len == (int)strlen("HTTP/1.1") &&
+           memcmp(str, "HTTP/1.", strlen("HTTP/1.")) == 0 &&
+           isdigit((unsigned char)str[len - 1]);
+}
 
 /**
- * @brief Parse the given HTTP response, extract version, status code, phrase, 
- * content length and cache_control fields.
- *
- * @param response String that starts with HTTP response to parse. It contains
- * the whole response header. But it may not contain the whole entity body.
- * @param out_version Output pointer to a string copy of version field.
- * @param out_status_code Output pointer to an integer copy of status code
- * field.
- * @param out_phrase Output pointer to a string copy of phrase field.
- * @param out_content_length Output pointer to a string copy of content length
- * field.
- * @param out_cache_control Output pointer to a string copy of cache control
- * field.
+ * @brief Set where a slice is in the buffer; it points into the buffer once
+ * the head is complete.
+ *
+ * @param slice Slice to set.
+ * @param off Offset of the slice in the buffer.
+ * @param len Byte size of the slice.
  */
-void parse_response_head(const char* response,
-                         int response_len,
-                         char** out_version,
-                         int* out_status_code,
-                         char** out_phrase,
-                         int* out_content_length,
-                         char** out_cache_control)
+static void set_slice(struct http_slice* slice, int off, int len)
 {
-    const char* st = response; /* Start of the part to parse. */
-    const char* end = response + response_len; /* End of response. */
-    int len = 0; /* Byte size of the last parsed part. */
-    char* name = NULL; /* Field name of a header line. */
-    char* value = NULL; /* Field value of a header line. */
+    slice->ptr = NULL;
+    slice->off = off;
+    slice->len = len;
+}
 
-    /* Parse status line. */
-    len = parse_status_line(response, out_version, out_status_code, out_phrase);
+/**
+ * @brief Whether a slice of the buffer equals a string, ignoring case.
+ *
+ * @param buf Buffer of the slice.
+ * @param slice Slice to compare.
+ * @param str Null-terminated string to compare with.
+ * @return int 1 if they're equal; 0 otherwise.
+ */
+static int slice_equals(const char* buf,
+                        const struct http_slice* slice,
+                        const char* str)
+{
+    return (size_t)slice->len == strlen(str) &&
+           strncasecmp(buf + slice->off, str, slice->len) == 0;
+}
 
-    /* Parse each header line. */
-    st += len; /* End of status line. */
-    while (st < end) {
-        len = parse_header_line(st, &name, &value);
-        if (name != NULL) {
-            if (strcmp(name, "Content-Length") == 0) {
-                *out_content_length = atoi(value);
-            }
-            else if (strcmp(name, "Cache-Control") == 0) {
-                *out_cache_control = value;
-                value = NULL;
-            }
-        }
-        free(name);
-        name = NULL;
-        free(value);
-        value = NULL;
-        st += len;
+/**
+ * @brief Parse a request line: method, URL and version, separated by single
+ * spaces.
+ *
+ * @param parser Parser of the request.
+ * @param buf Buffer of the request.
+ * @param st Offset of the line in buf.
+ * @param len Byte size of the line without its line break.
+ * @return int 0 on success; -1 if the line is malformed.
+ */
+static int parse_request_line(struct http_parser* parser,
+                              const char* buf,
+                              int st,
+                              int len)
+{
+    const char* line = buf + st;
+    const char* end = line + len;
+    const char* url; /* Start of the URL. */
+    const char* version; /* Start of the version. */
+
+    /* The method is the token run, which must end at a space. */
+    url = line + scan_token(line, len);
+    if (url == line || url == end || *url != ' ') {
+        return -1;
+    }
+    ++url;
+    /* The URL is the field text run up to a space; tabs aren't allowed. */
+    version = memchr(url, ' ', end - url);
+    if (version == NULL || version == url ||
+        scan_text(url, version - url) != version - url ||
+        memchr(url, '\t', version - url) != NULL) {
+        return -1;
     }
+    ++version;
+    if (!is_http_version(version, end - version)) {
+        return -1;
+    }
+    set_slice(&parser->method, st, url - 1 - line);
+    set_slice(&parser->url, st + (url - line), version - 1 - url);
+    set_slice(&parser->version, st + (version - line), end - version);
+    return 0;
 }
 
 /**
- * @brief Parse the given cache control field and extract the integer after 
- * "max-age=".
+ * @brief Parse a status line: version, 3-digit status code and an optional
+ * reason phrase, separated by single spaces.
  *
- * @param cache_control String of cache control field.
- * @param out_max_age Ouput; Integer after "max-age=".
- * If "max-age=" is not found, *out_max_age will remain its original value.
- * @return 
+ * @param parser Parser of the response.
+ * @param buf Buffer of the response.
+ * @param st Offset of the line in buf.
+ * @param len Byte size of the line without its line break.
+ * @return int 0 on success; -1 if the line is malformed.
  */
-void parse_cache_control(const char* cache_control, int* out_max_age)
+static int parse_status_line(struct http_parser* parser,
+                             const char* buf,
+                             int st,
+                             int len)
 {
-    char* pos;
-    static const char* prefix = "max-age=";
+    const char* line = buf + st;
+    int version_len = strlen("HTTP/1.1");
+    int reason_st = version_len + strlen(" 200 ");
 
-    if (cache_control == NULL) {
-        return;
+    if (len < reason_st - 1 ||
+        !is_http_version(line, version_len) ||
+        line[version_len] != ' ' ||
+        !isdigit((unsigned char)line[version_len + 1]) ||
+        !isdigit((unsigned char)line[version_len + 2]) ||
+        !isdigit((unsigned char)line[version_len + 3]) ||
+        (len >= reason_st && line[reason_st - 1] != ' ')) {
+        return -1;
+    }
+    if (len < reason_st) {
+        reason_st = len;
     }
+    if (!is_field_text(line + reason_st, len - reason_st)) {
+        return -1;
+    }
+    parser->status_code = atoi(line + version_len + 1);
+    set_slice(&parser->version, st, version_len);
+    set_slice(&parser->reason, st + reason_st, len - reason_st);
+    return 0;
+}
 
-    pos = strstr(cache_control, prefix);
-    /* "max-age=" is not found. */
-    if (pos == NULL) {
-        return;
+/**
+ * @brief Check a field that frames the body, i.e. Content-Length or
+ * Transfer-Encoding, and note the framing it sets.
+ *
+ * @param parser Parser of the message.
+ * @param buf Buffer of the message.
+ * @param field Field to check.
+ * @return int 0 on success; -1 if the field is malformed or contradicts an
+ * earlier one.
+ */
+static int parse_framing_field(struct http_parser* parser,
+                               const char* buf,
+                               const struct http_field* field)
+{
+    const char* value = buf + field->value.off;
+    int len = field->value.len;
+    long long content_length = 0;
+    int st; /* Start of the last coding. */
+
+    if (slice_equals(buf, &field->name, "Content-Length")) {
+        if (len == 0) {
+            return -1;
+        }
+        for (int i = 0; i < len; ++i) {
+            if (!isdigit((unsigned char)value[i]) ||
+                content_length > (LLONG_MAX - 9) / 10) {
+                return -1;
+            }
+            content_length = content_length * 10 + (value[i] - '0');
+        }
+        /* Repeated lengths have to agree. */
+        if (parser->content_length >= 0 &&
+            parser->content_length != content_length) {
+            return -1;
+        }
+        parser->content_length = content_length;
     }
-    pos += strlen(prefix); /* End of "max-age=". */
-    /* Empty after "max-age=". */
-    if (pos >= cache_control + strlen(cache_control)) {
-        return;
+    else if (slice_equals(buf, &field->name, "Transfer-Encoding")) {
+        /* The body is chunked if the last coding applied is. */
+        st = len;
+        while (st > 0 && value[st - 1] != ',') {
+            --st;
+        }
+        while (st < len && (value[st] == ' ' || value[st] == '\t')) {
+            ++st;
+        }
+        parser->has_transfer_encoding = 1;
+        parser->body.is_chunked =
+            len - st == (int)strlen("chunked") &&
+            strncasecmp(value + st, "chunked", len - st) == 0;
     }
-    *out_max_age = atoi(pos);
+    return 0;
 }
 
 /**
- * @brief Extract the first complete HTTP request from buf.
- * 
- * @param buf Buffer may contain a HTTP request.
- * @param n Byte size of the buffer.
- * @param out_request Output: String of the first HTTP request in buffer if the 
- * request is completed; it is not changed otherwise.
- * @param out_len Output; Byte size of request if it is completed; it is not
- * changed otherwise.
- * @return int Number of extracted request, i.e. 1 on success; 0 otherwise.
+ * @brief Parse a header field line: a token name, a colon, and a value with
+ * optional spaces around it.
+ *
+ * @param parser Parser of the message.
+ * @param buf Buffer of the message.
+ * @param st Offset of the line in buf.
+ * @param len Byte size of the line without its line break.
+ * @return int 0 on success; -1 if the line is malformed, e.g. folded onto the
+ * last one, or there are too many fields.
  */
-int extract_first_request(char** buf,
-                          int* n,
-                          char** out_request,
-                          int* out_len) {
-    char* end = NULL;
-    int size = -1;
-    char* new_buf = NULL;
-
-    if (buf == NULL || *buf == NULL) {
-        return 0;
+static int parse_field_line(struct http_parser* parser,
+                            const char* buf,
+                            int st,
+                            int len)
+{
+    const char* line = buf + st;
+    const char* colon;
+    struct http_field* field = NULL;
+    int value_st;
+    int value_end = len;
+
+    /* The name is the token run, which must end at the colon; a space before
+     * the colon, or a folded line, ends it early. */
+    colon = line + scan_token(line, len);
+    if (colon == line ||
+        colon == line + len ||
+        *colon != ':' ||
+        parser->num_fields == HTTP_MAX_FIELDS) {
+        return -1;
+    }
+    value_st = colon + 1 - line;
+    while (value_st < value_end &&
+           (line[value_st] == ' ' || line[value_st] == '\t')) {
+        ++value_st;
+    }
+    while (value_end > value_st &&
+           (line[value_end - 1] == ' ' || line[value_end - 1] == '\t')) {
+        --value_end;
     }
+    if (!is_field_text(line + value_st, value_end - value_st)) {
+        return -1;
+    }
+
+    field = &(parser->fields[parser->num_fields++]);
+    set_slice(&(field->name), st, colon - line);
+    set_slice(&(field->value), st + value_st, value_end - value_st);
+    return parse_framing_field(parser, buf, field);
+}
 
-    /* Find the empty line between head and body. */
-    end = strstr(*buf, "\r\n\r\n");
-    if (end == NULL) {
-        /* Request head is incomplete. */
+/**
+ * @brief Set up the framing of the body once the head is complete.
+ *
+ * @param parser Parser of the message.
+ * @return int 0 on success; -1 if the framing of a request is ambiguous.
+ */
+static int set_body_framing(struct http_parser* parser)
+{
+    struct http_body* body = &(parser->body);
+    int status_code = parser->status_code;
+
+    if (!parser->is_request &&
+        ((status_code >= 100 && status_code < 200) ||
+         status_code == 204 ||
+         status_code == 304)) {
+        /* Fields describe the body the response stands for, e.g. the cached
+         * one of "304 Not Modified". */
+        body->is_chunked = 0;
+        body->is_done = 1;
         return 0;
     }
-    
-    end += strlen("\r\n\r\n"); /* End of request. */
-    size = end - *buf; /* Byte size of request. */
-    
-    /* Copy response head without the empty line. */
-    *out_request = malloc(size + 1);
-    if (*out_request == NULL) {
-        PLOG_ERROR("malloc");
+    if (parser->has_transfer_encoding) {
+        if (parser->is_request &&
+            (!body->is_chunked || parser->content_length >= 0)) {
+            return -1;
+        }
+        /* A response that isn't chunked ends when the connection is
+         * closed. Content-Length doesn't count either way. */
+        body->remaining = body->is_chunked ? 0 : -1;
         return 0;
     }
-    memcpy(*out_request, *buf, size);
-    (*out_request)[size] = '\0';
-    *out_len = size;
+    if (parser->content_length >= 0) {
+        body->remaining = parser->content_length;
+        body->is_done = parser->content_length == 0;
+    }
+    else if (parser->is_request) {
+        /* A request without a length has no body. */
+        body->is_done = 1;
+    }
+    else {
+        /* Without a length, the body ends when the connection is closed. */
+        body->remaining = -1;
+    }
+    return 0;
+}
 
-    /* Remove the copied response from buf. */
-    if (*n > size) {
-        new_buf = malloc(*n - size);
-        if (new_buf == NULL) {
-            PLOG_ERROR("malloc");
-            return 0;
+/**
+ * @brief Reset a parser for the next message of a connection.
+ *
+ * @param parser Parser to reset.
+ * @param is_request Whether to parse a request; a response otherwise.
+ */
+void http_parser_init(struct http_parser* parser, int is_request)
+{
+    parser->is_request = is_request;
+    parser->pos = 0;
+    parser->line_start = 0;
+    parser->has_start_line = 0;
+    parser->head_len = 0;
+    set_slice(&(parser->method), 0, 0);
+    set_slice(&(parser->url), 0, 0);
+    set_slice(&(parser->version), 0, 0);
+    parser->status_code = -1;
+    set_slice(&(parser->reason), 0, 0);
+    parser->num_fields = 0;
+    parser->content_length = -1;
+    parser->has_transfer_encoding = 0;
+    parser->body.is_chunked = 0;
+    parser->body.is_done = 0;
+    parser->body.remaining = 0;
+    parser->body.chunk_state = CHUNK_SIZE;
+    parser->body.line_len = 0;
+    parser->body.data_len = 0;
+}
+
+/**
+ * @brief Parse the head of an HTTP/1.x message at the start of the given
+ * buffer, resuming from where the last call on the buffer stopped.
+ *
+ * The start line, the syntax of field names and values, and the fields that
+ * frame the body are validated in the same pass. A request with both a
+ * Content-Length and a Transfer-Encoding, or with a Transfer-Encoding that
+ * isn't chunked, is malformed, since its end would be ambiguous. So is a head
+ * with lines not ending with CRLF, or with folded fields.
+ *
+ * @param parser Parser of the message.
+ * @param buf Buffer that starts with the message. It holds at least what it
+ * held in the last call, and may have moved since then.
+ * @param n Byte size of buf.
+ * @return int HTTP_PARSE_DONE once the head is complete, and its slices point
+ * into buf; HTTP_PARSE_PARTIAL if more data is needed; HTTP_PARSE_ERROR if the
+ * head is malformed, or larger than HTTP_MAX_HEAD_BYTES.
+ */
+int http_parse(struct http_parser* parser, const char* buf, int n)
+{
+    const char* line_end; /* Line feed at the end of a line. */
+    int st; /* Offset of a line. */
+    int len; /* Byte size of a line without its line break. */
+    int ret;
+
+    if (scan_token == NULL) {
+        http_scan_get_kernel();
+    }
+    while (parser->head_len == 0) {
+        /* Only the bytes after the last call are scanned. memchr() of the C
+         * library is vectorized for the CPU already. */
+        line_end = memchr(buf + parser->pos, '\n', n - parser->pos);
+        if (line_end == NULL) {
+            parser->pos = n;
+            return n > HTTP_MAX_HEAD_BYTES ?
+                   HTTP_PARSE_ERROR :
+                   HTTP_PARSE_PARTIAL;
+        }
+        st = parser->line_start;
+        len = line_end - (buf + st);
+        parser->pos = st + len + 1;
+        parser->line_start = parser->pos;
+        if (parser->pos > HTTP_MAX_HEAD_BYTES) {
+            return HTTP_PARSE_ERROR;
+        }
+        /* Lines end with CRLF. */
+        if (len == 0 || buf[st + len - 1] != '\r') {
+            return HTTP_PARSE_ERROR;
+        }
+        --len;
+
+        if (!parser->has_start_line) {
+            parser->has_start_line = 1;
+            ret = parser->is_request ?
+                  parse_request_line(parser, buf, st, len) :
+                  parse_status_line(parser, buf, st, len);
+        }
+        else if (len == 0) {
+            /* The empty line ends the head. */
+            parser->head_len = parser->pos;
+            ret = set_body_framing(parser);
+        }
+        else {
+            ret = parse_field_line(parser, buf, st, len);
+        }
+        if (ret < 0) {
+            return HTTP_PARSE_ERROR;
         }
-        memcpy(new_buf, *buf + size, *n - size);
     }
-    free(*buf);
-    *buf = new_buf;
-    *n -= size;
-    return 1;
+
+    /* Point the slices into the buffer as it is now. */
+    parser->method.ptr = buf + parser->method.off;
+    parser->url.ptr = buf + parser->url.off;
+    parser->version.ptr = buf + parser->version.off;
+    parser->reason.ptr = buf + parser->reason.off;
+    for (int i = 0; i < parser->num_fields; ++i) {
+        parser->fields[i].name.ptr = buf + parser->fields[i].name.off;
+        parser->fields[i].value.ptr = buf + parser->fields[i].value.off;
+    }
+    return HTTP_PARSE_DONE;
 }
 
 /**
- * @brief Extract the first complete HTTP response from buf.
- *
- * @param buf Buffer may contain a HTTP response.
- * @param n Byte size of the buffer.
- * @param out_response Output: String of the first HTTP response in buffer if
- * the response is completed; it is not changed otherwise.
- * @param out_len Output; Byte size of response if it is completed; it is not
- * changed otherwise.
- * @param out_max_age Output: Max age (time-to-live) for the response in cache.
- * @param is_chunked 1 if the transfer encoding response is known to be chunked;
- * 0 if it is unknown or is not chunked. After calling this function, is_chunked
- * will be set to 1 if it is found that the transfer encoding of this response
- * is chunked.
- * @return int Number of extracted response, i.e. 1 on success; 0 otherwise.
+ * @brief Parse the body buffered after a complete head, resuming from where
+ * the last call on the buffer stopped, to find where the message ends. It's
+ * for requests, which are forwarded whole; response bodies are streamed, see
+ * scan_body().
+ *
+ * @param parser Parser of the message, whose head is complete.
+ * @param buf Buffer that starts with the message.
+ * @param n Byte size of buf.
+ * @return int HTTP_PARSE_DONE once the body is complete, and parser->pos is
+ * the byte size of the message; HTTP_PARSE_PARTIAL if more data is needed;
+ * HTTP_PARSE_ERROR if a chunk size is malformed.
  */
-int extract_first_response(char** buf,
-                           int* n,
-                           char** out_response,
-                           int* out_len,
-                           int* out_max_age,
-                           int* is_chunked) {
-    char* st = NULL;
-    char* end = NULL;
-    int len = 0;
-    char* name = NULL; /* Field name of a header line. */
-    char* value = NULL; /* Field value of a header line. */
-    int content_length = 0;
-
-    if (buf == NULL || *buf == NULL) {
-        return 0;
-    }
+int http_parse_body(struct http_parser* parser, const char* buf, int n)
+{
+    int len;
 
-    /* Find the empty line between head and body. */
-    end = strstr(*buf, "\r\n\r\n");
-    if (end == NULL) {
-        /* Request head is incomplete. */
-        return 0;
+    if (!parser->body.is_done) {
+        len = scan_body(&(parser->body), buf + parser->pos, n - parser->pos);
+        if (len < 0) {
+            return HTTP_PARSE_ERROR;
+        }
+        parser->pos += len;
     }
-    end += strlen("\r\n"); /* End of the last header line, i.e. the start of the 
-                            * empty line. */
-    /* From now on, the head is completed. */
+    return parser->body.is_done ? HTTP_PARSE_DONE : HTTP_PARSE_PARTIAL;
+}
 
-    /* Skip the status line. */
-    st = strstr(*buf, "\r\n");
-    st += strlen("\r\n"); /* Start of the first header line. */
+/**
+ * @brief Find a header field of a parsed head by name, ignoring case.
+ *
+ * @param parser Parser whose head is complete.
+ * @param name Field name to find.
+ * @return const struct http_field* The first such field; NULL if not found.
+ */
+const struct http_field* http_find_field(const struct http_parser* parser,
+                                         const char* name)
+{
+    const struct http_field* field = NULL;
+    int name_len = strlen(name);
 
-    /* Get content length and cache control. */
-    *out_max_age = 3600; /* 1h by default. */
-    while (st < end) {
-        len = parse_header_line(st, &name, &value);
-        if (name != NULL) {
-            if (strcmp(name, "Content-Length") == 0) {
-                content_length = atoi(value);
-            }
-            else if (strcmp(name, "Cache-Control") == 0) {
-                parse_cache_control(value, out_max_age);
-                /* TODO: Handle other cache-control value. */
-            }
-            else if (strcmp(name, "Transfer-Encoding") == 0 &&
-                     strcmp(value, "chunked") == 0) {
-                *is_chunked = 1;
-            }
+    for (int i = 0; i < parser->num_fields; ++i) {
+        field = &(parser->fields[i]);
+        if (field->name.len == name_len &&
+            strncasecmp(field->name.ptr, name, name_len) == 0) {
+            return field;
         }
-        free(name);
-        name = NULL;
-        free(value);
-        value = NULL;
-        st += len;
-    }
-
-    /* Check the completeness of body. */
-    st = end + strlen("\r\n"); /* Start of body. */
-    if (*is_chunked) {
-        long chunk_size = 0;
-
-        if (*n - 5 >= 0 && strncmp(&(*buf)[*n - 5], "0\r\n\r\n", 5) != 0) {
-            /* Body is incomplete. */
-            return 0;
-        }
-        /* The last 5 char in buffer fit the end of chunked response. */
-        /* Check completeness of each chunk. */
-        end = st;
-        while (1) {
-            /* Get claimed chunk size. */
-            chunk_size = strtol(end, &end, 16);
-            if (chunk_size == 0 &&
-                *n - (end - *buf) == 4 &&
-                strncmp(end, "\r\n\r\n", 4) == 0) {
-                /* Response is complete. */
+    }
+    return NULL;
+}
+
+/**
+ * @brief Make a copy of the head of a complete chunked response, for a body
+ * taken out of its chunked framing: its Transfer-Encoding, Content-Length and
+ * Trailer fields are replaced with a Content-Length of the given size.
+ *
+ * @param head Head of the response, ending with the empty line.
+ * @param head_len Byte size of head.
+ * @param body_len Byte size of the body without its framing.
+ * @param out_head Output pointer to the null-terminated new head.
+ * @param out_len Output; byte size of *out_head.
+ * @return int 0 on success; -1 if the head is malformed, or out of memory.
+ */
+int make_dechunked_head(const char* head,
+                        int head_len,
+                        long long body_len,
+                        char** out_head,
+                        int* out_len)
+{
+    static const char* dropped[] = {
+        "Transfer-Encoding",
+        "Content-Length",
+        "Trailer"
+    };
+    struct http_parser parser;
+    const struct http_slice* name = NULL;
+    int line_st; /* Offset of a line of head. */
+    int line_end; /* Offset of the next line of head. */
+    int is_dropped;
+    int len;
+
+    http_parser_init(&parser, 0);
+    if (http_parse(&parser, head, head_len) != HTTP_PARSE_DONE ||
+        parser.head_len != head_len ||
+        !parser.body.is_chunked) {
+        return -1;
+    }
+    /* The new field is at most as long as the dropped Transfer-Encoding and
+     * the digits of the size. */
+    *out_head = malloc(head_len + 32);
+    if (*out_head == NULL) {
+        return -1;
+    }
+
+    /* Copy the start line, and the fields that still hold. */
+    line_end = parser.num_fields > 0 ?
+               parser.fields[0].name.off :
+               head_len - (int)strlen("\r\n");
+    memcpy(*out_head, head, line_end);
+    len = line_end;
+    for (int i = 0; i < parser.num_fields; ++i) {
+        name = &(parser.fields[i].name);
+        line_st = name->off;
+        line_end = i + 1 < parser.num_fields ?
+                   parser.fields[i + 1].name.off :
+                   head_len - (int)strlen("\r\n");
+        is_dropped = 0;
+        for (size_t j = 0; j < sizeof(dropped) / sizeof(dropped[0]); ++j) {
+            if (name->len == (int)strlen(dropped[j]) &&
+                strncasecmp(name->ptr, dropped[j], name->len) == 0) {
+                is_dropped = 1;
                 break;
             }
-            /* Skip "\r\n". */
-            if (*n - (end - *buf) < 2) {
-                /* Chunk is incomplete. */
-                return 0;
-            }
-            if (strncmp(end, "\r\n", 2) != 0) {
-                /* Violate chunk format. */
-                return 0;
-            }
-            end += 2; /* Start of chunk data. */
-            /* Check actual chunk size. */
-            if (*n - (end - *buf) < chunk_size) {
-                /* Chunk is incomplete. */
-                return 0;
-            }
-            end += chunk_size;
-            /* Skip "\r\n" */
-            if (*n - (end - *buf) < 2) {
-                /* Chunk is incomplete. */
-                return 0;
-            }
-            if (strncmp(end, "\r\n", 2) != 0) {
-                /* Violate chunk format. */
-                return 0;
-            }
-            end += 2; /* Start of chunk size. */
         }
-    }
-    else {
-        if (*n - (end - *buf) < content_length) {
-            /* Body is incomplete. */
-            return 0;
+        if (!is_dropped) {
+            memcpy(*out_head + len, head + line_st, line_end - line_st);
+            len += line_end - line_st;
         }
     }
-    /* From now on, body is completed. */
-
-    /* Return the request. */
-    *out_response = *buf;
-    *out_len = *n;
-    *buf = NULL;
-    *n = 0;
-    return 1;
-}
\ No newline at end of file
+    len += sprintf(*out_head + len, "Content-Length: %lld\r\n\r\n", body_len);
+    *out_len = len;
+    return 0;
+}
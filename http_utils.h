@@ -14,105 +14,45 @@
 #ifndef HTTP_PARSER_H
 #define HTTP_PARSER_H
 
-/**
- * @brief Parse HTTP request/response and extract its head and body.
- *
- * @param buf Byte buffer should contain a whole HTTP request/response head and
- * may contain a whole/partial/empty entity body.
- * @param n Byte size of the buffer.
- * @param out_head Output pointer to a null-terminated string copy of head
- * without the empty line.
- * If the empty line between head and body is not found, *out_head will remain
- * its original value.
- * @param out_head_len Output; byte size of head.
- * @param out_body Output pointer to a null-terminated string copy of entity
- * body.
- * It may not be the whole entity body, or even be an empty string.
- * If empty line between head and body is not found, *out_body will remain its
- * original value.
- * @param out_body_len Output; byte size of body.
- */
-void parse_body_head(const char* buf,
-                     const int n,
-                     char** out_head,
-                     int* out_head_len,
-                     char** out_body,
-                     int* out_body_len);
-
-/**
- * @brief Parse the given HTTP request and extract method, url, version and host
- * fields.
- *
- * @param request HTTP request to parse.
- * @param out_method Output pointer to a null-terminated string as a copy of
- * method field in the request.
- * @param out_url Output pointer to a null-terminated string as a copy of url
- * field in the request.
- * @param out_version Output pointer to a null-terminated string as a copy of
- * version field in the request.
- * @param host Output pointer to a null-terminated string as a copy of host
- * field in the requst.
- */
-void parse_request_head(const char* request,
-                        char** out_method,
-                        char** out_url,
-                        char** out_version,
-                        char** out_host);
+#define HTTP_MAX_FIELDS 64 /* Max number of header fields of a head. */
+#define HTTP_MAX_HEAD_BYTES (64 << 10) /* Max byte size of a head. */
 
 /**
  * @brief Parse the given host field value of an HTTP request, and extract
  * hostname and port number.
  *
  * @param host Host field value in an HTTP request. It may not contain port
- * number.
- * @param out_hostname Output pointer to a string copy of hostname without port
- * number.
+ * number, and needn't be null-terminated.
+ * @param host_len Byte size of host.
+ * @param out_hostname Output pointer to a null-terminated string copy of
+ * hostname without port number.
  * @param out_port Output pointer to an integer copy of port number.
  * If port number is not specified in host field, out_port remains its original
  * value.
+ * @return int 0 on success; -1 if out of memory.
  */
-void parse_host_field(const char* host, char** out_hostname, int* out_port);
-
-/**
- * @brief Parse the given HTTP status line and extract version, status code and 
- * phrase fields.
- *
- * @param line String that starts with HTTP status line to parse. It may contain
- * other contents after the status line.
- * @param out_version Output pointer to a string copy of version field.
- * @param out_status_code Output pointer to an integer copy of status code
- * field.
- * @param out_phrase Pointer to a string copy of phrase field.
- * @return Length of status line including "\r\n"; -1 if the given request line
- * is invalid.
- */
-int parse_status_line(const char* line,
-                      char** out_version,
-                      int* out_status_code,
-                      char** out_phrase);
+int parse_host_field(const char* host,
+                     int host_len,
+                     char** out_hostname,
+                     int* out_port);
 
 /**
- * @brief Parse the given HTTP response, extract version, status code, phrase, 
- * content length and cache_control fields.
- *
- * @param response String that starts with HTTP response to parse. It contains
- * the whole response header. But it may not contain the whole entity body.
- * @param out_version Output pointer to a string copy of version field.
- * @param out_status_code Output pointer to an integer copy of status code
- * field.
- * @param out_phrase Output pointer to a string copy of phrase field.
- * @param out_content_length Output pointer to a string copy of content length
- * field.
- * @param out_cache_control Output pointer to a string copy of cache control
- * field.
+ * @brief Find a directive of the given cache control field by name, ignoring
+ * case, and extract its value, e.g. the integer of "stale-if-error=60".
+ *
+ * @param cache_control Cache control field value; it needn't be
+ * null-terminated.
+ * @param len Byte size of cache_control.
+ * @param name Directive name to find.
+ * @param out_value Output; integer value of the directive, which may be
+ * quoted. It remains its original value if the directive is not found or has
+ * no value.
+ * @return int 1 if the directive is found; 0 otherwise.
  */
-void parse_response_head(const char* response,
-                         int response_len,
-                         char** out_version,
-                         int* out_status_code,
-                         char** out_phrase,
-                         int* out_content_length,
-                         char** out_cache_control);
+int parse_cache_directive(const char* cache_control,
+                          int len,
+                          const char* name,
+                          int* out_value);
 
 /**
  * @brief Parse the given cache control field and extract the integer after 
@@ -125,38 +65,271 @@ void parse_response_head(const char* response,
 void parse_cache_control(const char* cache_control, int* out_max_age);
 
 /**
- * @brief Extract the first complete HTTP request from buf.
- * 
- * @param buf Buffer may contain a HTTP request.
- * @param n Byte size of the buffer.
- * @param out_request Output: The first HTTP request head in buffer if the 
- * request is completed; it is not changed otherwise.
- * @param out_len Output; Byte size of request head if it is completed; it is
- * not changed otherwise.
- * @return int Number of extracted request, i.e. 1 on success; 0 otherwise.
+ * @brief Find a header field of the given HTTP request/response head by name,
+ * ignoring case, and point at its value in place, without copying it. The head
+ * needn't be null-terminated.
+ *
+ * @param head HTTP request/response head, starting with its start line.
+ * @param head_len Byte size of head.
+ * @param name Field name to find.
+ * @param out_value Output; start of the value of the first such field within
+ * head, without surrounding spaces; it isn't null-terminated. It is not changed
+ * if the field is not found.
+ * @param out_len Output; byte size of *out_value.
+ * @return int 1 if the field is found; 0 otherwise.
+ */
+int find_header_value(const char* head,
+                      int head_len,
+                      const char* name,
+                      const char** out_value,
+                      int* out_len);
+
+/**
+ * @brief Find a header field of the given HTTP request/response head by name,
+ * ignoring case, and extract its value. The head needn't be null-terminated.
+ *
+ * @param head HTTP request/response head, starting with its start line.
+ * @param head_len Byte size of head.
+ * @param name Field name to find.
+ * @param out_value Output pointer to a null-terminated string copy of the value
+ * of the first such field, without surrounding spaces. It is not changed if the
+ * field is not found.
+ * @return int 1 if the field is found; 0 otherwise.
+ */
+int find_header_field(const char* head,
+                      int head_len,
+                      const char* name,
+                      char** out_value);
+
+/**
+ * @brief Make a conditional copy of the given GET request, which asks the
+ * server to reply "304 Not Modified" if a cached response is still valid.
+ * The validators of the cached response are added as If-None-Match and
+ * If-Modified-Since fields at the end of the head.
+ *
+ * @param request HTTP request head, ending with the empty line.
+ * @param request_len Byte size of request.
+ * @param etag ETag field value of the cached response; NULL if it has none.
+ * @param last_modified Last-Modified field value of the cached response; NULL
+ * if it has none.
+ * @param out_request Output pointer to a null-terminated conditional request.
+ * @param out_len Output; byte size of *out_request.
+ * @return int 0 on success; -1 if the request has no head or the response has
+ * no validator.
  */
-int extract_first_request(char** buf,
-                          int* n,
-                          char** out_request,
-                          int* out_len);
+int make_conditional_request(const char* request,
+                             int request_len,
+                             const char* etag,
+                             const char* last_modified,
+                             char** out_request,
+                             int* out_len);
+
+/* Part of a chunked body that is being received. */
+enum http_chunk_state {
+    CHUNK_SIZE, /* Hex size at the start of a chunk. */
+    CHUNK_EXT, /* Rest of the size line, e.g. chunk extensions. */
+    CHUNK_SIZE_LF, /* Line feed of the size line. */
+    CHUNK_DATA, /* Data of a chunk. */
+    CHUNK_DATA_END, /* CRLF after the data of a chunk. */
+    CHUNK_TRAILER, /* Trailer fields after the last chunk, up to an empty
+                    * line. */
+    CHUNK_TRAILER_LF /* Line feed of a trailer line. */
+};
+
+/* Framing of an HTTP message body, tracked as the body arrives, so the body
+ * needn't be buffered to find where it ends. */
+struct http_body {
+    int is_chunked; /* 1 for "Transfer-Encoding: chunked"; 0 otherwise. */
+    int is_done; /* Whether the whole body has arrived. */
+    long long remaining; /* Bytes left of the body, or of the data of the
+                          * current chunk if chunked; -1 if the body ends
+                          * when the connection is closed. */
+    enum http_chunk_state chunk_state;
+    int line_len; /* Bytes of the current line of a chunked body, without
+                   * line breaks. */
+    long long data_len; /* Bytes of chunk data so far, i.e. of the body
+                         * without its chunked framing. */
+};
+
+/* Result of parsing what's received of an HTTP message so far. */
+enum http_parse_result {
+    HTTP_PARSE_ERROR = -1, /* Message is malformed, or its head too large. */
+    HTTP_PARSE_PARTIAL = 0, /* Message is incomplete; parse again once more
+                             * data is received. */
+    HTTP_PARSE_DONE = 1 /* Message is complete. */
+};
+
+/* Part of a received head, e.g. a field value. It's not null-terminated. */
+struct http_slice {
+    const char* ptr; /* Start of the part; set once the head is complete, since
+                      * the buffer may move as it grows until then. */
+    int off; /* Offset of the part in the buffer. */
+    int len; /* Byte size of the part. */
+};
+
+/* Header field of a head. */
+struct http_field {
+    struct http_slice name;
+    struct http_slice value; /* Without surrounding spaces. */
+};
+
+/* Incremental parser of an HTTP/1.x request or response head. It's fed the
+ * buffer of a connection as it grows, and resumes at the line it stopped at,
+ * so each byte is scanned once however the head is split. Nothing is copied
+ * nor allocated: the parts of the head are slices of the buffer. */
+struct http_parser {
+    int is_request; /* Whether it parses a request; a response otherwise. */
+    int pos; /* Offset in the buffer to resume scanning from; once the head
+              * is parsed, the end of the part of the body parsed by
+              * http_parse_body(). */
+    int line_start; /* Offset of the line being received. */
+    int has_start_line; /* Whether the start line has been parsed. */
+    int head_len; /* Byte size of the head, including the empty line; 0 until
+                   * it's complete. */
+    struct http_slice method; /* Request only. */
+    struct http_slice url; /* Request only. */
+    struct http_slice version; /* E.g. "HTTP/1.1". */
+    int status_code; /* Response only. */
+    struct http_slice reason; /* Response only. */
+    struct http_field fields[HTTP_MAX_FIELDS];
+    int num_fields;
+    long long content_length; /* -1 if there's no Content-Length. */
+    int has_transfer_encoding; /* Whether there's a Transfer-Encoding; the
+                                * body is chunked if its last coding is. */
+    struct http_body body; /* Framing of the body, set once the head is
+                            * complete. */
+};
+
+/* Kernels that scan the chars of a head, e.g. to validate field names and
+ * values. The vector ones are picked only if the CPU supports them. */
+enum http_scan_kernel {
+    HTTP_SCAN_SCALAR, /* A byte, or 8 bytes, at a time. */
+    HTTP_SCAN_SSE42, /* 16 bytes at a time, with SSSE3 and SSE4.2. */
+    HTTP_SCAN_AVX2 /* 32 bytes at a time, with AVX2. Most field names and
+                    * values are shorter than that, so it's slower than
+                    * SSE4.2 on typical heads, and isn't picked by
+                    * default. */
+};
 
 /**
- * @brief Extract the first complete HTTP response from buf.
- * 
- * @param buf Buffer may contain a HTTP response.
- * @param n Byte size of the buffer.
- * @param out_response Output: String of the first HTTP response in buffer if the
- * response is completed; it is not changed otherwise.
- * @param out_len Output; Byte size of response if it is completed; it is not
- * changed otherwise.
- * @param out_max_age Output: Max age (time-to-live) for the response in cache.
- * @return int Number of extracted response, i.e. 1 on success; 0 otherwise.
+ * @brief Pick the kernels that scan heads. By default, the SSE4.2 ones are
+ * picked on first use if the CPU supports them, or the scalar ones otherwise.
+ *
+ * @param kernel Kernels to pick.
+ * @return int 0 on success; -1 if the CPU doesn't support them.
+ */
+int http_scan_set_kernel(enum http_scan_kernel kernel);
+
+/**
+ * @brief Get the kernels that scan heads, picking the default ones if none
+ * are picked yet.
+ *
+ * @return enum http_scan_kernel Kernels in use.
+ */
+enum http_scan_kernel http_scan_get_kernel(void);
+
+/**
+ * @brief Reset a parser for the next message of a connection.
+ *
+ * @param parser Parser to reset.
+ * @param is_request Whether to parse a request; a response otherwise.
+ */
+void http_parser_init(struct http_parser* parser, int is_request);
+
+/**
+ * @brief Parse the head of an HTTP/1.x message at the start of the given
+ * buffer, resuming from where the last call on the buffer stopped.
+ *
+ * The start line, the syntax of field names and values, and the fields that
+ * frame the body are validated in the same pass. A request with both a
+ * Content-Length and a Transfer-Encoding, or with a Transfer-Encoding that
+ * isn't chunked, is malformed, since its end would be ambiguous. So is a head
+ * with lines not ending with CRLF, or with folded fields.
+ *
+ * @param parser Parser of the message.
+ * @param buf Buffer that starts with the message. It holds at least what it
+ * held in the last call, and may have moved since then.
+ * @param n Byte size of buf.
+ * @return int HTTP_PARSE_DONE once the head is complete, and its slices point
+ * into buf; HTTP_PARSE_PARTIAL if more data is needed; HTTP_PARSE_ERROR if the
+ * head is malformed, or larger than HTTP_MAX_HEAD_BYTES.
+ */
+int http_parse(struct http_parser* parser, const char* buf, int n);
+
+/**
+ * @brief Parse the body buffered after a complete head, resuming from where
+ * the last call on the buffer stopped, to find where the message ends. It's
+ * for requests, which are forwarded whole; response bodies are streamed, see
+ * scan_body().
+ *
+ * @param parser Parser of the message, whose head is complete.
+ * @param buf Buffer that starts with the message.
+ * @param n Byte size of buf.
+ * @return int HTTP_PARSE_DONE once the body is complete, and parser->pos is
+ * the byte size of the message; HTTP_PARSE_PARTIAL if more data is needed;
+ * HTTP_PARSE_ERROR if a chunk size is malformed.
+ */
+int http_parse_body(struct http_parser* parser, const char* buf, int n);
+
+/**
+ * @brief Find a header field of a parsed head by name, ignoring case.
+ *
+ * @param parser Parser whose head is complete.
+ * @param name Field name to find.
+ * @return const struct http_field* The first such field; NULL if not found.
+ */
+const struct http_field* http_find_field(const struct http_parser* parser,
+                                         const char* name);
+
+/**
+ * @brief Track the framing of a message body over the next bytes received
+ * after what's been scanned so far, and find where the body ends. Each byte is
+ * scanned once, however the body is split. Chunk extensions and trailer fields
+ * are checked for control chars, and skipped.
+ *
+ * @param body Framing of the body, set by http_parse().
+ * @param data Next bytes received.
+ * @param len Byte size of data.
+ * @return int Byte size of the leading part of data that belongs to the body;
+ * it's less than len only if the body ends within data, and body->is_done is
+ * set then. -1 if the chunked framing is malformed, e.g. a line doesn't end
+ * with CRLF.
+ */
+int scan_body(struct http_body* body, const char* data, int len);
+
+/**
+ * @brief Like scan_body(), but stop right after the next run of body data, so
+ * a chunked body can be taken out of its framing.
+ *
+ * @param body Framing of the body, set by http_parse().
+ * @param data Next bytes received.
+ * @param len Byte size of data.
+ * @param out_data_len Output; byte size of the run of body data that the
+ * scanned part ends with; 0 if it has none.
+ * @return int Byte size of the leading part of data that is scanned; -1 if the
+ * chunked framing is malformed.
+ */
+int scan_body_data(struct http_body* body,
+                   const char* data,
+                   int len,
+                   int* out_data_len);
+
+/**
+ * @brief Make a copy of the head of a complete chunked response, for a body
+ * taken out of its chunked framing: its Transfer-Encoding, Content-Length and
+ * Trailer fields are replaced with a Content-Length of the given size.
+ *
+ * @param head Head of the response, ending with the empty line.
+ * @param head_len Byte size of head.
+ * @param body_len Byte size of the body without its framing.
+ * @param out_head Output pointer to the null-terminated new head.
+ * @param out_len Output; byte size of *out_head.
+ * @return int 0 on success; -1 if the head is malformed, or out of memory.
  */
-int extract_first_response(char** buf,
-                           int* n,
-                           char** out_request,
-                           int* out_len,
-                           int* out_max_age,
-                           int* is_chunked);
+int make_dechunked_head(const char* head,
+                        int head_len,
+                        long long body_len,
+                        char** out_head,
+                        int* out_len);
 
 #endif /* HTTP_PARSER_H */
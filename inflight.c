@@ -0,0 +1,246 @@
+/**************************************************************
+*
+*                         inflight.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Implementation for table of fetches in flight to origin
+*     servers, as a hash table with chained buckets. Each
+*     fetch keeps its waiters in a growing array.
+*
+**************************************************************/
+
+#include "inflight.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_BUCKETS 1024 /* Number of buckets in the table. */
+
+/* Entry of the table. */
+struct fetch {
+    char* key; /* Copy of the cache key. */
+    int fd; /* FD for the server socket. */
+    struct inflight_waiter* waiters;
+    int num_waiters;
+    int waiters_cap;
+    struct fetch* next; /* Next fetch in the same bucket. */
+};
+
+static struct fetch* buckets[NUM_BUCKETS];
+static int num_fetches = 0;
+
+/**
+ * @brief Hash a cache key with FNV-1a.
+ */
+static unsigned hash_key(const char* key)
+{
+    unsigned h = 2166136261u;
+
+    for (; *key != '\0'; ++key) {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Find the link to the fetch of the given key in its bucket.
+ *
+ * @param key Cache key, non-null.
+ * @return struct fetch** Link to the fetch; link to the NULL at the end of the
+ * bucket if the key isn't in flight.
+ */
+static struct fetch** find_link(const char* key)
+{
+    struct fetch** p = &buckets[hash_key(key) % NUM_BUCKETS];
+
+    while (*p != NULL && strcmp((*p)->key, key) != 0) {
+        p = &(*p)->next;
+    }
+    return p;
+}
+
+/**
+ * @brief Register a fetch of the given key.
+ *
+ * @param key Cache key of the response, non-null.
+ * @param fd FD for the server socket that fetches it.
+ * @return int Number of added fetches, i.e. 1 on success; 0 if the key is
+ * already in flight or on failure.
+ */
+int inflight_add(const char* key, int fd)
+{
+    struct fetch** p = find_link(key);
+    struct fetch* fetch = NULL;
+
+    if (*p != NULL) {
+        return 0;
+    }
+    fetch = malloc(sizeof(struct fetch));
+    if (fetch == NULL) {
+        PLOG_ERROR("malloc");
+        return 0;
+    }
+    fetch->key = strdup(key);
+    if (fetch->key == NULL) {
+        PLOG_ERROR("strdup");
+        free(fetch);
+        return 0;
+    }
+    fetch->fd = fd;
+    fetch->waiters = NULL;
+    fetch->num_waiters = 0;
+    fetch->waiters_cap = 0;
+    fetch->next = NULL;
+    *p = fetch;
+    ++num_fetches;
+    return 1;
+}
+
+/**
+ * @brief Find the fetch of the given key.
+ *
+ * @param key Cache key of the response, non-null.
+ * @return int FD for the server socket that fetches it; -1 if the key isn't
+ * in flight.
+ */
+int inflight_find(const char* key)
+{
+    struct fetch* fetch = *find_link(key);
+
+    return fetch != NULL ? fetch->fd : -1;
+}
+
+/**
+ * @brief Attach a waiter to the fetch of the given key.
+ *
+ * @param key Cache key of the response, non-null.
+ * @param fd FD for the waiting client socket.
+ * @param id ID of the socket buffer of the client.
+ * @return int Number of attached waiters, i.e. 1 on success; 0 if the key isn't
+ * in flight or on failure.
+ */
+int inflight_attach(const char* key, int fd, unsigned long id)
+{
+    struct fetch* fetch = *find_link(key);
+    struct inflight_waiter* ret = NULL;
+    int cap;
+
+    if (fetch == NULL) {
+        return 0;
+    }
+    if (fetch->num_waiters == fetch->waiters_cap) {
+        cap = fetch->waiters_cap == 0 ? 4 : fetch->waiters_cap * 2;
+        ret = realloc(fetch->waiters, cap * sizeof(struct inflight_waiter));
+        if (ret == NULL) {
+            PLOG_ERROR("realloc");
+            return 0;
+        }
+        fetch->waiters = ret;
+        fetch->waiters_cap = cap;
+    }
+    fetch->waiters[fetch->num_waiters].fd = fd;
+    fetch->waiters[fetch->num_waiters].id = id;
+    ++fetch->num_waiters;
+    return 1;
+}
+
+/**
+ * @brief Get the waiters of the fetch of the given key, if it's made by the
+ * given socket, in the order they were attached.
+ *
+ * @param key Cache key of the response; NULL for no fetch.
+ * @param fd FD for the server socket that fetches it.
+ * @param out_waiters Output pointer to the waiters, valid until the table
+ * changes.
+ * @return int Number of waiters; 0 if there's no such fetch.
+ */
+int inflight_waiters(const char* key,
+                     int fd,
+                     const struct inflight_waiter** out_waiters)
+{
+    struct fetch* fetch = NULL;
+
+    if (key == NULL) {
+        return 0;
+    }
+    fetch = *find_link(key);
+    if (fetch == NULL || fetch->fd != fd) {
+        return 0;
+    }
+    *out_waiters = fetch->waiters;
+    return fetch->num_waiters;
+}
+
+/**
+ * @brief Remove the fetch of the given key, if it's made by the given socket.
+ *
+ * @param key Cache key of the response; nothing happens if it's NULL.
+ * @param fd FD for the server socket that fetches it.
+ * @param out_waiters Output pointer to its waiters, to free by the caller;
+ * NULL to drop them. It's set to NULL if it has none.
+ * @param out_num_waiters Output; number of waiters, if out_waiters isn't NULL.
+ * @return int Number of removed fetches, i.e. 1 if removed; 0 otherwise.
+ */
+int inflight_remove(const char* key,
+                    int fd,
+                    struct inflight_waiter** out_waiters,
+                    int* out_num_waiters)
+{
+    struct fetch** p = NULL;
+    struct fetch* fetch = NULL;
+
+    if (key == NULL) {
+        return 0;
+    }
+    p = find_link(key);
+    fetch = *p;
+    if (fetch == NULL || fetch->fd != fd) {
+        return 0;
+    }
+    *p = fetch->next;
+    if (out_waiters != NULL) {
+        *out_waiters = fetch->waiters;
+        *out_num_waiters = fetch->num_waiters;
+    }
+    else {
+        free(fetch->waiters);
+    }
+    free(fetch->key);
+    free(fetch);
+    --num_fetches;
+    return 1;
+}
+
+/**
+ * @brief Get the number of fetches in flight.
+ *
+ * @return int Number of fetches.
+ */
+int inflight_size(void)
+{
+    return num_fetches;
+}
+
+/**
+ * @brief Remove all fetches.
+ */
+void inflight_clear(void)
+{
+    struct fetch* next = NULL;
+
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        for (struct fetch* fetch = buckets[i]; fetch != NULL; fetch = next) {
+            next = fetch->next;
+            free(fetch->waiters);
+            free(fetch->key);
+            free(fetch);
+        }
+        buckets[i] = NULL;
+    }
+    num_fetches = 0;
+}
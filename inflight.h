@@ -0,0 +1,103 @@
+/**************************************************************
+*
+*                         inflight.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Interface for table of fetches in flight to origin
+*     servers, by cache key.
+*
+*     A server socket that fetches a response for the cache
+*     registers its key, so others needing the same response
+*     find it instead of fetching it again. Clients asking for
+*     it attach to the fetch as waiters, to be fed from its
+*     response. The owner of the socket removes the key once
+*     the response is complete, or before closing it. Not
+*     thread-safe.
+*
+**************************************************************/
+
+#ifndef INFLIGHT_H
+#define INFLIGHT_H
+
+/* A client waiting for the response of a fetch. */
+struct inflight_waiter {
+    int fd; /* FD for client socket. */
+    unsigned long id; /* ID of its socket buffer, see struct sock_buf. */
+};
+
+/**
+ * @brief Register a fetch of the given key.
+ *
+ * @param key Cache key of the response, non-null.
+ * @param fd FD for the server socket that fetches it.
+ * @return int Number of added fetches, i.e. 1 on success; 0 if the key is
+ * already in flight or on failure.
+ */
+int inflight_add(const char* key, int fd);
+
+/**
+ * @brief Find the fetch of the given key.
+ *
+ * @param key Cache key of the response, non-null.
+ * @return int FD for the server socket that fetches it; -1 if the key isn't
+ * in flight.
+ */
+int inflight_find(const char* key);
+
+/**
+ * @brief Attach a waiter to the fetch of the given key.
+ *
+ * @param key Cache key of the response, non-null.
+ * @param fd FD for the waiting client socket.
+ * @param id ID of the socket buffer of the client.
+ * @return int Number of attached waiters, i.e. 1 on success; 0 if the key isn't
+ * in flight or on failure.
+ */
+int inflight_attach(const char* key, int fd, unsigned long id);
+
+/**
+ * @brief Get the waiters of the fetch of the given key, if it's made by the
+ * given socket, in the order they were attached.
+ *
+ * @param key Cache key of the response; NULL for no fetch.
+ * @param fd FD for the server socket that fetches it.
+ * @param out_waiters Output pointer to the waiters, valid until the table
+ * changes.
+ * @return int Number of waiters; 0 if there's no such fetch.
+ */
+int inflight_waiters(const char* key,
+                     int fd,
+                     const struct inflight_waiter** out_waiters);
+
+/**
+ * @brief Remove the fetch of the given key, if it's made by the given socket.
+ *
+ * @param key Cache key of the response; nothing happens if it's NULL.
+ * @param fd FD for the server socket that fetches it.
+ * @param out_waiters Output pointer to its waiters, to free by the caller;
+ * NULL to drop them. It's set to NULL if it has none.
+ * @param out_num_waiters Output; number of waiters, if out_waiters isn't NULL.
+ * @return int Number of removed fetches, i.e. 1 if removed; 0 otherwise.
+ */
+int inflight_remove(const char* key,
+                    int fd,
+                    struct inflight_waiter** out_waiters,
+                    int* out_num_waiters);
+
+/**
+ * @brief Get the number of fetches in flight.
+ *
+ * @return int Number of fetches.
+ */
+int inflight_size(void);
+
+/**
+ * @brief Remove all fetches.
+ */
+void inflight_clear(void);
+
+#endif /* INFLIGHT_H */
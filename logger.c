@@ -13,6 +13,23 @@
 #include <stdlib.h>
 #include <stdarg.h>
 
+static char log_tag[64] = ""; /* Tag in front of every log message. */
+
+/**
+ * @brief Set a tag printed in front of every log message of this process,
+ * e.g. "worker 3". It tells apart logs from different worker processes.
+ *
+ * @param tag Tag to print; NULL or empty string to print no tag.
+ */
+void set_log_tag(const char* tag)
+{
+    if (tag == NULL) {
+        log_tag[0] = '\0';
+        return;
+    }
+    snprintf(log_tag, sizeof(log_tag), "%s", tag);
+}
+
 /**
  * @brief Print log message with source file path and line number to stderr.
  *
@@ -46,7 +63,12 @@ void print_log(const char *file, int line, const char *fmt, ...)
     va_end(args);
 
     /* Print log message with source file path and line number. */
-    fprintf(stderr, "%s:%d: %s\n", file, line, msg);
+    if (log_tag[0] != '\0') {
+        fprintf(stderr, "[%s] %s:%d: %s\n", log_tag, file, line, msg);
+    }
+    else {
+        fprintf(stderr, "%s:%d: %s\n", file, line, msg);
+    }
 
     free(msg);
 }
\ No newline at end of file
@@ -23,6 +23,14 @@
  */
 void print_log(const char* file, int line, const char* fmt, ...);
 
+/**
+ * @brief Set a tag printed in front of every log message of this process,
+ * e.g. "worker 3". It tells apart logs from different worker processes.
+ *
+ * @param tag Tag to print; NULL or empty string to print no tag.
+ */
+void set_log_tag(const char* tag);
+
 #define LOG_RED "\x1B[31m"
 #define LOG_NORMAL "\x1B[0m"
 
@@ -0,0 +1,549 @@
+/**************************************************************
+*
+*                        out_queue.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Implementation for outbound queue of a non-blocking
+*     socket.
+*
+**************************************************************/
+
+#include "out_queue.h"
+#include "logger.h"
+#include <errno.h>
+#include <openssl/err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * @brief Write data to a socket once.
+ *
+ * @return int Byte size written, > 0; 0 if the socket would block; -1 if the
+ * socket is broken.
+ */
+static int write_once(int fd, SSL* ssl, const char* data, int size)
+{
+    int n;
+    int err;
+
+    if (ssl != NULL) {
+        n = SSL_write(ssl, data, size);
+        if (n > 0) {
+            return n;
+        }
+        err = SSL_get_error(ssl, n);
+        /* The handshake or a key update may need to read first; it's retried
+         * on the next readiness of the socket. */
+        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+            return 0;
+        }
+        ERR_print_errors_fp(stderr);
+        LOG_ERROR("SSL_write (fd: %d)", fd);
+        return -1;
+    }
+
+    do {
+        n = write(fd, data, size);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        PLOG_ERROR("write (fd: %d)", fd);
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Get the data of a chunk.
+ */
+static const char* chunk_data(const struct out_chunk* chunk)
+{
+    return chunk->ref != NULL ? chunk->ref : chunk->data;
+}
+
+/**
+ * @brief Free a chunk, and release its referenced data if any.
+ */
+static void free_chunk(struct out_chunk* chunk)
+{
+    if (chunk->ref != NULL) {
+        chunk->release(chunk->arg);
+    }
+    free(chunk);
+}
+
+/**
+ * @brief Append a chunk to the queue.
+ */
+static void append_chunk(struct out_queue* queue, struct out_chunk* chunk)
+{
+    if (queue->tail == NULL) {
+        queue->head = chunk;
+    }
+    else {
+        queue->tail->next = chunk;
+    }
+    queue->tail = chunk;
+    queue->size += chunk->end - chunk->start;
+}
+
+/**
+ * @brief Make an empty queue.
+ *
+ * @param queue Queue, non-null.
+ */
+void out_queue_init(struct out_queue* queue)
+{
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->size = 0;
+}
+
+/**
+ * @brief Drop the queued data and free the chunks.
+ *
+ * @param queue Queue, non-null.
+ */
+void out_queue_clear(struct out_queue* queue)
+{
+    struct out_chunk* next;
+
+    for (struct out_chunk* chunk = queue->head; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free_chunk(chunk);
+    }
+    out_queue_init(queue);
+}
+
+/**
+ * @brief Append a copy of data to the queue. Small appends fill up the last
+ * chunk before a new one is allocated.
+ *
+ * @param queue Queue, non-null.
+ * @param data Data to append.
+ * @param size Byte size of data.
+ * @return int 0 on success; -1 otherwise.
+ */
+int out_queue_push(struct out_queue* queue, const char* data, int size)
+{
+    struct out_chunk* tail = queue->tail;
+    struct out_chunk* chunk = NULL;
+    int n;
+
+    if (size <= 0) {
+        return 0;
+    }
+
+    /* A referenced chunk is always full. */
+    if (tail != NULL && tail->end < tail->cap) {
+        n = tail->cap - tail->end < size ? tail->cap - tail->end : size;
+        memcpy(tail->data + tail->end, data, n);
+        tail->end += n;
+        queue->size += n;
+        data += n;
+        size -= n;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    n = size > OUT_CHUNK_SIZE ? size : OUT_CHUNK_SIZE;
+    chunk = malloc(sizeof(struct out_chunk) + n);
+    if (chunk == NULL) {
+        PLOG_ERROR("malloc");
+        return -1;
+    }
+    chunk->next = NULL;
+    chunk->start = 0;
+    chunk->end = size;
+    chunk->cap = n;
+    chunk->ref = NULL;
+    chunk->release = NULL;
+    chunk->arg = NULL;
+    memcpy(chunk->data, data, size);
+    append_chunk(queue, chunk);
+    return 0;
+}
+
+/**
+ * @brief Append data to the queue by reference, without copying it.
+ *
+ * The caller hands one reference of the data to the queue: release(arg) is
+ * called once the data is sent, the queue is cleared, or the append fails.
+ *
+ * @param queue Queue, non-null.
+ * @param data Data to append. It must stay unchanged until released.
+ * @param size Byte size of data.
+ * @param release Callback when the data is no longer used, non-null.
+ * @param arg Argument of release.
+ * @return int 0 on success; -1 otherwise.
+ */
+int out_queue_push_ref(struct out_queue* queue,
+                       const char* data,
+                       int size,
+                       out_release release,
+                       void* arg)
+{
+    struct out_chunk* chunk = NULL;
+
+    if (size <= 0) {
+        release(arg);
+        return 0;
+    }
+
+    chunk = malloc(sizeof(struct out_chunk));
+    if (chunk == NULL) {
+        PLOG_ERROR("malloc");
+        release(arg);
+        return -1;
+    }
+    chunk->next = NULL;
+    chunk->start = 0;
+    chunk->end = size;
+    chunk->cap = size;
+    chunk->ref = data;
+    chunk->release = release;
+    chunk->arg = arg;
+    append_chunk(queue, chunk);
+    return 0;
+}
+
+/**
+ * @brief Send data to a socket after the queued data. Data is written right
+ * away if the queue is empty; whatever the socket can't take is queued.
+ *
+ * @param queue Queue of the socket, non-null.
+ * @param fd FD for non-blocking socket.
+ * @param ssl SSL structure if the socket is one end of a SSL connection; NULL
+ * otherwise.
+ * @param data Data to send.
+ * @param size Byte size of data.
+ * @return int 0 on success; -1 if the socket is broken.
+ */
+int out_queue_send(struct out_queue* queue,
+                   int fd,
+                   SSL* ssl,
+                   const char* data,
+                   int size)
+{
+    int n;
+
+    /* Keep the order of bytes: wait for the queue to be flushed. */
+    if (queue->size > 0) {
+        return out_queue_push(queue, data, size);
+    }
+
+    while (size > 0) {
+        n = write_once(fd, ssl, data, size);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return out_queue_push(queue, data, size);
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send data to a socket after the queued data without copying it.
+ * Whatever the socket can't take right away is queued by reference.
+ *
+ * The caller hands one reference of the data to the queue: release(arg) is
+ * called once the data is sent, the queue is cleared, or the send fails.
+ *
+ * @param queue Queue of the socket, non-null.
+ * @param fd FD for non-blocking socket.
+ * @param ssl SSL structure if the socket is one end of a SSL connection; NULL
+ * otherwise.
+ * @param data Data to send. It must stay unchanged until released.
+ * @param size Byte size of data.
+ * @param release Callback when the data is no longer used, non-null.
+ * @param arg Argument of release.
+ * @return int 0 on success; -1 if the socket is broken.
+ */
+int out_queue_send_ref(struct out_queue* queue,
+                       int fd,
+                       SSL* ssl,
+                       const char* data,
+                       int size,
+                       out_release release,
+                       void* arg)
+{
+    int n;
+
+    /* Keep the order of bytes: wait for the queue to be flushed. */
+    if (queue->size > 0) {
+        return out_queue_push_ref(queue, data, size, release, arg);
+    }
+
+    while (size > 0) {
+        n = write_once(fd, ssl, data, size);
+        if (n < 0) {
+            release(arg);
+            return -1;
+        }
+        if (n == 0) {
+            return out_queue_push_ref(queue, data, size, release, arg);
+        }
+        data += n;
+        size -= n;
+    }
+    release(arg);
+    return 0;
+}
+
+/**
+ * @brief Append pieces of data to the queue. The last piece is appended by
+ * reference, and the others are copied.
+ *
+ * The caller hands one reference of the last piece to the queue: release(arg)
+ * is called once it's sent, the queue is cleared, or the append fails.
+ *
+ * @param queue Queue, non-null.
+ * @param iovs Pieces of data, in order.
+ * @param num_iovs Number of pieces, > 0.
+ * @param release Callback when the last piece is no longer used, non-null.
+ * @param arg Argument of release.
+ * @return int 0 on success; -1 otherwise.
+ */
+int out_queue_pushv_ref(struct out_queue* queue,
+                        const struct iovec* iovs,
+                        int num_iovs,
+                        out_release release,
+                        void* arg)
+{
+    for (int i = 0; i < num_iovs - 1; ++i) {
+        if (out_queue_push(queue, iovs[i].iov_base, iovs[i].iov_len) < 0) {
+            release(arg);
+            return -1;
+        }
+    }
+    return out_queue_push_ref(queue,
+                              iovs[num_iovs - 1].iov_base,
+                              iovs[num_iovs - 1].iov_len,
+                              release,
+                              arg);
+}
+
+/**
+ * @brief Skip written bytes of pieces.
+ *
+ * @return int Index of the first piece with bytes left; num_iovs if none.
+ */
+static int advance(struct iovec* iovs, int first, int num_iovs, size_t n)
+{
+    while (first < num_iovs && n >= iovs[first].iov_len) {
+        n -= iovs[first].iov_len;
+        ++first;
+    }
+    if (first < num_iovs) {
+        iovs[first].iov_base = (char*)iovs[first].iov_base + n;
+        iovs[first].iov_len -= n;
+    }
+    return first;
+}
+
+/**
+ * @brief Send pieces of data to a socket after the queued data, with as few
+ * writes as possible: one writev() for a plain socket, or one SSL_write() of
+ * the pieces coalesced up to a full record for a SSL socket. What the socket
+ * can't take right away is queued: the last piece by reference, and the others
+ * by copy, so they should be small.
+ *
+ * The caller hands one reference of the last piece to the queue: release(arg)
+ * is called once it's sent, the queue is cleared, or the send fails.
+ *
+ * @param queue Queue of the socket, non-null.
+ * @param fd FD for non-blocking socket.
+ * @param ssl SSL structure if the socket is one end of a SSL connection; NULL
+ * otherwise.
+ * @param iovs Pieces of data, in order.
+ * @param num_iovs Number of pieces, 0 < num_iovs <= OUT_MAX_IOVS.
+ * @param release Callback when the last piece is no longer used, non-null.
+ * @param arg Argument of release.
+ * @return int 0 on success; -1 if the socket is broken.
+ */
+int out_queue_sendv_ref(struct out_queue* queue,
+                        int fd,
+                        SSL* ssl,
+                        const struct iovec* iovs,
+                        int num_iovs,
+                        out_release release,
+                        void* arg)
+{
+    struct iovec left[OUT_MAX_IOVS]; /* Pieces with unsent bytes. */
+    char record[OUT_CHUNK_SIZE]; /* Coalesced pieces for SSL. */
+    int first = 0;
+    int size;
+    int n;
+
+    /* Keep the order of bytes: wait for the queue to be flushed. */
+    if (queue->size > 0) {
+        return out_queue_pushv_ref(queue, iovs, num_iovs, release, arg);
+    }
+    memcpy(left, iovs, num_iovs * sizeof(struct iovec));
+
+    if (ssl != NULL) {
+        /* Coalesce the small pieces with the start of the last one, so they
+         * go out in one full record rather than a few small ones. */
+        while (first < num_iovs - 1) {
+            size = 0;
+            while (first < num_iovs && size < OUT_CHUNK_SIZE) {
+                n = OUT_CHUNK_SIZE - size;
+                if (left[first].iov_len < (size_t)n) {
+                    n = left[first].iov_len;
+                }
+                memcpy(record + size, left[first].iov_base, n);
+                size += n;
+                first = advance(left, first, num_iovs, n);
+            }
+            if (out_queue_send(queue, fd, ssl, record, size) < 0) {
+                release(arg);
+                return -1;
+            }
+            if (first < num_iovs && queue->size > 0) {
+                return out_queue_pushv_ref(queue,
+                                           left + first,
+                                           num_iovs - first,
+                                           release,
+                                           arg);
+            }
+        }
+        if (first == num_iovs) {
+            release(arg);
+            return 0;
+        }
+        return out_queue_send_ref(queue,
+                                  fd,
+                                  ssl,
+                                  left[first].iov_base,
+                                  left[first].iov_len,
+                                  release,
+                                  arg);
+    }
+
+    while (first < num_iovs) {
+        do {
+            n = writev(fd, left + first, num_iovs - first);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return out_queue_pushv_ref(queue,
+                                           left + first,
+                                           num_iovs - first,
+                                           release,
+                                           arg);
+            }
+            PLOG_ERROR("writev (fd: %d)", fd);
+            release(arg);
+            return -1;
+        }
+        first = advance(left, first, num_iovs, n);
+    }
+    release(arg);
+    return 0;
+}
+
+/**
+ * @brief Free the chunk at the head of the queue.
+ */
+static void pop_chunk(struct out_queue* queue)
+{
+    struct out_chunk* chunk = queue->head;
+
+    queue->head = chunk->next;
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+    free_chunk(chunk);
+}
+
+/**
+ * @brief Mark written bytes as sent, and free the chunks that are done.
+ */
+static void consume(struct out_queue* queue, int n)
+{
+    struct out_chunk* chunk;
+    int len;
+
+    queue->size -= n;
+    while (n > 0) {
+        chunk = queue->head;
+        len = chunk->end - chunk->start;
+        if (n < len) {
+            chunk->start += n;
+            return;
+        }
+        n -= len;
+        pop_chunk(queue);
+    }
+}
+
+/**
+ * @brief Write queued data to a socket until it would block.
+ *
+ * @param queue Queue of the socket, non-null.
+ * @param fd FD for non-blocking socket.
+ * @param ssl SSL structure if the socket is one end of a SSL connection; NULL
+ * otherwise.
+ * @return int 1 if the queue is empty; 0 if data is left; -1 if the socket is
+ * broken.
+ */
+int out_queue_flush(struct out_queue* queue, int fd, SSL* ssl)
+{
+    struct iovec iovs[OUT_MAX_IOVS];
+    struct out_chunk* chunk;
+    int num_iovs;
+    int n;
+
+    while (queue->size > 0) {
+        if (ssl != NULL) {
+            /* SSL records are written one chunk at a time. */
+            chunk = queue->head;
+            n = write_once(fd,
+                           ssl,
+                           chunk_data(chunk) + chunk->start,
+                           chunk->end - chunk->start);
+        }
+        else {
+            num_iovs = 0;
+            for (chunk = queue->head;
+                 chunk != NULL && num_iovs < OUT_MAX_IOVS;
+                 chunk = chunk->next) {
+                iovs[num_iovs].iov_base = (char*)chunk_data(chunk) +
+                                          chunk->start;
+                iovs[num_iovs].iov_len = chunk->end - chunk->start;
+                ++num_iovs;
+            }
+            do {
+                n = writev(fd, iovs, num_iovs);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    PLOG_ERROR("writev (fd: %d)", fd);
+                    return -1;
+                }
+                n = 0;
+            }
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        consume(queue, n);
+    }
+    return 1;
+}
@@ -0,0 +1,206 @@
+/**************************************************************
+*
+*                        out_queue.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Interface for outbound queue of a non-blocking socket.
+*
+*     Data that the socket can't take right away is copied
+*     into a chain of chunks, and flushed when the socket
+*     becomes writable again. Plain sockets are flushed with
+*     writev(); SSL sockets chunk by chunk, which needs
+*     SSL_MODE_ENABLE_PARTIAL_WRITE and
+*     SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER.
+*
+*     Data owned by someone else, e.g. a cached response, can
+*     be queued by reference instead. The owner is notified
+*     by a release callback once the data is sent or dropped.
+*
+**************************************************************/
+
+#ifndef OUT_QUEUE_H
+#define OUT_QUEUE_H
+
+#include <openssl/ssl.h>
+#include <sys/uio.h>
+
+#define OUT_CHUNK_SIZE 16384 /* Min byte size of a chunk. */
+#define OUT_MAX_IOVS 64 /* Max number of pieces written by one writev(). */
+
+/**
+ * @brief Callback invoked when referenced data is no longer used by a queue.
+ *
+ * @param arg Argument given with the data.
+ */
+typedef void (*out_release)(void* arg);
+
+/* Chunk of queued data. */
+struct out_chunk {
+    struct out_chunk* next;
+    int start; /* Offset of the first unsent byte. */
+    int end; /* Offset past the last queued byte. */
+    int cap; /* Byte size of data. */
+    const char* ref; /* Referenced data to send instead of data; NULL if the
+                      * data is copied. */
+    out_release release; /* Callback when ref is no longer used. */
+    void* arg; /* Argument of release. */
+    char data[];
+};
+
+struct out_queue {
+    struct out_chunk* head; /* Chunk to send first. */
+    struct out_chunk* tail; /* Chunk to append to. */
+    int size; /* Byte size of unsent data. */
+};
+
+/**
+ * @brief Make an empty queue.
+ *
+ * @param queue Queue, non-null.
+ */
+void out_queue_init(struct out_queue* queue);
+
+/**
+ * @brief Drop the queued data and free the chunks.
+ *
+ * @param queue Queue, non-null.
+ */
+void out_queue_clear(struct out_queue* queue);
+
+/**
+ * @brief Append a copy of data to the queue.
+ *
+ * @param queue Queue, non-null.
+ * @param data Data to append.
+ * @param size Byte size of data.
+ * @return int 0 on success; -1 otherwise.
+ */
+int out_queue_push(struct out_queue* queue, const char* data, int size);
+
+/**
+ * @brief Send data to a socket after the queued data. Data is written right
+ * away if the queue is empty; whatever the socket can't take is queued.
+ *
+ * @param queue Queue of the socket, non-null.
+ * @param fd FD for non-blocking socket.
+ * @param ssl SSL structure if the socket is one end of a SSL connection; NULL
+ * otherwise.
+ * @param data Data to send.
+ * @param size Byte size of data.
+ * @return int 0 on success; -1 if the socket is broken.
+ */
+int out_queue_send(struct out_queue* queue,
+                   int fd,
+                   SSL* ssl,
+                   const char* data,
+                   int size);
+
+/**
+ * @brief Send data to a socket after the queued data without copying it.
+ * Whatever the socket can't take right away is queued by reference.
+ *
+ * The caller hands one reference of the data to the queue: release(arg) is
+ * called once the data is sent, the queue is cleared, or the send fails.
+ *
+ * @param queue Queue of the socket, non-null.
+ * @param fd FD for non-blocking socket.
+ * @param ssl SSL structure if the socket is one end of a SSL connection; NULL
+ * otherwise.
+ * @param data Data to send. It must stay unchanged until released.
+ * @param size Byte size of data.
+ * @param release Callback when the data is no longer used, non-null.
+ * @param arg Argument of release.
+ * @return int 0 on success; -1 if the socket is broken.
+ */
+int out_queue_send_ref(struct out_queue* queue,
+                       int fd,
+                       SSL* ssl,
+                       const char* data,
+                       int size,
+                       out_release release,
+                       void* arg);
+
+/**
+ * @brief Append data to the queue by reference, without copying it.
+ *
+ * The caller hands one reference of the data to the queue: release(arg) is
+ * called once the data is sent, the queue is cleared, or the append fails.
+ *
+ * @param queue Queue, non-null.
+ * @param data Data to append. It must stay unchanged until released.
+ * @param size Byte size of data.
+ * @param release Callback when the data is no longer used, non-null.
+ * @param arg Argument of release.
+ * @return int 0 on success; -1 otherwise.
+ */
+int out_queue_push_ref(struct out_queue* queue,
+                       const char* data,
+                       int size,
+                       out_release release,
+                       void* arg);
+
+/**
+ * @brief Append pieces of data to the queue. The last piece is appended by
+ * reference, and the others are copied.
+ *
+ * The caller hands one reference of the last piece to the queue: release(arg)
+ * is called once it's sent, the queue is cleared, or the append fails.
+ *
+ * @param queue Queue, non-null.
+ * @param iovs Pieces of data, in order.
+ * @param num_iovs Number of pieces, > 0.
+ * @param release Callback when the last piece is no longer used, non-null.
+ * @param arg Argument of release.
+ * @return int 0 on success; -1 otherwise.
+ */
+int out_queue_pushv_ref(struct out_queue* queue,
+                        const struct iovec* iovs,
+                        int num_iovs,
+                        out_release release,
+                        void* arg);
+
+/**
+ * @brief Send pieces of data to a socket after the queued data, with as few
+ * writes as possible: one writev() for a plain socket, or one SSL_write() of
+ * the pieces coalesced up to a full record for a SSL socket. What the socket
+ * can't take right away is queued: the last piece by reference, and the others
+ * by copy, so they should be small.
+ *
+ * The caller hands one reference of the last piece to the queue: release(arg)
+ * is called once it's sent, the queue is cleared, or the send fails.
+ *
+ * @param queue Queue of the socket, non-null.
+ * @param fd FD for non-blocking socket.
+ * @param ssl SSL structure if the socket is one end of a SSL connection; NULL
+ * otherwise.
+ * @param iovs Pieces of data, in order.
+ * @param num_iovs Number of pieces, 0 < num_iovs <= OUT_MAX_IOVS.
+ * @param release Callback when the last piece is no longer used, non-null.
+ * @param arg Argument of release.
+ * @return int 0 on success; -1 if the socket is broken.
+ */
+int out_queue_sendv_ref(struct out_queue* queue,
+                        int fd,
+                        SSL* ssl,
+                        const struct iovec* iovs,
+                        int num_iovs,
+                        out_release release,
+                        void* arg);
+
+/**
+ * @brief Write queued data to a socket until it would block.
+ *
+ * @param queue Queue of the socket, non-null.
+ * @param fd FD for non-blocking socket.
+ * @param ssl SSL structure if the socket is one end of a SSL connection; NULL
+ * otherwise.
+ * @return int 1 if the queue is empty; 0 if data is left; -1 if the socket is
+ * broken.
+ */
+int out_queue_flush(struct out_queue* queue, int fd, SSL* ssl);
+
+#endif /* OUT_QUEUE_H */
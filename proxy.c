@@ -9,7 +9,48 @@
 *     Summary:
 *     Main driver for HTTP proxy.
 *
-*     Usage: ./proxy <port> [<cert> <key>]
+*     Usage: ./proxy [--workers <n>] [--connect-timeout <sec>]
+*                    [--hosts <file>] [--no-splice]
+*                    [--cache-size <size>]
+*                    [--cache-object-size <size>]
+*                    [--cache-sweep <n>] [--cache-dechunk]
+*                    [--cache-policy <policy>]
+*                    [--disk-cache <dir>] [--disk-cache-size <size>]
+*                    [--cache-snapshot <snapshot>]
+*                    <port> [<cert> <key>]
+*     * <n> is the number of worker processes. Each worker
+*     has its own listening socket bound with SO_REUSEPORT,
+*     event loop, socket buffers, cache and log tag. The
+*     kernel spreads new clients across workers. Without
+*     this option, the proxy runs in a single process.
+*     * <sec> is the timeout for connecting to a server, 10
+*     seconds by default. The client gets "502 Bad Gateway"
+*     on timeout.
+*     * <file> is an /etc/hosts-style file of "<addr> <host>
+*     [<ttl>]" lines. If given, hostnames are only resolved
+*     by it; otherwise, by the system resolver.
+*     * --no-splice copies CONNECT tunnel data through user
+*     space instead of moving it with splice().
+*     * --cache-size is the memory budget of the cache of each
+*     worker, 64M by default. --cache-object-size is the max
+*     size of one cached response, 8M by default. <size> is
+*     in bytes, with an optional K, M or G suffix.
+*     * --cache-sweep is the max number of expired responses
+*     removed from the cache per event loop tick, 16 by
+*     default; 0 leaves them until evicted or looked up.
+*     * --cache-dechunk caches chunked responses without their
+*     chunked framing and trailer fields, so cache hits are
+*     served with a Content-Length.
+*     * <policy> is the eviction policy of the cache: lru (by
+*     default), or s3fifo and tinylfu, which resist scans of
+*     one-off URLs.
+*     * <dir> enables the disk tier of the cache: responses
+*     evicted from memory spill to segment files in <dir>,
+*     up to --disk-cache-size per worker, 1G by default.
+*     * <snapshot> is a file that the fresh cached responses
+*     are saved to on shutdown, and loaded from on start, so
+*     a restarted proxy starts with a warm cache. Each worker
+*     uses its own file, <snapshot>.<n>.
 *     * <port> is the port that the proxy listens on.
 *     * <cert> is the certificate PEM file for SSL interception.
 *     * <key> is the private key PEM file for SSL interception.
@@ -20,12 +61,23 @@
 *
 **************************************************************/
 
+#define _GNU_SOURCE /* For accept4(), pipe2() and splice(). */
+
 #include "cache.h"
+#include "disk_cache.h"
+#include "event_loop.h"
 #include "http_utils.h"
+#include "inflight.h"
 #include "logger.h"
+#include "resolver.h"
+#include "slab.h"
 #include "sock_buf.h"
+#include "timer.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <openssl/err.h>
@@ -35,22 +87,170 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/select.h>
+#include <string.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #define BUF_SIZE 8192
-#define CACHE_SIZE 100
+#define CACHE_BYTES (64 << 20) /* Default memory budget of the cache. */
+#define CACHE_OBJECT_BYTES (8 << 20) /* Default max size of a cached
+                                      * response. */
+#define CACHE_SWEEP 16 /* Default max number of expired responses removed per
+                        * loop tick. */
+#define DISK_CACHE_BYTES (1ULL << 30) /* Default disk budget of the cache. */
+#define STALE_KEEP (24 * 3600) /* Seconds a stale response with a validator
+                                * stays cached, to be revalidated instead of
+                                * fetched again. */
+#define WORKER_MIN_UPTIME 10 /* Seconds a worker must run for before it
+                              * crashes, not to be respawned with a backoff. */
+#define WORKER_MAX_BACKOFF 60 /* Max seconds to wait before respawning a
+                               * worker. */
+#define RESOLVER_THREADS 4 /* Number of DNS resolver threads. */
+#define HEADER_TIMEOUT 30 /* Seconds for a client to send a request head. */
+#define IDLE_TIMEOUT 600 /* Seconds for an idle connection or tunnel. */
+#define RESPONSE_TIMEOUT 60 /* Seconds for a server to send (the next part of)
+                             * its response. */
+#define OUT_HIGH_WATER (256 * 1024) /* Queued bytes of a socket to pause reading
+                                     * from its peers. */
+#define OUT_LOW_WATER (64 * 1024) /* Queued bytes of a socket to resume reading
+                                   * from its peers. */
+#define PIPE_SIZE 65536 /* Byte size of data spliced into a tunnel pipe at a
+                         * time, i.e. the default pipe capacity. */
+
+/* Socket whose reading is resumed, to be read on the next loop iteration. */
+struct resumed_sock {
+    int fd;
+    unsigned long id; /* ID of the socket buffer when it's resumed. */
+};
 
 static int listen_port = 9999; /* Port that proxy listens on. */
 static int listen_sock; /* Listening socket of the proxy. */
-static fd_set active_fd_set; /* FD sets of all active sockets. */
-static fd_set read_fd_set;   /* FD sets of all sockets read to be read. */
-static int max_fd = 4; /* Largest used FD so far. */
 static SSL_CTX* ssl_ctx; /* SSL context for this proxy. */
 static int use_ssl = 0; /* Whether to use SSL interception. */
 static const char* CERT_FILE = NULL; /* Certificate file for SSL. */
 static const char* KEY_FILE = NULL; /* Private key file for SSL. */
+static time_t connect_timeout = 10; /* Timeout for connecting to server in
+                                     * seconds. */
+static const char* hosts_file = NULL; /* Hosts file to resolve hostnames; NULL
+                                      * to use the system resolver. */
+static int use_splice = 1; /* Whether to splice tunnel data instead of copying
+                            * it. */
+static size_t cache_bytes_limit = CACHE_BYTES; /* Memory budget of the
+                                                * cache. */
+static size_t cache_object_limit = CACHE_OBJECT_BYTES; /* Max size of a cached
+                                                        * response. */
+static int cache_dechunk = 0; /* Whether to cache chunked responses without
+                              * their chunked framing. */
+static int cache_sweep_limit = CACHE_SWEEP; /* Max number of expired responses
+                                             * removed per loop tick. */
+static enum cache_policy cache_policy = CACHE_LRU; /* Eviction policy of the
+                                                   * cache. */
+static const char* disk_cache_dir = NULL; /* Directory of the disk tier of the
+                                           * cache; NULL to disable it. */
+static size_t disk_cache_limit = DISK_CACHE_BYTES; /* Disk budget of the
+                                                    * cache. */
+static const char* cache_snapshot_file = NULL; /* Snapshot file of the cache;
+                                                * NULL to start cold. */
+static int num_workers = 0; /* Number of worker processes; 0 to run the proxy
+                             * in the main process. */
+static pid_t* worker_pids = NULL; /* PID of each worker process. */
+static volatile sig_atomic_t stopping = 0; /* Whether the proxy, or the
+                                            * workers, are stopping. */
+static struct resumed_sock* resumed = NULL; /* Sockets to read again. */
+static int num_resumed = 0;
+static int resumed_cap = 0;
+
+/**
+ * @brief Set the given socket non-blocking.
+ *
+ * @param sock FD for socket.
+ * @return int 0 on success; -1 otherwise.
+ */
+int set_nonblocking(int sock)
+{
+    int flags;
+
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        PLOG_ERROR("fcntl");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read from a non-blocking socket once.
+ *
+ * @param sock FD for socket.
+ * @param ssl SSL structure if the socket is one end of a SSL connection; NULL
+ * otherwise.
+ * @param buf Buffer to read into.
+ * @param size Byte size of buffer.
+ * @return int Byte size read on success; 0 if the socket is closed on the
+ * other side; -1 on error; -2 if there is nothing to read for now.
+ */
+int read_sock(int sock, SSL* ssl, char* buf, int size)
+{
+    int n;
+    int err;
+
+    if (ssl != NULL) {
+        n = SSL_read(ssl, buf, size);
+        if (n > 0) {
+            return n;
+        }
+        err = SSL_get_error(ssl, n);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            return -2;
+        }
+        if (err == SSL_ERROR_ZERO_RETURN ||
+            (err == SSL_ERROR_SYSCALL && n == 0)) {
+            return 0;
+        }
+        ERR_print_errors_fp(stderr);
+        LOG_ERROR("SSL_read");
+        return -1;
+    }
+
+    do {
+        n = read(sock, buf, size);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -2;
+        }
+        PLOG_ERROR("read");
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Advance a SSL handshake on a non-blocking socket as far as it goes
+ * without blocking.
+ *
+ * @param ssl SSL structure whose connect/accept state has been set.
+ * @return int 1 if the handshake is done; 0 if it waits for the socket to be
+ * readable or writable; -1 on error.
+ */
+int ssl_handshake(SSL* ssl)
+{
+    int n;
+    int err;
+
+    n = SSL_do_handshake(ssl);
+    if (n == 1) {
+        return 1;
+    }
+    err = SSL_get_error(ssl, n);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        return 0;
+    }
+    ERR_print_errors_fp(stderr);
+    return -1;
+}
 
 /**
  * @brief Initialzed a listening socket that listens on the given port.
@@ -78,8 +278,18 @@ int init_listen_sock(int port)
         PLOG_FATAL("setsockopt");
     }
 
+    /* Let each worker bind its own socket to the same port. */
+    if (num_workers > 0 &&
+        setsockopt(sock,
+                   SOL_SOCKET,
+                   SO_REUSEPORT,
+                   (const void *)&optval,
+                   sizeof(int)) < 0) {
+        PLOG_FATAL("setsockopt");
+    }
+
     /* Set socket non-block. */
-    fcntl(sock, F_SETFL, O_NONBLOCK);
+    set_nonblocking(sock);
 
     /* Build the sock's internet address. */
     addr.sin_family = AF_INET; /* Use the Internet. */
@@ -118,6 +328,12 @@ void init_ssl(void)
         LOG_FATAL("SSL_CTX_new");
     }
 
+    /* Let SSL_write() take part of the data, and be retried with the rest from
+     * an outbound queue that may move it. */
+    SSL_CTX_set_mode(ssl_ctx,
+                     SSL_MODE_ENABLE_PARTIAL_WRITE |
+                     SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
     /*  Load certificates. */
     if (SSL_CTX_use_certificate_file(ssl_ctx,
                                      CERT_FILE,
@@ -159,14 +375,22 @@ void clear_ssl(void)
     ERR_free_strings();
 }
 
+void handle_listen_event(int fd, int events);
+void set_deadline(int fd, enum sock_deadline deadline);
+void handle_resolver_event(int fd, int events);
+void handle_resolved(int fd, unsigned long id, int error, struct in_addr addr);
+void end_revalidation(int server_sock);
+
 /**
  * @brief Initialize the proxy.
  */
 void init_proxy(void)
 {
+    int num_loaded;
+
     /* Setup listening socket. */
     listen_sock = init_listen_sock(listen_port);
-    if (listen(listen_sock, 1) < 0) {
+    if (listen(listen_sock, SOMAXCONN) < 0) {
         PLOG_FATAL("listen");
     }
     LOG_INFO("listen on port %d", listen_port);
@@ -175,12 +399,46 @@ void init_proxy(void)
         init_ssl();
     }
 
-    /* Init FD set for select(). */
-    FD_ZERO(&active_fd_set);
-    FD_SET(listen_sock, &active_fd_set);
+    /* Init timer wheel. */
+    if (timer_init() < 0) {
+        LOG_FATAL("timer_init");
+    }
+
+    /* Init event loop and watch for new clients. */
+    if (event_loop_init() < 0) {
+        LOG_FATAL("event_loop_init");
+    }
+    if (event_loop_add(listen_sock, EVENT_READ, handle_listen_event) < 0) {
+        LOG_FATAL("event_loop_add");
+    }
+
+    /* Init DNS resolver and watch for completed lookups. */
+    if (resolver_init(RESOLVER_THREADS, hosts_file, handle_resolved) < 0) {
+        LOG_FATAL("resolver_init");
+    }
+    if (event_loop_add(resolver_fd(), EVENT_READ, handle_resolver_event) < 0) {
+        LOG_FATAL("event_loop_add");
+    }
 
-    /* Init LRU cache. */
-    cache_init(CACHE_SIZE);
+    /* Init cache. */
+    if (cache_init(cache_bytes_limit, cache_object_limit, cache_policy) < 0) {
+        LOG_FATAL("cache_init");
+    }
+    if (disk_cache_dir != NULL &&
+        disk_cache_init(disk_cache_dir,
+                        disk_cache_limit,
+                        DISK_SEGMENT_BYTES) < 0) {
+        LOG_FATAL("disk_cache_init");
+    }
+    /* Warm the cache from the last snapshot. An invalid one is skipped. */
+    if (cache_snapshot_file != NULL) {
+        num_loaded = cache_load(cache_snapshot_file);
+        if (num_loaded >= 0) {
+            LOG_INFO("cache: loaded %d responses from %s",
+                     num_loaded,
+                     cache_snapshot_file);
+        }
+    }
 
     /* Init socket buffer array. */
     sock_buf_arr_init();
@@ -191,19 +449,63 @@ void init_proxy(void)
  */
 void clear_proxy(void)
 {
-    /* Free LRU cache. */
+    struct slab_stats stats;
+    int num_saved;
+
+    /* Snapshot and free cache. */
+    if (cache_snapshot_file != NULL) {
+        num_saved = cache_save(cache_snapshot_file);
+        if (num_saved >= 0) {
+            LOG_INFO("cache: saved %d responses to %s",
+                     num_saved,
+                     cache_snapshot_file);
+        }
+    }
+    LOG_INFO("cache (%s): %zu bytes, peak %zu bytes",
+             cache_policy_name(cache_policy),
+             cache_bytes(),
+             cache_peak_bytes());
+    slab_get_stats(&stats);
+    LOG_INFO("cache slabs: %zu bytes, %zu in chunks, %zu requested; "
+             "%zu bytes mapped for %d large values",
+             stats.slab_bytes,
+             stats.chunk_bytes,
+             stats.request_bytes,
+             stats.large_bytes,
+             stats.num_large);
     cache_clear();
-
-    /* Free socket buffer array. */
-    sock_buf_arr_clear();
+    if (disk_cache_enabled()) {
+        LOG_INFO("disk cache: %zu bytes in %d responses",
+                 disk_cache_bytes(),
+                 disk_cache_size());
+        disk_cache_clear();
+    }
 
     /* Close all sockets. */
-    for (int fd = 0; fd < FD_SETSIZE; ++fd) {
-        if (FD_ISSET(fd, &active_fd_set)) {
-            FD_CLR(fd, &active_fd_set);
+    for (int fd = 0; fd < sock_buf_arr_size(); ++fd) {
+        if (sock_buf_get(fd) != NULL) {
+            end_revalidation(fd);
             close(fd);
         }
     }
+    close(listen_sock);
+
+    /* Free socket buffer array. */
+    sock_buf_arr_clear();
+    inflight_clear();
+    free(resumed);
+    resumed = NULL;
+    num_resumed = 0;
+    resumed_cap = 0;
+
+    /* Stop DNS resolver. */
+    resolver_clear();
+
+    /* Free timer wheel. */
+    timer_clear();
+
+    /* Free event loop. */
+    event_loop_clear();
 
     if (use_ssl) {
         clear_ssl();
@@ -211,14 +513,16 @@ void clear_proxy(void)
 }
 
 /**
- * @brief SIGINT handler that cleans up proxy and exit.
+ * @brief SIGINT/SIGTERM handler. It only flags the proxy, or the main process
+ * in worker mode, to stop; the cleanup, e.g. saving the cache snapshot, isn't
+ * async-signal-safe, so it's left to the main loop.
+ *
+ * @param sig
  */
-void INT_handler(int sig)
+void stop_handler(int sig)
 {
     (void)sig;
-    clear_proxy();
-    LOG_INFO("shut down");
-    exit(EXIT_SUCCESS);
+    stopping = 1;
 }
 
 /**
@@ -231,1036 +535,3562 @@ void PIPE_hander(int sig)
     (void)sig;
 }
 
+void handle_sock_event(int fd, int events);
+void handle_connect_failure(int server_sock);
+int handle_handshake_event(int fd);
+int reply_bad_gateway(int client_sock);
+void fast_forward(int server_sock, const char* buf, int n);
+void drain_waiters(const struct inflight_waiter* waiters, int num_waiters);
+
 /**
  * @brief Accept a new client.
+ *
+ * @return int 1 if a client is accepted; 0 if there is no pending client;
+ * -1 on error.
  */
-void accept_client(void)
+int accept_client(void)
 {
     int client_sock; /* FD for client sockect. */
     struct sockaddr_in client_addr; /* Client address. */
-    unsigned size = sizeof(client_addr);
+    socklen_t size = sizeof(client_addr);
 
-    client_sock = accept(listen_sock,
-                        (struct sockaddr *)&client_addr,
-                        &size);
+    client_sock = accept4(listen_sock,
+                          (struct sockaddr *)&client_addr,
+                          &size,
+                          SOCK_NONBLOCK);
     if (client_sock < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        if (errno == EINTR || errno == ECONNABORTED) {
+            /* Ignore this client. */
+            return 1;
+        }
         PLOG_ERROR("accept");
-        /* Ignore this client. */
-        return;
+        return -1;
     }
 
     /* Create socket buffer for this new client. */
     if (sock_buf_add_client(client_sock) == 0) {
         LOG_ERROR("fail to add client socket buffer");
         close(client_sock);
-        return;
+        return 1;
     }
 
-    /* Update upperbound of used FD for sockets. */
-    if (client_sock > max_fd) {
-        max_fd = client_sock;
+    /* Watch for incoming messages from the new client. */
+    if (event_loop_add(client_sock, EVENT_READ, handle_sock_event) < 0) {
+        LOG_ERROR("fail to watch client socket");
+        sock_buf_rm(client_sock);
+        close(client_sock);
+        return 1;
     }
-
-    /* Add new client to selection FD set. */
-    FD_SET(client_sock, &active_fd_set);
+    sock_buf_get(client_sock)->events = EVENT_READ;
+    set_deadline(client_sock, DEADLINE_HEADER);
 
     LOG_INFO("accept %s:%hu",
              inet_ntoa(client_addr.sin_addr),
              ntohs(client_addr.sin_port));
+    return 1;
 }
 
 /**
- * Connect to server by the given hostname and port.
+ * @brief Accept all pending clients when the listening socket is readable.
  *
- * @param hostname Server hostname without port number.
- * @param port Server port number.
- * @param client_sock FD for client socket.
- * @param connected_sock Socket for the other side of a CONNECT method; -1 if 
- * method is not CONNECT.
- * @param key String for cache key, i.e. hostname + url in GET request.
- * @return Socket of the new connected server.
+ * @param fd FD for the listening socket.
+ * @param events Ready events.
  */
-int connect_server(const char *hostname,
-                   const int port,
-                   int client_sock,
-                   char* key) {
-    int server_sock;
-    struct hostent *server;
-    struct sockaddr_in server_addr;
+void handle_listen_event(int fd, int events)
+{
+    (void)fd;
+    (void)events;
 
-    /* Create server socket. */
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
-        PLOG_ERROR("socket");
-        return -1;
+    /* Edge-triggered: accept until there is no pending client. */
+    while (accept_client() > 0) {
+        continue;
     }
+}
 
-    /* Get the server's DNS entry. */
-    server = gethostbyname(hostname);
-    if (server == NULL) {
-        LOG_ERROR("cannot resolve host: %s", hostname);
-        return -1;
-    }
+/**
+ * @brief Start a non-blocking connection to a resolved server.
+ *
+ * The server socket stays in SOCK_CONNECTING state until it becomes writable,
+ * see handle_connect_event().
+ *
+ * @param server_sock FD for server socket.
+ * @param addr Address of the server.
+ * @return int 0 on success; -1 otherwise.
+ */
+int start_connect(int server_sock, struct in_addr addr)
+{
+    struct sock_buf* server_buf = NULL;
+    struct sockaddr_in server_addr;
+
+    server_buf = sock_buf_get(server_sock);
 
     /* Build the server's Internet address. */
     bzero((char *)&server_addr, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr,
-          (char *)&server_addr.sin_addr.s_addr,
-          server->h_length);
-    server_addr.sin_port = htons(port);
+    server_addr.sin_addr = addr;
+    server_addr.sin_port = htons(server_buf->port);
 
-    /* Create a connection with the server. */
+    /* Start a connection with the server. */
     if (connect(server_sock,
                 (struct sockaddr *)&server_addr,
-                sizeof(server_addr)) < 0) {
+                sizeof(server_addr)) < 0 &&
+        errno != EINPROGRESS) {
         PLOG_ERROR("connect");
         return -1;
     }
 
-    /* Create socket buffer for this server. */
-    if (sock_buf_add_server(server_sock,
-                            client_sock,
-                            key) == 0) {
-      LOG_ERROR("fail to add server socket buffer");
-      close(server_sock);
+    /* Watch for the end of connecting, i.e. the socket becomes writable. Even
+     * if the connection has been established, it is handled in the event
+     * loop. */
+    if (event_loop_add(server_sock,
+                       EVENT_READ | EVENT_WRITE,
+                       handle_sock_event) < 0) {
+      LOG_ERROR("fail to watch server socket");
       return -1;
     }
-
-    /* Update upperbound of used FD for sockets. */
-    if (server_sock > max_fd) {
-        max_fd = server_sock;
-    }
-
-    /* Add new server to selection FD set. */
-    FD_SET(server_sock, &active_fd_set);
-
-    LOG_INFO("connect to %s:%d", hostname, port);
-
-    return server_sock;
+    server_buf->events = EVENT_READ | EVENT_WRITE;
+    server_buf->state = SOCK_CONNECTING;
+    return 0;
 }
 
-void disconnect_client(int fd);
-
 /**
- * @brief Disconnect the given server.
- * 
+ * @brief Callback of the resolver. Start connecting to the resolved server.
+ *
  * @param fd FD for server socket.
+ * @param id ID of the server socket buffer when the lookup started.
+ * @param error 0 if the host is resolved; -1 otherwise.
+ * @param addr Address of the server.
  */
-void disconnect_server(int fd)
+void handle_resolved(int fd, unsigned long id, int error, struct in_addr addr)
 {
-    struct sock_buf* client_buf = NULL;
     struct sock_buf* server_buf = NULL;
-    int is_forward = 0;
-    int peer;
 
-    if (sock_buf_get(fd) == NULL) {
+    /* The server may have been disconnected, e.g. on timeout. */
+    server_buf = sock_buf_get(fd);
+    if (server_buf == NULL ||
+        server_buf->id != id ||
+        server_buf->state != SOCK_RESOLVING) {
         return;
     }
 
-    /* Close SSL connection. */
-    if (sock_buf_is_ssl(fd)) {
-        /* Close SSL connection between the proxy and the server.*/
-        server_buf = sock_buf_get(fd);
-        SSL_shutdown(server_buf->ssl);
-        SSL_free(server_buf->ssl);
-        server_buf->ssl = NULL;
-
-        /* Close SSL connection between the proxy and the client.*/
-        client_buf = sock_buf_get(server_buf->peer);
-        if (client_buf != NULL && client_buf->ssl != NULL) {
-            SSL_shutdown(client_buf->ssl);
-            SSL_free(client_buf->ssl);
-            client_buf->ssl = NULL;
-        }
-    }
-
-    /* Close TCP connection. */
-    close(fd);
-
-    /* Remove from FD set for select(). */
-    FD_CLR(fd, &active_fd_set);
-
-    /* Find the peer that directly forward to. */
-    is_forward = sock_buf_is_forward(fd);
-    if (is_forward) {
-        /* Disconnect client that directly forward to. */
-        server_buf = sock_buf_get(fd);
-        peer = server_buf->peer;
+    if (error != 0) {
+        LOG_ERROR("cannot resolve host (fd: %d)", fd);
+        handle_connect_failure(fd);
+        return;
     }
-
-    /* Remove socket buffer. */
-    sock_buf_rm(fd);
-
-    /* Disconnect the peer that directly forward to. */
-    if (is_forward) {
-        disconnect_client(peer);
+    if (start_connect(fd, addr) < 0) {
+        handle_connect_failure(fd);
     }
-
-    LOG_INFO("disconnect server (fd: %d)", fd);
 }
 
 /**
- * @brief Disconnect a client of the given FD.
- *
- * Its required servers will also be disconnected.
- * @param fd FD for client socket.
+ * @brief Handle completed lookups of the resolver.
  */
-void disconnect_client(int fd)
+void handle_resolver_event(int fd, int events)
 {
-    struct sock_buf* server_buf = NULL;
-
-    if (sock_buf_get(fd) == NULL) {
-        return;
-    }
-
-    /* Close TCP connection. */
-    close(fd);
-
-    /* Remove from FD set for select(). */
-    FD_CLR(fd, &active_fd_set);
-
-    /* Remove socket buffer. */
-    sock_buf_rm(fd);
-
-    /* Close connected server. */
-    for (int i = 0; i <= max_fd; ++i) {
-        server_buf = sock_buf_get(i);
-        if (server_buf != NULL && server_buf->peer == fd) {
-            disconnect_server(i);
-        }
-    }
-
-    LOG_INFO("disconnect client (fd: %d)", fd);
+    (void)fd;
+    (void)events;
+    resolver_process();
 }
 
 /**
- * Establish SSL connection to server.
+ * Start connecting to server by the given hostname and port.
+ *
+ * Neither resolving nor connecting blocks. The server socket stays in
+ * SOCK_RESOLVING state until its hostname is resolved, see handle_resolved().
+ * Data sent to the server in the meantime is kept in its outbound queue.
  *
  * @param hostname Server hostname without port number.
  * @param port Server port number.
  * @param client_sock FD for client socket.
- * @return int Socket of the new connected server on success; -1 otherwise.
+ * @param key String for cache key, i.e. hostname + url in GET request.
+ * @return Socket of the new server on success; -1 otherwise.
  */
-int ssl_connect_server(const char* hostname, int port, int client_sock)
-{
+int connect_server(const char *hostname,
+                   const int port,
+                   int client_sock,
+                   char* key) {
     int server_sock;
-    struct sock_buf* sock_buf = NULL;
-    SSL* ssl = NULL;
+    int n;
+    struct sock_buf* server_buf = NULL;
+    struct in_addr addr;
 
-    server_sock = connect_server(hostname, port, client_sock, NULL);
+    /* Create non-blocking server socket. */
+    server_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (server_sock < 0) {
-        /* Fail to connect to the server. */
-        return -1;
-    }
-    sock_buf = sock_buf_get(server_sock);
-    if (sock_buf == NULL) {
-        LOG_ERROR("unknown socket %d", client_sock);
+        PLOG_ERROR("socket");
         return -1;
     }
-    ssl = SSL_new(ssl_ctx);
-    if (ssl == NULL) {
-        LOG_ERROR("SSL_new");
-        ERR_print_errors_fp(stderr);
-        disconnect_server(server_sock);
-        return -1;
+
+    /* Create socket buffer for this server. */
+    if (sock_buf_add_server(server_sock,
+                            client_sock,
+                            key) == 0) {
+      LOG_ERROR("fail to add server socket buffer");
+      close(server_sock);
+      return -1;
     }
-    if (SSL_set_fd(ssl, server_sock) == 0) {
-        LOG_ERROR("SSL_set_fd");
-        ERR_print_errors_fp(stderr);
-        disconnect_server(server_sock);
+    server_buf = sock_buf_get(server_sock);
+    server_buf->port = port;
+    set_deadline(server_sock, DEADLINE_CONNECT);
+
+    /* Look up the server's address. */
+    n = resolver_lookup(hostname, server_sock, server_buf->id, &addr);
+    if (n < 0) {
+        LOG_ERROR("cannot resolve host: %s", hostname);
+        sock_buf_rm(server_sock);
+        close(server_sock);
         return -1;
     }
-    if (SSL_connect(ssl) != 1) {
-        LOG_ERROR("SSL_connect");
-        ERR_print_errors_fp(stderr);
-        disconnect_server(server_sock);
+    if (n > 0 && start_connect(server_sock, addr) < 0) {
+        event_loop_del(server_sock);
+        sock_buf_rm(server_sock);
+        close(server_sock);
         return -1;
     }
-    sock_buf->ssl = ssl;
-    sock_buf->peer = client_sock;
+
+    LOG_INFO("connecting to %s:%d (fd: %d)", hostname, port, server_sock);
+
     return server_sock;
 }
 
 /**
- * @brief Establish SSL connection with client.
- * 
- * @param client_sock FD for client socket.
- * @param server_sock FD for client socket.
+ * @brief Change the events that an established socket is watched for, if they
+ * differ from the current ones.
+ *
+ * @param fd FD for client/server socket.
+ * @param events Bitwise OR of EVENT_READ and EVENT_WRITE.
  * @return int 0 on success; -1 otherwise.
  */
-int ssl_accept_client(int client_sock, int server_sock)
+int watch_sock(int fd, int events)
 {
     struct sock_buf* sock_buf = NULL;
-    SSL* ssl = NULL;
 
-    sock_buf = sock_buf_get(client_sock);
-    if (sock_buf == NULL) {
-        LOG_ERROR("unknown socket %d", client_sock);
-        return -1;
-    }
-    ssl = SSL_new(ssl_ctx);
-    if (ssl == NULL) {
-        LOG_ERROR("SSL_new");
-        ERR_print_errors_fp(stderr);
-        disconnect_client(client_sock);
-        return -1;
-    }
-    if (SSL_set_fd(ssl, client_sock) == 0) {
-        LOG_ERROR("SSL_set_fd");
-        ERR_print_errors_fp(stderr);
-        disconnect_client(client_sock);
-        return -1;
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf->events == events) {
+        return 0;
     }
-    if (SSL_accept(ssl) != 1) {
-        LOG_ERROR("SSL_accept");
-        ERR_print_errors_fp(stderr);
-        disconnect_client(client_sock);
+    if (event_loop_mod(fd, events) < 0) {
         return -1;
     }
-    sock_buf->ssl = ssl;
-    sock_buf->peer = server_sock;
+    sock_buf->events = events;
     return 0;
 }
 
 /**
- * @brief Send a connect established response to client
- * 
- * @param fd FD for a client/server socket.
- * @param version version string for HTTP request.
+ * @brief Pause reading from a socket. Its deadline becomes an idle one, since
+ * it's its peer that is slow.
  *
- * @return int 0 if succeed; -1 if client is disconnected, -2 if wrote a partial message.
+ * @param fd FD for client/server socket.
  */
-int reply_connection_established(int fd, char *version){
-    char * message = NULL;
-    int n;
-    int size =
-        strlen(version) + strlen(" 200 Connection Established\r\n\r\n");
-
+void pause_sock(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf == NULL || sock_buf->is_paused) {
+        return;
+    }
+    sock_buf->is_paused = 1;
+    set_deadline(fd, DEADLINE_IDLE);
+}
+
+/**
+ * @brief Resume reading from a paused socket. Data that arrived in the
+ * meantime didn't raise a new edge, so the socket is read on the next loop
+ * iteration, see handle_resumed().
+ *
+ * @param fd FD for client/server socket.
+ */
+void resume_sock(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+    struct resumed_sock* ret = NULL;
+    int cap;
+
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf == NULL || !sock_buf->is_paused) {
+        return;
+    }
+    if (num_resumed == resumed_cap) {
+        cap = resumed_cap == 0 ? 64 : resumed_cap * 2;
+        ret = realloc(resumed, cap * sizeof(struct resumed_sock));
+        if (ret == NULL) {
+            PLOG_ERROR("realloc");
+            return;
+        }
+        resumed = ret;
+        resumed_cap = cap;
+    }
+    sock_buf->is_paused = 0;
+    resumed[num_resumed].fd = fd;
+    resumed[num_resumed].id = sock_buf->id;
+    ++num_resumed;
+}
+
+/**
+ * @brief Resume reading from a paused server once all the clients it feeds,
+ * i.e. its own client and the clients waiting for its fetch, have drained their
+ * queues below the low-water mark. Any of them may have paused it.
+ *
+ * @param server_sock FD for server socket.
+ */
+void resume_fetch(int server_sock)
+{
+    struct sock_buf* server_buf = NULL;
+    struct sock_buf* client_buf = NULL;
+    const struct inflight_waiter* waiters = NULL;
+    int num_waiters;
+
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf == NULL || !server_buf->is_paused) {
+        return;
+    }
+    client_buf = sock_buf_get(server_buf->peer);
+    if (client_buf != NULL && client_buf->out.size > OUT_LOW_WATER) {
+        return;
+    }
+    num_waiters = inflight_waiters(server_buf->key, server_sock, &waiters);
+    for (int i = 0; i < num_waiters; ++i) {
+        client_buf = sock_buf_get(waiters[i].fd);
+        if (client_buf != NULL &&
+            client_buf->id == waiters[i].id &&
+            client_buf->out.size > OUT_LOW_WATER) {
+            return;
+        }
+    }
+    resume_sock(server_sock);
+}
+
+/**
+ * @brief Pause or resume reading from the sockets whose data is sent to the
+ * given socket, i.e. the servers of a client, or the client of a server. A
+ * client also resumes the server whose fetch it waits for; it's paused as the
+ * fetch is fed to the waiters, see fast_forward().
+ *
+ * @param fd FD for client/server socket.
+ * @param pause 1 to pause; 0 to resume.
+ */
+void throttle_peers(int fd, int pause)
+{
+    struct sock_buf* sock_buf = NULL;
+    struct sock_buf* server_buf = NULL;
+
+    void (*throttle)(int) = pause ? pause_sock : resume_fetch;
+
+    sock_buf = sock_buf_get(fd);
+    if (!sock_buf->is_client) {
+        if (sock_buf_get(sock_buf->peer) != NULL) {
+            if (pause) {
+                pause_sock(sock_buf->peer);
+            }
+            else {
+                resume_sock(sock_buf->peer);
+            }
+        }
+        return;
+    }
+    for (server_buf = sock_buf->servers;
+         server_buf != NULL;
+         server_buf = server_buf->next_server) {
+        throttle(server_buf->fd);
+    }
+    server_buf = sock_buf_get(sock_buf->wait_server);
+    if (!pause &&
+        server_buf != NULL &&
+        server_buf->id == sock_buf->wait_server_id) {
+        resume_fetch(server_buf->fd);
+    }
+}
+
+/**
+ * @brief Watch a socket for writability if data is queued for it, and pause
+ * its peers once too much data is queued.
+ *
+ * @param fd FD for client/server socket.
+ * @return int 0 on success; -1 otherwise.
+ */
+int watch_queue(int fd)
+{
+    struct sock_buf* sock_buf = sock_buf_get(fd);
+
+    if (sock_buf->state == SOCK_ESTABLISHED &&
+        sock_buf->out.size > 0 &&
+        watch_sock(fd, EVENT_READ | EVENT_WRITE) < 0) {
+        return -1;
+    }
+    if (sock_buf->out.size > OUT_HIGH_WATER) {
+        throttle_peers(fd, 1);
+    }
+    return 0;
+}
+
+/**
+ * @brief Send data to a socket without blocking. Data that the socket can't
+ * take right away is queued, and so is all the data before the connection is
+ * established. Its peers are paused once too much data is queued.
+ *
+ * @param fd FD for client/server socket.
+ * @param buf Data to send.
+ * @param len Byte size of data.
+ * @return int 0 on success; -1 if the socket is broken.
+ */
+int send_sock(int fd, const char* buf, int len)
+{
+    struct sock_buf* sock_buf = NULL;
+
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf == NULL) {
+        return -1;
+    }
+    if (sock_buf->state != SOCK_ESTABLISHED) {
+        if (out_queue_push(&sock_buf->out, buf, len) < 0) {
+            return -1;
+        }
+    }
+    else {
+        if (out_queue_send(&sock_buf->out,
+                           fd,
+                           sock_buf->ssl,
+                           buf,
+                           len) < 0) {
+            return -1;
+        }
+    }
+    return watch_queue(fd);
+}
+
+/**
+ * @brief Release callback of cached data queued for a socket.
+ *
+ * @param arg Pinned cache element.
+ */
+void release_cached(void* arg)
+{
+    cache_release(arg);
+}
+
+/**
+ * @brief Send pieces of a cached response to a socket without blocking, in
+ * one write if the socket takes it. The last piece is sent without copying;
+ * if the socket can't take it right away, it's queued by reference, which
+ * pins the cache element until it's sent. The other pieces should be small.
+ *
+ * @param fd FD for client/server socket.
+ * @param elem Pinned cache element that holds the last piece, non-null.
+ * @param iovs Pieces of data, in order.
+ * @param num_iovs Number of pieces, 0 < num_iovs <= OUT_MAX_IOVS.
+ * @return int 0 on success; -1 if the socket is broken.
+ */
+int send_cached(int fd,
+                struct cache_elem* elem,
+                const struct iovec* iovs,
+                int num_iovs)
+{
+    struct sock_buf* sock_buf = NULL;
+
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf == NULL) {
+        return -1;
+    }
+    /* The queue takes its own reference. */
+    cache_retain(elem);
+    if (sock_buf->state != SOCK_ESTABLISHED) {
+        if (out_queue_pushv_ref(&sock_buf->out,
+                                iovs,
+                                num_iovs,
+                                release_cached,
+                                elem) < 0) {
+            return -1;
+        }
+    }
+    else {
+        if (out_queue_sendv_ref(&sock_buf->out,
+                                fd,
+                                sock_buf->ssl,
+                                iovs,
+                                num_iovs,
+                                release_cached,
+                                elem) < 0) {
+            return -1;
+        }
+    }
+    return watch_queue(fd);
+}
+
+/**
+ * @brief Move the data in the pipe of a tunnel socket to its peer with
+ * splice(), until the peer would block. The data goes after whatever is queued
+ * for the peer, so it waits until the queue is empty.
+ *
+ * @param fd FD for client/server socket that is forwarded.
+ * @return int 0 on success, even if data is left; -1 if the peer is broken.
+ */
+int flush_pipe(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+    struct sock_buf* peer_buf = NULL;
+    int n;
+
+    sock_buf = sock_buf_get(fd);
+    peer_buf = sock_buf_get(sock_buf->peer);
+    if (peer_buf == NULL) {
+        return -1;
+    }
+    while (sock_buf->pipe_size > 0 && peer_buf->out.size == 0) {
+        n = splice(sock_buf->pipe_fds[0],
+                   NULL,
+                   sock_buf->peer,
+                   NULL,
+                   sock_buf->pipe_size,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            PLOG_ERROR("splice (fd: %d)", sock_buf->peer);
+            return -1;
+        }
+        sock_buf->pipe_size -= n;
+        sock_buf->forwarded += n;
+    }
+    if (sock_buf->pipe_size > 0) {
+        return watch_sock(sock_buf->peer, EVENT_READ | EVENT_WRITE);
+    }
+    return 0;
+}
+
+/**
+ * @brief Move the data left in the pipe of a tunnel socket to the outbound
+ * queue of its peer, e.g. before the socket is disconnected.
+ *
+ * @param fd FD for client/server socket that is forwarded.
+ * @return int 0 on success; -1 otherwise.
+ */
+int unpipe(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+    char buf[BUF_SIZE];
+    int n;
+
+    sock_buf = sock_buf_get(fd);
+    while (sock_buf->pipe_size > 0) {
+        n = read(sock_buf->pipe_fds[0], buf, BUF_SIZE);
+        if (n <= 0) {
+            PLOG_ERROR("read pipe (fd: %d)", fd);
+            return -1;
+        }
+        sock_buf->pipe_size -= n;
+        sock_buf->forwarded += n;
+        if (send_sock(sock_buf->peer, buf, n) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Send queued data of an established socket until it would block, and
+ * then the data in the pipe of its tunnel peer. Stop watching for writability
+ * once all is sent, and resume its peers once the queue drains below the
+ * low-water mark.
+ *
+ * @param fd FD for client/server socket.
+ * @return int 0 on success; -1 if the socket is broken.
+ */
+int flush_sock(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+    struct sock_buf* peer_buf = NULL;
+    int n;
+
+    sock_buf = sock_buf_get(fd);
+    n = out_queue_flush(&sock_buf->out, fd, sock_buf->ssl);
+    if (n < 0) {
+        return -1;
+    }
+    if (watch_sock(fd, n > 0 ? EVENT_READ : EVENT_READ | EVENT_WRITE) < 0) {
+        return -1;
+    }
+
+    /* Then the data spliced from the other end of a tunnel. */
+    peer_buf = sock_buf_get(sock_buf->peer);
+    if (n > 0 &&
+        sock_buf->is_forward &&
+        peer_buf != NULL &&
+        peer_buf->pipe_size > 0) {
+        if (flush_pipe(sock_buf->peer) < 0) {
+            return -1;
+        }
+        if (peer_buf->pipe_size > 0) {
+            return 0;
+        }
+    }
+
+    if (sock_buf->out.size <= OUT_LOW_WATER) {
+        throttle_peers(fd, 0);
+    }
+    return 0;
+}
+
+/**
+ * @brief Send data to a server. If the server is still connecting, the data is
+ * queued until the connection is established.
+ *
+ * @param server_sock FD for server socket.
+ * @param buf Data to send.
+ * @param len Byte size of data.
+ * @return int 0 on success; -1 otherwise.
+ */
+int send_to_server(int server_sock, const char* buf, int len)
+{
+    struct sock_buf* server_buf = NULL;
+
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf == NULL) {
+        LOG_ERROR("unknown socket %d", server_sock);
+        return -1;
+    }
+    if (server_buf->state == SOCK_ESTABLISHED && !server_buf->is_forward) {
+        set_deadline(server_sock, DEADLINE_RESPONSE);
+    }
+    return send_sock(server_sock, buf, len);
+}
+
+/**
+ * @brief Close a socket and free its socket buffer. Related sockets are left
+ * untouched.
+ *
+ * @param fd FD for client/server socket.
+ */
+void close_sock(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+    struct inflight_waiter* waiters = NULL;
+    int num_waiters = 0;
+    int wait_server = -1; /* Server whose fetch a client waits for. */
+    unsigned long wait_server_id = 0;
+
+    /* A fetch still in flight is cut short. Its waiters are drained once the
+     * socket is gone, since that may disconnect other sockets. */
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf != NULL && !sock_buf->is_client) {
+        inflight_remove(sock_buf->key, fd, &waiters, &num_waiters);
+        cache_fill_free(&sock_buf->fill);
+    }
+    else if (sock_buf != NULL) {
+        wait_server = sock_buf->wait_server;
+        wait_server_id = sock_buf->wait_server_id;
+    }
+    end_revalidation(fd);
+    event_loop_del(fd);
+    close(fd);
+    sock_buf_rm(fd);
+    /* A waiter that leaves no longer holds back the fetch. */
+    sock_buf = sock_buf_get(wait_server);
+    if (sock_buf != NULL && sock_buf->id == wait_server_id) {
+        resume_fetch(wait_server);
+    }
+    drain_waiters(waiters, num_waiters);
+    free(waiters);
+    waiters = NULL;
+}
+
+/**
+ * @brief Log the byte counters of a tunnel that is about to be closed.
+ *
+ * @param fd FD for client socket.
+ */
+void log_tunnel(int fd)
+{
+    struct sock_buf* client_buf = NULL;
+    struct sock_buf* server_buf = NULL;
+
+    client_buf = sock_buf_get(fd);
+    server_buf = sock_buf_get(client_buf->peer);
+    if (!client_buf->is_forward || server_buf == NULL) {
+        return;
+    }
+    LOG_INFO("close tunnel (fd: %d): %lld bytes up, %lld bytes down",
+             fd,
+             client_buf->forwarded,
+             server_buf->forwarded);
+}
+
+/**
+ * @brief Keep a server whose client is disconnected, if other clients wait for
+ * its response. It's detached from its client, and disconnected once the
+ * response is complete.
+ *
+ * @param server_sock FD for server socket.
+ * @return int 1 if it's kept; 0 otherwise.
+ */
+int keep_for_waiters(int server_sock)
+{
+    struct sock_buf* server_buf = NULL;
+    const struct inflight_waiter* waiters = NULL;
+
+    server_buf = sock_buf_get(server_sock);
+    if (inflight_waiters(server_buf->key, server_sock, &waiters) == 0) {
+        return 0;
+    }
+    sock_buf_detach_server(server_sock);
+    LOG_INFO("keep server for waiters (fd: %d)", server_sock);
+    /* Its client no longer holds back the fetch. */
+    resume_fetch(server_sock);
+    return 1;
+}
+
+/**
+ * @brief Disconnect a client of the given FD.
+ *
+ * Its servers will also be disconnected, except those fetching for waiters.
+ * @param fd FD for client socket.
+ */
+void disconnect_client(int fd)
+{
+    int server_sock;
+
+    if (sock_buf_get(fd) == NULL) {
+        return;
+    }
+    log_tunnel(fd);
+
+    /* Close its servers, except those fetching for waiters. */
+    while ((server_sock = sock_buf_first_server(fd)) >= 0) {
+        if (keep_for_waiters(server_sock)) {
+            continue;
+        }
+        close_sock(server_sock);
+        LOG_INFO("disconnect server (fd: %d)", server_sock);
+    }
+
+    close_sock(fd);
+    LOG_INFO("disconnect client (fd: %d)", fd);
+}
+
+/**
+ * @brief Disconnect a client once its queued data is sent, e.g. the rest of a
+ * tunnel whose server has closed, or an error reply.
+ *
+ * Its servers are disconnected right away, and nothing is read from it
+ * anymore.
+ * @param fd FD for client socket.
+ */
+void drain_client(int fd)
+{
+    struct sock_buf* client_buf = NULL;
+    int server_sock;
+
+    client_buf = sock_buf_get(fd);
+    if (client_buf == NULL) {
+        return;
+    }
+    if (client_buf->out.size == 0 || client_buf->state != SOCK_ESTABLISHED) {
+        disconnect_client(fd);
+        return;
+    }
+
+    log_tunnel(fd);
+    while ((server_sock = sock_buf_first_server(fd)) >= 0) {
+        if (keep_for_waiters(server_sock)) {
+            continue;
+        }
+        close_sock(server_sock);
+        LOG_INFO("disconnect server (fd: %d)", server_sock);
+    }
+    client_buf->peer = -1;
+    client_buf->is_closing = 1;
+    set_deadline(fd, DEADLINE_IDLE);
+}
+
+/**
+ * @brief Drain the waiters of a fetch that is cut short, since they can't get
+ * a whole response anymore. Waiters that are gone are skipped.
+ *
+ * @param waiters Waiters of the fetch.
+ * @param num_waiters Number of waiters.
+ */
+void drain_waiters(const struct inflight_waiter* waiters, int num_waiters)
+{
+    struct sock_buf* client_buf = NULL;
+
+    for (int i = 0; i < num_waiters; ++i) {
+        client_buf = sock_buf_get(waiters[i].fd);
+        if (client_buf == NULL || client_buf->id != waiters[i].id) {
+            continue;
+        }
+        LOG_INFO("fetch is cut short; drain waiter (fd: %d)", waiters[i].fd);
+        drain_client(waiters[i].fd);
+    }
+}
+
+/**
+ * @brief Get the next client waiting for the response of a server. Waiters
+ * that are gone are skipped. The waiters are looked up again on each call,
+ * since replying one may disconnect others.
+ *
+ * @param server_sock FD for server socket.
+ * @param pos In/out; position of the next waiter to check, 0 to start.
+ * @return int FD for the waiting client; -1 if there's no more.
+ */
+int next_waiter(int server_sock, int* pos)
+{
+    struct sock_buf* server_buf = NULL;
+    struct sock_buf* client_buf = NULL;
+    const struct inflight_waiter* waiters = NULL;
+    int num_waiters;
+
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf == NULL) {
+        return -1;
+    }
+    num_waiters = inflight_waiters(server_buf->key, server_sock, &waiters);
+    while (*pos < num_waiters) {
+        client_buf = sock_buf_get(waiters[*pos].fd);
+        if (client_buf != NULL && client_buf->id == waiters[*pos].id) {
+            return waiters[(*pos)++].fd;
+        }
+        ++*pos;
+    }
+    return -1;
+}
+
+/**
+ * @brief Disconnect the given server.
+ *
+ * A tunnel, either forwarded directly or intercepted by SSL, can't outlive
+ * its server, so its client is disconnected as well, once it gets the data
+ * queued for it. So is a client whose response is cut short, including one
+ * whose body ends when the server closes.
+ * @param fd FD for server socket.
+ */
+void disconnect_server(int fd)
+{
+    struct sock_buf* server_buf = NULL;
+    int client_sock;
+    int in_body;
+
+    server_buf = sock_buf_get(fd);
+    if (server_buf == NULL) {
+        return;
+    }
+    client_sock = server_buf->peer;
+    in_body = server_buf->in_body;
+
+    if ((server_buf->is_forward || server_buf->ssl != NULL) &&
+        sock_buf_get(client_sock) != NULL) {
+        drain_client(client_sock);
+        return;
+    }
+
+    close_sock(fd);
+    LOG_INFO("disconnect server (fd: %d)", fd);
+    if (in_body) {
+        drain_client(client_sock);
+    }
+}
+
+/**
+ * Start SSL handshake with a connected server. The server stays in
+ * SOCK_SSL_CONNECTING state until the handshake is done, see
+ * handle_handshake_event().
+ *
+ * @param server_sock FD for server socket.
+ * @return int 0 on success; -1 otherwise.
+ */
+int ssl_connect_server(int server_sock)
+{
+    struct sock_buf* sock_buf = NULL;
+    SSL* ssl = NULL;
+
+    sock_buf = sock_buf_get(server_sock);
+    if (sock_buf == NULL) {
+        LOG_ERROR("unknown socket %d", server_sock);
+        return -1;
+    }
+    ssl = SSL_new(ssl_ctx);
+    if (ssl == NULL) {
+        LOG_ERROR("SSL_new");
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    if (SSL_set_fd(ssl, server_sock) == 0) {
+        LOG_ERROR("SSL_set_fd");
+        ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
+        return -1;
+    }
+    SSL_set_connect_state(ssl);
+    sock_buf->ssl = ssl;
+    sock_buf->state = SOCK_SSL_CONNECTING;
+    return 0;
+}
+
+/**
+ * @brief Start SSL handshake with client. The client stays in
+ * SOCK_SSL_ACCEPTING state until the handshake is done, see
+ * handle_handshake_event().
+ *
+ * @param client_sock FD for client socket.
+ * @param server_sock FD for client socket.
+ * @return int 0 on success; -1 otherwise.
+ */
+int ssl_accept_client(int client_sock, int server_sock)
+{
+    struct sock_buf* sock_buf = NULL;
+    SSL* ssl = NULL;
+
+    sock_buf = sock_buf_get(client_sock);
+    if (sock_buf == NULL) {
+        LOG_ERROR("unknown socket %d", client_sock);
+        return -1;
+    }
+    ssl = SSL_new(ssl_ctx);
+    if (ssl == NULL) {
+        LOG_ERROR("SSL_new");
+        ERR_print_errors_fp(stderr);
+        disconnect_client(client_sock);
+        return -1;
+    }
+    if (SSL_set_fd(ssl, client_sock) == 0) {
+        LOG_ERROR("SSL_set_fd");
+        ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
+        disconnect_client(client_sock);
+        return -1;
+    }
+    SSL_set_accept_state(ssl);
+    sock_buf->ssl = ssl;
+    sock_buf->peer = server_sock;
+    sock_buf->state = SOCK_SSL_ACCEPTING;
+    set_deadline(client_sock, DEADLINE_CONNECT);
+
+    /* Watch both directions during the handshake. It also reports the
+     * ClientHello if it has already arrived. */
+    if (watch_sock(client_sock, EVENT_READ | EVENT_WRITE) < 0) {
+        disconnect_client(client_sock);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send a connect established response to client
+ * 
+ * @param fd FD for a client/server socket.
+ * @param version version string for HTTP request.
+ *
+ * @return int 0 if succeed; -1 if client is disconnected.
+ */
+int reply_connection_established(int fd, char *version){
+    char * message = NULL;
+    int n;
+    int size =
+        strlen(version) + strlen(" 200 Connection Established\r\n\r\n");
+
     message = malloc(size + 1);
     if (message == NULL) {
         PLOG_FATAL("malloc");
-        
+        
+    }
+    strcpy(message, version);
+    strcat(message, " 200 Connection Established\r\n\r\n");
+    message[size] = '\0';
+
+    n = send_sock(fd, message, size);
+    if (n < 0) {
+        free(message);
+        disconnect_client(fd);
+        return -1;
+    }
+    else {
+        LOG_INFO("replied Connection Established");
+    }
+
+    free(message);
+    message = NULL;
+
+    return 0;
+}
+
+/**
+ * @brief Send a cached response to a client, straight from the cache, with an
+ * Age field at the end of its head.
+ *
+ * @param client_sock FD for client socket.
+ * @param elem Pinned cache element of the response, non-null.
+ * @param val Value of the element.
+ * @param val_len Byte size of val.
+ * @param head_len Byte size of the head of val up to the end of its last field;
+ * -1 if it has no complete head.
+ * @param age Age of the response in seconds.
+ * @return int 0 on success; -1 if the client is disconnected.
+ */
+int reply_cached(int client_sock,
+                 struct cache_elem* elem,
+                 const char* val,
+                 int val_len,
+                 int head_len,
+                 int age)
+{
+    struct iovec iovs[3];
+    int num_iovs = 0;
+    char age_line[32];
+
+    if (head_len >= 0) {
+        iovs[num_iovs].iov_base = (char*)val;
+        iovs[num_iovs].iov_len = head_len;
+        ++num_iovs;
+        iovs[num_iovs].iov_base = age_line;
+        iovs[num_iovs].iov_len = snprintf(age_line,
+                                          sizeof(age_line),
+                                          "Age: %d\r\n",
+                                          age);
+        ++num_iovs;
+    }
+    else {
+        head_len = 0;
+    }
+    iovs[num_iovs].iov_base = (char*)val + head_len;
+    iovs[num_iovs].iov_len = val_len - head_len;
+    ++num_iovs;
+    if (send_cached(client_sock, elem, iovs, num_iovs) < 0) {
+        disconnect_client(client_sock);
+        return -1;
+    }
+    LOG_INFO("forward %d bytes from cache to client (fd %d)",
+             val_len,
+             client_sock);
+    return 0;
+}
+
+/**
+ * @brief Whether a client request is conditional on its own, i.e. it has an
+ * If-None-Match or If-Modified-Since field. Its client expects the answer to
+ * its own validators, so a stale cached response isn't revalidated nor served
+ * in its place.
+ *
+ * @param parser Parser of client request, whose head is complete.
+ * @return int 1 if it's conditional; 0 otherwise.
+ */
+int is_conditional_request(const struct http_parser* parser)
+{
+    return http_find_field(parser, "If-None-Match") != NULL ||
+           http_find_field(parser, "If-Modified-Since") != NULL;
+}
+
+/**
+ * @brief Whether the response to a client request may be shared with other
+ * requests for the same cache key, i.e. it's neither conditional on its own nor
+ * for a range, and carries no credentials (Authorization or Cookie) that its
+ * server may answer with a response meant for this client only.
+ *
+ * @param parser Parser of client request, whose head is complete.
+ * @return int 1 if it may be shared; 0 otherwise.
+ */
+int can_collapse(const struct http_parser* parser)
+{
+    return !is_conditional_request(parser) &&
+           http_find_field(parser, "Range") == NULL &&
+           http_find_field(parser, "Authorization") == NULL &&
+           http_find_field(parser, "Cookie") == NULL;
+}
+
+/**
+ * @brief Attach a client to the fetch in flight of a server, to be fed from
+ * its response like the client of the server. What the server has forwarded
+ * so far is replayed to the client right away from the cache fill of the
+ * response, so a response that passes through can't be waited for once its
+ * head is forwarded. The client keeps a copy of its request, to send it on its
+ * own if the response turns out not to be shared, see refetch_waiters().
+ *
+ * @param client_sock FD for client socket.
+ * @param server_sock FD for server socket that fetches the response.
+ * @param key Cache key of the response.
+ * @param request Client request.
+ * @param request_len Byte size of client request.
+ * @param url URL in client request.
+ * @param hostname Hostname in client request.
+ * @param port Port number in client request.
+ * @return int 1 if attached; 0 otherwise.
+ */
+int attach_waiter(int client_sock,
+                  int server_sock,
+                  const char* key,
+                  const char* request,
+                  int request_len,
+                  const char* url,
+                  const char* hostname,
+                  int port)
+{
+    struct sock_buf* client_buf = NULL;
+    struct sock_buf* server_buf = NULL;
+    const char* chunk = NULL;
+    int chunk_len = 0;
+    char* request_copy = NULL;
+    char* url_copy = NULL;
+    char* hostname_copy = NULL;
+
+    client_buf = sock_buf_get(client_sock);
+    server_buf = sock_buf_get(server_sock);
+    request_copy = malloc(request_len + 1);
+    url_copy = strdup(url);
+    hostname_copy = strdup(hostname);
+    if (request_copy == NULL || url_copy == NULL || hostname_copy == NULL) {
+        PLOG_ERROR("malloc");
+    }
+    if (request_copy == NULL ||
+        url_copy == NULL ||
+        hostname_copy == NULL ||
+        server_buf == NULL ||
+        server_buf->peer == client_sock ||
+        (server_buf->in_body &&
+         (server_buf->fill == NULL || cache_fill_is_full(server_buf->fill))) ||
+        inflight_attach(key, client_sock, client_buf->id) == 0) {
+        free(request_copy);
+        request_copy = NULL;
+        free(url_copy);
+        url_copy = NULL;
+        free(hostname_copy);
+        hostname_copy = NULL;
+        return 0;
+    }
+    LOG_INFO("wait for fetch in flight (fd: %d)", server_sock);
+    client_buf->wait_server = server_sock;
+    client_buf->wait_server_id = server_buf->id;
+    memcpy(request_copy, request, request_len);
+    request_copy[request_len] = '\0';
+    free(client_buf->wait_request);
+    client_buf->wait_request = request_copy;
+    client_buf->wait_request_len = request_len;
+    free(client_buf->wait_url);
+    client_buf->wait_url = url_copy;
+    free(client_buf->wait_hostname);
+    client_buf->wait_hostname = hostname_copy;
+    client_buf->wait_port = port;
+
+    /* Nothing has been forwarded before the head is received. */
+    if (!server_buf->in_body) {
+        return 1;
+    }
+    for (int i = 0;
+         (chunk = cache_fill_chunk(server_buf->fill, i, &chunk_len)) != NULL;
+         ++i) {
+        if (send_sock(client_sock, chunk, chunk_len) < 0) {
+            disconnect_client(client_sock);
+            return 1;
+        }
+    }
+    if (client_buf->out.size > OUT_HIGH_WATER) {
+        pause_sock(server_sock);
+    }
+    return 1;
+}
+
+/**
+ * @brief Make a conditional request that revalidates a stale cached response
+ * with the validators in its head.
+ *
+ * @param request Client request that isn't conditional on its own.
+ * @param request_len Byte size of client request.
+ * @param val Value of the stale response.
+ * @param head_len Byte size of the head of val up to the end of its last
+ * field; -1 if it has no complete head.
+ * @param out_request Output pointer to the conditional request.
+ * @param out_len Output; byte size of *out_request.
+ * @return int 0 on success; -1 if the response can't be revalidated.
+ */
+int make_revalidation_request(const char* request,
+                              int request_len,
+                              const char* val,
+                              int head_len,
+                              char** out_request,
+                              int* out_len)
+{
+    char* etag = NULL;
+    char* last_modified = NULL;
+    int ret;
+
+    if (head_len < 0) {
+        return -1;
+    }
+    find_header_field(val, head_len, "ETag", &etag);
+    find_header_field(val, head_len, "Last-Modified", &last_modified);
+    ret = make_conditional_request(request,
+                                   request_len,
+                                   etag,
+                                   last_modified,
+                                   out_request,
+                                   out_len);
+    free(etag);
+    etag = NULL;
+    free(last_modified);
+    last_modified = NULL;
+    return ret;
+}
+
+/**
+ * @brief Get how long a stale cached response may be served, from the
+ * "stale-while-revalidate" and "stale-if-error" directives of its
+ * Cache-Control field.
+ *
+ * @param val Value of the stale response.
+ * @param head_len Byte size of the head of val up to the end of its last
+ * field; -1 if it has no complete head.
+ * @param out_while_revalidate Output; seconds after going stale that it may be
+ * served while it's refreshed in the background; 0 if not allowed.
+ * @param out_if_error Output; seconds after going stale that it may be served
+ * if its server can't be reached; -1 if not allowed.
+ */
+void get_stale_limits(const char* val,
+                      int head_len,
+                      int* out_while_revalidate,
+                      int* out_if_error)
+{
+    const char* cache_control = NULL;
+    int cache_control_len = 0;
+
+    *out_while_revalidate = 0;
+    *out_if_error = -1;
+    if (head_len < 0 ||
+        !find_header_value(val,
+                           head_len,
+                           "Cache-Control",
+                           &cache_control,
+                           &cache_control_len)) {
+        return;
+    }
+    parse_cache_directive(cache_control,
+                          cache_control_len,
+                          "stale-while-revalidate",
+                          out_while_revalidate);
+    parse_cache_directive(cache_control,
+                          cache_control_len,
+                          "stale-if-error",
+                          out_if_error);
+}
+
+/**
+ * @brief Hand a pinned stale response over to the server that is asked to
+ * revalidate or replace it. The server holds the pin until it answers.
+ *
+ * @param server_sock FD for server socket.
+ * @param elem Pinned cache element of the stale response.
+ * @param val Value of the element.
+ * @param val_len Byte size of val.
+ * @param head_len Byte size of the head of val up to the end of its last
+ * field; -1 if it has no complete head.
+ * @param age Age of the response in seconds.
+ * @param if_error Whether the response may be replied if the server fails to
+ * connect.
+ */
+void hold_stale(int server_sock,
+                struct cache_elem* elem,
+                const char* val,
+                int val_len,
+                int head_len,
+                int age,
+                int if_error)
+{
+    struct sock_buf* server_buf = NULL;
+
+    server_buf = sock_buf_get(server_sock);
+    server_buf->stale = elem;
+    server_buf->stale_val = val;
+    server_buf->stale_val_len = val_len;
+    server_buf->stale_head_len = head_len;
+    server_buf->stale_date = time(NULL) - age;
+    server_buf->stale_if_error = if_error;
+}
+
+/**
+ * @brief Refresh a stale cached response in the background, on a server of no
+ * client whose response only goes to the cache: it's revalidated if it has a
+ * validator, and fetched again otherwise. At most one refresh of a key is in
+ * flight.
+ *
+ * @param client_sock FD for socket of the client that requests the response.
+ * @param request Client request.
+ * @param request_len Byte size of client request.
+ * @param hostname Hostname in client request.
+ * @param port Port number in client request.
+ * @param key Cache key of the response.
+ * @param elem Pinned cache element of the stale response.
+ * @param val Value of the element.
+ * @param val_len Byte size of val.
+ * @param head_len Byte size of the head of val up to the end of its last
+ * field; -1 if it has no complete head.
+ * @param age Age of the response in seconds.
+ */
+void refresh_in_background(int client_sock,
+                           const char* request,
+                           int request_len,
+                           const char* hostname,
+                           int port,
+                           char* key,
+                           struct cache_elem* elem,
+                           const char* val,
+                           int val_len,
+                           int head_len,
+                           int age)
+{
+    struct sock_buf* server_buf = NULL;
+    char* conditional = NULL; /* Conditional request to revalidate elem. */
+    int conditional_len = 0;
+    int server_sock;
+
+    if (inflight_find(key) >= 0) {
+        return;
+    }
+    server_sock = connect_server(hostname, port, -1, key);
+    if (server_sock < 0) {
+        return;
+    }
+    LOG_INFO("refresh stale response in background (fd: %d)", server_sock);
+    server_buf = sock_buf_get(server_sock);
+    server_buf->needs_ssl = sock_buf_is_ssl(client_sock);
+    inflight_add(key, server_sock);
+
+    if (make_revalidation_request(request,
+                                  request_len,
+                                  val,
+                                  head_len,
+                                  &conditional,
+                                  &conditional_len) == 0) {
+        cache_retain(elem);
+        hold_stale(server_sock, elem, val, val_len, head_len, age, 0);
+        request = conditional;
+        request_len = conditional_len;
+    }
+    if (send_to_server(server_sock, request, request_len) < 0) {
+        disconnect_server(server_sock);
+    }
+    free(conditional);
+    conditional = NULL;
+}
+
+/**
+ * @brief Handle GET request.
+ *
+ * A fresh cached response is replied right away. So is a stale one within its
+ * "stale-while-revalidate" limit, while it's refreshed in the background.
+ * Otherwise, a stale one is revalidated with a conditional request if it has a
+ * validator, see start_response(), or the response is fetched again.
+ * Within its "stale-if-error" limit, the stale one is replied if the server
+ * can't be reached. A request for a response that is being fetched already
+ * waits for that fetch instead, see attach_waiter().
+ *
+ * @param fd FD for client socket.
+ * @param request Client request.
+ * @param request_len Byte size of client request.
+ * @param url URL in client request.
+ * @param hostname Hostname in client request.
+ * @param port Port number in client request.
+ * @param is_shared Whether the response may be shared with other requests, see
+ * can_collapse().
+ */
+void handle_get_request(int fd,
+                        char* request,
+                        int request_len,
+                        char* url,
+                        char* hostname,
+                        int port,
+                        int is_shared) {
+    struct sock_buf* client_buf = NULL;
+    struct sock_buf* server_buf = NULL;
+    int is_ssl = 0;
+    char* key = NULL;
+    struct cache_elem* elem = NULL;
+    const char* val = NULL;
+    int val_len = 0;
+    int head_len = 0;
+    int age = 0;
+    int stale_secs = 0; /* Seconds since elem went stale; < 0 if fresh. */
+    int while_revalidate = 0; /* Stale limits of elem, see
+                               * get_stale_limits(). */
+    int if_error = -1;
+    char* conditional = NULL; /* Conditional request to revalidate elem. */
+    int conditional_len = 0;
+    struct inflight_waiter* waiters = NULL;
+    int num_waiters = 0;
+    unsigned long server_id;
+    int server_sock;
+
+    client_buf = sock_buf_get(fd);
+    if (client_buf == NULL) {
+        LOG_ERROR("unknown socket %d", fd);
+        return;
+    }
+    is_ssl = sock_buf_is_ssl(fd);
+
+    /* Check cache. */
+    /* Use hostname + url as cache key. */
+    key = malloc(strlen(hostname) + strlen(url) + 1);
+    if (key == NULL) {
+        PLOG_FATAL("malloc");
+    }
+    strcpy(key, hostname);
+    strcat(key, url);
+    elem = cache_acquire_stale(key,
+                               &val,
+                               &val_len,
+                               &head_len,
+                               &age,
+                               &stale_secs);
+    if (elem != NULL && stale_secs < 0) {
+        LOG_INFO("cache hit");
+        reply_cached(fd, elem, val, val_len, head_len, age);
+        cache_release(elem);
+        elem = NULL;
+        free(key);
+        key = NULL;
+        return;
+    }
+    if (elem != NULL && !is_shared) {
+        cache_release(elem);
+        elem = NULL;
+    }
+    if (elem == NULL) {
+        LOG_INFO("cache miss");
+    }
+    else {
+        get_stale_limits(val, head_len, &while_revalidate, &if_error);
+        if (stale_secs < while_revalidate) {
+            LOG_INFO("cache stale; revalidate in background");
+            refresh_in_background(fd,
+                                  request,
+                                  request_len,
+                                  hostname,
+                                  port,
+                                  key,
+                                  elem,
+                                  val,
+                                  val_len,
+                                  head_len,
+                                  age);
+            reply_cached(fd, elem, val, val_len, head_len, age);
+            cache_release(elem);
+            elem = NULL;
+            free(key);
+            key = NULL;
+            return;
+        }
     }
-    strcpy(message, version);
-    strcat(message, " 200 Connection Established\r\n\r\n");
-    message[size] = '\0';
 
-    n = write(fd, message, size);
-    if (n < 0) {
-        PLOG_ERROR("write");
-        disconnect_client(fd);
+    /* Wait for the fetch of the response in flight, if any. */
+    if (is_shared &&
+        inflight_find(key) >= 0 &&
+        attach_waiter(fd,
+                      inflight_find(key),
+                      key,
+                      request,
+                      request_len,
+                      url,
+                      hostname,
+                      port)) {
+        if (elem != NULL) {
+            cache_release(elem);
+            elem = NULL;
+        }
+        free(key);
+        key = NULL;
+        return;
+    }
+
+    /* Connect the requested server. */
+    if (is_ssl) {
+        server_sock = client_buf->peer;
+        server_buf = sock_buf_get(server_sock);
+        if (server_buf == NULL) {
+            LOG_ERROR("unknown socket %d", fd);
+            if (elem != NULL) {
+                cache_release(elem);
+                elem = NULL;
+            }
+            free(key);
+            key = NULL;
+            return;
+        }
+        /* The waiters of a fetch in flight on the server are cut short, since
+         * the server is keyed by the new request from now on. */
+        if (inflight_remove(server_buf->key,
+                            server_sock,
+                            &waiters,
+                            &num_waiters)) {
+            server_id = server_buf->id;
+            drain_waiters(waiters, num_waiters);
+            free(waiters);
+            waiters = NULL;
+            server_buf = sock_buf_get(server_sock);
+            if (server_buf == NULL || server_buf->id != server_id) {
+                /* Draining disconnected the client in turn. */
+                if (elem != NULL) {
+                    cache_release(elem);
+                    elem = NULL;
+                }
+                free(key);
+                key = NULL;
+                return;
+            }
+        }
+        free(server_buf->key);
+        server_buf->key = strdup(key);
+    }
+    else {
+        server_sock = connect_server(hostname, port, fd, key);
+        if (server_sock < 0) {
+            /* Fail to connect the request server. */
+            if (elem != NULL && stale_secs <= if_error) {
+                LOG_INFO("server is unreachable; reply stale response");
+                reply_cached(fd, elem, val, val_len, head_len, age);
+            }
+            else {
+                reply_bad_gateway(fd);
+            }
+            if (elem != NULL) {
+                cache_release(elem);
+                elem = NULL;
+            }
+            free(key);
+            key = NULL;
+            return;
+        }
+        server_buf = sock_buf_get(server_sock);
+    }
+
+    /* Revalidate the stale response instead of fetching it again, or keep it
+     * to reply if the server can't be reached. One stale response at a time
+     * per server, since the response of another request would be held back
+     * with it. */
+    if (elem != NULL) {
+        if (server_buf->stale == NULL &&
+            make_revalidation_request(request,
+                                      request_len,
+                                      val,
+                                      head_len,
+                                      &conditional,
+                                      &conditional_len) == 0) {
+            LOG_INFO("cache stale; revalidate");
+            request = conditional;
+            request_len = conditional_len;
+        }
+        else {
+            LOG_INFO("cache stale; fetch again");
+        }
+        if (server_buf->stale == NULL &&
+            (conditional != NULL || stale_secs <= if_error)) {
+            hold_stale(server_sock,
+                       elem,
+                       val,
+                       val_len,
+                       head_len,
+                       age,
+                       stale_secs <= if_error);
+        }
+        else {
+            cache_release(elem);
+        }
+        elem = NULL;
+    }
+
+    /* Later requests for the same response wait for this fetch. */
+    if (is_shared) {
+        inflight_add(key, server_sock);
+    }
+
+    /* Forward request to server. */
+    if (send_to_server(server_sock, request, request_len) < 0) {
+        disconnect_server(server_sock);
+    }
+
+    free(conditional);
+    conditional = NULL;
+    free(key);
+    key = NULL;
+}
+
+/**
+ * @brief Have the waiters of a fetch whose response isn't shared send their
+ * own requests, see attach_waiter(). They aren't shared again. Waiters that
+ * are gone are skipped.
+ *
+ * @param waiters Waiters of the fetch.
+ * @param num_waiters Number of waiters.
+ */
+void refetch_waiters(const struct inflight_waiter* waiters, int num_waiters)
+{
+    struct sock_buf* client_buf = NULL;
+    char* request = NULL;
+    char* url = NULL;
+    char* hostname = NULL;
+    int request_len;
+    int port;
+
+    for (int i = 0; i < num_waiters; ++i) {
+        client_buf = sock_buf_get(waiters[i].fd);
+        if (client_buf == NULL || client_buf->id != waiters[i].id) {
+            continue;
+        }
+        if (client_buf->wait_request == NULL) {
+            drain_client(waiters[i].fd);
+            continue;
+        }
+        LOG_INFO("response isn't shared; waiter fetches on its own (fd: %d)",
+                 waiters[i].fd);
+        request = client_buf->wait_request;
+        request_len = client_buf->wait_request_len;
+        url = client_buf->wait_url;
+        hostname = client_buf->wait_hostname;
+        port = client_buf->wait_port;
+        client_buf->wait_request = NULL;
+        client_buf->wait_url = NULL;
+        client_buf->wait_hostname = NULL;
+        handle_get_request(waiters[i].fd,
+                           request,
+                           request_len,
+                           url,
+                           hostname,
+                           port,
+                           0);
+        free(request);
+        request = NULL;
+        free(url);
+        url = NULL;
+        free(hostname);
+        hostname = NULL;
+    }
+}
+
+/**
+ * @brief Reply "502 Bad Gateway" to a client whose server can't be reached.
+ *
+ * @param client_sock FD for client socket.
+ * @return int 0 on success; -1 otherwise.
+ */
+int reply_bad_gateway(int client_sock)
+{
+    static const char* message = "HTTP/1.1 502 Bad Gateway\r\n"
+                                 "Content-Length: 0\r\n"
+                                 "\r\n";
+    struct sock_buf* client_buf = NULL;
+
+    client_buf = sock_buf_get(client_sock);
+    if (client_buf == NULL) {
         return -1;
     }
-    if (n == 0) {
-        LOG_ERROR("client socket is closed on the other side");
-        disconnect_client(fd);
+    if (send_sock(client_sock, message, strlen(message)) < 0) {
+        return -1;
+    }
+    LOG_INFO("replied Bad Gateway");
+    return 0;
+}
+
+/**
+ * @brief Handle a CONNECT request.
+ *
+ * The client is replied once the server is connected, see
+ * finish_connect_request().
+ *
+ * @param client_sock FD for client socket.
+ * @param version String of HTTP version field in the request.
+ * @param hostname Hostname to request.
+ * @param port Port number to request.
+ */
+void handle_connect_request(int client_sock,
+                           char* version,
+                           char* hostname,
+                           int port)
+{
+    int server_sock;
+    struct sock_buf* client_buf = NULL;
+    struct sock_buf* server_buf = NULL;
+
+    /* Start connecting server. */
+    server_sock = connect_server(hostname, port, client_sock, NULL);
+    if (server_sock < 0) {
+        reply_bad_gateway(client_sock);
+        disconnect_client(client_sock);
+        return;
+    }
+    server_buf = sock_buf_get(server_sock);
+    server_buf->connect_version = strdup(version);
+
+    if (!use_ssl) {
+        /* Setup 2-way forwarding. Data from the client is kept by the server
+         * until it is connected. */
+        client_buf = sock_buf_get(client_sock);
+        client_buf->peer = server_sock;
+        client_buf->is_forward = 1;
+        server_buf->peer = client_sock;
+        server_buf->is_forward = 1;
+    }
+}
+
+/**
+ * @brief Finish a CONNECT request after its server is connected, i.e. after
+ * the SSL handshake with the server in SSL interception mode.
+ *
+ * Reply client with "Connection Established". In SSL interception mode, then
+ * start SSL handshake with the client.
+ *
+ * @param server_sock FD for server socket.
+ * @return int 0 on success; -1 if the server is disconnected.
+ */
+int finish_connect_request(int server_sock)
+{
+    struct sock_buf* server_buf = NULL;
+    int client_sock;
+
+    server_buf = sock_buf_get(server_sock);
+    client_sock = server_buf->peer;
+
+    /* Reply client with "Connection Established". */
+    if (reply_connection_established(client_sock,
+                                     server_buf->connect_version) < 0) {
+        return -1;
+    }
+    free(server_buf->connect_version);
+    server_buf->connect_version = NULL;
+
+    /* The reply has to go out in plaintext before the SSL handshake. A fresh
+     * client always takes it right away. */
+    if (use_ssl && sock_buf_get(client_sock)->out.size > 0) {
+        LOG_ERROR("cannot reply Connection Established (fd: %d)", client_sock);
+        disconnect_client(client_sock);
+        return -1;
+    }
+    if (use_ssl && ssl_accept_client(client_sock, server_sock) < 0) {
+        LOG_ERROR("ssl_accept_client");
         return -1;
     }
-    else if(n < size){
-        LOG_ERROR("Cannot write the whole message");
-        return -2;
+    return 0;
+}
+
+/**
+ * @brief Start using a server whose connection is ready for data. Finish the
+ * CONNECT request waiting for it, or send the data queued while connecting.
+ *
+ * @param server_sock FD for server socket.
+ * @return int 1 on success; -1 if the server is disconnected.
+ */
+int handle_server_ready(int server_sock)
+{
+    struct sock_buf* server_buf = NULL;
+
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf->connect_version != NULL &&
+        finish_connect_request(server_sock) < 0) {
+        return -1;
+    }
+
+    /* Send data queued while connecting. */
+    if (server_buf->out.size > 0) {
+        if (flush_sock(server_sock) < 0) {
+            disconnect_server(server_sock);
+            return -1;
+        }
+        set_deadline(server_sock,
+                     server_buf->is_forward ? DEADLINE_IDLE : DEADLINE_RESPONSE);
     }
     else {
-        LOG_INFO("replied Connection Established");
+        set_deadline(server_sock, DEADLINE_IDLE);
     }
+    return 1;
+}
 
-    free(message);
-    message = NULL;
+/**
+ * @brief Reply a client whose server can't be reached with "502 Bad Gateway",
+ * or with the stale response that the server was to replace if
+ * "stale-if-error" allows it.
+ *
+ * @param server_sock FD for server socket that fails to connect.
+ * @param client_sock FD for client socket.
+ */
+void reply_unreachable(int server_sock, int client_sock)
+{
+    struct sock_buf* server_buf = NULL;
+
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf->stale != NULL &&
+        server_buf->stale_if_error &&
+        sock_buf_get(client_sock) != NULL) {
+        LOG_INFO("server is unreachable; reply stale response");
+        reply_cached(client_sock,
+                     server_buf->stale,
+                     server_buf->stale_val,
+                     server_buf->stale_val_len,
+                     server_buf->stale_head_len,
+                     time(NULL) - server_buf->stale_date);
+    }
+    else {
+        reply_bad_gateway(client_sock);
+    }
+}
+
+/**
+ * @brief Handle a server that fails to connect. Reply its client, and the
+ * clients waiting for its fetch, see reply_unreachable(). The client of a
+ * CONNECT request is disconnected as well.
+ *
+ * @param server_sock FD for server socket.
+ */
+void handle_connect_failure(int server_sock)
+{
+    struct sock_buf* server_buf = NULL;
+    int client_sock;
+    int is_connect;
+    int waiter_sock;
+    int pos = 0;
+
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf == NULL) {
+        return;
+    }
+    client_sock = server_buf->peer;
+    is_connect = server_buf->connect_version != NULL;
+
+    reply_unreachable(server_sock, client_sock);
+    while ((waiter_sock = next_waiter(server_sock, &pos)) >= 0) {
+        reply_unreachable(server_sock, waiter_sock);
+    }
+
+    /* Replying may have disconnected the server in turn. Otherwise, its
+     * waiters are done. */
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf == NULL) {
+        return;
+    }
+    inflight_remove(server_buf->key, server_sock, NULL, NULL);
+    if (is_connect) {
+        /* Also disconnects the server. */
+        disconnect_client(client_sock);
+    }
+    else {
+        disconnect_server(server_sock);
+    }
+}
+
+/**
+ * @brief Handle readiness of a server socket that is connecting.
+ *
+ * @param fd FD for server socket.
+ * @param events Ready events.
+ * @return int 1 if the connection is established; 0 if it is still in
+ * progress; -1 if the server is disconnected.
+ */
+int handle_connect_event(int fd, int events)
+{
+    struct sock_buf* server_buf = NULL;
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    server_buf = sock_buf_get(fd);
+    if (server_buf == NULL) {
+        return -1;
+    }
+
+    /* Check the result of the non-blocking connect. */
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        err = errno;
+    }
+    if (err != 0) {
+        LOG_ERROR("connect (fd: %d): %s", fd, strerror(err));
+        handle_connect_failure(fd);
+        return -1;
+    }
+    if (!(events & EVENT_WRITE)) {
+        /* Still connecting. */
+        return 0;
+    }
+
+    LOG_INFO("connected to server (fd: %d)", fd);
+
+    /* Intercept CONNECT request, or connect a server for a client that is
+     * intercepted already. Keep watching both directions during the SSL
+     * handshake. */
+    if ((server_buf->connect_version != NULL || server_buf->needs_ssl) &&
+        use_ssl) {
+        if (ssl_connect_server(fd) < 0) {
+            LOG_ERROR("ssl_connect_server");
+            handle_connect_failure(fd);
+            return -1;
+        }
+        return handle_handshake_event(fd);
+    }
+
+    /* From now on, only watch for incoming messages. */
+    server_buf->state = SOCK_ESTABLISHED;
+    watch_sock(fd, EVENT_READ);
+    return handle_server_ready(fd);
+}
+
+/**
+ * @brief Advance the SSL handshake of a socket in SOCK_SSL_CONNECTING or
+ * SOCK_SSL_ACCEPTING state.
+ *
+ * @param fd FD for client/server socket.
+ * @return int 1 if the handshake is done; 0 if it is still in progress; -1 if
+ * the socket is disconnected.
+ */
+int handle_handshake_event(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+    int n;
+
+    sock_buf = sock_buf_get(fd);
+    n = ssl_handshake(sock_buf->ssl);
+    if (n == 0) {
+        return 0;
+    }
+    if (n < 0) {
+        if (sock_buf->is_client) {
+            LOG_ERROR("SSL_accept (fd: %d)", fd);
+            disconnect_client(fd);
+        }
+        else {
+            LOG_ERROR("SSL_connect (fd: %d)", fd);
+            handle_connect_failure(fd);
+        }
+        return -1;
+    }
 
-    return 0;
+    /* From now on, only watch for incoming messages. */
+    sock_buf->state = SOCK_ESTABLISHED;
+    watch_sock(fd, EVENT_READ);
+    if (sock_buf->is_client) {
+        LOG_INFO("established SSL connection with client (fd %d)", fd);
+        set_deadline(fd, DEADLINE_HEADER);
+        return 1;
+    }
+    LOG_INFO("established SSL connection with server (fd %d)", fd);
+    return handle_server_ready(fd);
 }
 
 /**
- * @brief Handle GET request.
+ * @brief Handle other request by directly forwarding it to server.
  * 
  * @param fd FD for client socket.
- * @param request Client request.
+ * @param request Client request, or its head and the part of its body
+ * received so far.
  * @param request_len Byte size of client request.
- * @param url URL in client request.
  * @param hostname Hostname in client request.
  * @param port Port number in client request.
+ * @return int FD for the server that the request is forwarded to; -1 on
+ * failure.
  */
-void handle_get_request(int fd,
-                        char* request,
-                        int request_len,
-                        char* url,
-                        char* hostname,
-                        int port) {
+int handle_other_request(int fd,
+                         char* request,
+                         int request_len,
+                         char* hostname,
+                         int port) {
     struct sock_buf* client_buf = NULL;
     struct sock_buf* server_buf = NULL;
     int is_ssl = 0;
-    char* key = NULL;
-    char* val = NULL;
-    int val_len = 0;
-    int age = 0;
-    int n;
     int server_sock;
 
     client_buf = sock_buf_get(fd);
     if (client_buf == NULL) {
         LOG_ERROR("unknown socket %d", fd);
-        return;
+        return -1;
     }
     is_ssl = sock_buf_is_ssl(fd);
 
-    /* Check cache. */
-    /* Use hostname + url as cache key. */
-    key = malloc(strlen(hostname) + strlen(url) + 1);
-    if (key == NULL) {
-        PLOG_FATAL("malloc");
+    /* Connect the requested server. */
+    if (is_ssl) {
+        server_sock = client_buf->peer;
+        server_buf = sock_buf_get(server_sock);
+        if (server_buf == NULL) {
+            LOG_ERROR("unknown socket %d", fd);
+            return -1;
+        }
+    }
+    else {
+        server_sock = connect_server(hostname, port, fd, NULL);
+        if (server_sock < 0) {
+            /* Fail to connect the request server. */
+            reply_bad_gateway(fd);
+            return -1;
+        }
     }
-    strcpy(key, hostname);
-    strcat(key, url);
-    if (cache_get(key, &val, &val_len, &age) > 0) {
-        char* head = NULL;
-        int head_len = 0;
-        char* body = NULL;
-        int body_len = 0;
-        char* age_line = NULL;
 
-        LOG_INFO("cache hit");
+    /* Forward request to server. */
+    if (send_to_server(server_sock, request, request_len) < 0) {
+        disconnect_server(server_sock);
+        return -1;
+    }
+    return server_sock;
+}
+
+/**
+ * @brief Reply "400 Bad Request" to a client whose request is malformed, and
+ * disconnect it once the reply is sent, since where its next request would
+ * start is unknown.
+ *
+ * @param client_sock FD for client socket.
+ */
+void reply_bad_request(int client_sock)
+{
+    static const char* message = "HTTP/1.1 400 Bad Request\r\n"
+                                 "Content-Length: 0\r\n"
+                                 "Connection: close\r\n"
+                                 "\r\n";
+
+    if (send_sock(client_sock, message, strlen(message)) < 0) {
+        disconnect_client(client_sock);
+        return;
+    }
+    LOG_INFO("replied Bad Request");
+    drain_client(client_sock);
+}
+
+/**
+ * @brief Whether a parsed request has the given method.
+ *
+ * @param parser Parser whose request head is complete.
+ * @param method Method to compare with, case-sensitive.
+ * @return int 1 if it has the method; 0 otherwise.
+ */
+int is_method(const struct http_parser* parser, const char* method)
+{
+    return (size_t)parser->method.len == strlen(method) &&
+           memcmp(parser->method.ptr, method, parser->method.len) == 0;
+}
+
+/**
+ * @brief Forward the next bytes of the request body that a client is sending
+ * to its server, as they arrive, so the body is never held whole. Its framing
+ * is tracked to find where it ends; the bytes after it start the next request.
+ *
+ * @param fd FD for client socket, whose request body is being forwarded.
+ * @param buf Received data.
+ * @param n Byte size of received data.
+ * @return int Byte size of the leading part of buf that belongs to the body;
+ * -1 if the body is malformed, and the client is disconnected.
+ */
+int forward_request_body(int fd, const char* buf, int n)
+{
+    struct sock_buf* client_buf = NULL;
+    struct sock_buf* server_buf = NULL;
+    int len;
+
+    client_buf = sock_buf_get(fd);
+    server_buf = sock_buf_get(client_buf->body_server);
+    if (server_buf == NULL || server_buf->id != client_buf->body_server_id) {
+        /* The server is gone; the rest of the body is dropped. */
+        client_buf->body_server = -1;
+        server_buf = NULL;
+    }
+    len = scan_body(&(client_buf->parser.body), buf, n);
+    if (len < 0) {
+        LOG_ERROR("malformed chunked request (fd: %d)", fd);
+        if (server_buf != NULL) {
+            disconnect_server(server_buf->fd);
+        }
+        disconnect_client(fd);
+        return -1;
+    }
+    if (server_buf != NULL &&
+        send_to_server(server_buf->fd, buf, len) < 0) {
+        disconnect_server(server_buf->fd);
+        client_buf->body_server = -1;
+    }
+    if (client_buf->parser.body.is_done) {
+        client_buf->in_body = 0;
+        client_buf->body_server = -1;
+        http_parser_init(&(client_buf->parser), 1);
+    }
+    return len;
+}
+
+/**
+ * @brief Handle the complete request heads buffered from a client, in order.
+ * The buffer is parsed incrementally as it grows, see http_parse(), so a
+ * request that arrives in pieces is scanned once. A request is handled with
+ * the part of its body buffered with its head; the rest of the body is
+ * forwarded as it arrives, see forward_request_body().
+ * 
+ * @param fd FD for client socket.
+ */
+void handle_client_request(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+    struct http_parser* parser = NULL;
+    const struct http_field* host = NULL; /* Host field in client request. */
+    char* request = NULL;
+    int request_len = 0;
+    char* url = NULL; /* URL field in client request. */
+    char* version = NULL; /* Version field in client request. */
+    char* hostname = NULL; /* Server hostname without port number. */
+    int port = -1; /* Server port in client request. 80 by default. */
+    int is_ssl = 0; /* Whether the client is using SSL connection. */
+    int is_get = 0; /* Whether the method is GET. */
+    int is_connect = 0; /* Whether the method is CONNECT. */
+    int is_shared = 0; /* Whether the response to a GET request may be shared,
+                        * see can_collapse(). */
+    int has_more_body = 0; /* Whether the body hasn't been received whole. */
+    int method_len = 0;
+    int server_sock = -1;
+    unsigned long id;
+    int ret;
+
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf == NULL) {
+        return;
+    }
+    id = sock_buf->id;
+    is_ssl = sock_buf_is_ssl(fd);
+
+    while (sock_buf->size > 0) {
+        parser = &(sock_buf->parser);
+        ret = http_parse(parser, sock_buf->buf, sock_buf->size);
+        if (ret == HTTP_PARSE_PARTIAL) {
+            /* Request head is incomplete. */
+            break;
+        }
+        /* Only the part of the body buffered with the head is handled with
+         * it. */
+        if (ret == HTTP_PARSE_DONE) {
+            ret = http_parse_body(parser, sock_buf->buf, sock_buf->size);
+        }
+        has_more_body = ret == HTTP_PARSE_PARTIAL;
+        host = ret != HTTP_PARSE_ERROR ?
+               http_find_field(parser, "Host") :
+               NULL;
+        if (host == NULL ||
+            (has_more_body && is_method(parser, "CONNECT"))) {
+            LOG_ERROR("malformed request (fd: %d)", fd);
+            reply_bad_request(fd);
+            return;
+        }
 
-        /* Create header line for age field. */
-        age_line = malloc(100);
-        if (age_line == NULL) {
+        /* Copy what the handlers need, since the request leaves the buffer. */
+        request_len = parser->pos;
+        request = malloc(request_len + 1);
+        url = strndup(parser->url.ptr, parser->url.len);
+        version = strndup(parser->version.ptr, parser->version.len);
+        port = -1;
+        if (request == NULL ||
+            url == NULL ||
+            version == NULL ||
+            parse_host_field(host->value.ptr,
+                             host->value.len,
+                             &hostname,
+                             &port) < 0) {
             PLOG_ERROR("malloc");
+            free(request);
+            request = NULL;
+            free(url);
+            url = NULL;
+            free(version);
+            version = NULL;
+            disconnect_client(fd);
+            return;
         }
-        else {
-            bzero(age_line, 100);
-            sprintf(age_line, "Age: %d\r\n", age);
+        memcpy(request, sock_buf->buf, request_len);
+        request[request_len] = '\0';
+
+        fprintf(stderr, "================\n");
+        LOG_INFO("client request:\n"
+                 "%s", request);
+        fprintf(stderr, "================\n");
+        LOG_INFO("parsed request:\n"
+                 "- method: %.*s\n"
+                 "- url: %s\n"
+                 "- version: %s\n"
+                 "- host: %.*s\n"
+                 "- hostname: %s",
+                 parser->method.len,
+                 parser->method.ptr,
+                 url,
+                 version,
+                 host->value.len,
+                 host->value.ptr,
+                 hostname);
+
+        /* The request is handled from its copy from now on. */
+        /* A request whose body is still arriving is forwarded as it is, and
+         * its parser tracks the rest of the body. */
+        is_get = is_method(parser, "GET") && !has_more_body;
+        is_connect = is_method(parser, "CONNECT");
+        is_shared = is_get && can_collapse(parser);
+        method_len = parser->method.len;
+        sock_buf_consume(fd, request_len);
+        if (!has_more_body) {
+            http_parser_init(parser, 1);
         }
 
-        /* Forward cached response to the client. */
-        parse_body_head(val, val_len, &head, &head_len, &body, &body_len);
-        if (is_ssl) {
-            n = SSL_write(client_buf->ssl, head, head_len);
-            if (age_line != NULL) {
-                n = SSL_write(client_buf->ssl, age_line, strlen(age_line));
+        if (is_get) {
+            LOG_INFO("handle GET method");
+
+            if (port < 0) {
+                if (is_ssl) {
+                    port = 443; /* Default port for SSL link. */
+                }
+                else {
+                    port = 80; /* Default port for HTTP. */
+                }
             }
-            n = SSL_write(client_buf->ssl, "\r\n", strlen("\r\n"));
-            n = SSL_write(client_buf->ssl, body, body_len);
+            LOG_INFO("port: %d", port);
+
+            handle_get_request(fd,
+                               request,
+                               request_len,
+                               url,
+                               hostname,
+                               port,
+                               is_shared);
         }
-        else {
-            n = write(fd, head, head_len);
-            if (age_line != NULL) {
-                n = write(fd, age_line, strlen(age_line));
+        else if (is_connect) {
+            LOG_INFO("handle CONNECT method");
+
+            if (port < 0) {
+                port = 443; /* Default port for SSL link. */
             }
-            n = write(fd, "\r\n", strlen("\r\n"));
-            n = write(fd, body, body_len);
+            LOG_INFO("port: %d", port);
+
+            handle_connect_request(fd, version, hostname, port);
         }
-        if (n < 0) {
-            if (is_ssl) {
-                ERR_print_errors_fp(stderr);
-                LOG_ERROR("SSL_write");
-            }
-            else {
-                PLOG_ERROR("write");
+        else {
+            /* The request starts with its method. */
+            LOG_INFO("handle %.*s method", method_len, request);
+
+            if (port < 0) {
+                if (is_ssl) {
+                    port = 443; /* Default port for SSL link. */
+                }
+                else {
+                    port = 80; /* Default port for HTTP. */
+                }
             }
-            disconnect_client(fd);
+            LOG_INFO("port: %d", port);
+
+            server_sock = handle_other_request(fd,
+                                               request,
+                                               request_len,
+                                               hostname,
+                                               port);
         }
-        else if (n == 0) {
-            LOG_ERROR("client socket is closed on the other side");
-            disconnect_client(fd);
+
+        free(url);
+        url = NULL;
+        free(version);
+        version = NULL;
+        free(hostname);
+        hostname = NULL;
+        free(request);
+        request = NULL;
+
+        /* Handling may disconnect the client, or turn it into a tunnel. */
+        sock_buf = sock_buf_get(fd);
+        if (sock_buf == NULL ||
+            sock_buf->id != id ||
+            sock_buf->is_forward ||
+            sock_buf->is_closing) {
+            break;
         }
-        else {
-            LOG_INFO("forward %d bytes from cache to client (fd %d)",
-                     val_len,
-                     fd);
+        if (has_more_body) {
+            sock_buf->in_body = 1;
+            sock_buf->body_server = server_sock;
+            sock_buf->body_server_id = server_sock < 0 ?
+                                       0 :
+                                       sock_buf_get(server_sock)->id;
+            break;
         }
+    }
+}
 
-        free(key);
-        key = NULL;
-        free(val);
-        val = NULL;
-        free(head);
-        head = NULL;
-        free(body);
-        body = NULL;
-        free(age_line);
-        age_line = NULL;
+/**
+ * @brief Release the stale response that a server is asked to revalidate or
+ * replace, if any. Its response is no longer held back.
+ *
+ * @param server_sock FD for server socket.
+ */
+void end_revalidation(int server_sock)
+{
+    struct sock_buf* server_buf = NULL;
 
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf == NULL || server_buf->stale == NULL) {
         return;
     }
-    LOG_INFO("cache miss");
+    cache_release(server_buf->stale);
+    server_buf->stale = NULL;
+    server_buf->stale_val = NULL;
+    server_buf->stale_val_len = 0;
+    server_buf->stale_head_len = -1;
+}
 
-    /* Connect the requested server. */
-    if (is_ssl) {
-        server_sock = client_buf->peer;
+/**
+ * @brief Reply the stale response that a server confirms with "304 Not
+ * Modified" to its client and waiters, and make it fresh again. A max age in
+ * the 304 response replaces the one of the stale response.
+ *
+ * @param server_sock FD for server socket that revalidates a stale response,
+ * whose parser has the complete head of the "304 Not Modified" response.
+ */
+void reply_revalidated(int server_sock)
+{
+    struct sock_buf* server_buf = NULL;
+    const struct http_field* cache_control = NULL;
+    int max_age = -1;
+    int waiter_sock;
+    int pos = 0;
+
+    server_buf = sock_buf_get(server_sock);
+    cache_control = http_find_field(&(server_buf->parser), "Cache-Control");
+    if (cache_control != NULL) {
+        parse_cache_directive(cache_control->value.ptr,
+                              cache_control->value.len,
+                              "max-age",
+                              &max_age);
+    }
+    cache_refresh(server_buf->stale, max_age);
+    LOG_INFO("stale response is revalidated");
+    if (sock_buf_get(server_buf->peer) != NULL) {
+        reply_cached(server_buf->peer,
+                     server_buf->stale,
+                     server_buf->stale_val,
+                     server_buf->stale_val_len,
+                     server_buf->stale_head_len,
+                     0);
+    }
+
+    /* Clients waiting for the fetch get the same reply. Replying may
+     * disconnect the server in turn. */
+    while ((waiter_sock = next_waiter(server_sock, &pos)) >= 0) {
         server_buf = sock_buf_get(server_sock);
-        if (server_buf == NULL) {
-            LOG_ERROR("unknown socket %d", fd);
-            free(key);
-            key = NULL;
-            return;
+        reply_cached(waiter_sock,
+                     server_buf->stale,
+                     server_buf->stale_val,
+                     server_buf->stale_val_len,
+                     server_buf->stale_head_len,
+                     0);
+    }
+    end_revalidation(server_sock);
+}
+
+/**
+ * @brief Take a complete chunked response of a server out of its framing, so
+ * its cache hits are served with a Content-Length. Its trailer fields are
+ * dropped. The fill of the response is kept as it's received until then, since
+ * waiters that attach to the fetch are replayed what's been forwarded.
+ *
+ * @param server_sock FD for server socket, whose fill has the whole response.
+ * @return struct cache_fill* New fill of the response, to free with
+ * cache_fill_free(); NULL on failure.
+ */
+struct cache_fill* dechunk_fill(int server_sock)
+{
+    struct sock_buf* server_buf = NULL;
+    struct cache_fill* fill = NULL;
+    struct http_body body = {.is_chunked = 1, .chunk_state = CHUNK_SIZE};
+    const char* chunk = NULL;
+    int chunk_len = 0;
+    char* head = NULL; /* Head of the response, gathered from the fill. */
+    int head_len;
+    char* new_head = NULL;
+    int new_head_len = 0;
+    int pos = 0; /* Offset of a chunk of the fill in the response. */
+    int off; /* Offset in a chunk of the fill. */
+    int len;
+    int data_len;
+
+    server_buf = sock_buf_get(server_sock);
+    head_len = server_buf->parser.head_len;
+    head = malloc(head_len);
+    if (head == NULL) {
+        PLOG_ERROR("malloc");
+        return NULL;
+    }
+    for (int i = 0;
+         pos < head_len &&
+         (chunk = cache_fill_chunk(server_buf->fill, i, &chunk_len)) != NULL;
+         ++i) {
+        len = chunk_len < head_len - pos ? chunk_len : head_len - pos;
+        memcpy(head + pos, chunk, len);
+        pos += len;
+    }
+    if (pos < head_len ||
+        make_dechunked_head(head,
+                            head_len,
+                            server_buf->parser.body.data_len,
+                            &new_head,
+                            &new_head_len) < 0) {
+        free(head);
+        head = NULL;
+        return NULL;
+    }
+    free(head);
+    head = NULL;
+
+    fill = cache_fill_new(server_buf->key,
+                          new_head_len + server_buf->parser.body.data_len);
+    if (fill == NULL || cache_fill_append(fill, new_head, new_head_len) < 0) {
+        free(new_head);
+        new_head = NULL;
+        cache_fill_free(&fill);
+        return NULL;
+    }
+    free(new_head);
+    new_head = NULL;
+
+    /* Decode the body after the head, a run of chunk data at a time. */
+    pos = 0;
+    for (int i = 0;
+         (chunk = cache_fill_chunk(server_buf->fill, i, &chunk_len)) != NULL;
+         ++i) {
+        off = pos < head_len ? head_len - pos : 0;
+        pos += chunk_len;
+        while (off < chunk_len) {
+            len = scan_body_data(&body,
+                                 chunk + off,
+                                 chunk_len - off,
+                                 &data_len);
+            if (len <= 0 ||
+                cache_fill_append(fill,
+                                  chunk + off + len - data_len,
+                                  data_len) < 0) {
+                cache_fill_free(&fill);
+                return NULL;
+            }
+            off += len;
         }
-        server_buf->key = strdup(key);
     }
-    else {
-        server_sock = connect_server(hostname, port, fd, key);
-        if (server_sock < 0) {
-            /* Fail to connect the request server. */
-            free(key);
-            key = NULL;
+    if (!body.is_done) {
+        cache_fill_free(&fill);
+        return NULL;
+    }
+    return fill;
+}
+
+/**
+ * @brief Finish the response of a server once its body is received: cache it
+ * if it's filled for the cache, and end its fetch. The server is disconnected,
+ * unless it's kept alive for its client intercepted by SSL.
+ *
+ * @param server_sock FD for server socket.
+ */
+void finish_response(int server_sock)
+{
+    struct sock_buf* server_buf = NULL;
+    struct cache_fill* fill = NULL;
+    int is_ssl = 0;
+
+    server_buf = sock_buf_get(server_sock);
+    is_ssl = sock_buf_is_ssl(server_sock);
+    server_buf->in_body = 0;
+    if (cache_dechunk &&
+        server_buf->fill != NULL &&
+        server_buf->fill_stale_age >= 0 &&
+        server_buf->parser.body.is_chunked &&
+        !cache_fill_is_full(server_buf->fill)) {
+        fill = dechunk_fill(server_sock);
+        if (fill == NULL) {
+            LOG_INFO("chunked response is cached as it is");
+        }
+        else {
+            cache_fill_free(&server_buf->fill);
+            server_buf->fill = fill;
+        }
+    }
+    http_parser_init(&(server_buf->parser), 0);
+    if (server_buf->fill != NULL &&
+        server_buf->fill_stale_age >= 0 &&
+        cache_fill_put(server_buf->fill,
+                       server_buf->fill_max_age,
+                       server_buf->fill_stale_age) == 0) {
+        LOG_INFO("response of %zu bytes is not cached",
+                 cache_fill_len(server_buf->fill));
+    }
+    cache_fill_free(&server_buf->fill);
+
+    /* The fetch is done. Its waiters have got the whole response. */
+    inflight_remove(server_buf->key, server_sock, NULL, NULL);
+
+    /* Disconnect server. A server of no client isn't kept alive. */
+    if (!is_ssl || server_buf->peer < 0) {
+        disconnect_server(server_sock);
+    }
+    else if (server_buf->size == 0) {
+        /* Keep-alive until the client sends another request. */
+        set_deadline(server_sock, DEADLINE_IDLE);
+    }
+}
+
+/**
+ * @brief Start the response of a server once its head is parsed, and forward
+ * the head to its client and waiters.
+ *
+ * The response to a revalidation is held back until then: "304 Not Modified"
+ * confirms the stale response, see reply_revalidated(); anything else replaces
+ * it. A response to cache, i.e. whose status is 200 OK and that isn't meant for
+ * its client only, is copied into a cache fill as it's forwarded, and shared
+ * with the waiters of its fetch. It passes through once it's larger than a
+ * cached response may be, so only a few buffers of it are in memory at a time.
+ * The waiters of any other response send their own requests, see
+ * refetch_waiters().
+ *
+ * @param server_sock FD for server socket, whose parser has a complete head.
+ * @param buf Buffer that starts with the response.
+ */
+void start_response(int server_sock, const char* buf)
+{
+    struct sock_buf* server_buf = NULL;
+    const struct http_parser* parser = NULL;
+    const struct http_field* cache_control = NULL;
+    int head_len = 0;
+    int max_age = 3600; /* 1h by default. */
+    int stale_while_revalidate = 0;
+    int stale_if_error = 0;
+    int stale_age = 0; /* Seconds to keep the response once stale. */
+    size_t expected_len = 0; /* Byte size of the response; 0 if unknown. */
+    int is_private = 0; /* Whether the response is for its client only. */
+    struct inflight_waiter* waiters = NULL;
+    int num_waiters = 0;
+
+    server_buf = sock_buf_get(server_sock);
+    parser = &(server_buf->parser);
+    head_len = parser->head_len;
+    server_buf->in_body = 1;
+
+    if (server_buf->stale != NULL) {
+        if (parser->status_code == 304) {
+            /* The stale response is still valid. */
+            reply_revalidated(server_sock);
             return;
         }
+        LOG_INFO("stale response is replaced");
+        end_revalidation(server_sock);
     }
 
-    /* Forward request to server. */
-    if (is_ssl) {
-        n = SSL_write(server_buf->ssl, request, request_len);
+    /* Cache response whose status is 200 OK, unless its end is only known
+     * once the server closes, or it's for its client only. A response with a
+     * validator is kept once stale, to be revalidated, and so is one that may
+     * be served stale. */
+    server_buf->fill_stale_age = -1;
+    cache_control = http_find_field(parser, "Cache-Control");
+    if (http_find_field(parser, "Set-Cookie") != NULL ||
+        (cache_control != NULL &&
+         (parse_cache_directive(cache_control->value.ptr,
+                                cache_control->value.len,
+                                "private",
+                                &stale_age) ||
+          parse_cache_directive(cache_control->value.ptr,
+                                cache_control->value.len,
+                                "no-store",
+                                &stale_age)))) {
+        is_private = 1;
+        stale_age = 0;
     }
-    else {
-        n = write(server_sock, request, request_len);
-    }
-    if (n < 0) {
-        if (is_ssl) {
-            ERR_print_errors_fp(stderr);
-            LOG_ERROR("SSL_write");
+    if (parser->status_code == 200 &&
+        !is_private &&
+        (parser->body.is_chunked || parser->body.remaining >= 0)) {
+        if (cache_control != NULL) {
+            parse_cache_directive(cache_control->value.ptr,
+                                  cache_control->value.len,
+                                  "max-age",
+                                  &max_age);
+            parse_cache_directive(cache_control->value.ptr,
+                                  cache_control->value.len,
+                                  "stale-while-revalidate",
+                                  &stale_while_revalidate);
+            parse_cache_directive(cache_control->value.ptr,
+                                  cache_control->value.len,
+                                  "stale-if-error",
+                                  &stale_if_error);
         }
-        else {
-            PLOG_ERROR("write");
+        if (http_find_field(parser, "ETag") != NULL ||
+            http_find_field(parser, "Last-Modified") != NULL) {
+            stale_age = STALE_KEEP;
         }
-        disconnect_server(server_sock);
+        if (stale_age < stale_while_revalidate) {
+            stale_age = stale_while_revalidate;
+        }
+        if (stale_age < stale_if_error) {
+            stale_age = stale_if_error;
+        }
+        server_buf->fill_max_age = max_age;
+        server_buf->fill_stale_age = stale_age;
     }
-    if (n == 0) {
-        LOG_ERROR("server socket is closed on the other side");
-        disconnect_server(server_sock);
+
+    /* Only a response to cache is shared. */
+    if (server_buf->fill_stale_age < 0 &&
+        inflight_remove(server_buf->key,
+                        server_sock,
+                        &waiters,
+                        &num_waiters)) {
+        LOG_INFO("response isn't shared with %d waiters", num_waiters);
     }
 
-    free(key);
-    key = NULL;
+    /* Copy the response to cache it, and to replay it to later waiters. */
+    if (server_buf->key != NULL && server_buf->fill_stale_age >= 0) {
+        if (!parser->body.is_chunked) {
+            expected_len = head_len + parser->body.remaining;
+        }
+        server_buf->fill = cache_fill_new(server_buf->key, expected_len);
+        if (server_buf->fill != NULL &&
+            cache_fill_append(server_buf->fill, buf, head_len) < 0) {
+            LOG_INFO("response is too large to cache; pass it through");
+        }
+    }
+    fast_forward(server_sock, buf, head_len);
+    refetch_waiters(waiters, num_waiters);
+    free(waiters);
+    waiters = NULL;
 }
 
 /**
- * @brief Handle a CONNECT request.
- * 
- * @param client_sock FD for client socket.
- * @param version String of HTTP version field in the request.
- * @param hostname Hostname to request.
- * @param port Port number to request.
+ * @brief Handle data received from a server that is not a tunnel. The head of
+ * a response is buffered and parsed as it arrives until it's complete, see
+ * start_response(); its body is forwarded as it arrives, and the response is
+ * finished once the body ends, see finish_response().
+ *
+ * @param fd FD for server socket.
+ * @param buf Received data.
+ * @param n Byte size of received data.
  */
-void handle_connect_request(int client_sock,
-                           char* version,
-                           char* hostname,
-                           int port)
+void handle_server_data(int fd, const char* buf, int n)
 {
-    int server_sock;
+    struct sock_buf* server_buf = NULL;
+    char* head = NULL; /* Buffered head, and the data received with it. */
+    int head_size = 0;
+    unsigned long id;
+    int len;
+    int ret;
 
-    if (use_ssl) {
-        /* Establish SSL connection with server. */
-        server_sock = ssl_connect_server(hostname, port, client_sock);
-        if (server_sock < 0) {
-            LOG_ERROR("ssl_connect_server");
-            return;
+    server_buf = sock_buf_get(fd);
+    id = server_buf->id;
+    while (n > 0) {
+        if (!server_buf->in_body) {
+            if (sock_buf_buffer(fd, (char*)buf, n) < 0) {
+                PLOG_ERROR("sock_buf_buffer");
+                break;
+            }
+            n = 0;
+            ret = http_parse(&(server_buf->parser),
+                             server_buf->buf,
+                             server_buf->size);
+            if (ret == HTTP_PARSE_PARTIAL) {
+                break;
+            }
+            if (ret == HTTP_PARSE_ERROR) {
+                /* A server that sends a malformed head is as good as
+                 * unreachable. */
+                LOG_ERROR("malformed response (fd: %d)", fd);
+                handle_connect_failure(fd);
+                break;
+            }
+            len = server_buf->parser.head_len;
+            start_response(fd, server_buf->buf);
+            /* Forwarding the head may disconnect the server. Otherwise, the
+             * rest of the buffer is the start of the body. */
+            server_buf = sock_buf_get(fd);
+            if (server_buf == NULL || server_buf->id != id) {
+                break;
+            }
+            free(head);
+            head = server_buf->buf;
+            head_size = server_buf->size;
+            server_buf->buf = NULL;
+            server_buf->size = 0;
+            buf = head + len;
+            n = head_size - len;
         }
-        LOG_INFO("established SSL connection with %s:%d", hostname, port);
-
-        reply_connection_established(client_sock, version);
-
-        /* Establish SSL connection with client. */
-        if (ssl_accept_client(client_sock, server_sock) < 0) {
-            LOG_ERROR("ssl_accept_client");
-            return;
+        else {
+            len = scan_body(&(server_buf->parser.body), buf, n);
+            if (len < 0) {
+                LOG_ERROR("malformed chunked response (fd: %d)", fd);
+                disconnect_server(fd);
+                break;
+            }
+            if (server_buf->fill != NULL &&
+                !cache_fill_is_full(server_buf->fill) &&
+                cache_fill_append(server_buf->fill, buf, len) < 0) {
+                LOG_INFO("response is too large to cache; pass it through");
+            }
+            fast_forward(fd, buf, len);
+            buf += len;
+            n -= len;
         }
-        LOG_INFO("established SSL connection with client (fd %d)", client_sock);
-    }
-    else {
-        struct sock_buf* client_buf = NULL;
-        struct sock_buf* server_buf = NULL;
 
-        /* Connect server. */
-        server_sock = connect_server(hostname, port, client_sock, NULL);
-        if (server_sock < 0) {
-            return;
+        /* Forwarding may disconnect the server. */
+        server_buf = sock_buf_get(fd);
+        if (server_buf == NULL || server_buf->id != id) {
+            break;
+        }
+        if (server_buf->in_body && server_buf->parser.body.is_done) {
+            finish_response(fd);
+            server_buf = sock_buf_get(fd);
+            if (server_buf == NULL || server_buf->id != id) {
+                break;
+            }
         }
-
-        /* Setup 2-way forwarding. */
-        client_buf = sock_buf_get(client_sock);
-        server_buf = sock_buf_get(server_sock);
-        client_buf->peer = server_sock;
-        client_buf->is_forward = 1;
-        server_buf->peer = client_sock;
-        server_buf->is_forward = 1;
-
-        /* Reply client with "Connection Established". */
-        reply_connection_established(client_sock, version);
     }
+    free(head);
+    head = NULL;
 }
 
 /**
- * @brief Handle other request by directly forwarding it to server.
- * 
- * @param fd FD for client socket.
- * @param request Client request.
- * @param request_len Byte size of client request.
- * @param hostname Hostname in client request.
- * @param port Port number in client request.
+ * @brief Fast forward partial server response to its client and the clients
+ * waiting for its fetch.
+ *
+ * @param server_sock FD for server socket.
+ * @param buf Response buffer.
+ * @param n Response byte size.
  */
-void handle_other_request(int fd,
-                          char* request,
-                          int request_len,
-                          char* hostname,
-                          int port) {
-    struct sock_buf* client_buf = NULL;
+void fast_forward(int server_sock, const char* buf, int n)
+{
     struct sock_buf* server_buf = NULL;
-    int is_ssl = 0;
-    int n;
-    int server_sock;
+    int is_ssl = 0; /* Whether this socket is one end of a SSL connection. */
+    int is_behind = 0; /* Whether a waiter has too much data queued. */
+    int waiter_sock;
+    int pos = 0;
 
-    client_buf = sock_buf_get(fd);
-    if (client_buf == NULL) {
-        LOG_ERROR("unknown socket %d", fd);
+    is_ssl = sock_buf_is_ssl(server_sock);
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf == NULL) {
+        LOG_ERROR("unknown socket %d", server_sock);
         return;
     }
-    is_ssl = sock_buf_is_ssl(fd);
 
-    /* Connect the requested server. */
-    if (is_ssl) {
-        server_sock = client_buf->peer;
-        server_buf = sock_buf_get(server_sock);
-        if (server_buf == NULL) {
-            LOG_ERROR("unknown socket %d", fd);
-            return;
+    /* Feed the clients waiting for the fetch first. Sending to one may
+     * disconnect the server in turn. The server is paused while any waiter is
+     * behind, as it is for its own client, until all of them catch up, see
+     * resume_fetch(). */
+    while ((waiter_sock = next_waiter(server_sock, &pos)) >= 0) {
+        if (send_sock(waiter_sock, buf, n) < 0) {
+            disconnect_client(waiter_sock);
         }
-    }
-    else {
-        server_sock = connect_server(hostname, port, fd, NULL);
-        if (server_sock < 0) {
-            /* Fail to connect the request server. */
-            return;
+        else if (sock_buf_get(waiter_sock)->out.size > OUT_HIGH_WATER) {
+            is_behind = 1;
         }
     }
-
-    /* Forward request to server. */
-    if (is_ssl) {
-        n = SSL_write(server_buf->ssl, request, request_len);
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf == NULL) {
+        return;
     }
-    else {
-        n = write(server_sock, request, request_len);
+    if (is_behind) {
+        pause_sock(server_sock);
     }
-    if (n < 0) {
-        if (is_ssl) {
-            ERR_print_errors_fp(stderr);
-            LOG_ERROR("SSL_write");
+    if (server_buf->peer < 0) {
+        /* A server of no client, e.g. a background refresh, only fills the
+         * cache and feeds its waiters. */
+        return;
+    }
+
+    if (is_ssl) {
+        struct sock_buf* client_buf = NULL;
+
+        client_buf = sock_buf_get(server_buf->peer);
+        if (client_buf == NULL) {
+            LOG_ERROR("unknown socket %d", server_buf->peer);
+            return;
         }
-        else {
-            PLOG_ERROR("write");
+        if (!sock_buf_is_ssl(server_buf->peer)) {
+            LOG_ERROR("client is not in SSL connection");
+            return;
         }
-        disconnect_server(server_sock);
     }
-    if (n == 0) {
-        LOG_ERROR("server socket is closed on the other side");
-        disconnect_server(server_sock);
+    n = send_sock(server_buf->peer, buf, n);
+    if (n < 0) {
+        disconnect_client(server_buf->peer);
+    }
+    else {
+        #if 0
+        LOG_INFO("forward %d bytes from server (fd %d) to client (fd %d)",
+                    n,
+                    server_sock,
+                    server_buf->peer);
+        #endif
     }
+
 }
 
 /**
- * @brief Handle client request if the request inf buffer is completed.
- * 
- * @param fd FD for client socket.
+ * @brief Handle incoming message from a client/server.
+ *
+ * @param fd FD for a client/server socket.
+ * @param buf Received message.
+ * @param n Byte size of received message.
  */
-void handle_client_request(int fd)
+void handle_msg(int fd, char* buf, int n)
 {
-    struct sock_buf* sock_buf = NULL;
-    char* request = NULL;
-    int request_len = 0;
-    char* method = NULL; /* Method field in client request. */
-    char* url = NULL; /* URL field in client request. */
-    char* version = NULL; /* Version field in client request. */
-    char* host = NULL; /* Host field in client request. */
-    char* hostname = NULL; /* Server hostname without port number. */
-    int port = -1; /* Server port in client request. 80 by default. */
-    int is_ssl = 0; /* Whether the client is using SSL connection. */
+    struct sock_buf* sock_buf = NULL; /* Socket buffer. */
+    int is_client = 0; /* Whether this socket is for a client. */
+    int is_forward = 0; /* Whether simply forward data to its peer. */
+    int len;
 
     sock_buf = sock_buf_get(fd);
     if (sock_buf == NULL) {
+        LOG_ERROR("unknown socket %d", fd);
         return;
     }
-    is_ssl = sock_buf_is_ssl(fd);
-
-    /* Extract the leading completed request. */
-    while (extract_first_request(&(sock_buf->buf),
-                                 &(sock_buf->size),
-                                 &request,
-                                 &request_len) > 0) {
-
-        fprintf(stderr, "================\n");
-        LOG_INFO("client request:\n"
-                 "%s", request);
-        fprintf(stderr, "================\n");
-
-        /* Parse request. */
-        parse_request_head(request, &method, &url, &version, &host);
-        port = -1;
-        parse_host_field(host, &hostname, &port);
-        LOG_INFO("parsed request:\n"
-                 "- method: %s\n"
-                 "- url: %s\n"
-                 "- version: %s\n"
-                 "- host: %s\n"
-                 "- hostname: %s",
-                 method,
-                 url,
-                 version,
-                 host,
-                 hostname);
+    is_client = sock_buf_is_client(fd);
+    is_forward = sock_buf_is_forward(fd);
+    #if 0
+    if (is_client) {
+        LOG_INFO("received %d bytes from client (fd: %d): %s", n, fd, buf);
+    }
+    else {
+        LOG_INFO("received %d bytes from server (fd: %d): %s", n, fd, buf);
+    }
+    #endif
 
-        if (strcmp(method, "GET") == 0) {
-            LOG_INFO("handle GET method");
+    /* Forward encrypted messages originated from a CONNECT method. */
+    if (is_forward) {
+        /* Traffic in either direction keeps both ends alive. */
+        set_deadline(fd, DEADLINE_IDLE);
+        set_deadline(sock_buf->peer, DEADLINE_IDLE);
 
-            if (port < 0) {
-                if (is_ssl) {
-                    port = 443; /* Default port for SSL link. */
-                }
-                else {
-                    port = 80; /* Default port for HTTP. */
-                }
+        #if 0
+        LOG_INFO("forwarding encrypted data from fd %d to fd %d",
+                fd,
+                sock_buf->peer);
+        #endif
+        sock_buf->forwarded += n;
+        if (is_client) {
+            n = send_to_server(sock_buf->peer, buf, n);
+        }
+        else {
+            n = send_sock(sock_buf->peer, buf, n);
+        }
+        if (n < 0) {
+            LOG_INFO("CONNECT socket is closed on the other side");
+            if (is_client) {
+                disconnect_server(sock_buf->peer);
             }
-            LOG_INFO("port: %d", port);
+            else {
+                disconnect_client(sock_buf->peer);
+            }
+        }
+        return;
+    }
 
-            handle_get_request(fd, request, request_len, url, hostname, port);
+    /* Parse socket buffer. */
+    if (is_client) {
+        if (sock_buf->in_body) {
+            len = forward_request_body(fd, buf, n);
+            if (len < 0) {
+                return;
+            }
+            buf += len;
+            n -= len;
         }
-        else if (strcmp(method, "CONNECT") == 0) {
-            LOG_INFO("handle CONNECT method");
 
-            if (port < 0) {
-                port = 443; /* Default port for SSL link. */
+        /* Write received message into socket buffer. */
+        if (n > 0) {
+            if (sock_buf_buffer(fd, buf, n) < 0) {
+                PLOG_ERROR("sock_buf_input");
+                return;
             }
-            LOG_INFO("port: %d", port);
+            handle_client_request(fd);
+        }
 
-            handle_connect_request(fd, version, hostname, port);
+        /* A partial request head has to be completed in time. A body only has
+         * to keep arriving, however long it takes. Otherwise, wait for the
+         * next request or the response. */
+        sock_buf = sock_buf_get(fd);
+        if (sock_buf != NULL && sock_buf->state == SOCK_ESTABLISHED) {
+            if (sock_buf->size == 0 || sock_buf->in_body) {
+                set_deadline(fd, DEADLINE_IDLE);
+            }
+            else if (sock_buf->deadline != DEADLINE_HEADER) {
+                set_deadline(fd, DEADLINE_HEADER);
+            }
         }
-        else {
-            LOG_INFO("handle %s method", method);
+    }
+    else {
+        set_deadline(fd, DEADLINE_RESPONSE);
+        handle_server_data(fd, buf, n);
+    }
+}
 
-            if (port < 0) {
-                if (is_ssl) {
-                    port = 443; /* Default port for SSL link. */
+/**
+ * @brief Forward data from a tunnel socket to its peer through a pipe, without
+ * copying it to user space. Stop when the socket would block, or pause the
+ * socket when the peer can't take the data in the pipe.
+ *
+ * @param fd FD for client/server socket that is forwarded.
+ */
+void splice_sock(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+    int n;
+
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf->pipe_fds[0] < 0 &&
+        pipe2(sock_buf->pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        PLOG_ERROR("pipe2");
+        sock_buf->pipe_fds[0] = -1;
+        n = -1;
+    }
+    else {
+        while (true) {
+            /* Keep at most one pipe of data in flight. */
+            if (flush_pipe(fd) < 0) {
+                LOG_INFO("CONNECT socket is closed on the other side");
+                if (sock_buf->is_client) {
+                    disconnect_client(fd);
                 }
                 else {
-                    port = 80; /* Default port for HTTP. */
+                    disconnect_client(sock_buf->peer);
                 }
+                return;
             }
-            LOG_INFO("port: %d", port);
+            if (sock_buf->pipe_size > 0) {
+                pause_sock(fd);
+                return;
+            }
+
+            n = splice(fd,
+                       NULL,
+                       sock_buf->pipe_fds[1],
+                       NULL,
+                       PIPE_SIZE,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                /* Nothing left to read. */
+                return;
+            }
+            if (n <= 0) {
+                break;
+            }
+            sock_buf->pipe_size += n;
+
+            /* Traffic in either direction keeps both ends alive. */
+            set_deadline(fd, DEADLINE_IDLE);
+            set_deadline(sock_buf->peer, DEADLINE_IDLE);
+        }
+    }
 
-            handle_other_request(fd, request, request_len, hostname, port);
+    /* Socket is disconnected on the other side or broken. */
+    if (n < 0) {
+        PLOG_ERROR("splice (fd: %d)", fd);
+    }
+    if (sock_buf->is_client) {
+        LOG_INFO("client socket is closed on the other side");
+        disconnect_client(fd);
+    }
+    else {
+        /* Let the client get what the server sent before closing. */
+        LOG_INFO("server socket is closed on the other side");
+        if (unpipe(fd) < 0) {
+            disconnect_client(sock_buf->peer);
+            return;
         }
-
-        free(method);
-        method = NULL;
-        free(url);
-        url = NULL;
-        free(version);
-        version = NULL;
-        free(host);
-        host = NULL;
-        free(hostname);
-        hostname = NULL;
-        free(request);
-        request = NULL;
+        disconnect_server(fd);
     }
 }
 
 /**
- * @brief Handle server response. If response in buffer is completed, cache and
- * forward it to client.
+ * @brief Handle readiness of a client/server socket. Read and handle incoming
+ * messages until there is nothing left to read.
  *
- * @param fd FD for server socket.
+ * @param fd FD for a client/server socket.
+ * @param events Ready events.
  */
-void handle_server_response(int fd)
+void handle_sock_event(int fd, int events)
 {
-    char* response = NULL;
-    int response_len = 0;
-    int max_age = 3600;
-    struct sock_buf* server_buf = NULL;
-    int is_ssl = 0;
+    struct sock_buf* sock_buf = NULL; /* Socket buffer. */
+    struct sock_buf* peer_buf = NULL; /* Socket buffer of its peer. */
+    unsigned long id; /* ID of the socket buffer. */
+    char buf[BUF_SIZE]; /* Message buffer. */
+    int n; /* Byte size actually received. */
 
-    server_buf = sock_buf_get(fd);
-    if (server_buf == NULL) {
-        LOG_ERROR("unknown socket %d", server_buf);
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf == NULL) {
+        LOG_ERROR("unknown socket %d", fd);
         return;
     }
-    is_ssl = sock_buf_is_ssl(fd);
-
-    /* Extract the leading completed response. */
-    if (extract_first_response(&(server_buf->buf),
-                                &(server_buf->size),
-                                &response,
-                                &response_len,
-                                &max_age,
-                                &(server_buf->is_chunked)) == 0) {
-        /* Response is incomplete.*/
+    id = sock_buf->id;
+
+    /* Finish connecting and SSL handshakes first. */
+    switch (sock_buf->state) {
+    case SOCK_CONNECTING:
+        n = handle_connect_event(fd, events);
+        break;
+    case SOCK_SSL_CONNECTING:
+    case SOCK_SSL_ACCEPTING:
+        n = handle_handshake_event(fd);
+        break;
+    default:
+        n = 1;
+        break;
+    }
+    if (n <= 0) {
+        return;
+    }
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf == NULL || sock_buf->id != id) {
         return;
     }
 
-    /* Parse response. */
-    int status_code = -1;
-    char* version = NULL;
-    char* phrase = NULL;
-    parse_status_line(response,
-                      &version,
-                      &status_code,
-                      &phrase);
-    free(version);
-    version = NULL;
-    free(phrase);
-    phrase = NULL;
+    /* Send queued data. SSL may need to read before it can write, so try on
+     * any event. */
+    if ((sock_buf->out.size > 0 || (events & EVENT_WRITE)) &&
+        flush_sock(fd) < 0) {
+        if (sock_buf->is_client) {
+            disconnect_client(fd);
+        }
+        else {
+            disconnect_server(fd);
+        }
+        return;
+    }
+    if (sock_buf->is_closing) {
+        if (sock_buf->out.size == 0) {
+            disconnect_client(fd);
+        }
+        return;
+    }
+    if (!(events & EVENT_READ) || sock_buf->is_paused) {
+        return;
+    }
 
-    /* Cache response whose status is 200 OK. */
-    if (status_code == 200 &&
-        cache_put(server_buf->key, response, response_len, max_age) == 0) {
-        LOG_ERROR("fail to cache server response");
+    /* Tunnel data bypasses user space once both ends are established. */
+    if (sock_buf->is_forward && use_splice) {
+        peer_buf = sock_buf_get(sock_buf->peer);
+        if (peer_buf != NULL && peer_buf->state == SOCK_ESTABLISHED) {
+            splice_sock(fd);
+            return;
+        }
     }
 
-    /* Disconnect server. */
-    if (!is_ssl) {
-        disconnect_server(fd);
+    /* Edge-triggered: read until the socket would block, or its peer has too
+     * much data to send. */
+    while (true) {
+        n = read_sock(fd, sock_buf->ssl, buf, BUF_SIZE);
+        if (n == -2) {
+            /* Nothing left to read. */
+            return;
+        }
+        if (n <= 0) {
+            /* Socket is disconnected on the other side or broken. */
+            if (sock_buf->is_client) {
+                LOG_INFO("client socket is closed on the other side");
+                disconnect_client(fd);
+            }
+            else {
+                LOG_INFO("server socket is closed on the other side");
+                disconnect_server(fd);
+            }
+            return;
+        }
+
+        handle_msg(fd, buf, n);
+
+        /* Stop if the socket is disconnected while handling the message. The
+         * FD may even be reused by a new connection. */
+        sock_buf = sock_buf_get(fd);
+        if (sock_buf == NULL || sock_buf->id != id || sock_buf->is_paused) {
+            return;
+        }
     }
+}
 
-    free(response);
-    response = NULL;
+/**
+ * @brief Read from the sockets whose reading has been resumed since the last
+ * call. Sockets resumed in the meantime are left for the next call.
+ */
+void handle_resumed(void)
+{
+    struct sock_buf* sock_buf = NULL;
+    int n = num_resumed;
+
+    for (int i = 0; i < n; ++i) {
+        sock_buf = sock_buf_get(resumed[i].fd);
+        if (sock_buf != NULL &&
+            sock_buf->id == resumed[i].id &&
+            !sock_buf->is_paused) {
+            handle_sock_event(resumed[i].fd, EVENT_READ);
+        }
+    }
+    memmove(resumed,
+            resumed + n,
+            (num_resumed - n) * sizeof(struct resumed_sock));
+    num_resumed -= n;
 }
 
 /**
- * @brief Fast forward partial server response to its client.
+ * @brief Handle an expired deadline of a socket.
  *
- * @param server_sock FD for server socket.
- * @param buf Response buffer.
- * @param n Response byte size.
+ * @param fd FD for a client/server socket.
  */
-void fast_forward(int server_sock, const char* buf, int n)
+void handle_timeout(int fd)
 {
-    struct sock_buf* server_buf = NULL;
-    int is_ssl = 0; /* Whether this socket is one end of a SSL connection. */
+    struct sock_buf* sock_buf = NULL;
 
-    is_ssl = sock_buf_is_ssl(server_sock);
-    server_buf = sock_buf_get(server_sock);
-    if (server_buf == NULL) {
-        LOG_ERROR("unknown socket %d", server_sock);
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf == NULL) {
         return;
     }
 
-    if (is_ssl) {
-        struct sock_buf* client_buf = NULL;
-
-        client_buf = sock_buf_get(server_buf->peer);
-        if (client_buf == NULL) {
-            LOG_ERROR("unknown socket %d", client_buf);
-            return;
+    switch (sock_buf->deadline) {
+    case DEADLINE_CONNECT:
+        LOG_ERROR("connect (fd: %d): timeout", fd);
+        if (sock_buf->is_client) {
+            disconnect_client(fd);
         }
-        if (!sock_buf_is_ssl(server_buf->peer)) {
-            LOG_ERROR("client is not in SSL connection");
-            return;
+        else {
+            handle_connect_failure(fd);
         }
-        n = SSL_write(client_buf->ssl, buf, n);
-    }
-    else {
-        n = write(server_buf->peer, buf, n);
-    }
-    if (n < 0) {
-        if (is_ssl) {
-            LOG_ERROR("SSL_write");
-            ERR_print_errors_fp(stderr);
+        break;
+    case DEADLINE_HEADER:
+        LOG_INFO("request head timeout (fd: %d)", fd);
+        disconnect_client(fd);
+        break;
+    case DEADLINE_RESPONSE:
+        /* The client can't get a whole response anymore. */
+        LOG_ERROR("response timeout (fd: %d)", fd);
+        if (sock_buf_get(sock_buf->peer) != NULL) {
+            disconnect_client(sock_buf->peer);
+        }
+        disconnect_server(fd);
+        break;
+    default:
+        LOG_INFO("idle timeout (fd: %d)", fd);
+        if (sock_buf->is_client) {
+            disconnect_client(fd);
         }
         else {
-            PLOG_ERROR("write");
+            disconnect_server(fd);
         }
-        disconnect_client(server_buf->peer);
-    }
-    else if (n == 0) {
-        LOG_ERROR("client socket is closed on the other side");
-        disconnect_client(server_buf->peer);
-    }
-    else {
-        #if 0
-        LOG_INFO("forward %d bytes from server (fd %d) to client (fd %d)",
-                    n,
-                    server_sock,
-                    server_buf->peer);
-        #endif
+        break;
     }
-
 }
 
 /**
- * @brief Handle incoming message from a client/server.
- * 
+ * @brief Set the deadline of a socket, replacing its current one.
+ *
  * @param fd FD for a client/server socket.
+ * @param deadline Kind of the deadline.
  */
-void handle_msg(int fd)
+void set_deadline(int fd, enum sock_deadline deadline)
 {
-    struct sock_buf* sock_buf = NULL; /* Socket buffer. */
-    char buf[BUF_SIZE]; /* Message buffer. */
-    int n; /* Byte size actually received or sent. */
-    int is_client = 0; /* Whether this socket is for a client. */
-    int is_ssl = 0; /* Whether this socket is one end of a SSL connection. */
-    int is_forward = 0; /* Whether simply forward data to its peer. */
+    struct sock_buf* sock_buf = NULL;
+    time_t timeout;
 
     sock_buf = sock_buf_get(fd);
     if (sock_buf == NULL) {
-        LOG_ERROR("unknown socket %d", fd);
         return;
     }
-    is_client = sock_buf_is_client(fd);
-    is_forward = sock_buf_is_forward(fd);
-    is_ssl = sock_buf_is_ssl(fd);
-
-    /* Receive message. */
-    bzero(buf, BUF_SIZE);
-    if (is_ssl) {
-        n = SSL_read(sock_buf->ssl, buf, BUF_SIZE);
+    /* Sockets that are not established yet keep their connect deadline. */
+    if (sock_buf->state != SOCK_ESTABLISHED && deadline != DEADLINE_CONNECT) {
+        return;
     }
-    else {
-        n = read(fd, buf, BUF_SIZE);
+
+    switch (deadline) {
+    case DEADLINE_CONNECT:
+        timeout = connect_timeout;
+        break;
+    case DEADLINE_HEADER:
+        timeout = HEADER_TIMEOUT;
+        break;
+    case DEADLINE_RESPONSE:
+        timeout = RESPONSE_TIMEOUT;
+        break;
+    case DEADLINE_IDLE:
+        timeout = IDLE_TIMEOUT;
+        break;
+    default:
+        timer_cancel(&sock_buf->timer);
+        sock_buf->deadline = DEADLINE_NONE;
+        return;
     }
-    if (n < 0) {
-        if (is_ssl) {
-            ERR_print_errors_fp(stderr);
-            LOG_ERROR("SSL_read");
-        }
-        else {
-            PLOG_ERROR("read");
-        }
-        if (is_client) {
-            disconnect_client(fd);
-            return;
+    sock_buf->deadline = deadline;
+    timer_set(&sock_buf->timer, fd, handle_timeout, timeout * 1000LL);
+}
+
+/**
+ * @brief Run the proxy in this process until it is shut down.
+ */
+void run_proxy(void)
+{
+    struct sigaction action;
+    sigset_t stop_signals;
+    sigset_t old_mask; /* Signal mask before the proxy runs. */
+    sigset_t wait_mask; /* Signal mask while waiting for events. */
+    int timeout; /* Max time to wait for events in milliseconds. */
+
+    /* Clean up and stop proxy by CTRL+C or SIGTERM. The signals are blocked
+     * but while waiting for events, so they can't land between checking the
+     * flag and waiting. They are blocked before the resolver threads start,
+     * which inherit the mask, so the main thread gets them. */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop_signals, &old_mask);
+    wait_mask = old_mask;
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    init_proxy();
+
+    /* Ignore SIGPIPE. */
+    signal(SIGPIPE, PIPE_hander);
+
+    /* Main loop. */
+    while (!stopping) {
+        /* Block until some sockets are ready, or the next timer is due. Don't
+         * block if some sockets are resumed. */
+        timeout = num_resumed > 0 ? 0 : timer_next_timeout();
+        if (event_loop_run_once(timeout, &wait_mask) < 0) {
+            LOG_FATAL("event_loop_run_once");
         }
-        else {
-            disconnect_server(fd);
-            return;
+
+        /* Read from sockets resumed from backpressure. */
+        handle_resumed();
+
+        /* Read the clock once per tick and fire due timers. */
+        timer_run(timer_clock());
+
+        /* Free a few expired responses. */
+        if (cache_sweep_limit > 0) {
+            cache_sweep(cache_sweep_limit);
         }
     }
-    else if (n == 0) {
-        /* Socket is disconnected on the other side. */
-        if (is_client) {
-            LOG_INFO("client socket is closed on the other side");
-            disconnect_client(fd);
-            return;
-        }
-        else {
-            LOG_INFO("server socket is closed on the other side");
-            disconnect_server(fd);
-            return;
+
+    clear_proxy();
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    LOG_INFO("shut down");
+}
+
+/**
+ * @brief Fork a worker process that runs the proxy.
+ *
+ * @param id Worker ID, 0 <= id < num_workers.
+ * @return pid_t PID of the worker.
+ */
+pid_t spawn_worker(int id)
+{
+    static char snapshot_file[PATH_MAX];
+    pid_t pid;
+    char tag[32];
+
+    pid = fork();
+    if (pid < 0) {
+        PLOG_FATAL("fork");
+    }
+    if (pid == 0) {
+        /* Worker process. */
+        free(worker_pids);
+        worker_pids = NULL;
+        snprintf(tag, sizeof(tag), "worker %d", id);
+        set_log_tag(tag);
+        /* Each worker snapshots its own cache. */
+        if (cache_snapshot_file != NULL) {
+            snprintf(snapshot_file,
+                     sizeof(snapshot_file),
+                     "%s.%d",
+                     cache_snapshot_file,
+                     id);
+            cache_snapshot_file = snapshot_file;
         }
+        run_proxy();
+        exit(EXIT_SUCCESS);
     }
-    #if 0
-    if (is_client) {
-        LOG_INFO("received %d bytes from client (fd: %d): %s", n, fd, buf);
+    LOG_INFO("spawn worker %d (pid: %d)", id, pid);
+    return pid;
+}
+
+/**
+ * @brief Spawn worker processes and wait for them. Respawn a worker if it
+ * crashes, i.e. is killed by a signal, waiting longer each time it crashes
+ * soon after being spawned. A worker that exits with a failure, e.g. it can't
+ * bind the port, would fail again, so all workers are stopped then. Stop all
+ * workers by CTRL+C.
+ *
+ * @return int 0 if the workers are stopped by CTRL+C; -1 if one failed.
+ */
+int run_workers(void)
+{
+    struct sigaction action;
+    time_t* spawn_times = NULL; /* When each worker was last spawned. */
+    int* backoffs = NULL; /* Seconds to wait before respawning each worker. */
+    pid_t pid;
+    int status;
+    int ret = 0;
+
+    worker_pids = malloc(num_workers * sizeof(pid_t));
+    spawn_times = malloc(num_workers * sizeof(time_t));
+    backoffs = calloc(num_workers, sizeof(int));
+    if (worker_pids == NULL || spawn_times == NULL || backoffs == NULL) {
+        PLOG_FATAL("malloc");
     }
-    else {
-        LOG_INFO("received %d bytes from server (fd: %d): %s", n, fd, buf);
+    for (int i = 0; i < num_workers; ++i) {
+        worker_pids[i] = spawn_worker(i);
+        spawn_times[i] = time(NULL);
     }
-    #endif
 
-    /* Update the last input time of the socket. */
-    sock_buf_update_input_time(fd);
-
-    /* Forward encrypted messages originated from a CONNECT method. */
-    if (is_forward) {
-        #if 0
-        LOG_INFO("forwarding encrypted data from fd %d to fd %d",
-                fd,
-                sock_buf->peer);
-        #endif
-        n = write(sock_buf->peer, buf, n);
-        if (n < 0) {
-            PLOG_ERROR("write");
-            if (is_client) {
-                disconnect_server(sock_buf->peer);
-            } else {
-                disconnect_client(sock_buf->peer);
+    /* Without SA_RESTART, so that waitpid() and sleep() are interrupted by
+     * the signal. */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    while (!stopping) {
+        pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            PLOG_ERROR("waitpid");
+            break;
         }
-        if (n == 0) {
-            LOG_INFO("CONNECT socket is closed on the other side");
-            if (is_client) {
-                disconnect_server(sock_buf->peer);
+        for (int i = 0; i < num_workers; ++i) {
+            if (worker_pids[i] != pid) {
+                continue;
+            }
+            worker_pids[i] = -1;
+            /* A worker stopped by CTRL+C exits successfully. */
+            if (stopping ||
+                (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) ||
+                (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)) {
+                break;
+            }
+            if (!WIFSIGNALED(status)) {
+                LOG_ERROR("worker %d (pid: %d) failed with status %d; "
+                          "stop all workers",
+                          i,
+                          pid,
+                          WEXITSTATUS(status));
+                stopping = 1;
+                ret = -1;
+                break;
+            }
+            LOG_ERROR("worker %d (pid: %d) crashed by signal %d",
+                      i,
+                      pid,
+                      WTERMSIG(status));
+            /* Back off a worker that keeps crashing right away. */
+            if (time(NULL) - spawn_times[i] < WORKER_MIN_UPTIME) {
+                backoffs[i] = backoffs[i] == 0 ?
+                              1 :
+                              (backoffs[i] * 2 < WORKER_MAX_BACKOFF ?
+                               backoffs[i] * 2 :
+                               WORKER_MAX_BACKOFF);
+                LOG_INFO("respawn worker %d in %d seconds", i, backoffs[i]);
+                sleep(backoffs[i]);
+                if (stopping) {
+                    break;
+                }
             }
             else {
-                disconnect_client(sock_buf->peer);
+                backoffs[i] = 0;
             }
+            worker_pids[i] = spawn_worker(i);
+            spawn_times[i] = time(NULL);
+            break;
         }
-        return;
     }
 
-    /* Write received message into socket buffer. */
-    if (sock_buf_buffer(fd, buf, n) < 0) {
-        PLOG_ERROR("sock_buf_input");
-        return;
+    /* Stop all workers. */
+    for (int i = 0; i < num_workers; ++i) {
+        if (worker_pids[i] > 0) {
+            kill(worker_pids[i], SIGINT);
+        }
     }
-
-    /* Parse socket buffer. */
-    if (is_client) {
-         handle_client_request(fd);
+    while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {
+        continue;
     }
-    else {
-        /* Fast forward partial server response to client. */
-        fast_forward(fd, buf, n);
+    free(worker_pids);
+    worker_pids = NULL;
+    free(spawn_times);
+    spawn_times = NULL;
+    free(backoffs);
+    backoffs = NULL;
+    LOG_INFO("shut down all workers");
+    return ret;
+}
+
+/**
+ * @brief Print usage and exit on failure.
+ *
+ * @param prog Program name.
+ */
+void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [--workers <n>] [--connect-timeout <sec>] "
+            "[--hosts <file>] [--no-splice] [--cache-size <size>] "
+            "[--cache-object-size <size>] [--cache-sweep <n>] "
+            "[--cache-dechunk] "
+            "[--cache-policy lru|s3fifo|tinylfu] "
+            "[--disk-cache <dir>] [--disk-cache-size <size>] "
+            "[--cache-snapshot <file>] "
+            "<port> [<cert_file> <key_file>]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parse a byte size with an optional K, M or G suffix.
+ *
+ * @param arg Size string, e.g. "64M".
+ * @return size_t Byte size; 0 if invalid.
+ */
+size_t parse_size(const char* arg)
+{
+    char* end = NULL;
+    unsigned long long size = strtoull(arg, &end, 10);
 
-        /* Handle server response in its buffer. */
-        handle_server_response(fd);
+    if (end == arg) {
+        return 0;
+    }
+    switch (*end) {
+    case 'G':
+    case 'g':
+        size <<= 10;
+        /* FALLTHROUGH */
+    case 'M':
+    case 'm':
+        size <<= 10;
+        /* FALLTHROUGH */
+    case 'K':
+    case 'k':
+        size <<= 10;
+        ++end;
+        break;
+    default:
+        break;
     }
+    if (*end != '\0') {
+        return 0;
+    }
+    return size;
 }
 
 int main(int argc, char** argv)
 {
+    static const struct option options[] = {
+        {"workers", required_argument, NULL, 'w'},
+        {"connect-timeout", required_argument, NULL, 't'},
+        {"hosts", required_argument, NULL, 'H'},
+        {"no-splice", no_argument, NULL, 'S'},
+        {"cache-size", required_argument, NULL, 'c'},
+        {"cache-object-size", required_argument, NULL, 'o'},
+        {"cache-sweep", required_argument, NULL, 's'},
+        {"cache-dechunk", no_argument, NULL, 'u'},
+        {"cache-policy", required_argument, NULL, 'p'},
+        {"disk-cache", required_argument, NULL, 'd'},
+        {"disk-cache-size", required_argument, NULL, 'D'},
+        {"cache-snapshot", required_argument, NULL, 'f'},
+        {NULL, 0, NULL, 0}
+    };
+    const char* prog = argv[0]; /* Program name. */
+    int opt;
+    int policy;
+
     /* Parse cmd line args. */
-    if (argc != 2 && argc != 4) {
-        fprintf(stderr, "usage: %s <port> [<cert_file> <key_file>]\n", argv[0]);
-        exit(EXIT_FAILURE);
+    while ((opt = getopt_long(argc,
+                              argv,
+                              "w:t:H:Sc:o:s:up:d:D:f:",
+                              options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'w':
+            num_workers = atoi(optarg);
+            if (num_workers <= 0) {
+                usage(prog);
+            }
+            break;
+        case 'H':
+            hosts_file = optarg;
+            break;
+        case 'S':
+            use_splice = 0;
+            break;
+        case 'c':
+            cache_bytes_limit = parse_size(optarg);
+            if (cache_bytes_limit == 0) {
+                usage(prog);
+            }
+            break;
+        case 'o':
+            cache_object_limit = parse_size(optarg);
+            if (cache_object_limit == 0) {
+                usage(prog);
+            }
+            break;
+        case 's':
+            cache_sweep_limit = atoi(optarg);
+            if (cache_sweep_limit < 0) {
+                usage(prog);
+            }
+            break;
+        case 'u':
+            cache_dechunk = 1;
+            break;
+        case 'p':
+            policy = cache_parse_policy(optarg);
+            if (policy < 0) {
+                usage(prog);
+            }
+            cache_policy = policy;
+            break;
+        case 'd':
+            disk_cache_dir = optarg;
+            break;
+        case 'D':
+            disk_cache_limit = parse_size(optarg);
+            if (disk_cache_limit < 2 * (size_t)DISK_SEGMENT_BYTES) {
+                usage(prog);
+            }
+            break;
+        case 'f':
+            cache_snapshot_file = optarg;
+            break;
+        case 't':
+            connect_timeout = atoi(optarg);
+            if (connect_timeout <= 0) {
+                usage(prog);
+            }
+            break;
+        default:
+            usage(prog);
+        }
     }
-    listen_port = atoi(argv[1]);
-    if (argc == 4) {
+    argc -= optind;
+    argv += optind;
+    if (argc != 1 && argc != 3) {
+        usage(prog);
+    }
+    listen_port = atoi(argv[0]);
+    if (argc == 3) {
         use_ssl = 1; /* Raise flag for SSL interception. */
-        CERT_FILE = argv[2];
-        KEY_FILE = argv[3];
+        CERT_FILE = argv[1];
+        KEY_FILE = argv[2];
         LOG_INFO("run in SSL interception mode");
     }
     else {
         LOG_INFO("run in default mode");
     }
 
-    init_proxy();
-
-    /* Clean up and stop proxy by CTRL+C. */
-    signal(SIGINT, INT_handler);
-
-    /* Ignore SIGPIPE. */
-    signal(SIGPIPE, PIPE_hander);
-
-    /* Main loop. */
-    while(true) {
-        /* Block until input arrives on one or more active sockets. */
-        read_fd_set = active_fd_set;
-        if (select(max_fd + 1, &read_fd_set, NULL, NULL, NULL) < 0) {
-            PLOG_FATAL("select");
-        }
-        for (int fd = 0; fd <= max_fd; ++fd) {
-            if (FD_ISSET(fd, &read_fd_set)) {
-                /* Accept new client. */
-                if (fd == listen_sock) {
-                    accept_client();
-                }
-                /* Handle arriving data from a connected socket. */
-                else {
-                    handle_msg(fd);
-                }
-            }
-            /*remove timeout socket*/
-            if (sock_buf_is_timeout(fd)) {
-                if (sock_buf_is_client(fd)) {
-                    disconnect_client(fd);
-                }
-                else {
-                    disconnect_server(fd);
-                }
-            }
+    if (num_workers > 0) {
+        if (run_workers() < 0) {
+            return EXIT_FAILURE;
         }
     }
-
-    clear_proxy();
-    LOG_INFO("shut down");
+    else {
+        run_proxy();
+    }
 
     return EXIT_SUCCESS;
 }
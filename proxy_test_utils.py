@@ -0,0 +1,105 @@
+###############################################################
+#
+#                    proxy_test_utils.py
+#
+#     Final Project: High Performance HTTP Proxy
+#     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+#     Date: 2026-10-16
+#
+#     Summary:
+#     Shared fixture of the intergration tests against a local
+#     origin stub: it starts the stub on any free port, and the
+#     proxy with the given arguments under a temp dir, waits
+#     for the proxy to accept connections, and shuts both down
+#     after the tests.
+#
+###############################################################
+
+import http.server
+import os
+import shutil
+import socket
+import subprocess
+import tempfile
+import threading
+import time
+import unittest
+import urllib.request
+
+
+START_TIMEOUT = 10  # Seconds to wait for the proxy to accept connections.
+
+
+def wait_for_port(port, process, timeout=START_TIMEOUT):
+    '''
+    @brief Wait until a port on localhost accepts connections.
+    @param port Port to connect to.
+    @param process Process that is to listen on the port; the wait fails as
+    soon as it exits.
+    @param timeout Seconds to wait at most.
+    '''
+    deadline = time.time() + timeout
+    while True:
+        if process.poll() is not None:
+            raise Exception("proxy exited with {}".format(process.returncode))
+        try:
+            socket.create_connection(("localhost", port), timeout=1).close()
+            return
+        except OSError:
+            if time.time() > deadline:
+                raise Exception("proxy doesn't accept connections on port "
+                                "{}".format(port))
+            time.sleep(0.05)
+
+
+class ProxyTestCase(unittest.TestCase):
+    '''
+    @brief Test case of a proxy against a local origin stub. Subclasses set
+    ORIGIN_HANDLER, and PROXY_ARGS if the proxy takes options.
+    '''
+    PORT = 9999  # Port that the proxy listens on.
+    ORIGIN_HANDLER = None  # Request handler class of the origin stub.
+    PROXY_ARGS = []  # Proxy options, before the port.
+
+    @classmethod
+    def setUpClass(cls):
+        # Start the origin stub on any free port.
+        cls.origin = http.server.ThreadingHTTPServer(("127.0.0.1", 0),
+                                                     cls.ORIGIN_HANDLER)
+        cls.origin_url = "http://127.0.0.1:{}".format(cls.origin.server_port)
+        threading.Thread(target=cls.origin.serve_forever, daemon=True).start()
+
+        # Setup a temp dir as the test dir.
+        repo_root = os.path.join(os.path.dirname(__file__))
+        print("repo_root:", repo_root)
+        proxy_path = os.path.join(repo_root, "proxy")
+        if not os.path.exists(proxy_path):
+            raise Exception("proxy not found; please build the project first")
+        cls.test_root = tempfile.mkdtemp()
+        print("test_root:", cls.test_root)
+        shutil.copy(proxy_path, cls.test_root)
+
+        # Start proxy under the test dir.
+        cls.proxy_process = subprocess.Popen(
+            ["./proxy"] + cls.PROXY_ARGS + [str(cls.PORT)],
+            cwd=cls.test_root,
+            stderr=subprocess.DEVNULL)
+        cls.opener = urllib.request.build_opener(urllib.request.ProxyHandler(
+            {"http": "http://localhost:" + str(cls.PORT)}))
+        try:
+            wait_for_port(cls.PORT, cls.proxy_process)
+        except Exception:
+            cls.tearDownClass()
+            raise
+
+
+    @classmethod
+    def tearDownClass(cls):
+        # Shut down the proxy and the origin stub.
+        cls.proxy_process.kill()
+        cls.proxy_process.wait()
+        cls.origin.shutdown()
+        cls.origin.server_close()
+
+        # Cleanup the test dir.
+        shutil.rmtree(cls.test_root)
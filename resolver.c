@@ -0,0 +1,631 @@
+/**************************************************************
+*
+*                         resolver.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Implementation for asynchronous DNS resolver with a
+*     TTL-aware host cache.
+*
+*     The host cache is only touched by the event loop
+*     thread. Resolver threads only see queries, which carry
+*     a copy of the hostname and the result.
+*
+**************************************************************/
+
+#include "resolver.h"
+#include "logger.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_BUCKETS 1024 /* Number of buckets in the host cache. */
+#define MAX_HOSTS 4096 /* Number of cached hosts to start purging expired ones. */
+
+/* State of a cached host. */
+enum host_state {
+    HOST_PENDING, /* Query is in flight. */
+    HOST_RESOLVED, /* Address is known. */
+    HOST_FAILED /* Host can't be resolved. */
+};
+
+/* A connection waiting for a host to be resolved. */
+struct waiter {
+    int fd;
+    unsigned long id;
+};
+
+/* Entry of the host cache. */
+struct host {
+    char* name; /* Hostname in lower case. */
+    enum host_state state;
+    struct in_addr addr; /* Address if resolved. */
+    time_t expire; /* Time when the entry becomes stale. */
+    struct waiter* waiters; /* Waiters of the in-flight query. */
+    int num_waiters;
+    int waiters_cap;
+    struct host* next; /* Next host in the same bucket. */
+};
+
+/* Query handed to resolver threads. */
+struct query {
+    struct host* host; /* Host to update, only touched by the event loop. */
+    char* name; /* Copy of the hostname. */
+    int error; /* 0 if resolved; -1 otherwise. */
+    struct in_addr addr; /* Resolved address. */
+    time_t ttl; /* Time-to-live of the result in seconds. */
+    struct query* next;
+};
+
+/* Entry of the hosts file. */
+struct hosts_entry {
+    char* name;
+    struct in_addr addr;
+    time_t ttl;
+};
+
+static struct host* buckets[NUM_BUCKETS]; /* Host cache. */
+static int num_hosts = 0; /* Number of cached hosts. */
+static struct resolver_stats stats;
+static resolver_callback on_complete = NULL;
+static int event_fd = -1; /* Signaled when queries are done. */
+
+static struct hosts_entry* hosts = NULL; /* Entries of the hosts file. */
+static int num_hosts_entries = 0;
+static int use_hosts_file = 0; /* Whether the hosts file is authoritative. */
+
+static pthread_t* threads = NULL;
+static int thread_count = 0; /* Number of running resolver threads. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* Guards below. */
+static pthread_cond_t todo_cond = PTHREAD_COND_INITIALIZER;
+static struct query* todo_head = NULL; /* Queries to resolve. */
+static struct query* todo_tail = NULL;
+static struct query* done_head = NULL; /* Resolved queries. */
+static struct query* done_tail = NULL;
+static int stopping = 0; /* Whether resolver threads should exit. */
+
+/**
+ * @brief Hash a hostname case-insensitively with FNV-1a.
+ */
+static unsigned hash_name(const char* name)
+{
+    unsigned h = 2166136261u;
+
+    for (; *name != '\0'; ++name) {
+        h ^= (unsigned char)tolower((unsigned char)*name);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Append a query to a queue.
+ */
+static void queue_push(struct query** head,
+                       struct query** tail,
+                       struct query* q)
+{
+    q->next = NULL;
+    if (*tail == NULL) {
+        *head = q;
+    }
+    else {
+        (*tail)->next = q;
+    }
+    *tail = q;
+}
+
+/**
+ * @brief Load an /etc/hosts-style file.
+ *
+ * @param path Path to the file.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int load_hosts_file(const char* path)
+{
+    FILE* fp;
+    char line[512];
+    char addr[64];
+    char name[256];
+    long ttl;
+    int n;
+    int cap = 0;
+    struct hosts_entry* ret = NULL;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        PLOG_ERROR("fopen %s", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        ttl = RESOLVER_TTL;
+        n = sscanf(line, "%63s %255s %ld", addr, name, &ttl);
+        if (n < 2 || ttl < 0) {
+            continue;
+        }
+        if (num_hosts_entries == cap) {
+            cap = cap == 0 ? 16 : cap * 2;
+            ret = realloc(hosts, cap * sizeof(struct hosts_entry));
+            if (ret == NULL) {
+                PLOG_ERROR("realloc");
+                fclose(fp);
+                return -1;
+            }
+            hosts = ret;
+        }
+        if (inet_aton(addr, &hosts[num_hosts_entries].addr) == 0) {
+            /* Only IPv4 addresses are supported. */
+            continue;
+        }
+        hosts[num_hosts_entries].name = strdup(name);
+        hosts[num_hosts_entries].ttl = ttl;
+        ++num_hosts_entries;
+    }
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * @brief Resolve a query on a resolver thread.
+ */
+static void resolve(struct query* q)
+{
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+
+    q->error = -1;
+    q->ttl = RESOLVER_NEG_TTL;
+
+    if (use_hosts_file) {
+        for (int i = 0; i < num_hosts_entries; ++i) {
+            if (strcasecmp(hosts[i].name, q->name) == 0) {
+                q->error = 0;
+                q->addr = hosts[i].addr;
+                q->ttl = hosts[i].ttl;
+                return;
+            }
+        }
+        return;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(q->name, NULL, &hints, &res) != 0 || res == NULL) {
+        return;
+    }
+    q->error = 0;
+    q->addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
+    /* getaddrinfo() doesn't report the record TTL. */
+    q->ttl = RESOLVER_TTL;
+    freeaddrinfo(res);
+}
+
+/**
+ * @brief Main function of resolver threads.
+ */
+static void* resolver_thread(void* arg)
+{
+    struct query* q;
+    uint64_t one = 1;
+
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (!stopping && todo_head == NULL) {
+            pthread_cond_wait(&todo_cond, &lock);
+        }
+        if (stopping) {
+            break;
+        }
+        q = todo_head;
+        todo_head = q->next;
+        if (todo_head == NULL) {
+            todo_tail = NULL;
+        }
+        pthread_mutex_unlock(&lock);
+
+        resolve(q);
+
+        pthread_mutex_lock(&lock);
+        queue_push(&done_head, &done_tail, q);
+        /* Wake up the event loop. */
+        if (write(event_fd, &one, sizeof(one)) < 0) {
+            /* The counter is already non-zero. */
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/**
+ * @brief Free a list of queries.
+ */
+static void free_queries(struct query* q)
+{
+    struct query* next;
+
+    for (; q != NULL; q = next) {
+        next = q->next;
+        free(q->name);
+        free(q);
+    }
+}
+
+/**
+ * @brief Free a cached host.
+ */
+static void free_host(struct host* host)
+{
+    free(host->name);
+    free(host->waiters);
+    free(host);
+}
+
+/**
+ * @brief Remove expired hosts without in-flight queries from the cache.
+ */
+static void purge_hosts(time_t now)
+{
+    struct host** p;
+    struct host* host;
+
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        p = &buckets[i];
+        while (*p != NULL) {
+            host = *p;
+            if (host->state != HOST_PENDING && now >= host->expire) {
+                *p = host->next;
+                free_host(host);
+                --num_hosts;
+            }
+            else {
+                p = &host->next;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Start the resolver threads with an empty host cache.
+ *
+ * @param num_threads Number of resolver threads, > 0.
+ * @param hosts_file Path to an /etc/hosts-style file with lines of
+ * "<addr> <hostname> [<ttl>]". If non-null, it is the only source of
+ * addresses, which is useful for tests; otherwise, the system resolver is used.
+ * @param callback Callback for completed lookups, non-null.
+ * @return int 0 on success; -1 otherwise.
+ */
+int resolver_init(int num_threads,
+                  const char* hosts_file,
+                  resolver_callback callback)
+{
+    if (event_fd >= 0 || num_threads <= 0 || callback == NULL) {
+        return -1;
+    }
+
+    memset(buckets, 0, sizeof(buckets));
+    num_hosts = 0;
+    memset(&stats, 0, sizeof(stats));
+    on_complete = callback;
+    stopping = 0;
+
+    use_hosts_file = hosts_file != NULL;
+    if (use_hosts_file && load_hosts_file(hosts_file) < 0) {
+        resolver_clear();
+        return -1;
+    }
+
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        PLOG_ERROR("eventfd");
+        resolver_clear();
+        return -1;
+    }
+
+    threads = calloc(num_threads, sizeof(pthread_t));
+    if (threads == NULL) {
+        PLOG_ERROR("calloc");
+        resolver_clear();
+        return -1;
+    }
+    for (; thread_count < num_threads; ++thread_count) {
+        if (pthread_create(&threads[thread_count],
+                           NULL,
+                           resolver_thread,
+                           NULL) != 0) {
+            LOG_ERROR("pthread_create");
+            resolver_clear();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Stop the resolver threads and free the host cache. Pending waiters
+ * are dropped without being notified.
+ */
+void resolver_clear(void)
+{
+    struct host* next;
+
+    /* Stop resolver threads. */
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_broadcast(&todo_cond);
+    pthread_mutex_unlock(&lock);
+    for (int i = 0; i < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    threads = NULL;
+    thread_count = 0;
+
+    free_queries(todo_head);
+    free_queries(done_head);
+    todo_head = todo_tail = NULL;
+    done_head = done_tail = NULL;
+
+    /* Free host cache. */
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        for (struct host* host = buckets[i]; host != NULL; host = next) {
+            next = host->next;
+            free_host(host);
+        }
+        buckets[i] = NULL;
+    }
+    num_hosts = 0;
+
+    for (int i = 0; i < num_hosts_entries; ++i) {
+        free(hosts[i].name);
+    }
+    free(hosts);
+    hosts = NULL;
+    num_hosts_entries = 0;
+    use_hosts_file = 0;
+
+    if (event_fd >= 0) {
+        close(event_fd);
+    }
+    event_fd = -1;
+    on_complete = NULL;
+}
+
+/**
+ * @brief Get the eventfd that becomes readable when lookups complete.
+ *
+ * @return int Eventfd; -1 if the resolver is not initialized.
+ */
+int resolver_fd(void)
+{
+    return event_fd;
+}
+
+/**
+ * @brief Add a waiter to a host with an in-flight query.
+ *
+ * @return int 0 on success; -1 otherwise.
+ */
+static int add_waiter(struct host* host, int fd, unsigned long id)
+{
+    int cap;
+    struct waiter* ret = NULL;
+
+    if (host->num_waiters == host->waiters_cap) {
+        cap = host->waiters_cap == 0 ? 4 : host->waiters_cap * 2;
+        ret = realloc(host->waiters, cap * sizeof(struct waiter));
+        if (ret == NULL) {
+            PLOG_ERROR("realloc");
+            return -1;
+        }
+        host->waiters = ret;
+        host->waiters_cap = cap;
+    }
+    host->waiters[host->num_waiters].fd = fd;
+    host->waiters[host->num_waiters].id = id;
+    ++host->num_waiters;
+    return 0;
+}
+
+/**
+ * @brief Send a query of the given host to resolver threads.
+ *
+ * @return int 0 on success; -1 otherwise.
+ */
+static int send_query(struct host* host)
+{
+    struct query* q;
+
+    q = calloc(1, sizeof(struct query));
+    if (q == NULL) {
+        PLOG_ERROR("calloc");
+        return -1;
+    }
+    q->host = host;
+    q->name = strdup(host->name);
+    if (q->name == NULL) {
+        free(q);
+        return -1;
+    }
+
+    pthread_mutex_lock(&lock);
+    queue_push(&todo_head, &todo_tail, q);
+    pthread_cond_signal(&todo_cond);
+    pthread_mutex_unlock(&lock);
+
+    host->state = HOST_PENDING;
+    ++stats.queries;
+    return 0;
+}
+
+/**
+ * @brief Look up the address of a hostname.
+ *
+ * If the hostname is cached, the result is returned right away. Otherwise, the
+ * waiter (fd, id) is notified through the callback later.
+ *
+ * @param hostname Hostname to look up, non-null.
+ * @param fd FD of the waiter.
+ * @param id ID of the waiter, which tells apart connections reusing the FD.
+ * @param out_addr Output; address of the host if it's cached.
+ * @return int 1 if the host is resolved; 0 if the waiter will be notified; -1
+ * if the host can't be resolved.
+ */
+int resolver_lookup(const char* hostname,
+                    int fd,
+                    unsigned long id,
+                    struct in_addr* out_addr)
+{
+    struct host* host;
+    unsigned h;
+    time_t now;
+
+    if (event_fd < 0 || hostname == NULL || out_addr == NULL) {
+        return -1;
+    }
+
+    /* Numeric addresses need no lookup. */
+    if (inet_aton(hostname, out_addr) != 0) {
+        return 1;
+    }
+
+    h = hash_name(hostname) % NUM_BUCKETS;
+    for (host = buckets[h]; host != NULL; host = host->next) {
+        if (strcasecmp(host->name, hostname) == 0) {
+            break;
+        }
+    }
+
+    now = time(NULL);
+    if (host != NULL) {
+        if (host->state == HOST_PENDING) {
+            if (add_waiter(host, fd, id) < 0) {
+                return -1;
+            }
+            ++stats.merged;
+            return 0;
+        }
+        if (now < host->expire) {
+            if (host->state == HOST_RESOLVED) {
+                ++stats.hits;
+                *out_addr = host->addr;
+                return 1;
+            }
+            ++stats.neg_hits;
+            return -1;
+        }
+        /* Stale entry, look it up again. */
+        if (add_waiter(host, fd, id) < 0 || send_query(host) < 0) {
+            host->num_waiters = 0;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (num_hosts >= MAX_HOSTS) {
+        purge_hosts(now);
+    }
+
+    host = calloc(1, sizeof(struct host));
+    if (host == NULL) {
+        PLOG_ERROR("calloc");
+        return -1;
+    }
+    host->name = strdup(hostname);
+    for (char* p = host->name; p != NULL && *p != '\0'; ++p) {
+        *p = tolower((unsigned char)*p);
+    }
+    if (host->name == NULL ||
+        add_waiter(host, fd, id) < 0 ||
+        send_query(host) < 0) {
+        free_host(host);
+        return -1;
+    }
+    host->next = buckets[h];
+    buckets[h] = host;
+    ++num_hosts;
+    return 0;
+}
+
+/**
+ * @brief Cache completed lookups and notify their waiters. It should be called
+ * when resolver_fd() becomes readable.
+ *
+ * @return int Number of completed lookups.
+ */
+int resolver_process(void)
+{
+    uint64_t count;
+    struct query* q;
+    struct query* next;
+    struct host* host;
+    struct waiter* waiters;
+    int num_waiters;
+    int n = 0;
+    time_t now;
+
+    if (event_fd < 0) {
+        return 0;
+    }
+    if (read(event_fd, &count, sizeof(count)) < 0) {
+        /* Nothing is signaled yet. */
+    }
+
+    pthread_mutex_lock(&lock);
+    q = done_head;
+    done_head = done_tail = NULL;
+    pthread_mutex_unlock(&lock);
+
+    now = time(NULL);
+    for (; q != NULL; q = next) {
+        next = q->next;
+        host = q->host;
+        host->state = q->error == 0 ? HOST_RESOLVED : HOST_FAILED;
+        host->addr = q->addr;
+        host->expire = now + q->ttl;
+
+        /* Detach waiters first, since callbacks may look up other hosts. */
+        waiters = host->waiters;
+        num_waiters = host->num_waiters;
+        host->waiters = NULL;
+        host->num_waiters = 0;
+        host->waiters_cap = 0;
+        for (int i = 0; i < num_waiters; ++i) {
+            on_complete(waiters[i].fd, waiters[i].id, q->error, q->addr);
+        }
+        free(waiters);
+
+        free(q->name);
+        free(q);
+        ++n;
+    }
+    return n;
+}
+
+/**
+ * @brief Get the counters of the resolver.
+ *
+ * @param out_stats Output; counters, non-null.
+ */
+void resolver_get_stats(struct resolver_stats* out_stats)
+{
+    *out_stats = stats;
+}
@@ -0,0 +1,111 @@
+/**************************************************************
+*
+*                         resolver.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Interface for asynchronous DNS resolver with a TTL-aware
+*     host cache.
+*
+*     Lookups run on a small pool of resolver threads. Results
+*     are handed back to the event loop thread through an
+*     eventfd: once it becomes readable, call
+*     resolver_process() to cache the results and notify the
+*     waiters. Concurrent lookups of the same hostname share a
+*     single query.
+*
+**************************************************************/
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <netinet/in.h>
+
+#define RESOLVER_TTL 60 /* Time-to-live of resolved hosts in seconds. */
+#define RESOLVER_NEG_TTL 5 /* Time-to-live of failed lookups in seconds. */
+
+/**
+ * @brief Callback invoked on the event loop thread when a lookup completes.
+ *
+ * @param fd FD of the waiter, as given to resolver_lookup().
+ * @param id ID of the waiter, as given to resolver_lookup().
+ * @param error 0 if the host is resolved; -1 otherwise.
+ * @param addr Address of the host if resolved.
+ */
+typedef void (*resolver_callback)(int fd,
+                                  unsigned long id,
+                                  int error,
+                                  struct in_addr addr);
+
+/* Counters of the resolver. */
+struct resolver_stats {
+    unsigned long hits; /* Lookups answered by a cached address. */
+    unsigned long neg_hits; /* Lookups answered by a cached failure. */
+    unsigned long merged; /* Lookups that joined an in-flight query. */
+    unsigned long queries; /* Queries sent to the resolver threads. */
+};
+
+/**
+ * @brief Start the resolver threads with an empty host cache.
+ *
+ * @param num_threads Number of resolver threads, > 0.
+ * @param hosts_file Path to an /etc/hosts-style file with lines of
+ * "<addr> <hostname> [<ttl>]". If non-null, it is the only source of
+ * addresses, which is useful for tests; otherwise, the system resolver is used.
+ * @param callback Callback for completed lookups, non-null.
+ * @return int 0 on success; -1 otherwise.
+ */
+int resolver_init(int num_threads,
+                  const char* hosts_file,
+                  resolver_callback callback);
+
+/**
+ * @brief Stop the resolver threads and free the host cache. Pending waiters
+ * are dropped without being notified.
+ */
+void resolver_clear(void);
+
+/**
+ * @brief Get the eventfd that becomes readable when lookups complete.
+ *
+ * @return int Eventfd; -1 if the resolver is not initialized.
+ */
+int resolver_fd(void);
+
+/**
+ * @brief Look up the address of a hostname.
+ *
+ * If the hostname is cached, the result is returned right away. Otherwise, the
+ * waiter (fd, id) is notified through the callback later.
+ *
+ * @param hostname Hostname to look up, non-null.
+ * @param fd FD of the waiter.
+ * @param id ID of the waiter, which tells apart connections reusing the FD.
+ * @param out_addr Output; address of the host if it's cached.
+ * @return int 1 if the host is resolved; 0 if the waiter will be notified; -1
+ * if the host can't be resolved.
+ */
+int resolver_lookup(const char* hostname,
+                    int fd,
+                    unsigned long id,
+                    struct in_addr* out_addr);
+
+/**
+ * @brief Cache completed lookups and notify their waiters. It should be called
+ * when resolver_fd() becomes readable.
+ *
+ * @return int Number of completed lookups.
+ */
+int resolver_process(void);
+
+/**
+ * @brief Get the counters of the resolver.
+ *
+ * @param out_stats Output; counters, non-null.
+ */
+void resolver_get_stats(struct resolver_stats* out_stats);
+
+#endif /* RESOLVER_H */
@@ -0,0 +1,344 @@
+/**************************************************************
+*
+*                          slab.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Implementation for size-classed slab allocator.
+*
+*     Slabs are mapped with the alignment of their size, so
+*     the slab of a chunk is found by masking its address.
+*     Each slab keeps its own list of freed chunks, and hands
+*     out untouched chunks from its end only when that list is
+*     empty, so the pages of a new slab are touched as they
+*     are used. A class keeps the slabs with free chunks in a
+*     list, and a slab leaves the class as soon as its last
+*     chunk is freed.
+*
+**************************************************************/
+
+#include "slab.h"
+#include "logger.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SLAB_MIN_CHUNK_BYTES 16 /* Smallest chunk, and alignment of all. */
+#define SLAB_MAX_CLASSES 64 /* Capacity of the class table. */
+#define SLAB_MAX_SPARE 4 /* Max number of empty slabs kept for reuse. */
+#define SLAB_HEADER_BYTES 64 /* Bytes reserved for the header of a slab. */
+
+/* Header at the start of a slab. */
+struct slab {
+    struct slab* prev; /* Neighbors in the list of its class, or in the list
+                        * of spare slabs. */
+    struct slab* next;
+    void* free_chunks; /* Singly linked list of freed chunks. */
+    char* unused; /* First chunk never handed out. */
+    int cls; /* Index of its class; -1 if spare. */
+    int used; /* Number of chunks in use. */
+};
+
+/* Size class. */
+struct slab_class {
+    size_t chunk_bytes; /* Byte size of each chunk. */
+    int chunks_per_slab;
+    struct slab* partial; /* Slabs of the class with free chunks. */
+};
+
+static struct slab_class classes[SLAB_MAX_CLASSES];
+static int num_classes = 0; /* 0 until the classes are set up. */
+static struct slab* spare = NULL; /* Empty slabs of no class. */
+static struct slab_stats stats; /* Memory usage. */
+static size_t page_bytes = 0; /* Byte size of a page. */
+
+/**
+ * @brief Set up the size classes, about 25% apart, on first use.
+ */
+static void slab_init_classes(void)
+{
+    size_t bytes = SLAB_MIN_CHUNK_BYTES;
+    struct slab_class* c;
+
+    page_bytes = sysconf(_SC_PAGESIZE);
+    while (true) {
+        c = &classes[num_classes++];
+        c->chunk_bytes = bytes < SLAB_MAX_CHUNK_BYTES ?
+                         bytes : SLAB_MAX_CHUNK_BYTES;
+        c->chunks_per_slab = (SLAB_BYTES - SLAB_HEADER_BYTES) / c->chunk_bytes;
+        c->partial = NULL;
+        if (c->chunk_bytes == SLAB_MAX_CHUNK_BYTES) {
+            break;
+        }
+        bytes = (bytes + bytes / 4 + SLAB_MIN_CHUNK_BYTES - 1) &
+                ~(size_t)(SLAB_MIN_CHUNK_BYTES - 1);
+    }
+}
+
+/**
+ * @brief Get the smallest class whose chunks hold the given size.
+ *
+ * @param size Byte size, at most SLAB_MAX_CHUNK_BYTES.
+ * @return int Index of the class.
+ */
+static int slab_class_of(size_t size)
+{
+    int lo = 0;
+    int hi;
+
+    if (num_classes == 0) {
+        slab_init_classes();
+    }
+    hi = num_classes - 1;
+    while (lo < hi) {
+        if (classes[(lo + hi) / 2].chunk_bytes < size) {
+            lo = (lo + hi) / 2 + 1;
+        }
+        else {
+            hi = (lo + hi) / 2;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Round the given size up to whole pages.
+ */
+static size_t slab_page_round(size_t size)
+{
+    if (num_classes == 0) {
+        slab_init_classes();
+    }
+    return (size + page_bytes - 1) & ~(page_bytes - 1);
+}
+
+/**
+ * @brief Push a slab at the front of the given list.
+ */
+static void slab_list_push(struct slab** head, struct slab* slab)
+{
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+/**
+ * @brief Unlink a slab from the given list.
+ */
+static void slab_list_unlink(struct slab** head, struct slab* slab)
+{
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    }
+    else {
+        *head = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+/**
+ * @brief Map a slab aligned to its size. The unaligned ends of a mapping of
+ * twice the size are unmapped.
+ *
+ * @return struct slab* Mapped slab; NULL on failure.
+ */
+static struct slab* slab_map(void)
+{
+    char* p = mmap(NULL,
+                   2 * SLAB_BYTES,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1,
+                   0);
+    char* start;
+
+    if (p == MAP_FAILED) {
+        PLOG_ERROR("mmap");
+        return NULL;
+    }
+    start = (char*)(((uintptr_t)p + SLAB_BYTES - 1) &
+                    ~(uintptr_t)(SLAB_BYTES - 1));
+    if (start > p) {
+        munmap(p, start - p);
+    }
+    munmap(start + SLAB_BYTES, p + SLAB_BYTES - start);
+    stats.slab_bytes += SLAB_BYTES;
+    return (struct slab*)start;
+}
+
+/**
+ * @brief Give an empty slab to the given class, reusing a spare one if any.
+ *
+ * @param cls Index of the class.
+ * @return struct slab* Slab in the list of the class; NULL on failure.
+ */
+static struct slab* slab_take(int cls)
+{
+    struct slab* slab = spare;
+
+    if (slab != NULL) {
+        slab_list_unlink(&spare, slab);
+        --stats.num_spare_slabs;
+    }
+    else {
+        slab = slab_map();
+        if (slab == NULL) {
+            return NULL;
+        }
+    }
+    slab->free_chunks = NULL;
+    slab->unused = (char*)slab + SLAB_HEADER_BYTES;
+    slab->cls = cls;
+    slab->used = 0;
+    slab_list_push(&classes[cls].partial, slab);
+    ++stats.num_slabs;
+    return slab;
+}
+
+/**
+ * @brief Take an empty slab from its class. It's kept for any class if there
+ * are few spare slabs; otherwise, it's unmapped.
+ *
+ * @param slab Empty slab in the list of its class.
+ */
+static void slab_release(struct slab* slab)
+{
+    slab_list_unlink(&classes[slab->cls].partial, slab);
+    slab->cls = -1;
+    --stats.num_slabs;
+    if (stats.num_spare_slabs < SLAB_MAX_SPARE) {
+        slab_list_push(&spare, slab);
+        ++stats.num_spare_slabs;
+        return;
+    }
+    munmap(slab, SLAB_BYTES);
+    stats.slab_bytes -= SLAB_BYTES;
+}
+
+/**
+ * @brief Allocate memory from the class of the given size.
+ *
+ * @param size Byte size; 0 gets the smallest chunk.
+ * @return void* Memory aligned to 16 bytes; NULL on failure.
+ */
+void* slab_alloc(size_t size)
+{
+    struct slab_class* c;
+    struct slab* slab;
+    void* chunk;
+    int cls;
+
+    if (size > SLAB_MAX_CHUNK_BYTES) {
+        size = slab_page_round(size);
+        chunk = mmap(NULL,
+                     size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1,
+                     0);
+        if (chunk == MAP_FAILED) {
+            PLOG_ERROR("mmap");
+            return NULL;
+        }
+        ++stats.num_large;
+        stats.large_bytes += size;
+        return chunk;
+    }
+
+    cls = slab_class_of(size);
+    c = &classes[cls];
+    slab = c->partial;
+    if (slab == NULL) {
+        slab = slab_take(cls);
+        if (slab == NULL) {
+            return NULL;
+        }
+    }
+    if (slab->free_chunks != NULL) {
+        chunk = slab->free_chunks;
+        slab->free_chunks = *(void**)chunk;
+    }
+    else {
+        chunk = slab->unused;
+        slab->unused += c->chunk_bytes;
+    }
+    if (++slab->used == c->chunks_per_slab) {
+        slab_list_unlink(&c->partial, slab);
+    }
+    stats.chunk_bytes += c->chunk_bytes;
+    stats.request_bytes += size;
+    return chunk;
+}
+
+/**
+ * @brief Free memory allocated by slab_alloc().
+ *
+ * @param ptr Memory to free; nothing happens if it's NULL.
+ * @param size Byte size passed to slab_alloc().
+ */
+void slab_free(void* ptr, size_t size)
+{
+    struct slab_class* c;
+    struct slab* slab;
+
+    if (ptr == NULL) {
+        return;
+    }
+    if (size > SLAB_MAX_CHUNK_BYTES) {
+        size = slab_page_round(size);
+        munmap(ptr, size);
+        --stats.num_large;
+        stats.large_bytes -= size;
+        return;
+    }
+
+    slab = (struct slab*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_BYTES - 1));
+    c = &classes[slab->cls];
+    *(void**)ptr = slab->free_chunks;
+    slab->free_chunks = ptr;
+    if (slab->used-- == c->chunks_per_slab) {
+        slab_list_push(&c->partial, slab);
+    }
+    stats.chunk_bytes -= c->chunk_bytes;
+    stats.request_bytes -= size;
+    if (slab->used == 0) {
+        slab_release(slab);
+    }
+}
+
+/**
+ * @brief Get the bytes that an allocation of the given size takes.
+ *
+ * @param size Byte size.
+ * @return size_t Byte size of its chunk, or of its pages if it's large.
+ */
+size_t slab_alloc_bytes(size_t size)
+{
+    if (size > SLAB_MAX_CHUNK_BYTES) {
+        return slab_page_round(size);
+    }
+    return classes[slab_class_of(size)].chunk_bytes;
+}
+
+/**
+ * @brief Get the memory usage of the allocator. Slab bytes not in chunks are
+ * free chunks and slab headers; chunk bytes not requested are lost to
+ * rounding.
+ *
+ * @param out_stats Output; memory usage.
+ */
+void slab_get_stats(struct slab_stats* out_stats)
+{
+    *out_stats = stats;
+}
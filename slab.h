@@ -0,0 +1,88 @@
+/**************************************************************
+*
+*                          slab.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Interface for size-classed slab allocator of cache
+*     elements, keys and responses.
+*
+*     Sizes are rounded up to a class, about 25% apart. Each
+*     class carves chunks out of aligned slabs of SLAB_BYTES,
+*     and a slab that becomes empty goes back to a small pool
+*     shared by all classes, or to the OS. So memory freed by
+*     evicting one kind of responses serves other sizes, and
+*     the footprint follows the live bytes instead of the
+*     history of the heap. Larger allocations are mapped on
+*     their own, and unmapped when freed, so a value over
+*     SLAB_MAX_CHUNK_BYTES costs an mmap() and munmap() pair
+*     and the faults of its pages. That's small next to
+*     copying the value in, and its pages go back to the OS
+*     at once; a malloc() fallback was measured to keep about
+*     a quarter of the budget more in RSS after churn, as
+*     freed values fragment its heap. num_large in the stats
+*     counts these mappings.
+*
+*     Callers pass the size of an allocation back when freeing
+*     it, so chunks have no header. Not thread-safe.
+*
+**************************************************************/
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+#define SLAB_BYTES (256 << 10) /* Byte size and alignment of a slab. */
+#define SLAB_MAX_CHUNK_BYTES (32 << 10) /* Largest chunk; larger allocations
+                                          * are mapped on their own, one
+                                          * mapping each. */
+
+/* Memory usage of the allocator. */
+struct slab_stats {
+    int num_slabs; /* Slabs in use by a class. */
+    int num_spare_slabs; /* Empty slabs kept for reuse. */
+    size_t slab_bytes; /* Bytes of all slabs, including the spare ones. */
+    size_t chunk_bytes; /* Bytes of chunks in use. */
+    size_t request_bytes; /* Bytes requested for the chunks in use. */
+    int num_large; /* Large allocations mapped, one mapping each. */
+    size_t large_bytes; /* Bytes mapped for large allocations. */
+};
+
+/**
+ * @brief Allocate memory from the class of the given size.
+ *
+ * @param size Byte size; 0 gets the smallest chunk.
+ * @return void* Memory aligned to 16 bytes; NULL on failure.
+ */
+void* slab_alloc(size_t size);
+
+/**
+ * @brief Free memory allocated by slab_alloc().
+ *
+ * @param ptr Memory to free; nothing happens if it's NULL.
+ * @param size Byte size passed to slab_alloc().
+ */
+void slab_free(void* ptr, size_t size);
+
+/**
+ * @brief Get the bytes that an allocation of the given size takes.
+ *
+ * @param size Byte size.
+ * @return size_t Byte size of its chunk, or of its pages if it's large.
+ */
+size_t slab_alloc_bytes(size_t size);
+
+/**
+ * @brief Get the memory usage of the allocator. Slab bytes not in chunks are
+ * free chunks and slab headers; chunk bytes not requested are lost to
+ * rounding.
+ *
+ * @param out_stats Output; memory usage.
+ */
+void slab_get_stats(struct slab_stats* out_stats);
+
+#endif /* SLAB_H */
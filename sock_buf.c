@@ -15,10 +15,12 @@
 #include "logger.h"
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
+#include <unistd.h>
 
-static struct sock_buf *sock_buf_arr[FD_SETSIZE];
-static const time_t TIMEOUT = 600; /* Timeout for idle socket buffer. */
+static struct sock_buf** sock_buf_arr = NULL; /* Socket buffers indexed by FD.
+                                               * It grows on demand. */
+static int sock_buf_arr_cap = 0; /* Number of slots in sock_buf_arr. */
+static unsigned long next_id = 1; /* ID for the next added socket buffer. */
 
 /**
  * @brief Create an empty socket message buffer array.
@@ -27,9 +29,8 @@ static const time_t TIMEOUT = 600; /* Timeout for idle socket buffer. */
  */
 int sock_buf_arr_init(void)
 {
-    for (int i = 0; i < FD_SETSIZE; ++i) {
-        sock_buf_arr[i] = NULL;
-    }
+    sock_buf_arr = NULL;
+    sock_buf_arr_cap = 0;
     return 0;
 }
 
@@ -40,20 +41,70 @@ int sock_buf_arr_init(void)
  */
 int sock_buf_arr_clear(void)
 {
-    for (int i = 0; i < FD_SETSIZE; ++i) {
+    for (int i = 0; i < sock_buf_arr_cap; ++i) {
         sock_buf_rm(i);
     }
+    free(sock_buf_arr);
+    sock_buf_arr = NULL;
+    sock_buf_arr_cap = 0;
     return 0;
 }
 
 /**
- * @brief Check whether FD is valid, i.e. 0 <= FD < FD_SETSIZE.
+ * @brief Get the number of slots in the socket message buffer array. All FDs
+ * with a socket buffer are less than it.
+ *
+ * @return int Number of slots.
+ */
+int sock_buf_arr_size(void)
+{
+    return sock_buf_arr_cap;
+}
+
+/**
+ * @brief Check whether FD is valid, i.e. 0 <= FD < size of the array.
  *
  * @param fd FD to check.
  * @return int 1 if valid; 0 otherwise.
  */
 int is_valid_fd(int fd) {
-    return 0 <= fd && fd < FD_SETSIZE;
+    return 0 <= fd && fd < sock_buf_arr_cap;
+}
+
+/**
+ * @brief Grow the socket message buffer array so that it has a slot for FD.
+ *
+ * @param fd FD to hold, >= 0.
+ * @return int 0 on success; -1 otherwise.
+ */
+int sock_buf_arr_reserve(int fd)
+{
+    int cap = sock_buf_arr_cap;
+    struct sock_buf** ret = NULL;
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fd < sock_buf_arr_cap) {
+        return 0;
+    }
+    if (cap == 0) {
+        cap = 64;
+    }
+    while (cap <= fd) {
+        cap *= 2;
+    }
+    ret = realloc(sock_buf_arr, cap * sizeof(struct sock_buf*));
+    if (ret == NULL) {
+        PLOG_ERROR("realloc");
+        return -1;
+    }
+    for (int i = sock_buf_arr_cap; i < cap; ++i) {
+        ret[i] = NULL;
+    }
+    sock_buf_arr = ret;
+    sock_buf_arr_cap = cap;
+    return 0;
 }
 
 /**
@@ -66,7 +117,7 @@ int sock_buf_add_client(int fd)
 {
     struct sock_buf* new_sock_buf = NULL;
 
-    if (!is_valid_fd(fd) || sock_buf_arr[fd] != NULL) {
+    if (sock_buf_arr_reserve(fd) < 0 || sock_buf_arr[fd] != NULL) {
         return 0;
     }
 
@@ -75,15 +126,52 @@ int sock_buf_add_client(int fd)
         PLOG_ERROR("malloc");
         return 0;
     }
+    new_sock_buf->id = next_id++;
+    new_sock_buf->fd = fd;
     new_sock_buf->buf = NULL;
     new_sock_buf->size = 0;
-    new_sock_buf->last_input = time(NULL);
+    memset(&new_sock_buf->timer, 0, sizeof(struct timer));
+    new_sock_buf->deadline = DEADLINE_NONE;
     new_sock_buf->is_client = 1;
     new_sock_buf->is_forward = 0;
     new_sock_buf->ssl = NULL;
     new_sock_buf->peer = -1;
     new_sock_buf->key = NULL;
-    new_sock_buf->is_chunked = 0;
+    new_sock_buf->servers = NULL;
+    new_sock_buf->prev_server = NULL;
+    new_sock_buf->next_server = NULL;
+    new_sock_buf->in_body = 0;
+    new_sock_buf->body_server = -1;
+    new_sock_buf->body_server_id = 0;
+    new_sock_buf->wait_server = -1;
+    new_sock_buf->wait_server_id = 0;
+    new_sock_buf->wait_request = NULL;
+    new_sock_buf->wait_request_len = 0;
+    new_sock_buf->wait_url = NULL;
+    new_sock_buf->wait_hostname = NULL;
+    new_sock_buf->wait_port = -1;
+    http_parser_init(&new_sock_buf->parser, 1);
+    new_sock_buf->fill = NULL;
+    new_sock_buf->fill_max_age = 0;
+    new_sock_buf->fill_stale_age = -1;
+    new_sock_buf->state = SOCK_ESTABLISHED;
+    out_queue_init(&new_sock_buf->out);
+    new_sock_buf->events = 0;
+    new_sock_buf->is_paused = 0;
+    new_sock_buf->is_closing = 0;
+    new_sock_buf->pipe_fds[0] = -1;
+    new_sock_buf->pipe_fds[1] = -1;
+    new_sock_buf->pipe_size = 0;
+    new_sock_buf->forwarded = 0;
+    new_sock_buf->port = 0;
+    new_sock_buf->connect_version = NULL;
+    new_sock_buf->stale = NULL;
+    new_sock_buf->stale_val = NULL;
+    new_sock_buf->stale_val_len = 0;
+    new_sock_buf->stale_head_len = -1;
+    new_sock_buf->stale_date = 0;
+    new_sock_buf->stale_if_error = 0;
+    new_sock_buf->needs_ssl = 0;
     sock_buf_arr[fd] = new_sock_buf;
     return 1;
 }
@@ -92,6 +180,7 @@ int sock_buf_add_client(int fd)
  * @brief Add socket message buffer of the given FD.
  * 
  * @param fd FD for socket.
+ * @param client FD for its client socket; -1 for a server of no client.
  * @param key String of cache key, i.e. hostname + url in GET request.
  * @return int Number of socket buffer added, i.e. 1 on success; 0 otherwise.
  */
@@ -99,10 +188,9 @@ int sock_buf_add_server(int fd, int client, char* key)
 {
     struct sock_buf* new_sock_buf = NULL;
 
-    if(!is_valid_fd(fd) ||
-       !is_valid_fd(client) ||
+    if(sock_buf_arr_reserve(fd) < 0 ||
        sock_buf_arr[fd] != NULL ||
-       sock_buf_arr[client] == NULL) {
+       (client != -1 && sock_buf_get(client) == NULL)) {
         return 0;
     }
 
@@ -111,9 +199,12 @@ int sock_buf_add_server(int fd, int client, char* key)
         PLOG_ERROR("malloc");
         return 0;
     }
+    new_sock_buf->id = next_id++;
+    new_sock_buf->fd = fd;
     new_sock_buf->buf = NULL;
     new_sock_buf->size = 0;
-    new_sock_buf->last_input = time(NULL);
+    memset(&new_sock_buf->timer, 0, sizeof(struct timer));
+    new_sock_buf->deadline = DEADLINE_NONE;
     new_sock_buf->is_client = 0;
     new_sock_buf->is_forward = 0;
     new_sock_buf->ssl = NULL;
@@ -122,11 +213,76 @@ int sock_buf_add_server(int fd, int client, char* key)
     if (key != NULL) {
         new_sock_buf->key = strdup(key);
     }
-    new_sock_buf->is_chunked = 0;
+    new_sock_buf->servers = NULL;
+    new_sock_buf->in_body = 0;
+    new_sock_buf->body_server = -1;
+    new_sock_buf->body_server_id = 0;
+    new_sock_buf->wait_server = -1;
+    new_sock_buf->wait_server_id = 0;
+    new_sock_buf->wait_request = NULL;
+    new_sock_buf->wait_request_len = 0;
+    new_sock_buf->wait_url = NULL;
+    new_sock_buf->wait_hostname = NULL;
+    new_sock_buf->wait_port = -1;
+    http_parser_init(&new_sock_buf->parser, 0);
+    new_sock_buf->fill = NULL;
+    new_sock_buf->fill_max_age = 0;
+    new_sock_buf->fill_stale_age = -1;
+    new_sock_buf->state = SOCK_RESOLVING;
+    out_queue_init(&new_sock_buf->out);
+    new_sock_buf->events = 0;
+    new_sock_buf->is_paused = 0;
+    new_sock_buf->is_closing = 0;
+    new_sock_buf->pipe_fds[0] = -1;
+    new_sock_buf->pipe_fds[1] = -1;
+    new_sock_buf->pipe_size = 0;
+    new_sock_buf->forwarded = 0;
+    new_sock_buf->port = 0;
+    new_sock_buf->connect_version = NULL;
+    new_sock_buf->stale = NULL;
+    new_sock_buf->stale_val = NULL;
+    new_sock_buf->stale_val_len = 0;
+    new_sock_buf->stale_head_len = -1;
+    new_sock_buf->stale_date = 0;
+    new_sock_buf->stale_if_error = 0;
+    new_sock_buf->needs_ssl = 0;
+
+    /* Link it at the head of the server list of its client. */
+    new_sock_buf->prev_server = NULL;
+    new_sock_buf->next_server = NULL;
+    if (client != -1) {
+        new_sock_buf->next_server = sock_buf_arr[client]->servers;
+        if (new_sock_buf->next_server != NULL) {
+            new_sock_buf->next_server->prev_server = new_sock_buf;
+        }
+        sock_buf_arr[client]->servers = new_sock_buf;
+    }
+
     sock_buf_arr[fd] = new_sock_buf;
     return 1;
 }
 
+/**
+ * @brief Unlink a server from the server list of its client.
+ *
+ * @param sock_buf Socket buffer of the server.
+ */
+static void unlink_server(struct sock_buf* sock_buf)
+{
+    if (sock_buf->prev_server != NULL) {
+        sock_buf->prev_server->next_server = sock_buf->next_server;
+    }
+    else if (sock_buf_get(sock_buf->peer) != NULL &&
+             sock_buf_arr[sock_buf->peer]->servers == sock_buf) {
+        sock_buf_arr[sock_buf->peer]->servers = sock_buf->next_server;
+    }
+    if (sock_buf->next_server != NULL) {
+        sock_buf->next_server->prev_server = sock_buf->prev_server;
+    }
+    sock_buf->prev_server = NULL;
+    sock_buf->next_server = NULL;
+}
+
 /**
  * @brief Remove socket message buffer of the given FD.
  * 
@@ -135,21 +291,86 @@ int sock_buf_add_server(int fd, int client, char* key)
  */
 int sock_buf_rm(int fd)
 {
+    struct sock_buf* sock_buf = NULL;
+    struct sock_buf* server = NULL;
+    struct sock_buf* next = NULL;
+
     if(!is_valid_fd(fd) || sock_buf_arr[fd] == NULL) {
         return 0;
     }
+    sock_buf = sock_buf_arr[fd];
+
+    if (sock_buf->is_client) {
+        /* Detach its servers. */
+        for (server = sock_buf->servers; server != NULL; server = next) {
+            next = server->next_server;
+            server->peer = -1;
+            server->prev_server = NULL;
+            server->next_server = NULL;
+        }
+    }
+    else {
+        unlink_server(sock_buf);
+    }
 
+    timer_cancel(&sock_buf_arr[fd]->timer);
     free(sock_buf_arr[fd]->buf);
     free(sock_buf_arr[fd]->key);
+    out_queue_clear(&sock_buf_arr[fd]->out);
+    free(sock_buf_arr[fd]->connect_version);
+    free(sock_buf_arr[fd]->wait_request);
+    free(sock_buf_arr[fd]->wait_url);
+    free(sock_buf_arr[fd]->wait_hostname);
     if (sock_buf_arr[fd]->ssl != NULL) {
         SSL_shutdown(sock_buf_arr[fd]->ssl);
         SSL_free(sock_buf_arr[fd]->ssl);
     }
+    if (sock_buf_arr[fd]->pipe_fds[0] >= 0) {
+        close(sock_buf_arr[fd]->pipe_fds[0]);
+        close(sock_buf_arr[fd]->pipe_fds[1]);
+    }
     free(sock_buf_arr[fd]);
     sock_buf_arr[fd] = NULL;
     return 1;
 }
 
+/**
+ * @brief Detach a server from its client, so it outlives the client. It's
+ * unlinked from the server list of the client and has no client from now on.
+ *
+ * @param fd FD for server socket.
+ * @return int Number of detached servers, i.e. 1 on success; 0 if it's not a
+ * server of a client.
+ */
+int sock_buf_detach_server(int fd)
+{
+    if (!is_valid_fd(fd) ||
+        sock_buf_arr[fd] == NULL ||
+        sock_buf_arr[fd]->is_client ||
+        sock_buf_arr[fd]->peer < 0) {
+        return 0;
+    }
+    unlink_server(sock_buf_arr[fd]);
+    sock_buf_arr[fd]->peer = -1;
+    return 1;
+}
+
+/**
+ * @brief Get the first server in the server list of a client.
+ *
+ * @param fd FD for client socket.
+ * @return int FD for the server; -1 if the client has no server.
+ */
+int sock_buf_first_server(int fd)
+{
+    if (!is_valid_fd(fd) ||
+        sock_buf_arr[fd] == NULL ||
+        sock_buf_arr[fd]->servers == NULL) {
+        return -1;
+    }
+    return sock_buf_arr[fd]->servers->fd;
+}
+
 /**
  * @brief Get socket message buffer of the given FD.
  * 
@@ -221,41 +442,44 @@ int sock_buf_buffer(int fd, char* data, int size)
 }
 
 /**
- * @brief Whether simply forward data from the given socket to its peer.
+ * @brief Remove the leading data of the buffer, e.g. a handled request.
  *
  * @param fd FD for socket.
- * @return int 1 if it should simply forward the data; 0 otherwise.
+ * @param size Byte size of data to remove; at most the buffered size.
+ * @return int Byte size of data left in the buffer; -1 on failure.
  */
-int sock_buf_is_forward(int fd)
+int sock_buf_consume(int fd, int size)
 {
-    if (!is_valid_fd(fd) || sock_buf_arr[fd] == NULL) {
-        return 0;
-    }
-    return sock_buf_arr[fd]->is_forward;
-}
+    struct sock_buf* sock_buf = NULL;
 
-/**
- * @brief Update last_input of a socket to the current time
- *
- * @param fd FD for socket.
- * @return int 1 if it should simply forward the data; 0 otherwise.
- */
-void sock_buf_update_input_time(int fd){
     if (!is_valid_fd(fd) || sock_buf_arr[fd] == NULL) {
-        return;
+        return -1;
+    }
+    sock_buf = sock_buf_arr[fd];
+    if (size < 0 || size > sock_buf->size) {
+        return -1;
+    }
+    sock_buf->size -= size;
+    if (sock_buf->size == 0) {
+        free(sock_buf->buf);
+        sock_buf->buf = NULL;
     }
-    sock_buf_arr[fd]->last_input = time(NULL);
+    else {
+        memmove(sock_buf->buf, sock_buf->buf + size, sock_buf->size);
+    }
+    return sock_buf->size;
 }
 
 /**
- * @brief Whether the socket is timeout (current time - last_input > TIMEOUT).
+ * @brief Whether simply forward data from the given socket to its peer.
  *
  * @param fd FD for socket.
  * @return int 1 if it should simply forward the data; 0 otherwise.
  */
-int sock_buf_is_timeout(int fd) {
+int sock_buf_is_forward(int fd)
+{
     if (!is_valid_fd(fd) || sock_buf_arr[fd] == NULL) {
         return 0;
     }
-    return time(NULL) - sock_buf_arr[fd]->last_input > TIMEOUT;
+    return sock_buf_arr[fd]->is_forward;
 }
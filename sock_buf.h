@@ -14,20 +14,109 @@
 #ifndef SOCK_BUF_H
 #define SOCK_BUF_H
 
-#include <time.h>
+#include "http_utils.h"
+#include "out_queue.h"
+#include "timer.h"
 #include <openssl/ssl.h>
+#include <time.h>
+
+struct cache_elem;
+struct cache_fill;
+
+/* Connection state of a socket. */
+enum sock_state {
+    SOCK_RESOLVING, /* Hostname of the server is being resolved. */
+    SOCK_CONNECTING, /* Non-blocking connect to the server is in progress. */
+    SOCK_SSL_CONNECTING, /* SSL handshake with the server is in progress. */
+    SOCK_SSL_ACCEPTING, /* SSL handshake with the client is in progress. */
+    SOCK_ESTABLISHED /* Connection is ready for data. */
+};
+
+/* Kind of the deadline that the socket timer is set for. */
+enum sock_deadline {
+    DEADLINE_NONE, /* Timer is not set. */
+    DEADLINE_CONNECT, /* Resolve, connect and SSL handshake. */
+    DEADLINE_HEADER, /* Client sends a whole request head. */
+    DEADLINE_IDLE, /* Keep-alive connection or tunnel has no traffic. */
+    DEADLINE_RESPONSE /* Server sends (the next part of) its response. */
+};
 
 struct sock_buf {
+    unsigned long id; /* Unique ID of this socket buffer. It tells apart
+                       * different connections that reuse the same FD. */
+    int fd; /* FD for the socket. */
     char* buf; /* Buffer for plaintext received from the socket. */
     int size; /* Byte size of buffered data. */
-    time_t last_input; /* Time for the last input to the buffer. */
     int is_client; /* Whether the socket is for a client. */
     int is_forward; /* Whether simply forward data to its peer. */
     SSL* ssl; /* SSL structure for SSL/TLS connection. */
     int peer; /* Socket FD for the other end of the connection regardless of
                * proxy. */
     char* key; /* Key for the cached server response. */
-    int is_chunked; /* 1 for "Transfer-Encoding: chunked"; 0 otherwise. */
+    struct sock_buf* servers; /* Client only: head of the list of servers
+                               * connected for this client. */
+    struct sock_buf* prev_server; /* Server only: neighbors in the server */
+    struct sock_buf* next_server; /* list of its client (peer). */
+    int in_body; /* Whether the head of the message being received has been
+                  * handled, and its body is being forwarded as it
+                  * arrives. */
+    int body_server; /* Client only: FD for the server that the body of the
+                      * request is forwarded to; -1 to drop the body, e.g.
+                      * the server is gone. */
+    unsigned long body_server_id; /* ID of the buffer of body_server. */
+    int wait_server; /* Client only: FD for the server whose fetch it last
+                      * waited for, see attach_waiter(); -1 if none. */
+    unsigned long wait_server_id; /* ID of the buffer of wait_server. */
+    char* wait_request; /* Client only: copy of the GET request that waits
+                         * for wait_server, to send on its own if the
+                         * response isn't shared; NULL if none. */
+    int wait_request_len;
+    char* wait_url; /* URL, hostname and port of wait_request. */
+    char* wait_hostname;
+    int wait_port;
+    struct http_parser parser; /* Parser of the message being received: a
+                                * request for a client, a response for a
+                                * server. The framing of a response body is
+                                * tracked in its body. */
+    struct cache_fill* fill; /* Server only: copy of the response so far, to
+                              * cache it and to replay it to late waiters;
+                              * NULL if the response passes through. The
+                              * owner frees it before removing the buffer. */
+    int fill_max_age; /* Server only: times to cache the filled response */
+    int fill_stale_age; /* with; fill_stale_age is -1 if it isn't cached. */
+    enum sock_state state; /* Connection state. */
+    struct out_queue out; /* Data to send, kept while the connection is not
+                           * established or the socket is not writable. */
+    int events; /* Events that the event loop watches for. */
+    int is_paused; /* Whether reading is paused, since its peer has too much
+                    * data to send. */
+    int is_closing; /* Client only: whether to disconnect once its queued data
+                     * is sent. */
+    int pipe_fds[2]; /* Forward only: pipe holding data spliced from the socket
+                      * to its peer; -1 until it is needed. */
+    int pipe_size; /* Byte size of data in the pipe. */
+    long long forwarded; /* Forward only: byte size of data forwarded from
+                          * the socket to its peer. */
+    int port; /* Port of the server to connect. */
+    struct timer timer; /* Timer for the current deadline. */
+    enum sock_deadline deadline; /* Kind of the current deadline. */
+    char* connect_version; /* HTTP version of the CONNECT request waiting for
+                            * this server to connect; NULL if the server is not
+                            * for a CONNECT request. */
+    struct cache_elem* stale; /* Server only: pinned stale response that the
+                               * server is asked to revalidate or replace;
+                               * NULL if none. The response of the server is
+                               * held back until its status is known. The
+                               * owner of the pin releases it before removing
+                               * the buffer. */
+    const char* stale_val; /* Value of the stale response. */
+    int stale_val_len;
+    int stale_head_len; /* Head length of stale_val, as cache_acquire(). */
+    time_t stale_date; /* Time when the stale response had age 0. */
+    int stale_if_error; /* Whether the stale response may be replied if the
+                         * server fails to connect. */
+    int needs_ssl; /* Server only: whether to start SSL once connected, for a
+                    * client intercepted by SSL but no CONNECT request. */
 };
 
 /**
@@ -44,6 +133,14 @@ int sock_buf_arr_init(void);
  */
 int sock_buf_arr_clear(void);
 
+/**
+ * @brief Get the number of slots in the socket message buffer array. All FDs
+ * with a socket buffer are less than it.
+ *
+ * @return int Number of slots.
+ */
+int sock_buf_arr_size(void);
+
 /**
  * @brief Add socket message buffer of the given FD.
  * 
@@ -60,20 +157,41 @@ int sock_buf_add_client(int fd);
  * @param fd FD for socket.
  * @return int Number of socket message buffer added, i.e. 1 if succeeds; 0
  * otherwise.
+ * @param client FD for its client socket; -1 for a server of no client.
  * @param key String of cache key, i.e. hostname + url in GET request.
  * @return int Number of added server buffer, i.e. 1 on success; 0 otherwise.
  */
 int sock_buf_add_server(int fd, int client, char* key);
 
 /**
- * @brief Remove socket message buffer of the given FD.
- * 
+ * @brief Remove socket message buffer of the given FD. A server is unlinked
+ * from the server list of its client; the servers of a client are detached
+ * from it.
+ *
  * @param fd FD for socket.
  * @return int Number of socket message buffer removed, i.e. 1 if succeeds; 0
  * otherwise.
  */
 int sock_buf_rm(int fd);
 
+/**
+ * @brief Detach a server from its client, so it outlives the client. It's
+ * unlinked from the server list of the client and has no client from now on.
+ *
+ * @param fd FD for server socket.
+ * @return int Number of detached servers, i.e. 1 on success; 0 if it's not a
+ * server of a client.
+ */
+int sock_buf_detach_server(int fd);
+
+/**
+ * @brief Get the first server in the server list of a client.
+ *
+ * @param fd FD for client socket.
+ * @return int FD for the server; -1 if the client has no server.
+ */
+int sock_buf_first_server(int fd);
+
 /**
  * @brief Get socket message buffer of the given FD.
  * 
@@ -111,28 +229,20 @@ int sock_buf_is_ssl(int fd);
 int sock_buf_buffer(int fd, char* data, int size);
 
 /**
- * @brief Whether simply forward data from the given socket to its peer.
- *
- * @param fd FD for socket.
- * @return int 1 if it should simply forward the data; 0 otherwise.
- */
-int sock_buf_is_forward(int fd);
-
-/**
- * @brief Update last_input of a socket to the current time
+ * @brief Remove the leading data of the buffer, e.g. a handled request.
  *
  * @param fd FD for socket.
- * @return int 1 if it should simply forward the data; 0 otherwise.
+ * @param size Byte size of data to remove; at most the buffered size.
+ * @return int Byte size of data left in the buffer; -1 on failure.
  */
-void sock_buf_update_input_time(int fd);
-
+int sock_buf_consume(int fd, int size);
 
 /**
- * @brief Whether the socket is timeout (current time - last_input > TIMEOUT).
+ * @brief Whether simply forward data from the given socket to its peer.
  *
  * @param fd FD for socket.
  * @return int 1 if it should simply forward the data; 0 otherwise.
  */
-int sock_buf_is_timeout(int fd);
+int sock_buf_is_forward(int fd);
 
 #endif /* SOCK_BUF_H */
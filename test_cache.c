@@ -7,28 +7,54 @@
 *     Date: 2021-11-11
 *
 *     Summary:
-*     Test driver for fixed size LRU cache.
+*     Test driver for byte-budgeted LRU cache.
 *
 **************************************************************/
 
 #include "cache.h"
+#include "disk_cache.h"
 #include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 struct cache_elem {
-    char* key;
+    char* key; /* Null-terminated key, right after the struct. */
     char* val;
     int val_len; /* Byte size of val. */
     time_t creation_time; /* Creation time in seconds. */
     time_t max_age; /* Time-to-live in seconds. */
+    time_t stale_age; /* Seconds the element is kept once stale, so it can be
+                       * revalidated; it expires then. */
     struct cache_elem* next;
     struct cache_elem* prev;
+    unsigned hash; /* Hash of key. */
+    size_t bytes; /* Bytes charged for the element. */
+    int refs; /* Number of references, including the one of the cache. */
+    int head_len; /* Byte size of the response head up to the end of its last
+                   * field, where an Age field goes; the empty line and body
+                   * follow. -1 if val has no complete head. */
+    int heap_pos; /* Index in the expiry heap; -1 if not cached. */
+    int queue; /* Queue that the element is in; -1 if not cached. */
+    int freq; /* Hits in S3-FIFO, up to FREQ_MAX. */
+    struct cache_snapshot* snapshot; /* Snapshot that val is mapped from; NULL
+                                      * if val is allocated. */
+    uint64_t checksum; /* Checksum of val in the snapshot. */
+    int verified; /* Whether val is known to match its checksum. */
 };
 typedef struct cache_elem cache_elem;
 
+struct cache_slot {
+    unsigned hash; /* Hash of the key of elem. */
+    struct cache_elem* elem; /* NULL if the slot is empty. */
+};
+typedef struct cache_slot cache_slot;
+
+cache_elem* cache_force_get_elem(const char* key);
 cache_elem* cache_elem_new(const char* key,
                            const char* val,
                            const int val_len,
@@ -36,6 +62,9 @@ cache_elem* cache_elem_new(const char* key,
 void cache_elem_free(cache_elem** elem);
 time_t cache_elem_age(cache_elem* elem);
 int cache_elem_is_stale(cache_elem* elem);
+unsigned cache_hash(const char* key);
+time_t cache_elem_expire(const cache_elem* elem);
+size_t cache_elem_bytes(size_t key_len, size_t val_len);
 
 void test_cache_elem_new_normal(void)
 {
@@ -300,16 +329,47 @@ void test_cache_elem_is_stale(void)
     test_cache_elem_is_stale_false();
 }
 
-struct cache {
-    int size;
-    int capacity;
-    /* Doubly linked list of cache elements. */
+enum cache_queue_id {
+    CACHE_MAIN,
+    CACHE_SMALL,
+    CACHE_PROBATION,
+    CACHE_NUM_QUEUES
+};
+
+struct cache_queue {
     struct cache_elem* front;
     struct cache_elem* back;
+    int size; /* Number of elements. */
+    size_t bytes; /* Bytes charged for the elements. */
+};
+typedef struct cache_queue cache_queue;
+
+struct cache {
+    int size; /* Number of elements. */
+    size_t bytes; /* Bytes charged for all the elements. */
+    size_t peak_bytes; /* Max bytes ever charged. */
+    size_t max_bytes; /* Memory budget. */
+    size_t max_object_bytes; /* Max bytes charged for one element. */
+    enum cache_policy policy;
+    struct cache_queue queues[CACHE_NUM_QUEUES];
+    /* Hash index of cache elements. */
+    struct cache_slot* slots;
+    int num_slots; /* Power of 2, at least twice the size. */
+    /* Min-heap of cache elements by expiry time. */
+    struct cache_elem** heap;
+    int heap_cap; /* Capacity of heap, at least the size. */
+    unsigned* ghost;
+    int ghost_cap;
+    int ghost_start;
+    int ghost_size;
+    unsigned* ghost_table;
+    unsigned char* sketch;
+    int sketch_width;
+    int sketch_adds;
 };
 typedef struct cache cache;
 
-cache* the_cache; /* Global singleton cache declearation. */
+extern cache* the_cache; /* Global singleton cache declearation. */
 
 /* Assert that the cache is empty and in a valid state. */
 void assert_cache_empty(void)
@@ -319,43 +379,111 @@ void assert_cache_empty(void)
 
     assert(the_cache != NULL);
     assert(the_cache->size == 0);
+    assert(the_cache->bytes == 0);
+
+    for (int i = 0; i < CACHE_NUM_QUEUES; ++i) {
+        front = the_cache->queues[i].front;
+        assert(front != NULL);
+        assert(front->key == NULL);
+        assert(front->val == NULL);
 
-    front = the_cache->front;
-    assert(front != NULL);
-    assert(front->key == NULL);
-    assert(front->val == NULL);
+        back = the_cache->queues[i].back;
+        assert(back != NULL);
+        assert(back->key == NULL);
+        assert(back->val == NULL);
 
-    back = the_cache->back;
-    assert(back != NULL);
-    assert(back->key == NULL);
-    assert(back->val == NULL);
+        assert(front->prev == NULL);
+        assert(front->next == back);
+        assert(back->prev == front);
+        assert(back->next == NULL);
+        assert(the_cache->queues[i].size == 0);
+        assert(the_cache->queues[i].bytes == 0);
+    }
 
-    assert(front->prev == NULL);
-    assert(front->next == back);
-    assert(back->prev == front);
-    assert(back->next == NULL);
+    for (int i = 0; i < the_cache->num_slots; ++i) {
+        assert(the_cache->slots[i].elem == NULL);
+    }
 }
 
-void test_cache_init_normal(void)
+/* Assert that the hash index holds exactly the elements in the queues, and
+ * the bytes charged for them are within the budget. */
+void assert_cache_indexed(void)
 {
-    int capacity;
+    int num_indexed = 0;
+    int size = 0;
+    size_t bytes = 0;
+    int queue_size;
+    size_t queue_bytes;
+    cache_queue* queue;
+    cache_elem* elem;
 
+    assert((the_cache->num_slots & (the_cache->num_slots - 1)) == 0);
+    assert(the_cache->size * 2 <= the_cache->num_slots);
+    for (int i = 0; i < the_cache->num_slots; ++i) {
+        elem = the_cache->slots[i].elem;
+        if (elem != NULL) {
+            assert(the_cache->slots[i].hash == elem->hash);
+            assert(elem->hash == cache_hash(elem->key));
+            ++num_indexed;
+        }
+    }
+    for (int i = 0; i < CACHE_NUM_QUEUES; ++i) {
+        queue = &the_cache->queues[i];
+        queue_size = 0;
+        queue_bytes = 0;
+        for (elem = queue->front->next;
+             elem != queue->back;
+             elem = elem->next) {
+            assert(elem->bytes == cache_elem_bytes(strlen(elem->key),
+                                                   elem->val_len));
+            assert(elem->queue == i);
+            assert(elem->next->prev == elem);
+            ++queue_size;
+            queue_bytes += elem->bytes;
+        }
+        assert(queue_size == queue->size);
+        assert(queue_bytes == queue->bytes);
+        size += queue_size;
+        bytes += queue_bytes;
+    }
+    assert(num_indexed == the_cache->size);
+    assert(size == the_cache->size);
+    /* Each element in the heap expires no earlier than its parent. */
+    assert(the_cache->size <= the_cache->heap_cap);
+    for (int i = 0; i < the_cache->size; ++i) {
+        elem = the_cache->heap[i];
+        assert(elem->heap_pos == i);
+        assert(cache_force_get_elem(elem->key) == elem);
+        if (i > 0) {
+            assert(cache_elem_expire(the_cache->heap[(i - 1) / 2]) <=
+                   cache_elem_expire(elem));
+        }
+    }
+    assert(bytes == the_cache->bytes);
+    assert(bytes <= the_cache->max_bytes);
+    assert(bytes <= the_cache->peak_bytes);
+}
+
+void test_cache_init_normal(void)
+{
     fprintf(stderr, "--------------------\n");
     fprintf(stderr, "TEST cache_init() normal\n");
-    capacity = 10;
-    assert(cache_init(capacity) == 0);
+    assert(cache_init(10000, 1000, CACHE_LRU) == 0);
     assert_cache_empty();
-    assert(the_cache->capacity == capacity);
+    assert(the_cache->max_bytes == 10000);
+    assert(the_cache->max_object_bytes == 1000);
+    assert(the_cache->peak_bytes == 0);
+    assert(cache_init(10000, 1000, CACHE_LRU) < 0);
     fprintf(stderr, "PASS\n");
     cache_clear();
     fprintf(stderr, "--------------------\n");
 }
 
-void test_cache_init_neg_cap(void)
+void test_cache_init_0_object_cap(void)
 {
     fprintf(stderr, "--------------------\n");
-    fprintf(stderr, "TEST cache_new() capacity < 0\n");
-    assert(cache_init(-1) < 0);
+    fprintf(stderr, "TEST cache_init() max_object_bytes == 0\n");
+    assert(cache_init(10000, 0, CACHE_LRU) < 0);
     assert(the_cache == NULL);
     fprintf(stderr, "PASS\n");
     fprintf(stderr, "--------------------\n");
@@ -364,8 +492,8 @@ void test_cache_init_neg_cap(void)
 void test_cache_init_0_cap(void)
 {
     fprintf(stderr, "--------------------\n");
-    fprintf(stderr, "TEST cache_new() capacity == 0\n");
-    assert(cache_init(0) < 0);
+    fprintf(stderr, "TEST cache_init() max_bytes == 0\n");
+    assert(cache_init(0, 1000, CACHE_LRU) < 0);
     assert(the_cache == NULL);
     fprintf(stderr, "PASS\n");
     fprintf(stderr, "--------------------\n");
@@ -374,7 +502,7 @@ void test_cache_init_0_cap(void)
 void test_cache_init(void)
 {
     test_cache_init_normal();
-    test_cache_init_neg_cap();
+    test_cache_init_0_object_cap();
     test_cache_init_0_cap();
 }
 
@@ -409,11 +537,13 @@ void test_cache_put_add(void)
     int val_len2;
     time_t max_age2;
     time_t creation_time2;
+    cache_queue* lru;
 
     fprintf(stderr, "--------------------\n");
     fprintf(stderr, "TEST cache_put() add 2 elements\n");
     creation_time = time(NULL);
-    assert(cache_init(10) == 0);
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    lru = &the_cache->queues[CACHE_MAIN];
 
     /* Add one element. */
     key1 = "key1";
@@ -424,16 +554,16 @@ void test_cache_put_add(void)
     assert(cache_put(key1, val1, val_len1, max_age1) == 1);
     assert(the_cache->size == 1);
     /* Check dummy front and back. */
-    assert_cache_elem(the_cache->front, NULL, NULL, 0, creation_time, 0);
-    assert_cache_elem(the_cache->back, NULL, NULL, 0, creation_time, 0);
+    assert_cache_elem(lru->front, NULL, NULL, 0, creation_time, 0);
+    assert_cache_elem(lru->back, NULL, NULL, 0, creation_time, 0);
     /* Check elements. */
-    assert_cache_elem(the_cache->front->next,
+    assert_cache_elem(lru->front->next,
                       key1,
                       val1,
                       val_len1,
                       creation_time1,
                       max_age1);
-    assert(the_cache->front->next == the_cache->back->prev);
+    assert(lru->front->next == lru->back->prev);
 
     /* Add another element. */
     key2 = "key2";
@@ -444,22 +574,211 @@ void test_cache_put_add(void)
     assert(cache_put(key2, val2, val_len2, max_age2) == 1);
     assert(the_cache->size == 2);
     /* Check dummy front and back. */
-    assert_cache_elem(the_cache->front, NULL, NULL, 0, creation_time, 0);
-    assert_cache_elem(the_cache->back, NULL, NULL, 0, creation_time, 0);
+    assert_cache_elem(lru->front, NULL, NULL, 0, creation_time, 0);
+    assert_cache_elem(lru->back, NULL, NULL, 0, creation_time, 0);
     /* Check elements. */
-    assert_cache_elem(the_cache->front->next,
+    assert_cache_elem(lru->front->next,
                       key2,
                       val2,
                       val_len2,
                       creation_time2,
                       max_age2);
-    assert_cache_elem(the_cache->back->prev,
+    assert_cache_elem(lru->back->prev,
                       key1,
                       val1,
                       val_len1,
                       creation_time1,
                       max_age1);
-    assert(the_cache->front->next->next == the_cache->back->prev);
+    assert(lru->front->next->next == lru->back->prev);
+
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_put_update_valid(void)
+{
+    char* val = NULL;
+    int val_len;
+    int age;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put() update an element\n");
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    assert(cache_put("key1", "value1", 7, 100) == 1);
+    assert(cache_put("key2", "value2", 7, 100) == 1);
+    assert(cache_put("key1", "new value1", 11, 200) == 1);
+    assert(the_cache->size == 2);
+    assert_cache_indexed();
+    /* The updated element moves to the front. */
+    assert_cache_elem(the_cache->queues[CACHE_MAIN].front->next,
+                      "key1",
+                      "new value1",
+                      11,
+                      time(NULL),
+                      200);
+    assert(cache_get("key1", &val, &val_len, &age) == 1);
+    assert(val_len == 11 && strcmp(val, "new value1") == 0);
+    free(val);
+
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_put_full_pop_back(void)
+{
+    char* val = NULL;
+    int val_len;
+    int age;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put() full cache evicts the last element\n");
+    assert(cache_init(2 * cache_elem_bytes(4, 7), 1 << 20, CACHE_LRU) == 0);
+    assert(cache_put("key1", "value1", 7, 100) == 1);
+    assert(cache_put("key2", "value2", 7, 100) == 1);
+    assert(cache_put("key3", "value3", 7, 100) == 1);
+    assert(the_cache->size == 2);
+    assert_cache_indexed();
+    assert(cache_get("key1", &val, &val_len, &age) == 0);
+    assert(cache_get("key2", &val, &val_len, &age) == 1);
+    free(val);
+    assert(cache_get("key3", &val, &val_len, &age) == 1);
+    free(val);
+
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_put_large_evicts_many(void)
+{
+    static char big[4000];
+    char key[16];
+    char* val = NULL;
+    int val_len;
+    int age;
+    size_t small = cache_elem_bytes(4, 100);
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put() large element evicts small ones\n");
+    assert(cache_init(small * 50, sizeof(big) + 1000, CACHE_LRU) == 0);
+    memset(big, 'x', sizeof(big));
+    for (int i = 0; i < 50; ++i) {
+        snprintf(key, sizeof(key), "k%03d", i);
+        assert(cache_put(key, big, 100, 100) == 1);
+    }
+    assert(the_cache->size == 50);
+    assert(cache_bytes() == small * 50);
+
+    /* The least recently used ones make just enough room. */
+    assert(cache_put("big", big, sizeof(big), 100) == 1);
+    assert_cache_indexed();
+    assert(cache_bytes() + small > the_cache->max_bytes);
+    assert(cache_get("k000", &val, &val_len, &age) == 0);
+    assert(cache_get("k049", &val, &val_len, &age) == 1);
+    free(val);
+    assert(cache_get("big", &val, &val_len, &age) == 1);
+    assert(val_len == sizeof(big));
+    free(val);
+    assert(cache_peak_bytes() == small * 50);
+
+    cache_clear();
+    assert(cache_bytes() == 0 && cache_peak_bytes() == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_put_over_object_cap(void)
+{
+    static char big[2000];
+    char* val = NULL;
+    int val_len;
+    int age;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put() element over the per-object cap\n");
+    assert(cache_init(1 << 20, 1000, CACHE_LRU) == 0);
+    assert(cache_put("key1", "value1", 7, 100) == 1);
+    assert(cache_put("key2", "value2", 7, 100) == 1);
+    /* A new version too large to cache drops the old one. */
+    assert(cache_put("key1", big, sizeof(big), 100) == 0);
+    assert(cache_get("key1", &val, &val_len, &age) == 0);
+    assert(cache_put("key3", big, sizeof(big), 100) == 0);
+    assert(the_cache->size == 1);
+    assert_cache_indexed();
+    assert(cache_bytes() == cache_elem_bytes(4, 7));
+
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_put_update_grow(void)
+{
+    static char big[1000];
+    char* val = NULL;
+    int val_len;
+    int age;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put() update grows an element\n");
+    assert(cache_init(3 * cache_elem_bytes(4, 7), 1 << 20, CACHE_LRU) == 0);
+    assert(cache_put("key1", "value1", 7, 100) == 1);
+    assert(cache_put("key2", "value2", 7, 100) == 1);
+    assert(cache_put("key3", "value3", 7, 100) == 1);
+    /* The last element makes room for the one that grows. */
+    assert(cache_put("key1", big, 100, 100) == 1);
+    assert(the_cache->size == 2);
+    assert_cache_indexed();
+    assert(cache_get("key2", &val, &val_len, &age) == 0);
+    assert(cache_get("key1", &val, &val_len, &age) == 1);
+    assert(val_len == 100);
+    free(val);
+    /* It shrinks back. */
+    assert(cache_put("key1", "value1", 7, 100) == 1);
+    assert(cache_bytes() == 2 * cache_elem_bytes(4, 7));
+    assert(cache_peak_bytes() == 3 * cache_elem_bytes(4, 7));
+    /* The only element takes the whole budget, up to the rounding of its
+     * value to a slab chunk. */
+    val_len = the_cache->max_bytes - cache_elem_bytes(4, 0);
+    assert(cache_put("key3", big, val_len, 100) == 1);
+    assert(the_cache->size == 1);
+    assert(cache_bytes() == cache_elem_bytes(4, val_len));
+    assert(cache_bytes() <= the_cache->max_bytes);
+    assert_cache_indexed();
+
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_put_full_expired_first(void)
+{
+    char* val = NULL;
+    int val_len;
+    int age;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put() full cache evicts expired elements "
+                    "first\n");
+    assert(cache_init(3 * cache_elem_bytes(4, 7), 1 << 20, CACHE_LRU) == 0);
+    assert(cache_put("key1", "value1", 7, 100) == 1);
+    assert(cache_put("key2", "value2", 7, 100) == 1);
+    assert(cache_put("key3", "value3", 7, 0) == 1);
+    assert(cache_put("key4", "value4", 7, 100) == 1);
+    assert(the_cache->size == 3);
+    assert_cache_indexed();
+    assert(cache_force_get_elem("key3") == NULL);
+    assert(cache_get("key1", &val, &val_len, &age) == 1);
+    free(val);
+
+    /* Without expired elements, the least recently used one goes; the hit
+     * moved key1 to the front. */
+    assert(cache_put("key5", "value5", 7, 100) == 1);
+    assert(cache_force_get_elem("key2") == NULL);
+    assert(cache_force_get_elem("key1") != NULL);
+    assert_cache_indexed();
 
     cache_clear();
     fprintf(stderr, "PASS\n");
@@ -471,15 +790,690 @@ void test_cache_put(void)
     /* TODO */
     // test_cache_put_invalid_args();
     test_cache_put_add();
-    // test_cache_put_update_valid();
+    test_cache_put_update_valid();
     // test_cache_put_update_stale();
     // test_cache_put_full_clean_stale();
-    // test_cache_put_full_pop_back();
+    test_cache_put_full_pop_back();
+    test_cache_put_full_expired_first();
+    test_cache_put_large_evicts_many();
+    test_cache_put_over_object_cap();
+    test_cache_put_update_grow();
+}
+
+void test_cache_get_stale(void)
+{
+    char* val = NULL;
+    int val_len;
+    int age;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_get() removes a stale element\n");
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    assert(cache_put("key1", "value1", 7, 0) == 1);
+    assert(cache_get("key1", &val, &val_len, &age) == 0);
+    assert(val == NULL);
+    assert_cache_empty();
+
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_get_many(void)
+{
+    char key[64];
+    char* val = NULL;
+    int val_len;
+    int age;
+    int capacity = 1000;
+    size_t bytes;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_get() with many keys\n");
+    /* Keys and values are of the same length, so the budget holds exactly
+     * CAPACITY elements. */
+    bytes = cache_elem_bytes(strlen("http://example.com/0000"),
+                             strlen("http://example.com/0000") + 1);
+    assert(cache_init(capacity * bytes, 1 << 20, CACHE_LRU) == 0);
+    /* Put twice the capacity, so the older half is evicted. */
+    for (int i = 0; i < capacity * 2; ++i) {
+        snprintf(key, sizeof(key), "http://example.com/%04d", i);
+        assert(cache_put(key, key, strlen(key) + 1, 100) == 1);
+    }
+    assert(the_cache->size == capacity);
+    assert_cache_indexed();
+    for (int i = 0; i < capacity * 2; ++i) {
+        snprintf(key, sizeof(key), "http://example.com/%04d", i);
+        if (i < capacity) {
+            assert(cache_get(key, &val, &val_len, &age) == 0);
+            continue;
+        }
+        assert(cache_get(key, &val, &val_len, &age) == 1);
+        assert(strcmp(val, key) == 0);
+        free(val);
+    }
+
+    /* Removals keep the other keys reachable. */
+    for (int i = capacity; i < capacity * 2; i += 2) {
+        snprintf(key, sizeof(key), "http://example.com/%04d", i);
+        assert(cache_put(key, key, strlen(key) + 1, 0) == 1);
+        assert(cache_get(key, &val, &val_len, &age) == 0);
+    }
+    assert(the_cache->size == capacity / 2);
+    assert_cache_indexed();
+    for (int i = capacity + 1; i < capacity * 2; i += 2) {
+        snprintf(key, sizeof(key), "http://example.com/%04d", i);
+        assert(cache_get(key, &val, &val_len, &age) == 1);
+        free(val);
+    }
+
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_acquire(void)
+{
+    static char big[1000];
+    struct cache_elem* elem;
+    struct cache_elem* other;
+    const char* val = NULL;
+    int val_len;
+    int head_len;
+    int age;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_acquire() pins elements\n");
+    assert(cache_init(2 * cache_elem_bytes(4, 7), 1 << 20, CACHE_LRU) == 0);
+    assert(cache_acquire("key1", &val, &val_len, &head_len, &age) == NULL);
+    assert(cache_put("key1", "value1", 7, 100) == 1);
+
+    /* A hit shares the cached value. */
+    elem = cache_acquire("key1", &val, &val_len, &head_len, &age);
+    assert(elem != NULL);
+    assert(val == elem->val && val_len == 7 && strcmp(val, "value1") == 0);
+    assert(elem->refs == 2);
+    other = cache_acquire("key1", &val, &val_len, &head_len, &age);
+    assert(other == elem && elem->refs == 3);
+    cache_release(other);
+    assert(elem->refs == 2);
+
+    /* Replacement leaves the pinned value intact. */
+    assert(cache_put("key1", "VALUE1", 7, 100) == 1);
+    assert(elem->refs == 1);
+    assert(strcmp(val, "value1") == 0);
+    other = cache_acquire("key1", &val, &val_len, &head_len, &age);
+    assert(other != elem && strcmp(val, "VALUE1") == 0);
+
+    /* So does eviction; the budget no longer counts it. */
+    assert(cache_put("key2", big, sizeof(big), 100) == 0);
+    assert(cache_put("key2", "value2", 7, 100) == 1);
+    assert(cache_put("key3", "value3", 7, 100) == 1);
+    assert(cache_get("key1", (char**)&val, &val_len, &age) == 0);
+    assert(strcmp(other->val, "VALUE1") == 0 && other->refs == 1);
+    assert(cache_bytes() == 2 * cache_elem_bytes(4, 7));
+    assert_cache_indexed();
+    cache_release(other);
+    cache_release(elem);
+
+    /* Clearing the cache leaves pinned elements to their holders. */
+    elem = cache_acquire("key2", &val, &val_len, &head_len, &age);
+    assert(elem != NULL);
+    cache_clear();
+    assert(strcmp(val, "value2") == 0 && elem->refs == 1);
+    cache_release(elem);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_acquire_split(void)
+{
+    /* The body has a null byte and an empty line of its own. */
+    const char response[] = "HTTP/1.1 200 OK\r\n"
+                            "Content-Length: 9\r\n"
+                            "\r\n"
+                            "a\0b\r\n\r\nc\n";
+    struct cache_elem* elem;
+    const char* val = NULL;
+    int val_len;
+    int head_len;
+    int age;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_acquire() splits head and body\n");
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    assert(cache_put("key1", response, sizeof(response) - 1, 100) == 1);
+    elem = cache_acquire("key1", &val, &val_len, &head_len, &age);
+    assert(elem != NULL);
+    assert(val_len == sizeof(response) - 1);
+    assert(head_len == strlen("HTTP/1.1 200 OK\r\nContent-Length: 9\r\n"));
+    assert(memcmp(val + head_len, "\r\na\0b", 5) == 0);
+    cache_release(elem);
+
+    /* No complete head. */
+    assert(cache_put("key2", "HTTP/1.1 200 OK\r\n", 17, 100) == 1);
+    elem = cache_acquire("key2", &val, &val_len, &head_len, &age);
+    assert(elem != NULL && head_len == -1);
+    cache_release(elem);
+
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_fill(void)
+{
+    static char response[100000];
+    const char head[] = "HTTP/1.1 200 OK\r\nContent-Length: 99962\r\n\r\n";
+    struct cache_fill* fill = NULL;
+    struct cache_elem* elem;
+    const char* chunk = NULL;
+    const char* val = NULL;
+    int chunk_len;
+    int val_len;
+    int head_len;
+    int age;
+    size_t pos = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_fill_append() and cache_fill_put()\n");
+    memcpy(response, head, strlen(head));
+    for (size_t i = strlen(head); i < sizeof(response); ++i) {
+        response[i] = i % 251;
+    }
+    assert(cache_init(1 << 20, 200000, CACHE_LRU) == 0);
+
+    /* Appended in pieces of odd sizes, across chunks. */
+    fill = cache_fill_new("key1", 0);
+    assert(fill != NULL && !cache_fill_is_full(fill));
+    while (pos < sizeof(response)) {
+        size_t n = sizeof(response) - pos < 777 ? sizeof(response) - pos : 777;
+
+        assert(cache_fill_append(fill, response + pos, n) == 0);
+        pos += n;
+    }
+    assert(cache_fill_len(fill) == sizeof(response));
+    pos = 0;
+    for (int i = 0; (chunk = cache_fill_chunk(fill, i, &chunk_len)) != NULL;
+         ++i) {
+        assert(memcmp(chunk, response + pos, chunk_len) == 0);
+        pos += chunk_len;
+    }
+    assert(pos == sizeof(response));
+
+    /* The filled response is cached whole, and split like a put one. */
+    assert(cache_fill_put(fill, 100, 0) == 1);
+    cache_fill_free(&fill);
+    assert(fill == NULL);
+    elem = cache_acquire("key1", &val, &val_len, &head_len, &age);
+    assert(elem != NULL);
+    assert(val_len == sizeof(response));
+    assert(memcmp(val, response, sizeof(response)) == 0);
+    assert(head_len == strlen(head) - strlen("\r\n"));
+    cache_release(elem);
+
+    /* A fill over the cap drops its bytes, and its key isn't cached. */
+    fill = cache_fill_new("key1", 0);
+    assert(cache_fill_append(fill, response, sizeof(response)) == 0);
+    assert(cache_fill_append(fill, response, sizeof(response)) == -1);
+    assert(cache_fill_is_full(fill));
+    assert(cache_fill_chunk(fill, 0, &chunk_len) == NULL);
+    assert(cache_fill_append(fill, response, 10) == -1);
+    assert(cache_fill_len(fill) == 2 * sizeof(response) + 10);
+    assert(cache_fill_put(fill, 100, 0) == 0);
+    cache_fill_free(&fill);
+    assert(cache_acquire("key1", &val, &val_len, &head_len, &age) == NULL);
+
+    /* A known size over the cap is full from the start. */
+    fill = cache_fill_new("key2", 300000);
+    assert(cache_fill_is_full(fill));
+    assert(cache_fill_append(fill, response, 10) == -1);
+    cache_fill_free(&fill);
+    cache_fill_free(&fill);
+
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
 }
 
 void test_cache_get(void)
 {
-    /* TODO */
+    test_cache_get_stale();
+    test_cache_get_many();
+}
+
+void test_cache_sweep(void)
+{
+    char key[16];
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_sweep() removes a bounded number of expired "
+                    "elements\n");
+    assert(cache_sweep(10) == 0);
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    /* Mix expired elements with fresh ones of various max ages. */
+    for (int i = 0; i < 200; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        assert(cache_put(key, "value", 6, i % 3 == 0 ? 0 : 1000 - i) == 1);
+    }
+    assert_cache_indexed();
+    assert(cache_sweep(10) == 10);
+    assert(the_cache->size == 190);
+    assert_cache_indexed();
+    assert(cache_sweep(1000) == 57);
+    assert(cache_sweep(1000) == 0);
+    assert(the_cache->size == 133);
+    assert_cache_indexed();
+    for (int i = 0; i < 200; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        assert((cache_force_get_elem(key) == NULL) == (i % 3 == 0));
+    }
+
+    /* The earliest expiry is at the root. */
+    assert(the_cache->heap[0] == cache_force_get_elem("key199"));
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_revalidate(void)
+{
+    struct cache_elem* elem;
+    struct cache_elem* other;
+    const char* val = NULL;
+    char* copy = NULL;
+    int val_len;
+    int head_len;
+    int age;
+    int stale_secs;
+    char key[16];
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_acquire_stale() and cache_refresh()\n");
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    assert(cache_put_stale("key1", "value1", 7, 0, 100) == 1);
+    assert(cache_put_stale("key2", "value2", 7, 1000, 100) == 1);
+
+    /* A stale element kept for revalidation is missed, but not removed. */
+    assert(cache_get("key1", &copy, &val_len, &age) == 0);
+    assert(copy == NULL);
+    assert(cache_acquire("key1", &val, &val_len, &head_len, &age) == NULL);
+    assert(cache_sweep(10) == 0);
+    assert(the_cache->size == 2);
+    elem = cache_acquire_stale("key1",
+                               &val,
+                               &val_len,
+                               &head_len,
+                               &age,
+                               &stale_secs);
+    assert(elem != NULL && stale_secs >= 0 && stale_secs <= age);
+    assert(val_len == 7 && strcmp(val, "value1") == 0);
+    other = cache_acquire_stale("key2",
+                                &val,
+                                &val_len,
+                                &head_len,
+                                &age,
+                                &stale_secs);
+    assert(other != NULL && stale_secs < 0);
+    assert(stale_secs == age - 1000);
+    cache_release(other);
+
+    /* A refreshed element is fresh again, and expires later. */
+    assert(cache_elem_expire(the_cache->heap[0]) ==
+           cache_elem_expire(elem));
+    assert(cache_refresh(elem, -1) == 1);
+    assert(elem->max_age == 0);
+    assert(cache_refresh(elem, 2000) == 1);
+    assert(elem->max_age == 2000 && elem->stale_age == 100);
+    assert_cache_indexed();
+    assert(the_cache->heap[0] == cache_force_get_elem("key2"));
+    assert(cache_acquire("key1", &val, &val_len, &head_len, &age) == elem);
+    assert(age == 0);
+    cache_release(elem);
+
+    /* A replaced element isn't refreshed. */
+    assert(cache_put("key1", "value3", 7, 0) == 1);
+    assert(cache_refresh(elem, 100) == 0);
+    cache_release(elem);
+    assert(cache_force_get_elem("key1")->max_age == 0);
+
+    /* Without a stale age, a stale element expires at once. */
+    assert(cache_acquire_stale("key1",
+                               &val,
+                               &val_len,
+                               &head_len,
+                               &age,
+                               &stale_secs) == NULL);
+    assert(cache_force_get_elem("key1") == NULL);
+
+    /* Elements expire at the end of their stale age. */
+    for (int i = 0; i < 100; ++i) {
+        snprintf(key, sizeof(key), "key%d", i + 3);
+        assert(cache_put_stale(key, "value", 6, 0, i % 2 ? 100 : 0) == 1);
+    }
+    assert(cache_sweep(1000) == 50);
+    assert(the_cache->size == 51);
+    assert_cache_indexed();
+    elem = cache_force_get_elem("key4");
+    elem->creation_time -= 100;
+    assert(cache_acquire_stale("key4",
+                               &val,
+                               &val_len,
+                               &head_len,
+                               &age,
+                               &stale_secs) == NULL);
+    assert(cache_force_get_elem("key4") == NULL);
+    assert_cache_indexed();
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+/* Look up hot keys a few times, then scan many one-off keys, putting each key
+ * on a miss like the proxy does. Return the number of hot keys left. */
+int scan_hot_keys(enum cache_policy policy)
+{
+    const int num_hot = 20;
+    const int num_scanned = 2000;
+    char key[64];
+    char* val = NULL;
+    int val_len;
+    int age;
+    int num_left = 0;
+    size_t bytes = cache_elem_bytes(strlen("http://example.com/hot/0000"),
+                                    strlen("value"));
+
+    /* The cache holds 100 elements. */
+    assert(cache_init(100 * bytes, 1 << 20, policy) == 0);
+    for (int round = 0; round < 4; ++round) {
+        for (int i = 0; i < num_hot; ++i) {
+            snprintf(key, sizeof(key), "http://example.com/hot/%04d", i);
+            if (cache_get(key, &val, &val_len, &age) == 1) {
+                free(val);
+                continue;
+            }
+            assert(cache_put(key, "value", strlen("value"), 100) == 1);
+        }
+    }
+    for (int i = 0; i < num_scanned; ++i) {
+        snprintf(key, sizeof(key), "http://example.com/new/%04d", i);
+        assert(cache_get(key, &val, &val_len, &age) == 0);
+        assert(cache_put(key, "value", strlen("value"), 100) == 1);
+        if (i % 100 == 0) {
+            assert_cache_indexed();
+        }
+    }
+    assert(the_cache->size == 100);
+    assert_cache_indexed();
+    for (int i = 0; i < num_hot; ++i) {
+        snprintf(key, sizeof(key), "http://example.com/hot/%04d", i);
+        if (cache_force_get_elem(key) != NULL) {
+            ++num_left;
+        }
+    }
+    cache_clear();
+    return num_left;
+}
+
+void test_cache_policy_scan(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache policies under a scan of one-off keys\n");
+    assert(cache_parse_policy("lru") == CACHE_LRU);
+    assert(cache_parse_policy("s3fifo") == CACHE_S3FIFO);
+    assert(cache_parse_policy("tinylfu") == CACHE_TINYLFU);
+    assert(cache_parse_policy("fifo") < 0);
+    assert(strcmp(cache_policy_name(CACHE_TINYLFU), "tinylfu") == 0);
+    assert(cache_init(1 << 20, 1 << 20, CACHE_NUM_POLICIES) < 0);
+
+    /* LRU loses the hot keys; the scan-resistant policies keep them all. */
+    assert(scan_hot_keys(CACHE_LRU) == 0);
+    assert(scan_hot_keys(CACHE_S3FIFO) == 20);
+    assert(scan_hot_keys(CACHE_TINYLFU) == 20);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_policy_mixed(void)
+{
+    static char big[3000];
+    char key[16];
+    char* val = NULL;
+    int val_len;
+    int age;
+    unsigned r = 1;
+    struct cache_elem* pinned[8] = {NULL};
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache policies keep queues consistent\n");
+    memset(big, 'x', sizeof(big));
+    for (int policy = 0; policy < CACHE_NUM_POLICIES; ++policy) {
+        assert(cache_init(50 * cache_elem_bytes(4, 100), 1 << 20, policy) ==
+               0);
+        /* Random gets and puts of various sizes and max ages, with some
+         * elements pinned while evicted. */
+        for (int i = 0; i < 20000; ++i) {
+            r = r * 1103515245u + 12345u;
+            snprintf(key, sizeof(key), "k%03u", (r >> 8) % 300);
+            if ((r >> 4) % 3 != 0) {
+                if (cache_get(key, &val, &val_len, &age) == 1) {
+                    free(val);
+                }
+                continue;
+            }
+            assert(cache_put(key,
+                             big,
+                             (r >> 12) % 10 == 0 ? sizeof(big) : 100,
+                             (r >> 16) % 20 == 0 ? 0 : 100) >= 0);
+            if ((r >> 20) % 50 == 0) {
+                cache_release(pinned[(r >> 24) % 8]);
+                pinned[(r >> 24) % 8] = cache_acquire(key,
+                                                      (const char**)&val,
+                                                      &val_len,
+                                                      &age,
+                                                      &age);
+            }
+            if (i % 1000 == 0) {
+                assert_cache_indexed();
+            }
+        }
+        assert_cache_indexed();
+        cache_clear();
+        for (int i = 0; i < 8; ++i) {
+            cache_release(pinned[i]);
+            pinned[i] = NULL;
+        }
+    }
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_disk_tier(void)
+{
+    static char big[5000];
+    char dir[] = "/tmp/test_cache.XXXXXX";
+    char* val = NULL;
+    int val_len;
+    const char* stale_val = NULL;
+    int head_len;
+    int stale_secs;
+    cache_elem* elem = NULL;
+    int age;
+    time_t creation_time;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST evicted elements spill to disk and are promoted\n");
+    memset(big, 'x', sizeof(big));
+    assert(mkdtemp(dir) != NULL);
+    assert(cache_init(2 * cache_elem_bytes(4, sizeof(big)), 1 << 20, CACHE_LRU)
+           == 0);
+    assert(disk_cache_init(dir, 128 * 1024, 64 * 1024) == 0);
+    assert(cache_put("key1", big, sizeof(big), 100) == 1);
+    creation_time = cache_force_get_elem("key1")->creation_time;
+    assert(cache_put("key2", big, sizeof(big), 100) == 1);
+
+    /* The least recently used element spills. */
+    assert(cache_put("key3", big, sizeof(big), 100) == 1);
+    assert(cache_force_get_elem("key1") == NULL);
+    assert(disk_cache_size() == 1);
+
+    /* A hit promotes it with its creation time, and spills another one. */
+    assert(cache_get("key1", &val, &val_len, &age) == 1);
+    assert(val_len == sizeof(big) && memcmp(val, big, sizeof(big)) == 0);
+    free(val);
+    assert(cache_force_get_elem("key1")->creation_time == creation_time);
+    assert(cache_force_get_elem("key2") == NULL);
+    assert(disk_cache_size() == 1);
+    assert_cache_indexed();
+
+    /* A newer response replaces the spilled one, and key3 spills. */
+    assert(cache_put("key2", "value2", 7, 100) == 1);
+    assert(disk_cache_remove("key2") == 0);
+    assert(disk_cache_size() == 1);
+    assert(cache_get("key2", &val, &val_len, &age) == 1);
+    assert(strcmp(val, "value2") == 0);
+    free(val);
+
+    /* Small and expired elements don't spill; key1 does. */
+    assert(cache_put("key4", "value4", 7, 0) == 1);
+    assert(cache_put("key5", big, sizeof(big), 100) == 1);
+    assert(cache_put("key6", big, sizeof(big), 100) == 1);
+    assert(cache_force_get_elem("key2") == NULL);
+    assert(disk_cache_size() == 2);
+    assert(disk_cache_remove("key1") == 1);
+    assert(disk_cache_remove("key3") == 1);
+    assert_cache_indexed();
+
+    /* A stale element kept for revalidation spills with its stale age. */
+    assert(cache_put_stale("key7", big, sizeof(big), 0, 100) == 1);
+    creation_time = cache_force_get_elem("key7")->creation_time;
+    assert(cache_put("key8", big, sizeof(big), 100) == 1);
+    assert(cache_put("key9", big, sizeof(big), 100) == 1);
+    assert(cache_force_get_elem("key7") == NULL);
+    assert(disk_cache_size() == 3);
+    elem = cache_acquire_stale("key7",
+                               &stale_val,
+                               &val_len,
+                               &head_len,
+                               &age,
+                               &stale_secs);
+    assert(elem != NULL && stale_secs >= 0);
+    assert(val_len == sizeof(big) && memcmp(stale_val, big, sizeof(big)) == 0);
+    assert(elem->creation_time == creation_time && elem->stale_age == 100);
+    cache_release(elem);
+    assert(cache_get("key7", &val, &val_len, &age) == 0);
+    assert(disk_cache_size() == 3);
+    assert_cache_indexed();
+
+    cache_clear();
+    disk_cache_clear();
+    assert(rmdir(dir) == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+/* Flip a byte of the given file at the given offset; from the end if < 0. */
+void corrupt_file(const char* path, off_t offset)
+{
+    int fd = open(path, O_RDWR);
+    char c;
+
+    assert(fd >= 0);
+    if (offset < 0) {
+        offset += lseek(fd, 0, SEEK_END);
+    }
+    assert(pread(fd, &c, 1, offset) == 1);
+    c ^= 0x20;
+    assert(pwrite(fd, &c, 1, offset) == 1);
+    close(fd);
+}
+
+void test_cache_snapshot(void)
+{
+    static char big[5000];
+    const char* response = "HTTP/1.1 200 OK\r\nA: b\r\n\r\nbody1";
+    char dir[] = "/tmp/test_cache.XXXXXX";
+    char path[64];
+    const char* val;
+    char* copy = NULL;
+    int val_len;
+    int head_len;
+    int age;
+    FILE* file;
+    cache_elem* elem;
+    cache_elem* pinned;
+    time_t creation_time;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_save() and cache_load()\n");
+    memset(big, 'x', sizeof(big));
+    assert(mkdtemp(dir) != NULL);
+    snprintf(path, sizeof(path), "%s/snapshot", dir);
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    assert(cache_load(path) == 0);
+    assert(cache_put("key1", response, strlen(response), 100) == 1);
+    cache_force_get_elem("key1")->creation_time -= 10;
+    creation_time = cache_force_get_elem("key1")->creation_time;
+    assert(cache_put("key2", big, sizeof(big), 100) == 1);
+    assert(cache_put("key3", "value3", 7, 0) == 1);
+
+    /* Stale elements are left out. */
+    assert(cache_save(path) == 2);
+    cache_clear();
+
+    /* Loaded values stay in the file until used. */
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    assert(cache_load(path) == 2);
+    assert(cache_force_get_elem("key3") == NULL);
+    elem = cache_force_get_elem("key1");
+    assert(elem != NULL && elem->snapshot != NULL && !elem->verified);
+    assert(elem->creation_time == creation_time);
+    assert(elem->head_len == (int)strlen("HTTP/1.1 200 OK\r\nA: b\r\n"));
+    assert(cache_bytes() == cache_elem_bytes(4, strlen(response)) +
+                            cache_elem_bytes(4, sizeof(big)));
+    assert_cache_indexed();
+    pinned = cache_acquire("key1", &val, &val_len, &head_len, &age);
+    assert(pinned == elem && elem->verified);
+    assert(val_len == (int)strlen(response));
+    assert(memcmp(val, response, val_len) == 0);
+    assert(age >= 10);
+
+    /* The mapped file is replaced, and the mapping outlives the cache. */
+    assert(cache_save(path) == 2);
+    cache_clear();
+    assert(memcmp(val, response, val_len) == 0);
+    cache_release(pinned);
+
+    /* A corrupted value is dropped on use. key1, the most recently used, is
+     * the last value of the file. */
+    corrupt_file(path, -1);
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    assert(cache_load(path) == 2);
+    assert(cache_get("key1", &copy, &val_len, &age) == 0);
+    assert(cache_force_get_elem("key1") == NULL);
+    assert(cache_get("key2", &copy, &val_len, &age) == 1);
+    assert(val_len == sizeof(big) && memcmp(copy, big, sizeof(big)) == 0);
+    free(copy);
+
+    /* A corrupted index drops the whole snapshot. */
+    assert(cache_save(path) == 1);
+    cache_clear();
+    corrupt_file(path, 40);
+    assert(cache_init(1 << 20, 1 << 20, CACHE_LRU) == 0);
+    assert(cache_load(path) < 0);
+    assert(cache_bytes() == 0);
+    file = fopen(path, "w");
+    assert(file != NULL);
+    fputs("junk", file);
+    fclose(file);
+    assert(cache_load(path) < 0);
+    assert_cache_empty();
+    cache_clear();
+
+    assert(unlink(path) == 0);
+    assert(rmdir(dir) == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
 }
 
 void test_cache_clear(void)
@@ -498,6 +1492,15 @@ int main(void)
     test_cache_init();
     test_cache_put();
     test_cache_get();
+    test_cache_acquire();
+    test_cache_acquire_split();
+    test_cache_fill();
+    test_cache_sweep();
+    test_cache_revalidate();
+    test_cache_policy_scan();
+    test_cache_policy_mixed();
+    test_cache_disk_tier();
+    test_cache_snapshot();
     test_cache_clear();
 
     fprintf(stderr, "ALL PASS\n");
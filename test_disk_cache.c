@@ -0,0 +1,236 @@
+/**************************************************************
+*
+*                      test_disk_cache.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Test driver for disk-backed second tier of the cache,
+*     using a temporary directory.
+*
+**************************************************************/
+
+#include "disk_cache.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VAL_SIZE 10000
+#define SEGMENT_SIZE (64 * 1024)
+
+static char dir[] = "/tmp/test_disk_cache.XXXXXX";
+static char val[VAL_SIZE]; /* Response of every key, a byte pattern. */
+
+/* Assert that the response of key is taken with the given size and times. */
+void assert_taken(const char* key,
+                  int val_len,
+                  time_t creation_time,
+                  time_t max_age,
+                  time_t stale_age)
+{
+    char* out_val = NULL;
+    int out_val_len;
+    time_t out_creation_time;
+    time_t out_max_age;
+    time_t out_stale_age;
+
+    assert(disk_cache_take(key,
+                           &out_val,
+                           &out_val_len,
+                           &out_creation_time,
+                           &out_max_age,
+                           &out_stale_age) == 1);
+    assert(out_val_len == val_len);
+    assert(memcmp(out_val, val, val_len) == 0);
+    assert(out_creation_time == creation_time);
+    assert(out_max_age == max_age);
+    assert(out_stale_age == stale_age);
+    free(out_val);
+}
+
+/* Assert that no response of key is taken. */
+void assert_not_taken(const char* key)
+{
+    char* out_val = NULL;
+    int out_val_len;
+    time_t out_creation_time;
+    time_t out_max_age;
+    time_t out_stale_age;
+
+    assert(disk_cache_take(key,
+                           &out_val,
+                           &out_val_len,
+                           &out_creation_time,
+                           &out_max_age,
+                           &out_stale_age) == 0);
+    assert(out_val == NULL);
+}
+
+void test_disk_cache_init(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST disk_cache_init()\n");
+    assert(!disk_cache_enabled());
+    assert(disk_cache_init(dir, SEGMENT_SIZE, SEGMENT_SIZE) < 0);
+    assert(disk_cache_init(dir, SEGMENT_SIZE * 2, 0) < 0);
+    assert(disk_cache_init(NULL, SEGMENT_SIZE * 2, SEGMENT_SIZE) < 0);
+    assert(disk_cache_init("/nonexistent", SEGMENT_SIZE * 2, SEGMENT_SIZE) <
+           0);
+    assert(!disk_cache_enabled());
+    assert(disk_cache_put("key", val, VAL_SIZE, time(NULL), 100, 0) == 0);
+
+    assert(disk_cache_init(dir, SEGMENT_SIZE * 2, SEGMENT_SIZE) == 0);
+    assert(disk_cache_enabled());
+    assert(disk_cache_init(dir, SEGMENT_SIZE * 2, SEGMENT_SIZE) < 0);
+    /* Segment files are unlinked right away, so the directory is empty. */
+    assert(rmdir(dir) == 0);
+    assert(mkdir(dir, 0700) == 0);
+    disk_cache_clear();
+    assert(!disk_cache_enabled());
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_disk_cache_put_take(void)
+{
+    time_t now = time(NULL);
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST disk_cache_put() and disk_cache_take()\n");
+    assert(disk_cache_init(dir, SEGMENT_SIZE * 4, SEGMENT_SIZE) == 0);
+    assert_not_taken("key1");
+
+    /* Small and oversized responses aren't kept. */
+    assert(disk_cache_put("small", val, DISK_MIN_OBJECT_BYTES - 1, now, 100, 0)
+           == 0);
+    assert(disk_cache_put("big", val, SEGMENT_SIZE, now, 100, 0) == 0);
+    assert(disk_cache_size() == 0 && disk_cache_bytes() == 0);
+
+    assert(disk_cache_put("key1", val, VAL_SIZE, now - 10, 100, 0) == 1);
+    assert(disk_cache_put("key2", val, 5000, now, 200, 0) == 1);
+    assert(disk_cache_size() == 2);
+    assert(disk_cache_bytes() > VAL_SIZE + 5000);
+
+    /* A hit takes the response out. */
+    assert_taken("key1", VAL_SIZE, now - 10, 100, 0);
+    assert_not_taken("key1");
+    assert(disk_cache_size() == 1);
+
+    /* A newer response replaces the old one. */
+    assert(disk_cache_put("key2", val, 6000, now, 300, 0) == 1);
+    assert(disk_cache_size() == 1);
+    assert_taken("key2", 6000, now, 300, 0);
+
+    /* Expired responses are dropped. */
+    assert(disk_cache_put("key3", val, 5000, now - 100, 100, 0) == 1);
+    assert_not_taken("key3");
+    assert(disk_cache_size() == 0 && disk_cache_bytes() == 0);
+
+    /* Stale responses are kept for their stale age. */
+    assert(disk_cache_put("key3", val, 5000, now - 150, 100, 100) == 1);
+    assert_taken("key3", 5000, now - 150, 100, 100);
+    assert(disk_cache_put("key3", val, 5000, now - 250, 100, 100) == 1);
+    assert_not_taken("key3");
+
+    assert(disk_cache_put("key4", val, 5000, now, 100, 0) == 1);
+    assert(disk_cache_remove("key4") == 1);
+    assert(disk_cache_remove("key4") == 0);
+    assert_not_taken("key4");
+    disk_cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_disk_cache_reuse_segments(void)
+{
+    char key[32];
+    time_t now = time(NULL);
+    int num_segments = 3;
+    int num_kept = 0;
+    int first_kept = -1;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST disk_cache_put() reuses the oldest segment\n");
+    assert(disk_cache_init(dir,
+                           SEGMENT_SIZE * num_segments,
+                           SEGMENT_SIZE) == 0);
+    for (int i = 0; i < 100; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        assert(disk_cache_put(key, val, VAL_SIZE, now, 100, 0) == 1);
+        assert(disk_cache_bytes() <= (size_t)SEGMENT_SIZE * num_segments);
+    }
+
+    /* The most recent responses are kept, in whole segments. */
+    for (int i = 0; i < 100; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        if (disk_cache_remove(key) == 1) {
+            if (first_kept < 0) {
+                first_kept = i;
+            }
+            assert(i >= first_kept);
+            ++num_kept;
+        }
+        else {
+            assert(first_kept < 0);
+        }
+    }
+    assert(first_kept + num_kept == 100);
+    assert(num_kept > (num_segments - 1) * (SEGMENT_SIZE / VAL_SIZE - 1));
+    assert(disk_cache_size() == 0 && disk_cache_bytes() == 0);
+    disk_cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_disk_cache_many(void)
+{
+    char key[32];
+    time_t now = time(NULL);
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST disk_cache_take() with many keys\n");
+    assert(disk_cache_init(dir, 64 << 20, 16 << 20) == 0);
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(key, sizeof(key), "http://example.com/%d", i);
+        assert(disk_cache_put(key, val, DISK_MIN_OBJECT_BYTES + i, now, 100, 0)
+               == 1);
+    }
+    assert(disk_cache_size() == 1000);
+
+    /* Removals keep the other keys reachable. */
+    for (int i = 0; i < 1000; i += 2) {
+        snprintf(key, sizeof(key), "http://example.com/%d", i);
+        assert(disk_cache_remove(key) == 1);
+    }
+    for (int i = 1; i < 1000; i += 2) {
+        snprintf(key, sizeof(key), "http://example.com/%d", i);
+        assert_taken(key, DISK_MIN_OBJECT_BYTES + i, now, 100, 0);
+    }
+    assert(disk_cache_size() == 0 && disk_cache_bytes() == 0);
+    disk_cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    for (int i = 0; i < VAL_SIZE; ++i) {
+        val[i] = (char)(i * 7 + i / 251);
+    }
+    assert(mkdtemp(dir) != NULL);
+
+    fprintf(stderr, "====================\n");
+    test_disk_cache_init();
+    test_disk_cache_put_take();
+    test_disk_cache_reuse_segments();
+    test_disk_cache_many();
+    assert(rmdir(dir) == 0);
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,483 @@
+/**************************************************************
+*
+*                     test_http_utils.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Test driver for incremental HTTP parser.
+*
+**************************************************************/
+
+#include "http_utils.h"
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* request = "GET http://example.com:8080/a?b=c HTTP/1.1\r\n"
+                             "Host: example.com:8080\r\n"
+                             "User-Agent:  test\tbrowser/1.0 \xe2\x9c\x93 \t\r\n"
+                             "Accept:\r\n"
+                             "\r\n";
+
+/* Assert that a slice holds the given string. */
+void assert_slice(const struct http_slice* slice, const char* str)
+{
+    assert(slice->ptr != NULL);
+    assert((size_t)slice->len == strlen(str));
+    assert(memcmp(slice->ptr, str, slice->len) == 0);
+}
+
+/* Parse a whole message at once. */
+int parse_all(struct http_parser* parser, const char* msg, int is_request)
+{
+    http_parser_init(parser, is_request);
+    return http_parse(parser, msg, strlen(msg));
+}
+
+void test_http_parse_request(void)
+{
+    struct http_parser parser;
+    const struct http_field* field = NULL;
+    char* buf = NULL;
+    int len = strlen(request);
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST http_parse() of a request\n");
+    assert(parse_all(&parser, request, 1) == HTTP_PARSE_DONE);
+    assert(parser.head_len == len);
+    assert_slice(&parser.method, "GET");
+    assert_slice(&parser.url, "http://example.com:8080/a?b=c");
+    assert_slice(&parser.version, "HTTP/1.1");
+    assert(parser.num_fields == 3);
+    assert_slice(&parser.fields[0].name, "Host");
+    assert_slice(&parser.fields[0].value, "example.com:8080");
+    assert_slice(&parser.fields[1].value, "test\tbrowser/1.0 \xe2\x9c\x93");
+    assert_slice(&parser.fields[2].value, "");
+    field = http_find_field(&parser, "user-agent");
+    assert(field == &parser.fields[1]);
+    assert(http_find_field(&parser, "User") == NULL);
+    assert(parser.body.is_done);
+    assert(http_parse_body(&parser, request, len) == HTTP_PARSE_DONE);
+    assert(parser.pos == len);
+
+    /* Fed a byte at a time into a buffer that moves, it's parsed the same. */
+    http_parser_init(&parser, 1);
+    for (int n = 1; n <= len; ++n) {
+        free(buf);
+        buf = malloc(n);
+        memcpy(buf, request, n);
+        assert(http_parse(&parser, buf, n) ==
+               (n < len ? HTTP_PARSE_PARTIAL : HTTP_PARSE_DONE));
+    }
+    assert(parser.head_len == len);
+    assert(parser.url.ptr == buf + strlen("GET "));
+    assert_slice(&parser.fields[0].value, "example.com:8080");
+    free(buf);
+    buf = NULL;
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_http_parse_body(void)
+{
+    static const char* chunked = "POST / HTTP/1.1\r\n"
+                                 "Host: a\r\n"
+                                 "Transfer-Encoding: gzip, Chunked\r\n"
+                                 "\r\n"
+                                 "3;x=y\r\nabc\r\n0\r\nT: 1\r\n\r\n"
+                                 "GET / HTTP/1.1\r\n";
+    static const char* length = "PUT / HTTP/1.1\r\n"
+                                "Content-Length: 5\r\n"
+                                "Content-Length: 5\r\n"
+                                "\r\n"
+                                "12345GET";
+    struct http_parser parser;
+    int len = strstr(chunked, "GET") - chunked;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST http_parse_body() of requests\n");
+    assert(parse_all(&parser, chunked, 1) == HTTP_PARSE_DONE);
+    assert(parser.body.is_chunked);
+    for (int n = parser.head_len; n < len; ++n) {
+        assert(http_parse_body(&parser, chunked, n) == HTTP_PARSE_PARTIAL);
+    }
+    assert(http_parse_body(&parser, chunked, strlen(chunked)) ==
+           HTTP_PARSE_DONE);
+    assert(parser.pos == len);
+
+    assert(parse_all(&parser, length, 1) == HTTP_PARSE_DONE);
+    assert(parser.content_length == 5);
+    assert(http_parse_body(&parser, length, parser.head_len + 4) ==
+           HTTP_PARSE_PARTIAL);
+    assert(http_parse_body(&parser, length, strlen(length)) ==
+           HTTP_PARSE_DONE);
+    assert(parser.pos == (int)strlen(length) - 3);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_http_parse_response(void)
+{
+    struct http_parser parser;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST http_parse() of responses\n");
+    assert(parse_all(&parser,
+                     "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n",
+                     0) == HTTP_PARSE_DONE);
+    assert(parser.status_code == 200);
+    assert_slice(&parser.version, "HTTP/1.1");
+    assert_slice(&parser.reason, "OK");
+    assert(!parser.body.is_chunked && parser.body.remaining == 10);
+
+    /* Chunked wins over the length. */
+    assert(parse_all(&parser,
+                     "HTTP/1.0 404 Not Found\r\n"
+                     "Content-Length: 10\r\n"
+                     "Transfer-Encoding: chunked\r\n\r\n",
+                     0) == HTTP_PARSE_DONE);
+    assert(parser.status_code == 404);
+    assert(parser.body.is_chunked && !parser.body.is_done);
+
+    /* Without a length, or with a coding but chunked, it ends on close. */
+    assert(parse_all(&parser, "HTTP/1.1 200\r\n\r\n", 0) == HTTP_PARSE_DONE);
+    assert_slice(&parser.reason, "");
+    assert(parser.body.remaining == -1);
+    assert(parse_all(&parser,
+                     "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip\r\n\r\n",
+                     0) == HTTP_PARSE_DONE);
+    assert(!parser.body.is_chunked && parser.body.remaining == -1);
+
+    /* Some status codes have no body. */
+    assert(parse_all(&parser,
+                     "HTTP/1.1 304 Not Modified\r\nContent-Length: 9\r\n\r\n",
+                     0) == HTTP_PARSE_DONE);
+    assert(parser.body.is_done);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_scan_body(void)
+{
+    static const char* head = "HTTP/1.1 200 OK\r\n"
+                              "Content-Length: 3\r\n"
+                              "Transfer-Encoding: chunked\r\n"
+                              "Cache-Control: max-age=60\r\n"
+                              "Trailer: X-Sum\r\n"
+                              "\r\n";
+    static const char* body = "5;name=\"v a\"\r\nhello\r\n"
+                              "A \r\n0123456789\r\n"
+                              "0\r\nX-Sum: 1\r\n\r\n";
+    static const char* malformed[] = {
+        "5\r\nhelloX\r\n0\r\n\r\n", /* No CRLF after the data. */
+        "5\r\nhello\n0\r\n\r\n", /* Bare line feed after the data. */
+        "5\nhello\r\n0\r\n\r\n", /* Bare line feed after the size. */
+        "0x5\r\nhello\r\n0\r\n\r\n", /* Not hex. */
+        ";x\r\n", /* No size. */
+        "5;x\x01\r\nhello\r\n", /* Control char in an extension. */
+        "0\r\nX: 1\x7f\r\n\r\n", /* Control char in a trailer. */
+        "0\r\n\r\r\n", /* Bare carriage return at the end. */
+        "fffffffffffffffff\r\n", /* Too large. */
+    };
+    struct http_parser parser;
+    char* new_head = NULL;
+    char decoded[64];
+    int body_len = strlen(body);
+    int decoded_len = 0;
+    int new_len = 0;
+    int len;
+    int data_len;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST scan_body() and make_dechunked_head()\n");
+    /* Fed a byte at a time, the body ends at its last line. */
+    assert(parse_all(&parser, head, 0) == HTTP_PARSE_DONE);
+    for (int i = 0; i < body_len; ++i) {
+        assert(!parser.body.is_done);
+        assert(scan_body(&parser.body, body + i, 1) == 1);
+    }
+    assert(parser.body.is_done && parser.body.data_len == 15);
+    assert(scan_body(&parser.body, "x", 1) == 0);
+
+    /* The data runs are taken out of the framing. */
+    assert(parse_all(&parser, head, 0) == HTTP_PARSE_DONE);
+    for (int i = 0; i < body_len; i += len) {
+        len = scan_body_data(&parser.body, body + i, body_len - i, &data_len);
+        assert(len > 0);
+        memcpy(decoded + decoded_len, body + i + len - data_len, data_len);
+        decoded_len += data_len;
+    }
+    assert(parser.body.is_done);
+    assert(decoded_len == 15 && memcmp(decoded, "hello0123456789", 15) == 0);
+
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+        assert(parse_all(&parser, head, 0) == HTTP_PARSE_DONE);
+        assert(scan_body(&parser.body, malformed[i], strlen(malformed[i])) ==
+               -1);
+    }
+
+    /* The new head frames the decoded body with its length. */
+    assert(make_dechunked_head(head,
+                               strlen(head),
+                               decoded_len,
+                               &new_head,
+                               &new_len) == 0);
+    assert(new_len == (int)strlen(new_head));
+    assert(strcmp(new_head,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Cache-Control: max-age=60\r\n"
+                  "Content-Length: 15\r\n"
+                  "\r\n") == 0);
+    free(new_head);
+    new_head = NULL;
+    assert(make_dechunked_head("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n",
+                               38,
+                               1,
+                               &new_head,
+                               &new_len) == -1);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_http_parse_error(void)
+{
+    static const char* requests[] = {
+        "GET / HTTP/1.1\nHost: a\r\n\r\n", /* Bare line feed. */
+        "GET  / HTTP/1.1\r\n\r\n", /* Double space. */
+        "GET / HTTP/2.0\r\n\r\n", /* Not HTTP/1.x. */
+        "G(T / HTTP/1.1\r\n\r\n", /* Method isn't a token. */
+        "GET /a\x01 HTTP/1.1\r\n\r\n", /* Control char in URL. */
+        "GET / HTTP/1.1\r\nHost : a\r\n\r\n", /* Space before colon. */
+        "GET / HTTP/1.1\r\nA: b\r\n c\r\n\r\n", /* Folded field. */
+        "GET / HTTP/1.1\r\nA: b\x7f\r\n\r\n", /* Control char in value. */
+        "GET / HTTP/1.1\r\nA: 0123456789abcdef\x01xyz\r\n\r\n",
+        "GET / HTTP/1.1\r\nA: 0123456789\tabcdef\x7fxyz\r\n\r\n",
+        "GET /0123456789abcdef\tx HTTP/1.1\r\n\r\n", /* Tab in URL. */
+        "GET / HTTP/1.1\r\nNo colon\r\n\r\n",
+        "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+        "GET / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n",
+        "GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n",
+        "GET / HTTP/1.1\r\n"
+        "Content-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "GET / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n",
+    };
+    static const char* responses[] = {
+        "HTTP/1.1 20 OK\r\n\r\n",
+        "HTTP/1.1 200OK\r\n\r\n",
+        "HTTP/1.1 2x0 OK\r\n\r\n",
+        "HTTP/1.1 200 O\rK\r\n\r\n",
+    };
+    struct http_parser parser;
+    char* buf = NULL;
+    int len;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST http_parse() of malformed heads\n");
+    for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); ++i) {
+        assert(parse_all(&parser, requests[i], 1) == HTTP_PARSE_ERROR);
+    }
+    for (size_t i = 0; i < sizeof(responses) / sizeof(responses[0]); ++i) {
+        assert(parse_all(&parser, responses[i], 0) == HTTP_PARSE_ERROR);
+    }
+
+    /* Too many fields. */
+    buf = malloc(HTTP_MAX_HEAD_BYTES * 2);
+    len = sprintf(buf, "GET / HTTP/1.1\r\n");
+    for (int i = 0; i <= HTTP_MAX_FIELDS; ++i) {
+        len += sprintf(buf + len, "F%d: %d\r\n", i, i);
+    }
+    len += sprintf(buf + len, "\r\n");
+    http_parser_init(&parser, 1);
+    assert(http_parse(&parser, buf, len) == HTTP_PARSE_ERROR);
+
+    /* Too large a head, even if it's incomplete. */
+    len = sprintf(buf, "GET / HTTP/1.1\r\nA: ");
+    memset(buf + len, 'a', HTTP_MAX_HEAD_BYTES);
+    http_parser_init(&parser, 1);
+    assert(http_parse(&parser, buf, HTTP_MAX_HEAD_BYTES) ==
+           HTTP_PARSE_PARTIAL);
+    assert(http_parse(&parser, buf, HTTP_MAX_HEAD_BYTES + 1) ==
+           HTTP_PARSE_ERROR);
+
+    /* Field names take the token chars only. */
+    for (int c = 1; c < 256; ++c) {
+        if (c == ':') {
+            continue;
+        }
+        len = sprintf(buf, "GET / HTTP/1.1\r\nA%cB: v\r\n\r\n", c);
+        http_parser_init(&parser, 1);
+        assert((http_parse(&parser, buf, len) == HTTP_PARSE_DONE) ==
+               (isalnum(c) || strchr("!#$%&'*+-.^_`|~", c) != NULL));
+    }
+    free(buf);
+    buf = NULL;
+
+    /* Malformed chunk size. */
+    assert(parse_all(&parser,
+                     "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+                     1) == HTTP_PARSE_DONE);
+    assert(http_parse_body(&parser,
+                           "POST / HTTP/1.1\r\n"
+                           "Transfer-Encoding: chunked\r\n\r\n"
+                           "x\r\n",
+                           parser.head_len + 3) == HTTP_PARSE_ERROR);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_parse_fields(void)
+{
+    static const char* cache_control = "no-cache, max-age=60, "
+                                       "stale-if-error=\"99999999999\"";
+    static const char* head = "HTTP/1.1 304 Not Modified\r\n"
+                              "ETag: \"a\"\r\n"
+                              "cache-control: \t max-age=60 \r\n";
+    const char* field = NULL;
+    int field_len = 0;
+    char* hostname = NULL;
+    int port = -1;
+    int value = -1;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr,
+            "TEST parse_host_field(), parse_cache_directive() and "
+            "find_header_value()\n");
+    /* Only the given bytes are parsed. */
+    assert(parse_host_field("example.com:8080xyz", 16, &hostname, &port) == 0);
+    assert(strcmp(hostname, "example.com") == 0 && port == 8080);
+    free(hostname);
+    hostname = NULL;
+    port = -1;
+    assert(parse_host_field("example.com:", 12, &hostname, &port) == 0);
+    assert(strcmp(hostname, "example.com") == 0 && port == -1);
+    free(hostname);
+    hostname = NULL;
+
+    assert(parse_cache_directive(cache_control,
+                                 strlen(cache_control),
+                                 "MAX-AGE",
+                                 &value) == 1);
+    assert(value == 60);
+    assert(parse_cache_directive(cache_control,
+                                 strlen("no-cache, max-age=6"),
+                                 "max-age",
+                                 &value) == 1);
+    assert(value == 6);
+    assert(parse_cache_directive(cache_control,
+                                 strlen("no-cach"),
+                                 "no-cache",
+                                 &value) == 0);
+    assert(parse_cache_directive(cache_control,
+                                 strlen(cache_control),
+                                 "stale-if-error",
+                                 &value) == 1);
+    assert(value == 2147483647);
+
+    /* Values are trimmed in place, and only the given bytes are searched. */
+    assert(find_header_value(head,
+                             strlen(head),
+                             "Cache-Control",
+                             &field,
+                             &field_len) == 1);
+    assert(field_len == 10 && strncmp(field, "max-age=60", 10) == 0);
+    assert(field > head && field < head + strlen(head));
+    assert(find_header_value(head,
+                             strlen("HTTP/1.1 304 Not Modified\r\n"
+                                    "ETag: \"a\"\r\n"),
+                             "Cache-Control",
+                             &field,
+                             &field_len) == 0);
+    assert(find_header_value(head,
+                             strlen(head),
+                             "Last-Modified",
+                             &field,
+                             &field_len) == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_http_scan_kernel(void)
+{
+    /* Chars to place in a run, and whether each is a token char and field
+     * text. */
+    static const struct {
+        unsigned char c;
+        int is_token;
+        int is_text;
+    } chars[] = {
+        {'a', 1, 1}, {'~', 1, 1}, {' ', 0, 1}, {'\t', 0, 1}, {'(', 0, 1},
+        {'"', 0, 1}, {0x01, 0, 0}, {0x1f, 0, 0}, {0x7f, 0, 0}, {0x80, 0, 1},
+        {0xff, 0, 1},
+    };
+    struct http_parser parser;
+    char buf[256];
+    int len;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr,
+            "TEST http_parse() with kernel %d\n",
+            http_scan_get_kernel());
+    /* A char at every offset of names and values, across the 8, 16 and 32
+     * byte blocks of the kernels and their tails. */
+    for (int run = 1; run <= 100; ++run) {
+        for (int i = 0; i < run; ++i) {
+            for (size_t j = 0; j < sizeof(chars) / sizeof(chars[0]); ++j) {
+                len = sprintf(buf, "GET / HTTP/1.1\r\n");
+                memset(buf + len, 'n', run);
+                buf[len + i] = chars[j].c;
+                len += run;
+                len += sprintf(buf + len, ": v\r\n\r\n");
+                http_parser_init(&parser, 1);
+                assert((http_parse(&parser, buf, len) == HTTP_PARSE_DONE) ==
+                       chars[j].is_token);
+
+                len = sprintf(buf, "GET / HTTP/1.1\r\nA: <");
+                memset(buf + len, 'v', run);
+                buf[len + i] = chars[j].c;
+                len += run;
+                len += sprintf(buf + len, ">\r\n\r\n");
+                http_parser_init(&parser, 1);
+                assert((http_parse(&parser, buf, len) == HTTP_PARSE_DONE) ==
+                       chars[j].is_text);
+                if (chars[j].is_text) {
+                    assert(parser.fields[0].value.len == run + 2);
+                }
+            }
+        }
+    }
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    static const enum http_scan_kernel kernels[] = {
+        HTTP_SCAN_SCALAR,
+        HTTP_SCAN_SSE42,
+        HTTP_SCAN_AVX2,
+    };
+
+    fprintf(stderr, "====================\n");
+    /* Each kernel the CPU supports must parse alike. */
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        if (http_scan_set_kernel(kernels[i]) < 0) {
+            fprintf(stderr, "SKIP kernel %d, not supported\n", kernels[i]);
+            continue;
+        }
+        test_http_scan_kernel();
+        test_http_parse_request();
+        test_http_parse_body();
+        test_http_parse_response();
+        test_http_parse_error();
+    }
+    test_scan_body();
+    test_parse_fields();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+/**************************************************************
+*
+*                       test_inflight.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Test driver for table of fetches in flight.
+*
+**************************************************************/
+
+#include "inflight.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_KEYS 5000
+
+void test_inflight_add_find(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST inflight_add() and inflight_find()\n");
+    assert(inflight_find("www.example.com/") == -1);
+    assert(inflight_add("www.example.com/", 5) == 1);
+    assert(inflight_find("www.example.com/") == 5);
+    assert(inflight_find("www.example.com/a") == -1);
+    assert(inflight_size() == 1);
+
+    /* One fetch per key. */
+    assert(inflight_add("www.example.com/", 6) == 0);
+    assert(inflight_find("www.example.com/") == 5);
+    assert(inflight_add("www.example.com/a", 6) == 1);
+    assert(inflight_size() == 2);
+    inflight_clear();
+    assert(inflight_size() == 0);
+    assert(inflight_find("www.example.com/") == -1);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_inflight_remove(void)
+{
+    char key[32];
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST inflight_remove()\n");
+    assert(inflight_remove(NULL, 5, NULL, NULL) == 0);
+    assert(inflight_remove("www.example.com/", 5, NULL, NULL) == 0);
+    assert(inflight_add("www.example.com/", 5) == 1);
+
+    /* Only the socket of the fetch removes it. */
+    assert(inflight_remove("www.example.com/", 6, NULL, NULL) == 0);
+    assert(inflight_find("www.example.com/") == 5);
+    assert(inflight_remove("www.example.com/", 5, NULL, NULL) == 1);
+    assert(inflight_find("www.example.com/") == -1);
+    assert(inflight_size() == 0);
+
+    /* Many keys share buckets. */
+    for (int i = 0; i < NUM_KEYS; ++i) {
+        snprintf(key, sizeof(key), "host/%d", i);
+        assert(inflight_add(key, i) == 1);
+    }
+    assert(inflight_size() == NUM_KEYS);
+    for (int i = 0; i < NUM_KEYS; i += 2) {
+        snprintf(key, sizeof(key), "host/%d", i);
+        assert(inflight_remove(key, i, NULL, NULL) == 1);
+    }
+    for (int i = 0; i < NUM_KEYS; ++i) {
+        snprintf(key, sizeof(key), "host/%d", i);
+        assert(inflight_find(key) == (i % 2 ? i : -1));
+    }
+    assert(inflight_size() == NUM_KEYS / 2);
+    inflight_clear();
+    assert(inflight_size() == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_inflight_waiters(void)
+{
+    const struct inflight_waiter* waiters = NULL;
+    struct inflight_waiter* removed = NULL;
+    int num = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST inflight_attach() and inflight_waiters()\n");
+    assert(inflight_attach("www.example.com/", 7, 1) == 0);
+    assert(inflight_add("www.example.com/", 5) == 1);
+    assert(inflight_waiters("www.example.com/", 5, &waiters) == 0);
+    assert(inflight_waiters(NULL, 5, &waiters) == 0);
+
+    /* Waiters are kept in order. */
+    for (int i = 0; i < 100; ++i) {
+        assert(inflight_attach("www.example.com/", 7 + i, 100 + i) == 1);
+    }
+    assert(inflight_waiters("www.example.com/", 6, &waiters) == 0);
+    assert(inflight_waiters("www.example.com/", 5, &waiters) == 100);
+    for (int i = 0; i < 100; ++i) {
+        assert(waiters[i].fd == 7 + i && waiters[i].id == 100ul + i);
+    }
+
+    /* Removing the fetch hands its waiters over. */
+    assert(inflight_remove("www.example.com/", 5, &removed, &num) == 1);
+    assert(num == 100 && removed[99].fd == 106);
+    free(removed);
+    assert(inflight_waiters("www.example.com/", 5, &waiters) == 0);
+
+    /* Or drops them. */
+    assert(inflight_add("www.example.com/", 5) == 1);
+    assert(inflight_remove("www.example.com/", 5, &removed, &num) == 1);
+    assert(num == 0 && removed == NULL);
+    assert(inflight_add("www.example.com/", 5) == 1);
+    assert(inflight_attach("www.example.com/", 7, 1) == 1);
+    assert(inflight_remove("www.example.com/", 5, NULL, NULL) == 1);
+    assert(inflight_add("www.example.com/", 5) == 1);
+    assert(inflight_attach("www.example.com/", 7, 1) == 1);
+    inflight_clear();
+    assert(inflight_size() == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_inflight_add_find();
+    test_inflight_remove();
+    test_inflight_waiters();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -98,6 +98,29 @@ void test_PLOG_ERROR(void)
     fprintf(stderr, "--------------------------\n\n");
 }
 
+void test_set_log_tag(void)
+{
+    fprintf(stderr, "---- TEST set_log_tag ----\n");
+
+    /* Normal. */
+    set_log_tag("worker 3");
+    LOG_INFO("Hello, world!");
+
+    /* Tag longer than the tag buffer is truncated. */
+    set_log_tag("a very long tag that exceeds 64 bytes"
+                "a very long tag that exceeds 64 bytes");
+    LOG_INFO("Hello, world!");
+
+    /* Empty string and NULL clear the tag. */
+    set_log_tag("");
+    LOG_INFO("Hello, world!");
+    set_log_tag(NULL);
+    LOG_INFO("Hello, world!");
+
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------------\n\n");
+}
+
 void test_LOG_FATAL(void)
 {
     fprintf(stderr, "---- TEST LOG_FATAL ----\n");
@@ -148,6 +171,7 @@ int main(void)
     test_LOG_INFO();
     test_LOG_ERROR();
     test_PLOG_ERROR();
+    test_set_log_tag();
     // test_LOG_FATAL();
     // test_PLOG_FATAL();
 
@@ -0,0 +1,361 @@
+/**************************************************************
+*
+*                      test_out_queue.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Test driver for outbound queue, using non-blocking
+*     socket pairs.
+*
+**************************************************************/
+
+#include "out_queue.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DATA_SIZE (1024 * 1024)
+
+static char data[DATA_SIZE]; /* Data to send, a byte pattern. */
+static char received[DATA_SIZE]; /* Data read from the other end. */
+static int num_released = 0; /* Number of released references. */
+
+/* Count released references. */
+void count_release(void* arg)
+{
+    assert(arg == data);
+    ++num_released;
+}
+
+/* Make a socket pair whose first end is non-blocking with a small send
+ * buffer. */
+void make_pair(int fds[2])
+{
+    int size = 4096;
+
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    assert(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+    assert(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size))
+           == 0);
+}
+
+/* Read whatever is available from a socket after the given offset. */
+int read_available(int fd, int offset)
+{
+    int n;
+
+    while (offset < DATA_SIZE) {
+        n = read(fd, received + offset, DATA_SIZE - offset);
+        if (n < 0) {
+            assert(errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
+        }
+        assert(n > 0);
+        offset += n;
+    }
+    return offset;
+}
+
+void test_out_queue_push(void)
+{
+    struct out_queue queue;
+    struct out_chunk* chunk;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST out_queue_push()\n");
+    out_queue_init(&queue);
+    assert(out_queue_push(&queue, data, 0) == 0);
+    assert(queue.head == NULL);
+
+    /* Small pieces share a chunk. */
+    for (int i = 0; i < 10; ++i) {
+        assert(out_queue_push(&queue, data + i * 100, 100) == 0);
+    }
+    assert(queue.size == 1000);
+    assert(queue.head == queue.tail);
+    assert(memcmp(queue.head->data, data, 1000) == 0);
+
+    /* A large piece fills the chunk up, and the rest takes one chunk. */
+    assert(out_queue_push(&queue, data + 1000, OUT_CHUNK_SIZE * 3) == 0);
+    assert(queue.size == 1000 + OUT_CHUNK_SIZE * 3);
+    chunk = queue.head;
+    assert(chunk->end == OUT_CHUNK_SIZE);
+    assert(chunk->next == queue.tail);
+    assert(queue.tail->end == 1000 + OUT_CHUNK_SIZE * 2);
+    assert(memcmp(queue.tail->data,
+                  data + OUT_CHUNK_SIZE,
+                  queue.tail->end) == 0);
+
+    out_queue_clear(&queue);
+    assert(queue.head == NULL && queue.tail == NULL && queue.size == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_out_queue_send_direct(void)
+{
+    struct out_queue queue;
+    int fds[2];
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST out_queue_send() to a writable socket\n");
+    make_pair(fds);
+    out_queue_init(&queue);
+
+    /* Nothing is copied if the socket takes it all. */
+    assert(out_queue_send(&queue, fds[0], NULL, data, 100) == 0);
+    assert(queue.size == 0 && queue.head == NULL);
+    assert(read_available(fds[1], 0) == 100);
+    assert(memcmp(received, data, 100) == 0);
+
+    out_queue_clear(&queue);
+    close(fds[0]);
+    close(fds[1]);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_out_queue_send_backlog(void)
+{
+    struct out_queue queue;
+    int fds[2];
+    int total = 0;
+    int offset = 0;
+    int n;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST out_queue_send() and out_queue_flush() when the "
+                    "socket is full\n");
+    make_pair(fds);
+    out_queue_init(&queue);
+
+    /* The socket takes part of the data; the rest is queued in order. */
+    for (; total < DATA_SIZE; total += 4096) {
+        assert(out_queue_send(&queue, fds[0], NULL, data + total, 4096)
+               == 0);
+    }
+    assert(queue.size > 0);
+    assert(out_queue_flush(&queue, fds[0], NULL) == 0);
+
+    /* Drain the other end and flush until the queue is empty. */
+    do {
+        offset = read_available(fds[1], offset);
+        n = out_queue_flush(&queue, fds[0], NULL);
+        assert(n >= 0);
+    } while (n == 0);
+    assert(queue.size == 0 && queue.head == NULL && queue.tail == NULL);
+    offset = read_available(fds[1], offset);
+    assert(offset == DATA_SIZE);
+    assert(memcmp(received, data, DATA_SIZE) == 0);
+
+    /* An empty queue writes directly again. */
+    assert(out_queue_send(&queue, fds[0], NULL, data, 10) == 0);
+    assert(queue.size == 0);
+
+    out_queue_clear(&queue);
+    close(fds[0]);
+    close(fds[1]);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_out_queue_send_ref(void)
+{
+    struct out_queue queue;
+    int fds[2];
+    int offset = 0;
+    int n;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST out_queue_send_ref() queues data by reference\n");
+    make_pair(fds);
+    out_queue_init(&queue);
+    num_released = 0;
+
+    /* Data written right away is released right away. */
+    assert(out_queue_send_ref(&queue,
+                              fds[0],
+                              NULL,
+                              data,
+                              100,
+                              count_release,
+                              data) == 0);
+    assert(num_released == 1 && queue.size == 0);
+    offset = read_available(fds[1], offset);
+    assert(offset == 100);
+
+    /* The rest is referenced, not copied, and copies don't fill it up. */
+    assert(out_queue_send_ref(&queue,
+                              fds[0],
+                              NULL,
+                              data + 100,
+                              DATA_SIZE / 2 - 100,
+                              count_release,
+                              data) == 0);
+    assert(num_released == 1 && queue.size > 0);
+    assert(queue.tail->ref != NULL && queue.tail->ref >= data + 100);
+    assert(out_queue_push(&queue, data + DATA_SIZE / 2, 100) == 0);
+    assert(queue.tail->ref == NULL);
+    assert(out_queue_send_ref(&queue,
+                              fds[0],
+                              NULL,
+                              data + DATA_SIZE / 2 + 100,
+                              DATA_SIZE / 2 - 100,
+                              count_release,
+                              data) == 0);
+    assert(queue.tail->ref == data + DATA_SIZE / 2 + 100);
+    assert(num_released == 1);
+
+    do {
+        offset = read_available(fds[1], offset);
+        n = out_queue_flush(&queue, fds[0], NULL);
+        assert(n >= 0);
+    } while (n == 0);
+    offset = read_available(fds[1], offset);
+    assert(offset == DATA_SIZE);
+    assert(memcmp(received, data, DATA_SIZE) == 0);
+    assert(num_released == 3);
+
+    /* Clearing the queue releases what is left. */
+    assert(out_queue_push_ref(&queue, data, 100, count_release, data) == 0);
+    out_queue_clear(&queue);
+    assert(num_released == 4);
+
+    close(fds[0]);
+    close(fds[1]);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_out_queue_sendv_ref(void)
+{
+    struct out_queue queue;
+    struct iovec iovs[3];
+    int fds[2];
+    int offset = 0;
+    int n;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST out_queue_sendv_ref() writes pieces at once\n");
+    make_pair(fds);
+    out_queue_init(&queue);
+    num_released = 0;
+
+    /* Small pieces go out in one write. */
+    iovs[0].iov_base = data;
+    iovs[0].iov_len = 10;
+    iovs[1].iov_base = data + 10;
+    iovs[1].iov_len = 0;
+    iovs[2].iov_base = data + 10;
+    iovs[2].iov_len = 90;
+    assert(out_queue_sendv_ref(&queue,
+                               fds[0],
+                               NULL,
+                               iovs,
+                               3,
+                               count_release,
+                               data) == 0);
+    assert(num_released == 1 && queue.size == 0);
+    offset = read_available(fds[1], offset);
+    assert(offset == 100);
+
+    /* A full socket takes part of the pieces; the small ones left are copied,
+     * and the last one is referenced. */
+    iovs[0].iov_base = data + 100;
+    iovs[0].iov_len = 100;
+    iovs[1].iov_base = data + 200;
+    iovs[1].iov_len = DATA_SIZE - 200;
+    assert(out_queue_sendv_ref(&queue,
+                               fds[0],
+                               NULL,
+                               iovs,
+                               2,
+                               count_release,
+                               data) == 0);
+    assert(num_released == 1 && queue.size > 0);
+    assert(queue.tail->ref != NULL);
+    do {
+        offset = read_available(fds[1], offset);
+        n = out_queue_flush(&queue, fds[0], NULL);
+        assert(n >= 0);
+    } while (n == 0);
+    offset = read_available(fds[1], offset);
+    assert(offset == DATA_SIZE);
+    assert(memcmp(received, data, DATA_SIZE) == 0);
+    assert(num_released == 2);
+
+    /* Pieces wait for queued data. */
+    assert(out_queue_push(&queue, data, 10) == 0);
+    iovs[0].iov_base = data + 10;
+    iovs[0].iov_len = 10;
+    iovs[1].iov_base = data + 20;
+    iovs[1].iov_len = 10;
+    assert(out_queue_sendv_ref(&queue,
+                               fds[0],
+                               NULL,
+                               iovs,
+                               2,
+                               count_release,
+                               data) == 0);
+    assert(queue.size == 30);
+    assert(queue.head->end == 20 && queue.head->next == queue.tail);
+    assert(queue.tail->ref == data + 20);
+
+    out_queue_clear(&queue);
+    assert(num_released == 3);
+    close(fds[0]);
+    close(fds[1]);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_out_queue_broken(void)
+{
+    struct out_queue queue;
+    int fds[2];
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST out_queue_flush() on a broken socket\n");
+    make_pair(fds);
+    out_queue_init(&queue);
+    assert(out_queue_push(&queue, data, 100) == 0);
+    close(fds[1]);
+    assert(out_queue_flush(&queue, fds[0], NULL) < 0);
+    assert(out_queue_send(&queue, fds[0], NULL, data, 100) == 0);
+    assert(queue.size == 200);
+
+    out_queue_clear(&queue);
+    close(fds[0]);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    /* Broken sockets are reported by errors instead. */
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < DATA_SIZE; ++i) {
+        data[i] = (char)(i * 7 + i / 251);
+    }
+
+    fprintf(stderr, "====================\n");
+    test_out_queue_push();
+    test_out_queue_send_direct();
+    test_out_queue_send_backlog();
+    test_out_queue_send_ref();
+    test_out_queue_sendv_ref();
+    test_out_queue_broken();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,309 @@
+###############################################################
+#
+#                    test_proxy_collapse.py
+#
+#     Final Project: High Performance HTTP Proxy
+#     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+#     Date: 2026-10-16
+#
+#     Summary:
+#     Intergration tests for collapsed forwarding: concurrent
+#     requests for the same response share a single fetch from
+#     a local origin stub that counts the requests it gets.
+#
+#     Usage: python3 test_proxy_collapse.py [port]
+#     where [port] is the port that the proxy listens on,
+#     9999 by default.
+#
+###############################################################
+
+import concurrent.futures
+import http.server
+import socket
+import sys
+import threading
+import time
+import unittest
+import urllib.error
+import urllib.parse
+import urllib.request
+
+import proxy_test_utils
+
+
+MAX_AGE = 2  # Max age of the responses of the origin stub in seconds.
+BODY_SIZE = 1000000  # Byte size of each response body.
+DELAY = 1  # Seconds that the origin stub pauses in the middle of each body.
+NUM_CLIENTS = 10  # Number of concurrent clients.
+LARGE_SIZE = 128 << 20  # Byte size of the body of a large response.
+WRITE_SIZE = 64 << 10  # Byte size of each write of a large body.
+MAX_RSS = 64 << 20  # Max peak memory of the proxy, in bytes.
+
+
+class OriginStub(http.server.BaseHTTPRequestHandler):
+    '''
+    @brief Origin that serves a body per path slowly: it sends the first half,
+    pauses, then sends the rest. Paths that start with "/large" pause before
+    the head instead, then send a body of LARGE_SIZE bytes. Paths that start
+    with "/private" pause before the head too, then send a response for each
+    request: a 500 if the path ends with "500", or a 200 that sets a cookie.
+    '''
+    protocol_version = "HTTP/1.1"
+    num_requests = {}  # Number of requests got per path.
+    lock = threading.Lock()
+
+    def do_GET(self):
+        cls = OriginStub
+        # The proxy forwards the absolute URL.
+        self.path = urllib.parse.urlparse(self.path).path
+        with cls.lock:
+            cls.num_requests[self.path] = cls.num_requests.get(self.path, 0) + 1
+            num_requests = cls.num_requests[self.path]
+        if self.path.startswith("/private"):
+            time.sleep(DELAY)
+            body = "{} {}".format(self.path, num_requests).encode()
+            if self.path.endswith("500"):
+                self.send_response(500)
+            else:
+                self.send_response(200)
+                self.send_header("Set-Cookie", "id={}".format(num_requests))
+            self.send_header("Cache-Control", "max-age={}".format(MAX_AGE))
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            return
+        if self.path.startswith("/large"):
+            time.sleep(DELAY)
+            self.send_response(200)
+            self.send_header("Content-Length", str(LARGE_SIZE))
+            self.end_headers()
+            block = b"x" * WRITE_SIZE
+            for _ in range(LARGE_SIZE // WRITE_SIZE):
+                self.wfile.write(block)
+            return
+        body = expected_body(self.path)
+        self.send_response(200)
+        self.send_header("Cache-Control", "max-age={}".format(MAX_AGE))
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body[:len(body) // 2])
+        self.wfile.flush()
+        time.sleep(DELAY)
+        self.wfile.write(body[len(body) // 2:])
+
+    def log_message(self, *args):
+        pass
+
+
+def expected_body(path):
+    '''
+    @brief Get the body that the origin stub serves for a path.
+    '''
+    return ("{}\n".format(path) * BODY_SIZE).encode()[:BODY_SIZE]
+
+
+class TestProxyCollapse(proxy_test_utils.ProxyTestCase):
+    ORIGIN_HANDLER = OriginStub
+
+
+    def get(self, path, headers={}):
+        '''
+        @brief GET a path of the origin stub via proxy.
+        @param path Path to get.
+        @param headers Extra request fields.
+        @return Status code and body of the response.
+        '''
+        request = urllib.request.Request(self.origin_url + path,
+                                         headers=headers)
+        with self.opener.open(request, timeout=10) as response:
+            return response.status, response.read()
+
+
+    def get_concurrently(self, path, headers={}):
+        '''
+        @brief GET a path by many clients at once, and check their responses.
+        @param path Path to get.
+        @param headers Extra request fields.
+        '''
+        with concurrent.futures.ThreadPoolExecutor(NUM_CLIENTS) as executor:
+            futures = [executor.submit(self.get, path, headers)
+                       for _ in range(NUM_CLIENTS)]
+            for future in futures:
+                self.assertEqual(future.result(), (200, expected_body(path)))
+
+
+    def request(self, path):
+        '''
+        @brief Send a GET request for a path of the origin stub to the proxy on
+        a new connection.
+        @param path Path to get.
+        @return Socket of the connection.
+        '''
+        client = socket.create_connection(("localhost", self.PORT))
+        client.sendall("GET {}{} HTTP/1.1\r\nHost: {}\r\n\r\n".format(
+            self.origin_url,
+            path,
+            urllib.parse.urlparse(self.origin_url).netloc).encode())
+        return client
+
+
+    def read_body_len(self, client):
+        '''
+        @brief Read a response with a Content-Length, and count its body.
+        @param client Socket of the connection.
+        @return Status code and byte size of the body.
+        '''
+        reader = client.makefile("rb")
+        status = int(reader.readline().split()[1])
+        length = 0
+        for line in iter(reader.readline, b"\r\n"):
+            name, _, value = line.decode().partition(":")
+            if name.lower() == "content-length":
+                length = int(value)
+        received = 0
+        while received < length:
+            data = reader.read(min(length - received, 1 << 20))
+            if not data:
+                break
+            received += len(data)
+        reader.close()
+        return status, received
+
+
+    def peak_rss(self):
+        '''
+        @brief Get the peak resident memory of the proxy in bytes.
+        '''
+        with open("/proc/{}/status".format(self.proxy_process.pid)) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1]) * 1024
+        return 0
+
+
+    def test_concurrent_misses(self):
+        ''' Concurrent misses share a single fetch. '''
+        path = "/miss"
+        print("TEST concurrent misses {}".format(path))
+        self.get_concurrently(path)
+        self.assertEqual(OriginStub.num_requests.get(path), 1)
+        print("PASS")
+
+
+    def test_expiry(self):
+        ''' Concurrent requests for an expired response share a single fetch. '''
+        path = "/expire"
+        print("TEST concurrent requests at expiry {}".format(path))
+        self.assertEqual(self.get(path), (200, expected_body(path)))
+        time.sleep(MAX_AGE + 1)
+        self.get_concurrently(path)
+        self.assertEqual(OriginStub.num_requests.get(path), 2)
+        print("PASS")
+
+
+    def test_first_client_leaves(self):
+        '''
+        A waiter that attaches in the middle of the fetch gets the whole
+        response, even if the client that started the fetch leaves.
+        '''
+        path = "/leave"
+        print("TEST first client leaves {}".format(path))
+        first = socket.create_connection(("localhost", self.PORT))
+        first.sendall("GET {}{} HTTP/1.1\r\nHost: {}\r\n\r\n".format(
+            self.origin_url,
+            path,
+            urllib.parse.urlparse(self.origin_url).netloc).encode())
+        first.recv(1)  # Wait for the first half.
+        with concurrent.futures.ThreadPoolExecutor(1) as executor:
+            future = executor.submit(self.get, path)
+            time.sleep(DELAY / 4)
+            first.close()
+            self.assertEqual(future.result(), (200, expected_body(path)))
+        self.assertEqual(OriginStub.num_requests.get(path), 1)
+        print("PASS")
+
+
+    def get_private(self, path):
+        '''
+        @brief GET a path of the origin stub via proxy, whatever its status.
+        @param path Path to get.
+        @return Status code, Set-Cookie field and body of the response.
+        '''
+        request = urllib.request.Request(self.origin_url + path)
+        try:
+            with self.opener.open(request, timeout=10) as response:
+                return (response.status,
+                        response.headers.get("Set-Cookie"),
+                        response.read())
+        except urllib.error.HTTPError as e:
+            return e.code, e.headers.get("Set-Cookie"), e.read()
+
+
+    def test_private(self):
+        '''
+        Responses that aren't cached, e.g. errors or those that set cookies,
+        aren't shared: each waiter gets a response of its own.
+        '''
+        for path, status in (("/private-500", 500), ("/private-cookie", 200)):
+            print("TEST private responses {}".format(path))
+            with concurrent.futures.ThreadPoolExecutor(NUM_CLIENTS) as executor:
+                futures = [executor.submit(self.get_private, path)
+                           for _ in range(NUM_CLIENTS)]
+                responses = [future.result() for future in futures]
+            self.assertEqual({r[0] for r in responses}, {status})
+            self.assertEqual(len({r[2] for r in responses}), NUM_CLIENTS)
+            if status == 200:
+                self.assertEqual(len({r[1] for r in responses}), NUM_CLIENTS)
+            self.assertEqual(OriginStub.num_requests.get(path), NUM_CLIENTS)
+            print("PASS")
+
+
+    def test_slow_waiter(self):
+        '''
+        A waiter that doesn't read holds back the fetch, instead of having the
+        whole response queued for it, even one too large to cache.
+        '''
+        path = "/large-slow-waiter"
+        print("TEST slow waiter {}".format(path))
+        first = self.request(path)
+        time.sleep(DELAY / 4)  # Wait for the fetch to start.
+        waiter = self.request(path)
+        with concurrent.futures.ThreadPoolExecutor(1) as executor:
+            future = executor.submit(self.read_body_len, first)
+            time.sleep(DELAY + 2)
+            self.assertLess(self.peak_rss(), MAX_RSS)
+            self.assertEqual(self.read_body_len(waiter), (200, LARGE_SIZE))
+            self.assertEqual(future.result(), (200, LARGE_SIZE))
+        first.close()
+        waiter.close()
+        self.assertEqual(OriginStub.num_requests.get(path), 1)
+        self.assertLess(self.peak_rss(), MAX_RSS)
+        print("PASS")
+
+
+    def test_range(self):
+        ''' Range requests aren't shared. '''
+        path = "/range"
+        print("TEST range requests {}".format(path))
+        self.get_concurrently(path, {"Range": "bytes=0-"})
+        self.assertEqual(OriginStub.num_requests.get(path), NUM_CLIENTS)
+        print("PASS")
+
+
+    def test_credentials(self):
+        ''' Requests with credentials aren't shared. '''
+        for field, value in (("Authorization", "Basic dXNlcjpwYXNz"),
+                             ("Cookie", "session=1")):
+            path = "/credentials/" + field
+            print("TEST requests with {} {}".format(field, path))
+            self.get_concurrently(path, {field: value})
+            self.assertEqual(OriginStub.num_requests.get(path), NUM_CLIENTS)
+            print("PASS")
+
+
+if __name__ == "__main__":
+    # Parse command line arguments.
+    if (len(sys.argv) == 2):
+        TestProxyCollapse.PORT = int(sys.argv.pop())
+
+    unittest.main()
@@ -0,0 +1,258 @@
+###############################################################
+#
+#                  test_proxy_revalidate.py
+#
+#     Final Project: High Performance HTTP Proxy
+#     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+#     Date: 2026-10-16
+#
+#     Summary:
+#     Intergration tests for revalidation and serving of stale
+#     cached responses, against a local origin stub that
+#     counts the full and "304 Not Modified" responses it
+#     sends.
+#
+#     Usage: python3 test_proxy_revalidate.py [port]
+#     where [port] is the port that the proxy listens on,
+#     9999 by default.
+#
+###############################################################
+
+import http.server
+import sys
+import threading
+import time
+import unittest
+import urllib.parse
+import urllib.request
+
+import proxy_test_utils
+
+
+MAX_AGE = 2  # Max age of the responses of the origin stub in seconds.
+STALE_LIMIT = 60  # Seconds that some responses may be served once stale.
+BODY_SIZE = 100000  # Byte size of each response body.
+
+
+class OriginStub(http.server.BaseHTTPRequestHandler):
+    '''
+    @brief Origin that serves a body per path, with an ETag or a Last-Modified
+    validator or a stale limit depending on the path, and answers conditional
+    requests.
+    '''
+    protocol_version = "HTTP/1.1"
+    version = 1  # Version of the bodies; bumped to change them.
+    delay = 0  # Seconds to wait before each response.
+    num_full = {}  # Number of full responses sent per path.
+    num_not_modified = {}  # Number of 304 responses sent per path.
+    conditions = {}  # Conditional fields of the last request per path.
+
+    def do_GET(self):
+        cls = OriginStub
+        # The proxy forwards the absolute URL.
+        self.path = urllib.parse.urlparse(self.path).path
+        etag = '"v{}"'.format(cls.version)
+        last_modified = "Sat, 0{} Jan 2022 00:00:00 GMT".format(cls.version)
+        cls.conditions[self.path] = (self.headers.get("If-None-Match"),
+                                     self.headers.get("If-Modified-Since"))
+        cache_control = "max-age={}".format(MAX_AGE)
+        if self.path.startswith("/swr"):
+            cache_control += ", stale-while-revalidate={}".format(STALE_LIMIT)
+        elif self.path.startswith("/sie"):
+            cache_control += ", stale-if-error={}".format(STALE_LIMIT)
+        time.sleep(cls.delay)
+        validators = []
+        not_modified = False
+        if self.path.startswith("/etag"):
+            validators.append(("ETag", etag))
+            not_modified = self.headers.get("If-None-Match") == etag
+        elif self.path.startswith("/last-modified"):
+            validators.append(("Last-Modified", last_modified))
+            not_modified = (self.headers.get("If-Modified-Since") ==
+                            last_modified)
+
+        if not_modified:
+            cls.num_not_modified[self.path] = (
+                cls.num_not_modified.get(self.path, 0) + 1)
+            self.send_response(304)
+            for name, value in validators:
+                self.send_header(name, value)
+            self.send_header("Cache-Control", cache_control)
+            self.end_headers()
+            return
+
+        cls.num_full[self.path] = cls.num_full.get(self.path, 0) + 1
+        body = ("{} v{}\n".format(self.path, cls.version) * BODY_SIZE).encode()
+        body = body[:BODY_SIZE]
+        self.send_response(200)
+        for name, value in validators:
+            self.send_header(name, value)
+        self.send_header("Cache-Control", cache_control)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+class TestProxyRevalidate(proxy_test_utils.ProxyTestCase):
+    ORIGIN_HANDLER = OriginStub
+
+
+    def get(self, path, headers={}, origin_url=None):
+        '''
+        @brief GET a path of the origin stub via proxy.
+        @param path Path to get.
+        @param headers Extra request fields.
+        @param origin_url URL of another origin stub to get it from.
+        @return Status code and body of the response.
+        '''
+        request = urllib.request.Request((origin_url or self.origin_url) + path,
+                                         headers=headers)
+        try:
+            with self.opener.open(request, timeout=5) as response:
+                return response.status, response.read()
+        except urllib.error.HTTPError as error:
+            return error.code, error.read()
+
+
+    def expected_body(self, path):
+        '''
+        @brief Get the body that the origin stub serves for a path now.
+        '''
+        body = "{} v{}\n".format(path, OriginStub.version) * BODY_SIZE
+        return body.encode()[:BODY_SIZE]
+
+
+    def check_revalidated(self, path):
+        '''
+        @brief Check that a stale response of a path with a validator is
+        revalidated instead of fetched again, and replaced once it changes.
+        @param path Path to get.
+        '''
+        print("TEST revalidate {}".format(path))
+        OriginStub.version = 1
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        self.assertEqual(OriginStub.num_full.get(path), 1)
+
+        # The stale response is served once the origin confirms it.
+        time.sleep(MAX_AGE + 1)
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        self.assertEqual(OriginStub.num_full.get(path), 1)
+        self.assertEqual(OriginStub.num_not_modified.get(path), 1)
+
+        # Then it's fresh again.
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        self.assertEqual(OriginStub.num_not_modified.get(path), 1)
+
+        # A changed response replaces the stale one.
+        time.sleep(MAX_AGE + 1)
+        OriginStub.version = 2
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        self.assertEqual(OriginStub.num_full.get(path), 2)
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        self.assertEqual(OriginStub.num_full.get(path), 2)
+        self.assertEqual(OriginStub.num_not_modified.get(path), 1)
+        print("PASS")
+
+
+    def test_etag(self):
+        self.check_revalidated("/etag")
+        self.assertEqual(OriginStub.conditions["/etag"], ('"v1"', None))
+
+
+    def test_last_modified(self):
+        self.check_revalidated("/last-modified")
+        self.assertEqual(OriginStub.conditions["/last-modified"],
+                         (None, "Sat, 01 Jan 2022 00:00:00 GMT"))
+
+
+    def test_no_validator(self):
+        ''' A stale response without a validator is fetched again. '''
+        path = "/plain"
+        print("TEST no validator {}".format(path))
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        time.sleep(MAX_AGE + 1)
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        self.assertEqual(OriginStub.num_full.get(path), 2)
+        self.assertEqual(OriginStub.conditions[path], (None, None))
+        print("PASS")
+
+
+    def test_client_conditional(self):
+        ''' A request conditional on its own gets the answer of the origin. '''
+        path = "/etag-client"
+        print("TEST client conditional {}".format(path))
+        OriginStub.version = 1
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        time.sleep(MAX_AGE + 1)
+        status, body = self.get(path, {"If-None-Match": '"v1"'})
+        self.assertEqual((status, body), (304, b""))
+        self.assertEqual(OriginStub.num_full.get(path), 1)
+        self.assertEqual(OriginStub.num_not_modified.get(path), 1)
+        print("PASS")
+
+
+    def test_stale_while_revalidate(self):
+        '''
+        A stale response within its stale-while-revalidate limit is served
+        right away, while a single refresh runs in the background.
+        '''
+        path = "/swr"
+        print("TEST stale-while-revalidate {}".format(path))
+        OriginStub.version = 1
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        time.sleep(MAX_AGE + 1)
+
+        # A slow origin doesn't slow down the stale responses.
+        OriginStub.delay = MAX_AGE
+        try:
+            for _ in range(3):
+                start = time.time()
+                status, body = self.get(path)
+                self.assertLess(time.time() - start, MAX_AGE / 2)
+                self.assertEqual((status, body),
+                                 (200, self.expected_body(path)))
+            OriginStub.version = 2
+            time.sleep(MAX_AGE + 1)
+        finally:
+            OriginStub.delay = 0
+        self.assertEqual(OriginStub.num_full.get(path), 2)
+
+        # The refreshed response is fresh.
+        self.assertEqual(self.get(path), (200, self.expected_body(path)))
+        self.assertEqual(OriginStub.num_full.get(path), 2)
+        print("PASS")
+
+
+    def test_stale_if_error(self):
+        '''
+        A stale response within its stale-if-error limit is served if its
+        origin can't be reached; others get "502 Bad Gateway".
+        '''
+        print("TEST stale-if-error")
+        OriginStub.version = 1
+        origin = http.server.ThreadingHTTPServer(("127.0.0.1", 0), OriginStub)
+        origin_url = "http://127.0.0.1:{}".format(origin.server_port)
+        threading.Thread(target=origin.serve_forever, daemon=True).start()
+        for path in ["/sie", "/plain-sie"]:
+            self.assertEqual(self.get(path, origin_url=origin_url),
+                             (200, self.expected_body(path)))
+        origin.shutdown()
+        origin.server_close()
+        time.sleep(MAX_AGE + 1)
+
+        self.assertEqual(self.get("/sie", origin_url=origin_url),
+                         (200, self.expected_body("/sie")))
+        self.assertEqual(self.get("/plain-sie", origin_url=origin_url)[0], 502)
+        print("PASS")
+
+
+if __name__ == "__main__":
+    # Parse command line arguments.
+    if (len(sys.argv) == 2):
+        TestProxyRevalidate.PORT = int(sys.argv.pop())
+
+    unittest.main()
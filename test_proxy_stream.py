@@ -0,0 +1,305 @@
+###############################################################
+#
+#                     test_proxy_stream.py
+#
+#     Final Project: High Performance HTTP Proxy
+#     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+#     Date: 2026-10-16
+#
+#     Summary:
+#     Intergration tests for streaming of response bodies:
+#     responses are forwarded as they arrive and filled into
+#     the cache, and responses larger than a cached one pass
+#     through without being held in memory. Chunked responses
+#     are cached without their framing. Request bodies are
+#     streamed to the origin as they arrive as well. A local
+#     origin stub counts the requests it gets.
+#
+#     Usage: python3 test_proxy_stream.py [port]
+#     where [port] is the port that the proxy listens on,
+#     9999 by default.
+#
+###############################################################
+
+import hashlib
+import http.server
+import os
+import socket
+import sys
+import threading
+import unittest
+import urllib.parse
+import urllib.request
+
+import proxy_test_utils
+
+
+OBJECT_LIMIT = 1 << 20  # Max byte size of a cached response of the proxy.
+LARGE_SIZE = 256 << 20  # Byte size of the body of a large response.
+MAX_RSS = 64 << 20  # Max peak memory of the proxy, in bytes.
+WRITE_SIZE = 64 << 10  # Byte size of each write of the origin stub.
+
+
+def expected_body(path, size):
+    '''
+    @brief Get the body of the given size that the origin stub serves for a
+    path.
+    '''
+    line = "{}\n".format(path).encode()
+    return (line * (size // len(line) + 1))[:size]
+
+
+class OriginStub(http.server.BaseHTTPRequestHandler):
+    '''
+    @brief Origin that serves a body of the size in its path:
+    "/length-<size>" with a Content-Length, "/chunked-<size>" in chunks with
+    extensions and a trailer field, and "/close-<size>" until it closes the
+    connection.
+    '''
+    protocol_version = "HTTP/1.1"
+    num_requests = {}  # Number of requests got per path.
+    lock = threading.Lock()
+
+    def do_GET(self):
+        cls = OriginStub
+        # The proxy forwards the absolute URL.
+        self.path = urllib.parse.urlparse(self.path).path
+        with cls.lock:
+            cls.num_requests[self.path] = cls.num_requests.get(self.path, 0) + 1
+        kind, _, size = self.path[1:].rpartition("-")
+        size = int(size)
+        self.send_response(200)
+        self.send_header("Cache-Control", "max-age=3600")
+        if kind == "chunked":
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            body = expected_body(self.path, size)
+            for pos in range(0, size, WRITE_SIZE):
+                chunk = body[pos:pos + WRITE_SIZE]
+                self.wfile.write("{:x};ext=1\r\n".format(len(chunk)).encode())
+                self.wfile.write(chunk + b"\r\n")
+            self.wfile.write(b"0\r\nX-Trailer: 1\r\n\r\n")
+            return
+        if kind == "close":
+            self.close_connection = True
+        else:
+            self.send_header("Content-Length", str(size))
+        self.end_headers()
+        # Generate the body as it's sent, so a large one isn't in memory.
+        line = "{}\n".format(self.path).encode()
+        block = line * (WRITE_SIZE // len(line) + 2)
+        pos = 0
+        while pos < size:
+            n = min(size - pos, WRITE_SIZE)
+            offset = pos % len(line)
+            self.wfile.write(block[offset:offset + n])
+            pos += n
+
+    def do_POST(self):
+        ''' Reply the byte size and checksum of the request body. '''
+        size = 0
+        checksum = hashlib.sha256()
+        if self.headers.get("Transfer-Encoding") == "chunked":
+            while True:
+                chunk_size = int(self.rfile.readline().split(b";")[0], 16)
+                if chunk_size == 0:
+                    while self.rfile.readline() not in (b"\r\n", b""):
+                        pass
+                    break
+                data = self.rfile.read(chunk_size)
+                self.rfile.readline()
+                size += len(data)
+                checksum.update(data)
+        else:
+            remaining = int(self.headers.get("Content-Length", 0))
+            while remaining > 0:
+                data = self.rfile.read(min(remaining, WRITE_SIZE))
+                remaining -= len(data)
+                size += len(data)
+                checksum.update(data)
+        body = "{} {}".format(size, checksum.hexdigest()).encode()
+        self.send_response(200)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+class TestProxyStream(proxy_test_utils.ProxyTestCase):
+    ORIGIN_HANDLER = OriginStub
+    PROXY_ARGS = ["--cache-object-size",
+                  str(OBJECT_LIMIT),
+                  "--cache-dechunk"]
+
+
+    def get(self, path):
+        '''
+        @brief GET a path of the origin stub via proxy.
+        @param path Path to get.
+        @return Status code and body of the response.
+        '''
+        request = urllib.request.Request(self.origin_url + path)
+        with self.opener.open(request, timeout=10) as response:
+            return response.status, response.read()
+
+
+    def peak_rss(self):
+        '''
+        @brief Get the peak resident memory of the proxy in bytes.
+        '''
+        with open("/proc/{}/status".format(self.proxy_process.pid)) as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1]) * 1024
+        return 0
+
+
+    def test_cached(self):
+        ''' Responses within the limit are cached, whatever their framing. '''
+        for path in ["/length-{}".format(OBJECT_LIMIT // 2),
+                     "/chunked-{}".format(OBJECT_LIMIT // 2)]:
+            print("TEST cached {}".format(path))
+            for _ in range(2):
+                self.assertEqual(self.get(path),
+                                 (200, expected_body(path, OBJECT_LIMIT // 2)))
+            self.assertEqual(OriginStub.num_requests.get(path), 1)
+            print("PASS")
+
+
+    def test_dechunked(self):
+        ''' A cached chunked response is served with a Content-Length. '''
+        path = "/chunked-{}".format(OBJECT_LIMIT // 4)
+        print("TEST dechunked {}".format(path))
+        for i in range(2):
+            request = urllib.request.Request(self.origin_url + path)
+            with self.opener.open(request, timeout=10) as response:
+                body = response.read()
+                is_chunked = response.headers.get("Transfer-Encoding")
+                length = response.headers.get("Content-Length")
+            self.assertEqual(body, expected_body(path, OBJECT_LIMIT // 4))
+            if i == 0:
+                self.assertEqual(is_chunked, "chunked")
+            else:
+                self.assertIsNone(is_chunked)
+                self.assertEqual(length, str(OBJECT_LIMIT // 4))
+        self.assertEqual(OriginStub.num_requests.get(path), 1)
+        print("PASS")
+
+
+    def test_too_large(self):
+        ''' Responses over the limit pass through, and aren't cached. '''
+        for path in ["/length-{}".format(OBJECT_LIMIT * 2),
+                     "/chunked-{}".format(OBJECT_LIMIT * 2)]:
+            print("TEST too large {}".format(path))
+            for _ in range(2):
+                self.assertEqual(self.get(path),
+                                 (200, expected_body(path, OBJECT_LIMIT * 2)))
+            self.assertEqual(OriginStub.num_requests.get(path), 2)
+            print("PASS")
+
+
+    def test_close_delimited(self):
+        ''' A body without a length ends when the origin closes. '''
+        path = "/close-{}".format(OBJECT_LIMIT // 2)
+        print("TEST close delimited {}".format(path))
+        self.assertEqual(self.get(path),
+                         (200, expected_body(path, OBJECT_LIMIT // 2)))
+        print("PASS")
+
+
+    def test_large_memory(self):
+        ''' A large response is streamed in bounded memory. '''
+        path = "/length-{}".format(LARGE_SIZE)
+        print("TEST large response {}".format(path))
+        client = socket.create_connection(("localhost", self.PORT))
+        client.sendall("GET {}{} HTTP/1.1\r\nHost: {}\r\n\r\n".format(
+            self.origin_url,
+            path,
+            urllib.parse.urlparse(self.origin_url).netloc).encode())
+        received = 0
+        head = b""
+        while True:
+            data = client.recv(1 << 20)
+            if not data:
+                break
+            if not head:
+                head, _, data = data.partition(b"\r\n\r\n")
+                head += b"\r\n\r\n"
+            received += len(data)
+            if received >= LARGE_SIZE:
+                break
+        client.close()
+        self.assertTrue(head.startswith(b"HTTP/1.1 200"))
+        self.assertEqual(received, LARGE_SIZE)
+        self.assertLess(self.peak_rss(), MAX_RSS)
+        print("PASS")
+
+
+    def read_response(self, reader):
+        '''
+        @brief Read a response with a Content-Length.
+        @param reader Buffered reader of a socket connected to the proxy.
+        @return Status line and body of the response.
+        '''
+        status = reader.readline()
+        length = 0
+        while True:
+            line = reader.readline()
+            if line in (b"\r\n", b""):
+                break
+            name, _, value = line.partition(b":")
+            if name.strip().lower() == b"content-length":
+                length = int(value)
+        return status, reader.read(length)
+
+
+    def test_upload(self):
+        ''' A large request body is streamed in bounded memory. '''
+        print("TEST upload {} bytes".format(LARGE_SIZE))
+        netloc = urllib.parse.urlparse(self.origin_url).netloc
+        block = os.urandom(WRITE_SIZE)
+        checksum = hashlib.sha256()
+        for _ in range(LARGE_SIZE // WRITE_SIZE):
+            checksum.update(block)
+        expected = "{} {}".format(LARGE_SIZE, checksum.hexdigest()).encode()
+
+        # With a length, then chunked, followed by a pipelined request.
+        client = socket.create_connection(("localhost", self.PORT))
+        reader = client.makefile("rb")
+        client.sendall("POST {}/upload HTTP/1.1\r\nHost: {}\r\n"
+                       "Content-Length: {}\r\n\r\n".format(
+                           self.origin_url, netloc, LARGE_SIZE).encode())
+        for _ in range(LARGE_SIZE // WRITE_SIZE):
+            client.sendall(block)
+        status, body = self.read_response(reader)
+        self.assertTrue(status.startswith(b"HTTP/1.1 200"))
+        self.assertEqual(body, expected)
+
+        client.sendall("POST {}/upload HTTP/1.1\r\nHost: {}\r\n"
+                       "Transfer-Encoding: chunked\r\n\r\n".format(
+                           self.origin_url, netloc).encode())
+        for _ in range(LARGE_SIZE // WRITE_SIZE):
+            client.sendall("{:x};ext=1\r\n".format(WRITE_SIZE).encode() +
+                           block + b"\r\n")
+        path = "/length-100"
+        client.sendall("0\r\nX-Trailer: 1\r\n\r\n"
+                       "GET {}{} HTTP/1.1\r\nHost: {}\r\n\r\n".format(
+                           self.origin_url, path, netloc).encode())
+        # Each request has its own server, so the responses may come in
+        # either order.
+        bodies = {self.read_response(reader)[1] for _ in range(2)}
+        self.assertEqual(bodies, {expected, expected_body(path, 100)})
+        reader.close()
+        client.close()
+        self.assertLess(self.peak_rss(), MAX_RSS)
+        print("PASS")
+
+
+if __name__ == "__main__":
+    # Parse command line arguments.
+    if (len(sys.argv) == 2):
+        TestProxyStream.PORT = int(sys.argv.pop())
+
+    unittest.main()
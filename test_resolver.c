@@ -0,0 +1,269 @@
+/**************************************************************
+*
+*                      test_resolver.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Test driver for asynchronous DNS resolver, using an
+*     /etc/hosts-style fixture file.
+*
+**************************************************************/
+
+#include "resolver.h"
+#include <arpa/inet.h>
+#include <assert.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_CALLS 16
+
+/* Arguments of a callback invocation. */
+struct call {
+    int fd;
+    unsigned long id;
+    int error;
+    struct in_addr addr;
+};
+
+static struct call calls[MAX_CALLS]; /* Recorded callback invocations. */
+static int num_calls = 0;
+static char hosts_path[] = "/tmp/test_resolver_XXXXXX";
+
+void record_call(int fd, unsigned long id, int error, struct in_addr addr)
+{
+    assert(num_calls < MAX_CALLS);
+    calls[num_calls].fd = fd;
+    calls[num_calls].id = id;
+    calls[num_calls].error = error;
+    calls[num_calls].addr = addr;
+    ++num_calls;
+}
+
+/* Write the fixture file of hosts. */
+void write_hosts_file(void)
+{
+    int fd;
+    FILE* fp;
+
+    fd = mkstemp(hosts_path);
+    assert(fd >= 0);
+    fp = fdopen(fd, "w");
+    assert(fp != NULL);
+    fprintf(fp, "# fixture for test_resolver\n");
+    fprintf(fp, "10.0.0.1 www.example.com\n");
+    fprintf(fp, "10.0.0.2 short.example.com 0\n");
+    fprintf(fp, "fe80::1 v6.example.com\n");
+    fclose(fp);
+}
+
+/* Wait until the given number of lookups are completed. */
+void wait_lookups(int n)
+{
+    struct pollfd pfd;
+    int done = 0;
+
+    pfd.fd = resolver_fd();
+    pfd.events = POLLIN;
+    while (done < n) {
+        assert(poll(&pfd, 1, 5000) == 1);
+        done += resolver_process();
+    }
+    assert(done == n);
+}
+
+void assert_addr(struct in_addr addr, const char* expected)
+{
+    assert(strcmp(inet_ntoa(addr), expected) == 0);
+}
+
+void init_resolver(void)
+{
+    num_calls = 0;
+    assert(resolver_init(2, hosts_path, record_call) == 0);
+    assert(resolver_fd() >= 0);
+}
+
+void test_resolver_init_invalid(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST resolver_init() invalid arguments\n");
+    assert(resolver_init(0, hosts_path, record_call) < 0);
+    assert(resolver_init(1, hosts_path, NULL) < 0);
+    assert(resolver_init(1, "/nonexistent/hosts", record_call) < 0);
+    assert(resolver_fd() < 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_resolver_lookup_numeric(void)
+{
+    struct in_addr addr;
+    struct resolver_stats stats;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST resolver_lookup() numeric address\n");
+    init_resolver();
+    assert(resolver_lookup("127.0.0.1", 3, 1, &addr) == 1);
+    assert_addr(addr, "127.0.0.1");
+    resolver_get_stats(&stats);
+    assert(stats.queries == 0);
+    assert(num_calls == 0);
+    resolver_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_resolver_lookup_hit(void)
+{
+    struct in_addr addr;
+    struct resolver_stats stats;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST resolver_lookup() miss then hit\n");
+    init_resolver();
+    assert(resolver_lookup("www.example.com", 3, 7, &addr) == 0);
+    wait_lookups(1);
+    assert(num_calls == 1);
+    assert(calls[0].fd == 3);
+    assert(calls[0].id == 7);
+    assert(calls[0].error == 0);
+    assert_addr(calls[0].addr, "10.0.0.1");
+
+    /* Cached, and hostnames are case-insensitive. */
+    assert(resolver_lookup("WWW.Example.COM", 4, 8, &addr) == 1);
+    assert_addr(addr, "10.0.0.1");
+    assert(num_calls == 1);
+    resolver_get_stats(&stats);
+    assert(stats.queries == 1);
+    assert(stats.hits == 1);
+    resolver_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_resolver_lookup_merge(void)
+{
+    struct in_addr addr;
+    struct resolver_stats stats;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST resolver_lookup() merges concurrent lookups\n");
+    init_resolver();
+    assert(resolver_lookup("www.example.com", 3, 1, &addr) == 0);
+    assert(resolver_lookup("www.example.com", 4, 2, &addr) == 0);
+    assert(resolver_lookup("www.example.com", 5, 3, &addr) == 0);
+    wait_lookups(1);
+    resolver_get_stats(&stats);
+    assert(stats.queries == 1);
+    assert(stats.merged == 2);
+    assert(num_calls == 3);
+    for (int i = 0; i < 3; ++i) {
+        assert(calls[i].fd == 3 + i);
+        assert(calls[i].id == (unsigned long)(1 + i));
+        assert(calls[i].error == 0);
+        assert_addr(calls[i].addr, "10.0.0.1");
+    }
+    resolver_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_resolver_lookup_negative(void)
+{
+    struct in_addr addr;
+    struct resolver_stats stats;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST resolver_lookup() negative cache\n");
+    init_resolver();
+    assert(resolver_lookup("missing.example.com", 3, 1, &addr) == 0);
+    wait_lookups(1);
+    assert(num_calls == 1);
+    assert(calls[0].error != 0);
+
+    /* Failure is cached. */
+    assert(resolver_lookup("missing.example.com", 3, 2, &addr) < 0);
+    /* IPv6 entries are skipped. */
+    assert(resolver_lookup("v6.example.com", 4, 3, &addr) == 0);
+    wait_lookups(1);
+    assert(num_calls == 2);
+    assert(calls[1].error != 0);
+    resolver_get_stats(&stats);
+    assert(stats.queries == 2);
+    assert(stats.neg_hits == 1);
+    resolver_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_resolver_lookup_expired(void)
+{
+    struct in_addr addr;
+    struct resolver_stats stats;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST resolver_lookup() expired entry\n");
+    init_resolver();
+    assert(resolver_lookup("short.example.com", 3, 1, &addr) == 0);
+    wait_lookups(1);
+    assert(num_calls == 1);
+    assert_addr(calls[0].addr, "10.0.0.2");
+
+    /* TTL is 0, so it's looked up again. */
+    assert(resolver_lookup("short.example.com", 3, 2, &addr) == 0);
+    wait_lookups(1);
+    assert(num_calls == 2);
+    assert(calls[1].id == 2);
+    assert_addr(calls[1].addr, "10.0.0.2");
+    resolver_get_stats(&stats);
+    assert(stats.queries == 2);
+    assert(stats.hits == 0);
+    resolver_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_resolver_clear_pending(void)
+{
+    struct in_addr addr;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST resolver_clear() with pending lookups\n");
+    init_resolver();
+    for (int i = 0; i < 8; ++i) {
+        assert(resolver_lookup(i % 2 ? "www.example.com" : "x.example.com",
+                               3 + i,
+                               i,
+                               &addr) == 0);
+    }
+    resolver_clear();
+    assert(num_calls == 0);
+    assert(resolver_fd() < 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    write_hosts_file();
+
+    fprintf(stderr, "====================\n");
+    test_resolver_init_invalid();
+    test_resolver_lookup_numeric();
+    test_resolver_lookup_hit();
+    test_resolver_lookup_merge();
+    test_resolver_lookup_negative();
+    test_resolver_lookup_expired();
+    test_resolver_clear_pending();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+
+    unlink(hosts_path);
+    return EXIT_SUCCESS;
+}
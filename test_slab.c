@@ -0,0 +1,216 @@
+/**************************************************************
+*
+*                        test_slab.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Test driver for size-classed slab allocator.
+*
+**************************************************************/
+
+#include "slab.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_PTRS 20000
+
+static void* ptrs[NUM_PTRS];
+static size_t sizes[NUM_PTRS];
+
+/* Assert that the allocator holds no chunk nor large allocation. */
+void assert_slab_empty(void)
+{
+    struct slab_stats stats;
+
+    slab_get_stats(&stats);
+    assert(stats.num_slabs == 0);
+    assert(stats.chunk_bytes == 0);
+    assert(stats.request_bytes == 0);
+    assert(stats.num_large == 0);
+    assert(stats.large_bytes == 0);
+    assert(stats.slab_bytes == (size_t)stats.num_spare_slabs * SLAB_BYTES);
+}
+
+void test_slab_alloc_bytes(void)
+{
+    size_t prev = 0;
+    size_t bytes;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST slab_alloc_bytes()\n");
+    assert(slab_alloc_bytes(0) == 16);
+    assert(slab_alloc_bytes(1) == 16);
+    assert(slab_alloc_bytes(16) == 16);
+    assert(slab_alloc_bytes(17) > 16);
+    for (size_t size = 1; size <= SLAB_MAX_CHUNK_BYTES; size += 7) {
+        bytes = slab_alloc_bytes(size);
+        assert(bytes >= size && bytes % 16 == 0);
+        assert(bytes >= prev);
+        /* Classes are about 25% apart. */
+        assert(size < 64 || bytes <= size + size / 4 + 16);
+        prev = bytes;
+    }
+    assert(slab_alloc_bytes(SLAB_MAX_CHUNK_BYTES) == SLAB_MAX_CHUNK_BYTES);
+    assert(slab_alloc_bytes(SLAB_MAX_CHUNK_BYTES + 1) >
+           SLAB_MAX_CHUNK_BYTES);
+    assert(slab_alloc_bytes(SLAB_MAX_CHUNK_BYTES + 1) % 4096 == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_slab_alloc_free(void)
+{
+    struct slab_stats stats;
+    char* p;
+    char* q;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST slab_alloc() and slab_free()\n");
+    slab_free(NULL, 100);
+    p = slab_alloc(100);
+    q = slab_alloc(100);
+    assert(p != NULL && q != NULL && p != q);
+    assert((uintptr_t)p % 16 == 0 && (uintptr_t)q % 16 == 0);
+    memset(p, 'p', 100);
+    memset(q, 'q', 100);
+    assert(p[99] == 'p' && q[0] == 'q');
+    slab_get_stats(&stats);
+    assert(stats.num_slabs == 1);
+    assert(stats.chunk_bytes == 2 * slab_alloc_bytes(100));
+    assert(stats.request_bytes == 200);
+
+    /* A freed chunk is reused first. */
+    slab_free(p, 100);
+    assert(slab_alloc(97) == p);
+    slab_free(p, 97);
+    slab_free(q, 100);
+    assert_slab_empty();
+
+    /* Large allocations are mapped on their own, and counted apart. */
+    p = slab_alloc(SLAB_MAX_CHUNK_BYTES + 1);
+    q = slab_alloc(1 << 20);
+    assert(p != NULL && q != NULL);
+    assert((uintptr_t)p % 16 == 0 && (uintptr_t)q % 16 == 0);
+    memset(p, 'x', SLAB_MAX_CHUNK_BYTES + 1);
+    memset(q, 'y', 1 << 20);
+    slab_get_stats(&stats);
+    assert(stats.num_large == 2);
+    assert(stats.large_bytes == slab_alloc_bytes(SLAB_MAX_CHUNK_BYTES + 1) +
+                                slab_alloc_bytes(1 << 20));
+    assert(stats.num_slabs == 0);
+    slab_free(p, SLAB_MAX_CHUNK_BYTES + 1);
+    slab_free(q, 1 << 20);
+    assert_slab_empty();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_slab_release(void)
+{
+    struct slab_stats stats;
+    size_t peak_bytes;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST slab_free() releases empty slabs\n");
+    /* Many slabs of small chunks. */
+    for (int i = 0; i < NUM_PTRS; ++i) {
+        sizes[i] = 1000 + i % 24;
+        ptrs[i] = slab_alloc(sizes[i]);
+        assert(ptrs[i] != NULL);
+        memset(ptrs[i], i, sizes[i]);
+    }
+    slab_get_stats(&stats);
+    assert(stats.num_slabs > 4);
+    assert(stats.chunk_bytes <= stats.slab_bytes);
+    peak_bytes = stats.slab_bytes;
+
+    /* Free every other chunk; no slab is empty yet. */
+    for (int i = 0; i < NUM_PTRS; i += 2) {
+        slab_free(ptrs[i], sizes[i]);
+    }
+    slab_get_stats(&stats);
+    assert(stats.slab_bytes == peak_bytes);
+    assert(stats.chunk_bytes * 2 <= stats.slab_bytes);
+
+    /* Chunks of other sizes reuse the free ones in place. */
+    for (int i = 0; i < NUM_PTRS; i += 2) {
+        sizes[i] = 1100 + i % 24;
+        ptrs[i] = slab_alloc(sizes[i]);
+        assert(ptrs[i] != NULL);
+    }
+    for (int i = 1; i < NUM_PTRS; i += 2) {
+        assert(((unsigned char*)ptrs[i])[sizes[i] - 1] == (unsigned char)i);
+    }
+    slab_get_stats(&stats);
+    assert(stats.slab_bytes == peak_bytes);
+
+    /* Once all freed, at most a few spare slabs are left. */
+    for (int i = 0; i < NUM_PTRS; ++i) {
+        slab_free(ptrs[i], sizes[i]);
+    }
+    assert_slab_empty();
+    slab_get_stats(&stats);
+    assert(stats.num_spare_slabs <= 4);
+
+    /* Spare slabs serve any class. */
+    ptrs[0] = slab_alloc(50000);
+    assert(ptrs[0] != NULL);
+    slab_get_stats(&stats);
+    assert(stats.slab_bytes <= 4 * SLAB_BYTES);
+    slab_free(ptrs[0], 50000);
+    assert_slab_empty();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_slab_random(void)
+{
+    size_t size;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST slab_alloc() and slab_free() at random\n");
+    memset(ptrs, 0, sizeof(ptrs));
+    srand(1);
+    for (int round = 0; round < 200000; ++round) {
+        int i = rand() % 2000;
+
+        if (ptrs[i] != NULL) {
+            /* The chunk kept its pattern while others came and went. */
+            assert(((unsigned char*)ptrs[i])[0] == (unsigned char)i);
+            assert(((unsigned char*)ptrs[i])[sizes[i] - 1] ==
+                   (unsigned char)i);
+            slab_free(ptrs[i], sizes[i]);
+            ptrs[i] = NULL;
+            continue;
+        }
+        size = 1 + rand() % (rand() % 8 == 0 ? 200000 : 2000);
+        ptrs[i] = slab_alloc(size);
+        assert(ptrs[i] != NULL);
+        sizes[i] = size;
+        memset(ptrs[i], i, size);
+    }
+    for (int i = 0; i < 2000; ++i) {
+        slab_free(ptrs[i], sizes[i]);
+    }
+    assert_slab_empty();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_slab_alloc_bytes();
+    test_slab_alloc_free();
+    test_slab_release();
+    test_slab_random();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
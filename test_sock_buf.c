@@ -12,13 +12,152 @@
 **************************************************************/
 
 #include "sock_buf.h"
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Assert the server list of a client, from head to tail. */
+void assert_servers(int client, const int* servers, int n)
+{
+    struct sock_buf* server = sock_buf_get(client)->servers;
+
+    assert(sock_buf_first_server(client) == (n > 0 ? servers[0] : -1));
+    for (int i = 0; i < n; ++i) {
+        assert(server != NULL);
+        assert(server->fd == servers[i]);
+        assert(server->peer == client);
+        assert(i > 0 || server->prev_server == NULL);
+        assert(i == 0 || server->prev_server->fd == servers[i - 1]);
+        server = server->next_server;
+    }
+    assert(server == NULL);
+}
+
+void test_sock_buf_server_list(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST server list of a client\n");
+    assert(sock_buf_arr_init() == 0);
+    assert(sock_buf_add_client(5) == 1);
+    assert(sock_buf_add_client(6) == 1);
+    assert_servers(5, NULL, 0);
+
+    /* Servers are linked at the head. */
+    assert(sock_buf_add_server(10, 5, NULL) == 1);
+    assert(sock_buf_add_server(11, 5, "key") == 1);
+    assert(sock_buf_add_server(12, 6, NULL) == 1);
+    assert(sock_buf_add_server(13, 5, NULL) == 1);
+    assert_servers(5, (int[]){13, 11, 10}, 3);
+    assert_servers(6, (int[]){12}, 1);
+
+    /* Unlink from the middle, the head and the tail. */
+    assert(sock_buf_rm(11) == 1);
+    assert_servers(5, (int[]){13, 10}, 2);
+    assert(sock_buf_rm(13) == 1);
+    assert_servers(5, (int[]){10}, 1);
+    assert(sock_buf_rm(10) == 1);
+    assert_servers(5, NULL, 0);
+    assert_servers(6, (int[]){12}, 1);
+
+    assert(sock_buf_arr_clear() == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_sock_buf_rm_client(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST remove a client with servers\n");
+    assert(sock_buf_arr_init() == 0);
+    assert(sock_buf_add_client(5) == 1);
+    assert(sock_buf_add_server(10, 5, NULL) == 1);
+    assert(sock_buf_add_server(11, 5, NULL) == 1);
+
+    /* Its servers are detached. */
+    assert(sock_buf_rm(5) == 1);
+    assert(sock_buf_get(10)->peer == -1);
+    assert(sock_buf_get(11)->next_server == NULL);
+
+    /* The FD is reused by a new client. */
+    assert(sock_buf_add_client(5) == 1);
+    assert_servers(5, NULL, 0);
+    assert(sock_buf_rm(10) == 1);
+    assert(sock_buf_rm(11) == 1);
+    assert_servers(5, NULL, 0);
+
+    /* A server needs an existing client, unless it has none. */
+    assert(sock_buf_add_server(12, 7, NULL) == 0);
+    assert(sock_buf_add_server(12, -1, "key") == 1);
+    assert(sock_buf_get(12)->peer == -1);
+    assert_servers(5, NULL, 0);
+    assert(sock_buf_rm(12) == 1);
+
+    assert(sock_buf_arr_clear() == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_sock_buf_detach_server(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST detach a server from its client\n");
+    assert(sock_buf_arr_init() == 0);
+    assert(sock_buf_add_client(5) == 1);
+    assert(sock_buf_add_server(10, 5, NULL) == 1);
+    assert(sock_buf_add_server(11, 5, NULL) == 1);
+    assert(sock_buf_add_server(12, 5, NULL) == 1);
+
+    assert(sock_buf_detach_server(11) == 1);
+    assert(sock_buf_get(11)->peer == -1);
+    assert(sock_buf_get(11)->prev_server == NULL);
+    assert(sock_buf_get(11)->next_server == NULL);
+    assert_servers(5, (int[]){12, 10}, 2);
+    assert(sock_buf_detach_server(11) == 0);
+    assert(sock_buf_detach_server(5) == 0);
+    assert(sock_buf_detach_server(12) == 1);
+    assert_servers(5, (int[]){10}, 1);
+
+    /* A detached server outlives its client. */
+    assert(sock_buf_rm(5) == 1);
+    assert(sock_buf_rm(11) == 1);
+    assert(sock_buf_rm(12) == 1);
+    assert(sock_buf_get(10)->peer == -1);
+
+    assert(sock_buf_arr_clear() == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_sock_buf_consume(void)
+{
+    struct sock_buf* sock_buf = NULL;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST consume buffered data\n");
+    assert(sock_buf_arr_init() == 0);
+    assert(sock_buf_add_client(5) == 1);
+    sock_buf = sock_buf_get(5);
+    assert(sock_buf->parser.is_request);
+    assert(sock_buf_buffer(5, "first second", 12) == 12);
+    assert(sock_buf_consume(5, 13) == -1);
+    assert(sock_buf_consume(5, 6) == 6);
+    assert(sock_buf->size == 6 && memcmp(sock_buf->buf, "second", 6) == 0);
+    assert(sock_buf_consume(5, 6) == 0);
+    assert(sock_buf->buf == NULL);
+    assert(sock_buf_consume(6, 0) == -1);
+    assert(sock_buf_arr_clear() == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
 
 int main(void)
 {
     fprintf(stderr, "====================\n");
-    /* TODO: add tests. */
+    test_sock_buf_server_list();
+    test_sock_buf_rm_client();
+    test_sock_buf_detach_server();
+    test_sock_buf_consume();
     fprintf(stderr, "ALL PASS\n");
     fprintf(stderr, "====================\n\n");
     return EXIT_SUCCESS;
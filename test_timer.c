@@ -0,0 +1,210 @@
+/**************************************************************
+*
+*                        test_timer.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Test driver for hashed timer wheel.
+*
+**************************************************************/
+
+#include "timer.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_FIRED 64
+
+static int fired[MAX_FIRED]; /* FDs of fired timers in order. */
+static int num_fired = 0;
+static struct timer timers[8];
+
+void record_fire(int fd)
+{
+    assert(num_fired < MAX_FIRED);
+    fired[num_fired++] = fd;
+}
+
+/* Cancel the timer of FD 1 when fired. */
+void cancel_other(int fd)
+{
+    record_fire(fd);
+    timer_cancel(&timers[1]);
+}
+
+/* Set itself again when fired for the first time. */
+void rearm_self(int fd)
+{
+    record_fire(fd);
+    if (num_fired == 1) {
+        timer_set(&timers[fd], fd, rearm_self, 500);
+    }
+}
+
+void init_wheel(void)
+{
+    assert(timer_init() == 0);
+    num_fired = 0;
+    for (int i = 0; i < 8; ++i) {
+        timers[i].prev = NULL;
+        timers[i].next = NULL;
+    }
+}
+
+void test_timer_empty(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST timer_next_timeout() without timers\n");
+    init_wheel();
+    assert(timer_next_timeout() == -1);
+    assert(timer_run(timer_now() + 100000) == 0);
+    timer_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_timer_fire_in_order(void)
+{
+    long long start;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST timer_run() fires due timers only\n");
+    init_wheel();
+    start = timer_now();
+    timer_set(&timers[0], 0, record_fire, 1000);
+    timer_set(&timers[1], 1, record_fire, 300);
+    timer_set(&timers[2], 2, record_fire, 300);
+    assert(timer_is_set(&timers[0]));
+
+    /* Next timeout is at most one tick later than the earliest deadline. */
+    assert(timer_next_timeout() >= 0);
+    assert(timer_next_timeout() <= 300 + TIMER_TICK);
+
+    assert(timer_run(start + 299) == 0);
+    assert(timer_run(start + 400) == 2);
+    assert(fired[0] == 1 && fired[1] == 2);
+    assert(!timer_is_set(&timers[1]));
+    assert(timer_is_set(&timers[0]));
+    assert(timer_next_timeout() <= 600 + TIMER_TICK);
+
+    assert(timer_run(start + 999) == 0);
+    assert(timer_run(start + 1000 + TIMER_TICK) == 1);
+    assert(fired[2] == 0);
+    assert(timer_next_timeout() == -1);
+    timer_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_timer_cancel_and_reset(void)
+{
+    long long start;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST timer_cancel() and timer_set() on a set timer\n");
+    init_wheel();
+    start = timer_now();
+    timer_set(&timers[0], 0, record_fire, 200);
+    timer_set(&timers[1], 1, record_fire, 200);
+    timer_cancel(&timers[0]);
+    timer_cancel(&timers[0]);
+    assert(!timer_is_set(&timers[0]));
+
+    /* Reset pushes the deadline back. */
+    timer_set(&timers[1], 1, record_fire, 5000);
+    assert(timer_run(start + 1000) == 0);
+    assert(timer_run(start + 5100) == 1);
+    assert(num_fired == 1 && fired[0] == 1);
+    timer_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_timer_beyond_one_lap(void)
+{
+    long long start;
+    long long lap = (long long)TIMER_SLOTS * TIMER_TICK;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST timer_run() with deadlines beyond one lap\n");
+    init_wheel();
+    start = timer_now();
+    timer_set(&timers[0], 0, record_fire, lap * 3 + 500);
+    timer_set(&timers[1], 1, record_fire, 500);
+
+    /* Both share a slot, but only the near one is due. */
+    assert(timer_run(start + 600) == 1);
+    assert(fired[0] == 1);
+    for (long long t = start + 600; t < start + lap * 3 + 500; t += lap / 2) {
+        assert(timer_run(t) == 0);
+    }
+    assert(timer_run(start + lap * 3 + 600) == 1);
+    assert(fired[1] == 0);
+    timer_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_timer_long_stall(void)
+{
+    long long start;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST timer_run() after a stall longer than one lap\n");
+    init_wheel();
+    start = timer_now();
+    for (int i = 0; i < 4; ++i) {
+        timer_set(&timers[i], i, record_fire, 1000 * (i + 1));
+    }
+    assert(timer_run(start + (long long)TIMER_SLOTS * TIMER_TICK * 10) == 4);
+    assert(timer_next_timeout() == -1);
+    timer_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_timer_handler_changes_timers(void)
+{
+    long long start;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST timer handlers cancel and set timers\n");
+    init_wheel();
+    start = timer_now();
+
+    /* Both expire in the same run; the first one cancels the second. */
+    timer_set(&timers[0], 0, cancel_other, 100);
+    timer_set(&timers[1], 1, record_fire, 100);
+    assert(timer_run(start + 200) == 1);
+    assert(num_fired == 1 && fired[0] == 0);
+    assert(!timer_is_set(&timers[1]));
+
+    /* A handler sets its own timer again. */
+    num_fired = 0;
+    timer_set(&timers[2], 2, rearm_self, 100);
+    assert(timer_run(start + 400) == 1);
+    assert(timer_is_set(&timers[2]));
+    assert(timer_run(start + 1000) == 1);
+    assert(num_fired == 2);
+    assert(!timer_is_set(&timers[2]));
+    timer_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_timer_empty();
+    test_timer_fire_in_order();
+    test_timer_cancel_and_reset();
+    test_timer_beyond_one_lap();
+    test_timer_long_stall();
+    test_timer_handler_changes_timers();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
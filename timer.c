@@ -0,0 +1,271 @@
+/**************************************************************
+*
+*                          timer.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Implementation for hashed timer wheel with a cached
+*     monotonic clock.
+*
+*     A timer lives in the slot of its deadline tick modulo
+*     TIMER_SLOTS. Deadlines further than one lap share slots
+*     with nearer ones, so each visited slot only fires the
+*     timers that are actually due.
+*
+**************************************************************/
+
+#include "timer.h"
+#include "logger.h"
+#include <stddef.h>
+#include <time.h>
+
+static struct timer slots[TIMER_SLOTS]; /* Sentinel of each slot list. */
+static int slot_sizes[TIMER_SLOTS]; /* Number of timers in each slot. */
+static struct timer expired; /* Sentinel of timers to fire. */
+static int num_timers = 0; /* Number of timers in the slots. */
+static long long current_tick = 0; /* Last tick that has been run. */
+static long long cached_now = 0; /* Cached clock in milliseconds. */
+
+/**
+ * @brief Make an empty circular list of the given sentinel.
+ */
+static void list_init(struct timer* head)
+{
+    head->prev = head;
+    head->next = head;
+}
+
+/**
+ * @brief Append a timer to the list of the given sentinel.
+ */
+static void list_push(struct timer* head, struct timer* timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/**
+ * @brief Unlink a timer from its list.
+ */
+static void list_unlink(struct timer* timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+/**
+ * @brief Get the slot index of a timer in the wheel. Timers that are already
+ * due go to the next tick.
+ */
+static int slot_of(const struct timer* timer)
+{
+    long long tick = (timer->expire + TIMER_TICK - 1) / TIMER_TICK;
+
+    if (tick <= current_tick) {
+        tick = current_tick + 1;
+    }
+    return tick % TIMER_SLOTS;
+}
+
+/**
+ * @brief Create an empty wheel and read the clock.
+ *
+ * @return int 0 on success; -1 otherwise.
+ */
+int timer_init(void)
+{
+    for (int i = 0; i < TIMER_SLOTS; ++i) {
+        list_init(&slots[i]);
+        slot_sizes[i] = 0;
+    }
+    list_init(&expired);
+    num_timers = 0;
+    cached_now = timer_clock();
+    if (cached_now < 0) {
+        return -1;
+    }
+    current_tick = cached_now / TIMER_TICK;
+    return 0;
+}
+
+/**
+ * @brief Detach all the timers from the wheel.
+ */
+void timer_clear(void)
+{
+    struct timer* head;
+
+    for (int i = 0; i < TIMER_SLOTS; ++i) {
+        head = &slots[i];
+        while (head->next != NULL && head->next != head) {
+            list_unlink(head->next);
+        }
+        slot_sizes[i] = 0;
+    }
+    while (expired.next != NULL && expired.next != &expired) {
+        list_unlink(expired.next);
+    }
+    num_timers = 0;
+}
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return long long Current time in milliseconds; -1 on error.
+ */
+long long timer_clock(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        PLOG_ERROR("clock_gettime");
+        return -1;
+    }
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Get the cached clock, i.e. the time given to the last timer_run().
+ *
+ * @return long long Cached time in milliseconds.
+ */
+long long timer_now(void)
+{
+    return cached_now;
+}
+
+/**
+ * @brief Set (or reset) a timer that expires after the given delay from the
+ * cached clock.
+ *
+ * @param timer Timer, non-null. It is canceled first if already set.
+ * @param fd FD passed to the handler.
+ * @param handler Callback on expiry, non-null.
+ * @param delay Delay in milliseconds, >= 0.
+ */
+void timer_set(struct timer* timer,
+               int fd,
+               timer_handler handler,
+               long long delay)
+{
+    timer_cancel(timer);
+    timer->expire = cached_now + delay;
+    timer->fd = fd;
+    timer->handler = handler;
+    timer->slot = slot_of(timer);
+    list_push(&slots[timer->slot], timer);
+    ++slot_sizes[timer->slot];
+    ++num_timers;
+}
+
+/**
+ * @brief Cancel a timer. It's a no-op if the timer is not set.
+ *
+ * @param timer Timer, non-null.
+ */
+void timer_cancel(struct timer* timer)
+{
+    if (!timer_is_set(timer)) {
+        return;
+    }
+    /* Timers moved to the expired list are no longer counted. */
+    if (timer->slot >= 0) {
+        --slot_sizes[timer->slot];
+        --num_timers;
+    }
+    list_unlink(timer);
+}
+
+/**
+ * @brief Whether a timer is set.
+ *
+ * @param timer Timer, non-null.
+ * @return int 1 if set; 0 otherwise.
+ */
+int timer_is_set(const struct timer* timer)
+{
+    return timer->next != NULL;
+}
+
+/**
+ * @brief Update the cached clock and fire all the expired timers.
+ *
+ * @param now Current time in milliseconds, usually timer_clock().
+ * @return int Number of fired timers.
+ */
+int timer_run(long long now)
+{
+    long long now_tick = now / TIMER_TICK;
+    long long steps;
+    struct timer* head;
+    struct timer* timer;
+    struct timer* next;
+    int n = 0;
+
+    if (now > cached_now) {
+        cached_now = now;
+    }
+
+    /* Move due timers of every passed tick to the expired list. A long stall
+     * visits each slot at most once. */
+    steps = now_tick - current_tick;
+    if (steps > TIMER_SLOTS) {
+        steps = TIMER_SLOTS;
+    }
+    for (long long i = 1; i <= steps; ++i) {
+        head = &slots[(current_tick + i) % TIMER_SLOTS];
+        for (timer = head->next; timer != head; timer = next) {
+            next = timer->next;
+            if (timer->expire <= cached_now) {
+                list_unlink(timer);
+                --slot_sizes[timer->slot];
+                --num_timers;
+                timer->slot = -1;
+                list_push(&expired, timer);
+            }
+        }
+    }
+    if (now_tick > current_tick) {
+        current_tick = now_tick;
+    }
+
+    /* Fire expired timers one by one, since a handler may cancel others. */
+    while (expired.next != &expired) {
+        timer = expired.next;
+        list_unlink(timer);
+        timer->handler(timer->fd);
+        ++n;
+    }
+    return n;
+}
+
+/**
+ * @brief Get how long the event loop may wait before the next timer_run().
+ *
+ * It's the time to the next tick that has timers in its slot. The timers may
+ * be due in a later lap, which only costs a spurious wakeup.
+ *
+ * @return int Timeout in milliseconds; -1 if there is no timer.
+ */
+int timer_next_timeout(void)
+{
+    long long timeout;
+
+    if (num_timers == 0) {
+        return -1;
+    }
+    for (long long i = 1; i <= TIMER_SLOTS; ++i) {
+        if (slot_sizes[(current_tick + i) % TIMER_SLOTS] > 0) {
+            timeout = (current_tick + i) * TIMER_TICK - cached_now;
+            return timeout > 0 ? timeout : 0;
+        }
+    }
+    return TIMER_SLOTS * TIMER_TICK;
+}
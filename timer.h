@@ -0,0 +1,115 @@
+/**************************************************************
+*
+*                          timer.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2026-10-16
+*
+*     Summary:
+*     Interface for hashed timer wheel with a cached monotonic
+*     clock.
+*
+*     Timers are embedded in their owners, e.g. socket
+*     buffers, so setting and canceling a timer never
+*     allocates. The clock is read once per event loop tick;
+*     timer_next_timeout() tells the event loop how long it
+*     may sleep.
+*
+**************************************************************/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#define TIMER_TICK 100 /* Resolution of the wheel in milliseconds. */
+#define TIMER_SLOTS 1024 /* Number of slots in the wheel. */
+
+/**
+ * @brief Callback invoked when a timer expires.
+ *
+ * @param fd FD that the timer is set for.
+ */
+typedef void (*timer_handler)(int fd);
+
+struct timer {
+    long long expire; /* Deadline in milliseconds of the monotonic clock. */
+    int fd; /* FD passed to the handler. */
+    timer_handler handler; /* Callback on expiry. */
+    int slot; /* Slot index in the wheel; -1 if it's about to fire. */
+    struct timer* prev; /* Neighbors in the slot list; NULL if not set. */
+    struct timer* next;
+};
+
+/**
+ * @brief Create an empty wheel and read the clock.
+ *
+ * @return int 0 on success; -1 otherwise.
+ */
+int timer_init(void);
+
+/**
+ * @brief Detach all the timers from the wheel.
+ */
+void timer_clear(void);
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return long long Current time in milliseconds.
+ */
+long long timer_clock(void);
+
+/**
+ * @brief Get the cached clock, i.e. the time given to the last timer_run().
+ *
+ * @return long long Cached time in milliseconds.
+ */
+long long timer_now(void);
+
+/**
+ * @brief Set (or reset) a timer that expires after the given delay from the
+ * cached clock.
+ *
+ * @param timer Timer, non-null. It is canceled first if already set.
+ * @param fd FD passed to the handler.
+ * @param handler Callback on expiry, non-null.
+ * @param delay Delay in milliseconds, >= 0.
+ */
+void timer_set(struct timer* timer,
+               int fd,
+               timer_handler handler,
+               long long delay);
+
+/**
+ * @brief Cancel a timer. It's a no-op if the timer is not set.
+ *
+ * @param timer Timer, non-null.
+ */
+void timer_cancel(struct timer* timer);
+
+/**
+ * @brief Whether a timer is set.
+ *
+ * @param timer Timer, non-null.
+ * @return int 1 if set; 0 otherwise.
+ */
+int timer_is_set(const struct timer* timer);
+
+/**
+ * @brief Update the cached clock and fire all the expired timers.
+ *
+ * Handlers may set or cancel any timer, including the other expired ones.
+ *
+ * @param now Current time in milliseconds, usually timer_clock().
+ * @return int Number of fired timers.
+ */
+int timer_run(long long now);
+
+/**
+ * @brief Get how long the event loop may wait before the next timer_run().
+ *
+ * @return int Timeout in milliseconds; -1 if there is no timer.
+ */
+int timer_next_timeout(void);
+
+#endif /* TIMER_H */